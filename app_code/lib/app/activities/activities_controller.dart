@@ -0,0 +1,136 @@
+import 'dart:convert';
+
+import 'package:evolt_controller/app/activities/history_record.dart';
+import 'package:evolt_controller/app/activities/history_sync.dart';
+import 'package:flutter_blue_plus/flutter_blue_plus.dart';
+import 'package:get/get.dart';
+import 'package:shared_preferences/shared_preferences.dart';
+
+// Charge sessions synced from chargers. Each sync asks only for what is new
+// since the last one: records from the last synced time, skipping the ones
+// at that time already seen.
+class ActivitiesController extends GetxController {
+  static const int _attempts = 3;
+
+  final RxList<ChargeSession> sessions = <ChargeSession>[].obs;
+  final RxBool syncing = false.obs;
+  final RxInt progress = 0.obs;
+  final Rxn<HistorySyncResult> lastSync = Rxn<HistorySyncResult>();
+
+  // Per device: last synced log time and how many records carried it
+  final Map<String, List<int>> _cursors = {};
+  // Records of a sync that did not finish, kept to resume from
+  final Map<String, List<HistoryRecord>> _partial = {};
+
+  @override
+  void onInit() {
+    super.onInit();
+    _load();
+  }
+
+  void _load() async {
+    final prefs = await SharedPreferences.getInstance();
+    final list = prefs.getStringList('sessions') ?? [];
+    sessions.assignAll(list.map((s) => ChargeSession.fromJson(jsonDecode(s))));
+    final cursors = prefs.getString('history_cursors');
+    if (cursors != null) {
+      (jsonDecode(cursors) as Map<String, dynamic>).forEach(
+        (k, v) => _cursors[k] = List<int>.from(v),
+      );
+    }
+  }
+
+  void _save() async {
+    final prefs = await SharedPreferences.getInstance();
+    await prefs.setStringList(
+      'sessions',
+      sessions.map((s) => jsonEncode(s.toJson())).toList(),
+    );
+    await prefs.setString('history_cursors', jsonEncode(_cursors));
+  }
+
+  // The last record's time and how many records carry it, counted on from
+  // the cursor. Resuming there is not thrown off by records the charger
+  // reclaimed since.
+  static List<int> _after(List<int> cursor, List<HistoryRecord> records) {
+    int lastTs = cursor[0], atLast = cursor[1];
+    for (final r in records) {
+      if (r.ts != lastTs) {
+        lastTs = r.ts;
+        atLast = 0;
+      }
+      atLast++;
+    }
+    return [lastTs, atLast];
+  }
+
+  // Pull new records from a connected charger. Returns the last download,
+  // which says how fast it went and whether it finished.
+  Future<HistorySyncResult?> sync(BluetoothCharacteristic history) async {
+    if (syncing.value) return null;
+    final deviceId = history.device.remoteId.str;
+    final cursor = _cursors[deviceId] ?? [0, 0];
+    final records = _partial.remove(deviceId) ?? <HistoryRecord>[];
+    syncing.value = true;
+    progress.value = records.length;
+
+    try {
+      await history.device.requestMtu(HistorySync.preferredMtu);
+    } catch (_) {
+      // iOS negotiates the MTU itself
+    }
+
+    HistorySyncResult? result;
+    try {
+      for (int i = 0; i < _attempts; i++) {
+        final from = _after(cursor, records);
+        result = await HistorySync(history).download(
+          fromTs: from[0],
+          resume: from[1],
+          onProgress: (n) => progress.value = records.length + n,
+        );
+        records.addAll(result.records);
+        if (result.complete) break;
+      }
+    } finally {
+      syncing.value = false;
+    }
+
+    if (result == null || !result.complete) {
+      _partial[deviceId] = records;
+      lastSync.value = result;
+      return result;
+    }
+
+    // Records at the cursor time were seen last time, keep counting them. A
+    // session still running is read again from its start next time, so it
+    // is only listed once it stopped.
+    int lastTs = cursor[0], atLast = cursor[1];
+    List<int>? openAt;
+    for (final r in records) {
+      if (r.ts != lastTs) {
+        lastTs = r.ts;
+        atLast = 0;
+      }
+      if (r.type == HistoryRecord.sessionStart) openAt = [r.ts, atLast];
+      if (r.type == HistoryRecord.sessionStop ||
+          r.type == HistoryRecord.boot) {
+        openAt = null; // A reboot turns the relays off
+      }
+      atLast++;
+    }
+    _cursors[deviceId] = openAt ?? [lastTs, atLast];
+    sessions.insertAll(
+      0,
+      ChargeSession.fromRecords(
+        deviceId,
+        records,
+        result.nowTs!,
+        DateTime.now(),
+      ).reversed,
+    );
+    lastSync.value = result;
+    _save();
+    return result;
+  }
+}
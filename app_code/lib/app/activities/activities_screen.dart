@@ -1,4 +1,8 @@
+import 'package:evolt_controller/app/activities/activities_controller.dart';
+import 'package:evolt_controller/app/activities/history_record.dart';
 import 'package:flutter/material.dart';
+import 'package:flutter_screenutil/flutter_screenutil.dart';
+import 'package:get/get.dart';
 
 class ActivitiesScreen extends StatefulWidget {
   const ActivitiesScreen({super.key});
@@ -8,17 +12,61 @@ class ActivitiesScreen extends StatefulWidget {
 }
 
 class _ActivitiesScreenState extends State<ActivitiesScreen> {
+  final ActivitiesController _activities = Get.find();
+
+  String _date(DateTime t) =>
+      '${t.year}-${t.month.toString().padLeft(2, '0')}-'
+      '${t.day.toString().padLeft(2, '0')} '
+      '${t.hour.toString().padLeft(2, '0')}:'
+      '${t.minute.toString().padLeft(2, '0')}';
+
+  Widget _buildSession(ThemeData theme, ChargeSession s) {
+    final minutes = s.duration?.inMinutes ?? 0;
+    return ListTile(
+      leading: Icon(
+        s.faults != 0 ? Icons.warning_amber_rounded : Icons.ev_station,
+        color: s.faults != 0 ? Colors.red : theme.primaryColor,
+      ),
+      title: Text(_date(s.start)),
+      subtitle: Text(
+        '${minutes ~/ 60} h ${minutes % 60} min · channel ${s.channel}',
+        style: theme.textTheme.bodySmall,
+      ),
+      trailing: Text(
+        '${(s.energyWh / 1000).toStringAsFixed(2)} kWh',
+        style: TextStyle(fontSize: 14.sp, fontWeight: FontWeight.w500),
+      ),
+    );
+  }
+
   @override
   Widget build(BuildContext context) {
+    final theme = Theme.of(context);
     return Scaffold(
       appBar: AppBar(
         title: const Text('Activities'),
       ),
-      body: Center(
-        child: Text(
-          'No activities yet!',
-        ),
-      ),
+      body: Obx(() {
+        if (_activities.sessions.isEmpty) {
+          return const Center(child: Text('No activities yet!'));
+        }
+        final last = _activities.lastSync.value;
+        return ListView(
+          children: [
+            if (last != null)
+              Padding(
+                padding: EdgeInsets.all(16.w),
+                child: Text(
+                  'Last sync: ${last.records.length} records, '
+                  '${last.kbPerSecond.toStringAsFixed(1)} KB/s'
+                  '${last.complete ? '' : ' (incomplete)'}',
+                  style: theme.textTheme.bodySmall,
+                ),
+              ),
+            ..._activities.sessions.map((s) => _buildSession(theme, s)),
+          ],
+        );
+      }),
     );
   }
 }
@@ -0,0 +1,178 @@
+// Session log records as the firmware packs them (see evlog.h and
+// history_xfer.h): a type/length byte, then varints with the time as a
+// delta from the record before.
+class HistoryRecord {
+  static const int boot = 1;
+  static const int sessionStart = 2;
+  static const int sessionStop = 3;
+  static const int energy = 4;
+  static const int fault = 5;
+
+  static const int _fChannel = 0x1;
+  static const int _fEnergy = 0x2;
+  static const int _fPower = 0x4;
+  static const int _fFlags = 0x8;
+
+  static const Map<int, int> _typeFields = {
+    boot: _fFlags,
+    sessionStart: _fChannel,
+    sessionStop: _fChannel | _fEnergy,
+    energy: _fChannel | _fEnergy | _fPower,
+    fault: _fFlags,
+  };
+
+  final int type;
+  final int channel;
+  // Log seconds: uptime plus the last logged time before each boot
+  final int ts;
+  final int energyWh;
+  final int powerW;
+  final int flags;
+
+  const HistoryRecord({
+    required this.type,
+    required this.ts,
+    this.channel = 0,
+    this.energyWh = 0,
+    this.powerW = 0,
+    this.flags = 0,
+  });
+
+  // The record at off and its length, null if b does not hold a whole one
+  static (HistoryRecord, int)? unpack(List<int> b, int off, int prevTs) {
+    if (off + 2 > b.length) return null;
+    final type = b[off] >> 4;
+    final end = off + 2 + (b[off] & 0x0F);
+    final fields = _typeFields[type];
+    if (fields == null || end > b.length) return null;
+
+    int p = off + 1;
+    int? varint() {
+      int v = 0;
+      for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        final byte = b[p++];
+        v |= (byte & 0x7F) << shift;
+        if (byte & 0x80 == 0) return v & 0xFFFFFFFF;
+      }
+      return null;
+    }
+
+    final dts = varint();
+    if (dts == null) return null;
+    int channel = 0, energyWh = 0, powerW = 0, flags = 0;
+    if (fields & _fChannel != 0) {
+      if (p == end) return null;
+      channel = b[p++];
+    }
+    if (fields & _fEnergy != 0) {
+      final v = varint();
+      if (v == null) return null;
+      energyWh = v;
+    }
+    if (fields & _fPower != 0) {
+      final v = varint();
+      if (v == null) return null;
+      powerW = (v >> 1) ^ -(v & 1); // Zigzag
+    }
+    if (fields & _fFlags != 0) {
+      final v = varint();
+      if (v == null) return null;
+      flags = v;
+    }
+    if (p != end) return null;
+    return (
+      HistoryRecord(
+        type: type,
+        ts: (prevTs + dts) & 0xFFFFFFFF,
+        channel: channel,
+        energyWh: energyWh,
+        powerW: powerW,
+        flags: flags,
+      ),
+      end - off,
+    );
+  }
+}
+
+// One charge session put together from its records
+class ChargeSession {
+  final String deviceId;
+  final int channel;
+  final DateTime start;
+  final DateTime? stop;
+  final int energyWh;
+  final int faults;
+
+  const ChargeSession({
+    required this.deviceId,
+    required this.channel,
+    required this.start,
+    this.stop,
+    this.energyWh = 0,
+    this.faults = 0,
+  });
+
+  Duration? get duration => stop?.difference(start);
+
+  Map<String, dynamic> toJson() => {
+    'device': deviceId,
+    'channel': channel,
+    'start': start.millisecondsSinceEpoch,
+    'stop': stop?.millisecondsSinceEpoch,
+    'wh': energyWh,
+    'faults': faults,
+  };
+
+  static ChargeSession fromJson(Map<String, dynamic> j) => ChargeSession(
+    deviceId: j['device'] as String,
+    channel: j['channel'] as int,
+    start: DateTime.fromMillisecondsSinceEpoch(j['start'] as int),
+    stop: j['stop'] == null
+        ? null
+        : DateTime.fromMillisecondsSinceEpoch(j['stop'] as int),
+    energyWh: j['wh'] as int,
+    faults: j['faults'] as int,
+  );
+
+  // Sessions in records, dated by the device's log time at nowTs being
+  // wall-clock now. Time the charger spent powered off is not in the log,
+  // so sessions from before its last power cut come out later than they
+  // were.
+  static List<ChargeSession> fromRecords(
+    String deviceId,
+    List<HistoryRecord> records,
+    int nowTs,
+    DateTime now,
+  ) {
+    DateTime at(int ts) => now.subtract(Duration(seconds: nowTs - ts));
+    final sessions = <ChargeSession>[];
+    final open = <int, HistoryRecord>{};
+    int faults = 0;
+    for (final r in records) {
+      switch (r.type) {
+        case HistoryRecord.boot:
+          open.clear();
+        case HistoryRecord.sessionStart:
+          open[r.channel] = r;
+          faults = 0;
+        case HistoryRecord.fault:
+          faults |= r.flags;
+        case HistoryRecord.sessionStop:
+          final start = open.remove(r.channel);
+          if (start != null) {
+            sessions.add(
+              ChargeSession(
+                deviceId: deviceId,
+                channel: r.channel,
+                start: at(start.ts),
+                stop: at(r.ts),
+                energyWh: r.energyWh,
+                faults: faults,
+              ),
+            );
+          }
+      }
+    }
+    return sessions;
+  }
+}
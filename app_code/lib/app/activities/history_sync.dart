@@ -0,0 +1,148 @@
+import 'dart:async';
+import 'dart:typed_data';
+
+import 'package:evolt_controller/app/activities/history_record.dart';
+import 'package:flutter_blue_plus/flutter_blue_plus.dart';
+
+// Result of one download, complete or cut short
+class HistorySyncResult {
+  final List<HistoryRecord> records;
+  final bool complete;
+  // The device's log time when the transfer ended, null if it never did
+  final int? nowTs;
+  final int bytes;
+  final Duration elapsed;
+
+  const HistorySyncResult({
+    required this.records,
+    required this.complete,
+    required this.nowTs,
+    required this.bytes,
+    required this.elapsed,
+  });
+
+  double get kbPerSecond => elapsed.inMicroseconds == 0
+      ? 0
+      : bytes / 1000 / (elapsed.inMicroseconds / 1e6);
+}
+
+// Downloads the session log from the HISTORY characteristic (see
+// history_xfer.h in the firmware). The charger streams packed records as
+// notifications, one chunk per credit; credits are handed back as chunks
+// arrive so a window of them is always in flight.
+class HistorySync {
+  static const int opOpen = 0x01;
+  static const int opCredit = 0x02;
+  static const int opStop = 0x03;
+
+  static const int flagEnd = 0x01;
+  static const int flagMtu = 0x02;
+
+  static const int chunkHeaderLen = 9;
+  static const int window = 16;
+  static const int preferredMtu = 256;
+  static const Duration stallTimeout = Duration(seconds: 5);
+
+  final BluetoothCharacteristic characteristic;
+
+  HistorySync(this.characteristic);
+
+  static List<int> _le32(int v) => [
+    v & 0xFF,
+    (v >> 8) & 0xFF,
+    (v >> 16) & 0xFF,
+    (v >> 24) & 0xFF,
+  ];
+
+  // Records at or after fromTs, skipping the first resume of those at
+  // exactly fromTs. A download that stalls returns what arrived with
+  // complete false; carry on from the last record's time.
+  Future<HistorySyncResult> download({
+    int fromTs = 0,
+    int resume = 0,
+    void Function(int records)? onProgress,
+  }) async {
+    final records = <HistoryRecord>[];
+    final done = Completer<int?>();
+    final watch = Stopwatch()..start();
+    int bytes = 0;
+    int unacked = 0;
+    Timer? stall;
+
+    void armStall() {
+      stall?.cancel();
+      stall = Timer(stallTimeout, () {
+        if (!done.isCompleted) done.complete(null);
+      });
+    }
+
+    final sub = characteristic.onValueReceived.listen((value) {
+      if (done.isCompleted || value.length < chunkHeaderLen) return;
+      final b = ByteData.sublistView(Uint8List.fromList(value));
+      final index = b.getUint32(0, Endian.little);
+      int ts = b.getUint32(4, Endian.little);
+      final flags = b.getUint8(8);
+      if (flags & flagMtu != 0) {
+        done.completeError(
+          StateError('MTU too small for history, negotiate a larger one'),
+        );
+        return;
+      }
+      final end = flags & flagEnd != 0 ? value.length - 4 : value.length;
+      if (end > chunkHeaderLen && index != resume + records.length) {
+        done.complete(null); // A lost chunk, resume from what we have
+        return;
+      }
+
+      for (int off = chunkHeaderLen; off < end;) {
+        final rec = HistoryRecord.unpack(value, off, ts);
+        if (rec == null) break;
+        records.add(rec.$1);
+        ts = rec.$1.ts;
+        off += rec.$2;
+      }
+      bytes += value.length;
+      onProgress?.call(records.length);
+
+      if (flags & flagEnd != 0) {
+        done.complete(b.getUint32(end, Endian.little));
+        return;
+      }
+      armStall();
+      // Hand credits back in batches to keep writes off the radio
+      if (++unacked >= window ~/ 2) {
+        characteristic.write([opCredit, unacked], withoutResponse: true);
+        unacked = 0;
+      }
+    });
+
+    try {
+      await characteristic.setNotifyValue(true);
+      await characteristic.write([
+        opOpen,
+        ..._le32(fromTs),
+        ..._le32(resume),
+        window,
+      ], withoutResponse: true);
+      armStall();
+      final nowTs = await done.future;
+      if (nowTs == null) {
+        try {
+          await characteristic.write([opStop], withoutResponse: true);
+        } catch (_) {
+          // Gone already, the charger drops the transfer with the link
+        }
+      }
+      return HistorySyncResult(
+        records: records,
+        complete: nowTs != null,
+        nowTs: nowTs,
+        bytes: bytes,
+        elapsed: watch.elapsed,
+      );
+    } finally {
+      stall?.cancel();
+      await sub.cancel();
+    }
+  }
+}
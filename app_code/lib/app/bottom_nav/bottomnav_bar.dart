@@ -1,8 +1,10 @@
+import 'package:evolt_controller/app/activities/activities_controller.dart';
 import 'package:evolt_controller/app/activities/activities_screen.dart';
 import 'package:evolt_controller/app/favourites/favourites_screen.dart';
 import 'package:evolt_controller/app/devices/scan_view.dart';
 import 'package:evolt_controller/app/settings/settings_screen.dart';
 import 'package:flutter/material.dart';
+import 'package:get/get.dart';
 
 class NavigationExample extends StatefulWidget {
   const NavigationExample({super.key});
@@ -14,6 +16,13 @@ class NavigationExample extends StatefulWidget {
 class _NavigationExampleState extends State<NavigationExample> {
   int currentPageIndex = 1;
 
+  @override
+  void initState() {
+    super.initState();
+    // Shared by the activities list and the sync button on a charger's controls
+    Get.put(ActivitiesController());
+  }
+
   @override
   Widget build(BuildContext context) {
     final ThemeData theme = Theme.of(context);
@@ -0,0 +1,67 @@
+import 'dart:typed_data';
+
+import 'package:flutter_blue_plus/flutter_blue_plus.dart';
+
+// Status a charger broadcasts in its advertisement's manufacturer data
+// (see adv_beacon.h in the firmware), read from scan results without
+// connecting. flutter_blue_plus strips the company id, offsets here start at
+// the version byte. All fields are little-endian.
+class ChargerBeacon {
+  static const int companyId = 0xFFFF;
+  static const int version1 = 1;
+
+  static const int stateAvailable = 0;
+  static const int stateReady = 1;
+  static const int stateCharging = 2;
+  static const int stateFault = 3;
+
+  final int state;
+  final int relayMask;
+  final int freeSlots;
+  final int powerW;
+  final int errorFlags;
+  final int seq;
+
+  const ChargerBeacon({
+    required this.state,
+    required this.relayMask,
+    required this.freeSlots,
+    required this.powerW,
+    required this.errorFlags,
+    required this.seq,
+  });
+
+  // Returns null for other manufacturers' data or an unknown version
+  static ChargerBeacon? fromScan(AdvertisementData adv) {
+    final value = adv.manufacturerData[companyId];
+    if (value == null || value.length < 9 || value[0] != version1) {
+      return null;
+    }
+    final b = ByteData.sublistView(Uint8List.fromList(value));
+    return ChargerBeacon(
+      state: b.getUint8(1),
+      relayMask: b.getUint8(2),
+      freeSlots: b.getUint8(3),
+      powerW: b.getUint16(4, Endian.little) * 100,
+      errorFlags: b.getUint16(6, Endian.little),
+      seq: b.getUint8(8),
+    );
+  }
+
+  bool get connectable => freeSlots > 0;
+
+  String get label {
+    switch (state) {
+      case stateAvailable:
+        return 'Available';
+      case stateReady:
+        return 'Ready';
+      case stateCharging:
+        return 'Charging · ${(powerW / 1000).toStringAsFixed(1)} kW';
+      case stateFault:
+        return 'Fault 0x${errorFlags.toRadixString(16)}';
+      default:
+        return 'Unknown';
+    }
+  }
+}
@@ -0,0 +1,83 @@
+import 'dart:typed_data';
+
+// Packed status snapshot served on the 0xFEF4 characteristic
+// (see status_snapshot.h in the firmware). All fields are little-endian.
+class ChargerStatus {
+  static const int version1 = 1;
+
+  final int version;
+  final int size;
+  final int relayCount;
+  final int relayMask;
+  final int uptimeS;
+  final int errorFlags;
+  final int fwVersion;
+  final int cmdsRun;
+  final int cmdsRejected;
+  final int relaySwitches;
+  final int sessions;
+  final int lastSeq;
+  // Metering, null from firmware that predates it (size < 52)
+  final int? vRmsMv;
+  final int? iRmsMa;
+  final int? powerW;
+  final int? energyWh;
+  final int? iPeakMa;
+
+  const ChargerStatus({
+    required this.version,
+    required this.size,
+    required this.relayCount,
+    required this.relayMask,
+    required this.uptimeS,
+    required this.errorFlags,
+    required this.fwVersion,
+    required this.cmdsRun,
+    required this.cmdsRejected,
+    required this.relaySwitches,
+    required this.sessions,
+    required this.lastSeq,
+    this.vRmsMv,
+    this.iRmsMa,
+    this.powerW,
+    this.energyWh,
+    this.iPeakMa,
+  });
+
+  // Notifications are cut at MTU - 3; a short value means a read is needed
+  static bool isComplete(List<int> value) =>
+      value.length >= 2 && value.length >= value[1];
+
+  // Returns null if the value is not a complete v1 snapshot
+  static ChargerStatus? parse(List<int> value) {
+    if (!isComplete(value) || value[0] != version1 || value.length < 30) {
+      return null;
+    }
+    final b = ByteData.sublistView(Uint8List.fromList(value));
+    final metered = value[1] >= 52;
+    return ChargerStatus(
+      version: b.getUint8(0),
+      size: b.getUint8(1),
+      relayCount: b.getUint8(2),
+      relayMask: b.getUint8(3),
+      uptimeS: b.getUint32(4, Endian.little),
+      errorFlags: b.getUint32(8, Endian.little),
+      fwVersion: b.getUint32(12, Endian.little),
+      cmdsRun: b.getUint32(16, Endian.little),
+      cmdsRejected: b.getUint32(20, Endian.little),
+      relaySwitches: b.getUint32(24, Endian.little),
+      sessions: b.getUint8(28),
+      lastSeq: b.getUint8(29),
+      vRmsMv: metered ? b.getUint32(32, Endian.little) : null,
+      iRmsMa: metered ? b.getUint32(36, Endian.little) : null,
+      powerW: metered ? b.getInt32(40, Endian.little) : null,
+      energyWh: metered ? b.getUint32(44, Endian.little) : null,
+      iPeakMa: metered ? b.getUint32(48, Endian.little) : null,
+    );
+  }
+
+  bool relayOn(int channel) => (relayMask >> channel) & 1 == 1;
+
+  String get fwVersionString =>
+      '${fwVersion >> 16}.${(fwVersion >> 8) & 0xFF}.${fwVersion & 0xFF}';
+}
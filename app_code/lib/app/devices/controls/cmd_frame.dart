@@ -0,0 +1,101 @@
+import 'dart:convert';
+
+// Binary command frames understood by the ESP32 firmware (see cmd_proto.h).
+// Several frames can be concatenated into a single characteristic write.
+class CmdFrame {
+  static const int sof = 0xA5;
+
+  static const int opNop = 0x00;
+  static const int opRelaySet = 0x01;
+  static const int opConfigSet = 0x02;
+  static const int opTimeSet = 0x03;
+  static const int opPlanWindow = 0x04;
+  static const int opPlanTariff = 0x05;
+  static const int opPlanPrices = 0x06;
+  static const int opCurrentLimit = 0x07;
+
+  // Bits of a schedule rule's days
+  static const int monday = 0x01;
+  static const int everyDay = 0x7F;
+
+  // Settings fields, see config_fields.def in the firmware
+  static const int cfgBleName = 0;
+  static const int cfgWifiSsid = 1;
+  static const int cfgWifiPass = 2;
+  static const int cfgSiteBudget = 3; // amps, "0" for no site balancing
+
+  static const int maxPayload = 32;
+
+  static int _seq = 0;
+
+  // CRC-16/CCITT-FALSE over opcode, seq, len and payload
+  static int crc16(List<int> data) {
+    int crc = 0xFFFF;
+    for (final b in data) {
+      crc ^= (b & 0xFF) << 8;
+      for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) != 0 ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        crc &= 0xFFFF;
+      }
+    }
+    return crc;
+  }
+
+  static List<int> encode(int opcode, [List<int> payload = const []]) {
+    _seq = (_seq + 1) & 0xFF;
+    final body = [opcode, _seq, payload.length, ...payload];
+    final crc = crc16(body);
+    return [sof, ...body, crc & 0xFF, crc >> 8];
+  }
+
+  static List<int> relaySet(int channel, bool on) =>
+      encode(opRelaySet, [channel, on ? 1 : 0]);
+
+  // One frame per 30-byte piece; send them in a single write so the
+  // firmware stores the whole value with one flash commit
+  static List<int> configSet(int field, String value) {
+    final bytes = utf8.encode(value);
+    const piece = maxPayload - 2;
+    final frames = <List<int>>[];
+    for (int off = 0; off == 0 || off < bytes.length; off += piece) {
+      final end = (off + piece < bytes.length) ? off + piece : bytes.length;
+      frames.add(encode(opConfigSet, [field, off, ...bytes.sublist(off, end)]));
+    }
+    return batch(frames);
+  }
+
+  static List<int> _le16(int v) => [v & 0xFF, (v >> 8) & 0xFF];
+
+  // The charger's clock for its charge schedule, with the phone's UTC
+  // offset; sent again on every connect, which also carries DST changes
+  static List<int> timeSet(DateTime now) {
+    final unix = now.toUtc().millisecondsSinceEpoch ~/ 1000;
+    return encode(opTimeSet, [
+      unix & 0xFF,
+      (unix >> 8) & 0xFF,
+      (unix >> 16) & 0xFF,
+      (unix >> 24) & 0xFF,
+      ..._le16(now.timeZoneOffset.inMinutes),
+    ]);
+  }
+
+  // Charge window in local minutes of the day; an end at or before start
+  // runs past midnight. Days 0 clears the slot.
+  static List<int> planWindow(
+          int index, int days, int channel, int startMin, int endMin) =>
+      encode(opPlanWindow,
+          [index, days, channel, ..._le16(startMin), ..._le16(endMin)]);
+
+  static List<int> planTariff(
+          int index, int days, int startMin, int endMin, int price) =>
+      encode(opPlanTariff,
+          [index, days, ..._le16(startMin), ..._le16(endMin), ..._le16(price)]);
+
+  // Channels in cheapMask charge whenever the price is at most maxPrice
+  static List<int> planPrices(int defaultPrice, int maxPrice, int cheapMask) =>
+      encode(opPlanPrices,
+          [..._le16(defaultPrice), ..._le16(maxPrice), cheapMask]);
+
+  static List<int> batch(List<List<int>> frames) =>
+      [for (final f in frames) ...f];
+}
@@ -1,4 +1,6 @@
-import 'dart:convert';
+import 'package:evolt_controller/app/activities/activities_controller.dart';
+import 'package:evolt_controller/app/devices/controls/charger_status.dart';
+import 'package:evolt_controller/app/devices/controls/cmd_frame.dart';
 import 'package:evolt_controller/widgets/snackbars.dart';
 import 'package:flutter/material.dart';
 import 'package:flutter_blue_plus/flutter_blue_plus.dart';
@@ -10,11 +12,13 @@ import 'dart:async';
 class ControlsScreen extends StatefulWidget {
   final BluetoothCharacteristic dhtCharacteristic;
   final BluetoothCharacteristic? readCharacteristic;
+  final BluetoothCharacteristic? historyCharacteristic;
 
   const ControlsScreen({
     super.key,
     required this.dhtCharacteristic,
     this.readCharacteristic,
+    this.historyCharacteristic,
   });
 
   @override
@@ -25,10 +29,12 @@ class _ControlsScreenState extends State<ControlsScreen> {
   late BluetoothCharacteristic _dhtCharacteristic;
   bool _isConnected = false;
   bool _isSending = false;
-  String _lastReceivedData = '';
+  ChargerStatus? _status;
   bool _isGpioOn = false;
-  Timer? _statusTimer;
+  StreamSubscription<List<int>>? _statusSubscription;
+  Timer? _keepalive;
   bool isLoading = true;
+  final ActivitiesController _activities = Get.find();
 
   @override
   void initState() {
@@ -36,12 +42,13 @@ class _ControlsScreenState extends State<ControlsScreen> {
     _dhtCharacteristic = widget.dhtCharacteristic;
     _checkConnection();
     _listenToDevice();
-    _startStatusPolling();
+    _startKeepalive();
   }
 
   @override
   void dispose() {
-    _statusTimer?.cancel();
+    _keepalive?.cancel();
+    _statusSubscription?.cancel();
     super.dispose();
   }
 
@@ -51,51 +58,50 @@ class _ControlsScreenState extends State<ControlsScreen> {
     });
   }
 
+  // The firmware pushes the status characteristic on every change, so no
+  // polling is needed. Fall back to a single read if notify is unavailable.
   void _listenToDevice() async {
+    final statusCharacteristic = widget.readCharacteristic;
+    if (statusCharacteristic == null) {
+      _readGpioStatus();
+      return;
+    }
     try {
-      await _dhtCharacteristic.setNotifyValue(true);
-      _dhtCharacteristic.lastValueStream.listen(
+      _statusSubscription = statusCharacteristic.onValueReceived.listen(
         (value) {
-          if (mounted) {
-            setState(() {
-              _lastReceivedData = utf8.decode(value);
-              _parseGpioStatus(_lastReceivedData);
-
-            });
+          if (!mounted) return;
+          if (ChargerStatus.isComplete(value)) {
+            _applyStatus(value);
+          } else {
+            // Cut at the MTU, fetch the whole snapshot with a long read
+            _readGpioStatus();
           }
         },
         onError: (error) {
-          if (mounted) {}
+          debugPrint('❌ Status notification error: $error');
         },
       );
+      await statusCharacteristic.setNotifyValue(true);
     } catch (e) {
       Fluttertoast.showToast(
         msg: 'Failed to listen to device: $e',
         backgroundColor: Colors.red,
         textColor: Colors.white,
       );
+      _readGpioStatus();
     }
   }
 
-  void _parseGpioStatus(String data) {
-    if (data.startsWith('GPIO_13:')) {
-      String status = data.substring(
-        8,
-      ); // Remove "GPIO_13:" prefix (8 characters)
-      setState(() {
-        _isGpioOn = status == '1';
-        isLoading = false;
-      });
-    } else {
-      debugPrint('⚠️ Unknown data format: $data');
+  void _applyStatus(List<int> value) {
+    final status = ChargerStatus.parse(value);
+    if (status == null) {
+      debugPrint('⚠️ Unknown status format: $value');
+      return;
     }
-  }
-
-  void _startStatusPolling() {
-    _statusTimer = Timer.periodic(Duration(seconds: 2), (timer) {
-      if (_isConnected && mounted) {
-        _readGpioStatus();
-      }
+    setState(() {
+      _status = status;
+      _isGpioOn = status.relayOn(0);
+      isLoading = false;
     });
   }
 
@@ -107,14 +113,43 @@ class _ControlsScreenState extends State<ControlsScreen> {
           widget.readCharacteristic ?? _dhtCharacteristic;
 
       List<int> value = await characteristicToRead.read();
-      String data = utf8.decode(value);
-      _parseGpioStatus(data);
+      if (mounted) _applyStatus(value);
     } catch (e) {
       debugPrint('❌ Error reading GPIO status: $e');
     }
   }
 
-  Future<void> _sendCommand(String command) async {
+  // The firmware moves a connection to slow, low power intervals after a
+  // while without commands (CONFIG_EVOLTE_CONN_IDLE_S, 10 s by default).
+  // NOPs while this screen is open keep it on fast ones, so a tap reaches
+  // the charger within tens of milliseconds.
+  static const _keepalivePeriod = Duration(seconds: 4);
+
+  void _startKeepalive() {
+    _sendClock();
+    _keepalive = Timer.periodic(_keepalivePeriod, (_) => _sendNop());
+  }
+
+  Future<void> _sendNop() async {
+    if (!_isConnected || _isSending) return;
+    try {
+      await _dhtCharacteristic.write(CmdFrame.encode(CmdFrame.opNop));
+    } catch (e) {
+      debugPrint('⚠️ Keepalive failed: $e');
+    }
+  }
+
+  // Keeps the charge schedule on time when the charger has no Wi-Fi
+  Future<void> _sendClock() async {
+    if (!_isConnected) return;
+    try {
+      await _dhtCharacteristic.write(CmdFrame.timeSet(DateTime.now()));
+    } catch (e) {
+      debugPrint('⚠️ Clock sync failed: $e');
+    }
+  }
+
+  Future<void> _sendCommand(List<int> frames) async {
     if (!_isConnected) {
       Snackbars.showError('Device not connected');
       return;
@@ -123,16 +158,12 @@ class _ControlsScreenState extends State<ControlsScreen> {
     setState(() => _isSending = true);
 
     try {
-      // Send simple string command as ESP32 expects
-      await _dhtCharacteristic.write(utf8.encode(command));
+      // Binary command frames, see cmd_frame.dart
+      await _dhtCharacteristic.write(frames);
 
       setState(() {
         _isSending = false;
       });
-
-      // Read updated status after sending command
-      await Future.delayed(Duration(milliseconds: 500));
-      _readGpioStatus();
     } catch (e) {
       setState(() => _isSending = false);
       Snackbars.showError('Failed to send command, Try again!');
@@ -140,10 +171,24 @@ class _ControlsScreenState extends State<ControlsScreen> {
   }
 
   Future<void> _sendLedCommand(String status) async {
-    if (status == '1') {
-      await _sendCommand('LIGHT ON');
-    } else {
-      await _sendCommand('LIGHT OFF');
+    await _sendCommand(CmdFrame.relaySet(0, status == '1'));
+  }
+
+  Future<void> _syncHistory() async {
+    try {
+      final result = await _activities.sync(widget.historyCharacteristic!);
+      if (result == null) return;
+      if (result.complete) {
+        Fluttertoast.showToast(
+          msg:
+              '${result.records.length} records, '
+              '${result.kbPerSecond.toStringAsFixed(1)} KB/s',
+        );
+      } else {
+        Snackbars.showError('History sync stalled, sync again to resume');
+      }
+    } catch (e) {
+      Snackbars.showError('History sync failed: $e');
     }
   }
 
@@ -225,6 +270,35 @@ class _ControlsScreenState extends State<ControlsScreen> {
                               : _sendLedCommand('1')
                         : null,
                   ),
+                  if (widget.historyCharacteristic != null) ...[
+                    SizedBox(height: 20.h),
+                    Text(
+                      'Charge History',
+                      style: TextStyle(fontWeight: FontWeight.w500),
+                    ),
+                    SizedBox(height: 10.h),
+                    Obx(
+                      () => _buildControlButton(
+                        theme,
+                        icon: Icons.sync,
+                        label: _activities.syncing.value
+                            ? 'Syncing ${_activities.progress.value}'
+                            : 'Sync history',
+                        isOn: false,
+                        onPressed: _isConnected && !_activities.syncing.value
+                            ? _syncHistory
+                            : null,
+                      ),
+                    ),
+                  ],
+                  if (_status != null) ...[
+                    SizedBox(height: 20.h),
+                    Text(
+                      'Firmware ${_status!.fwVersionString} · '
+                      'up ${Duration(seconds: _status!.uptimeS).inMinutes} min',
+                      style: theme.textTheme.bodySmall,
+                    ),
+                  ],
                 ],
               ),
             ),
@@ -1,6 +1,8 @@
 import 'dart:async';
+import 'package:evolt_controller/app/devices/controls/charger_beacon.dart';
 import 'package:evolt_controller/app/devices/controls/controls_screen.dart';
 import 'package:evolt_controller/app/favourites/favourite_controller.dart';
+import 'package:evolt_controller/consts/gatt_uuids.dart';
 import 'package:flutter/foundation.dart';
 import 'package:flutter/material.dart';
 import 'package:flutter_blue_plus/flutter_blue_plus.dart';
@@ -130,35 +132,38 @@ class _ScanPageState extends State<ScanPage> {
 
       BluetoothCharacteristic? writeCharacteristic;
       BluetoothCharacteristic? readCharacteristic;
+      BluetoothCharacteristic? historyCharacteristic;
 
       // Look for the ESP32 service (0x180) and characteristics
       for (BluetoothService service in services) {
         debugPrint('Found service: ${service.uuid}');
 
         // Check if this is our target service (0x180)
-        String serviceUuid = service.uuid.toString().toLowerCase();
-        if (serviceUuid.contains('0180') || serviceUuid.contains('180')) {
+        if (gattUuidIs(service.uuid.toString(), chargerServiceUuid16)) {
           debugPrint('Found target service: ${service.uuid}');
 
           for (BluetoothCharacteristic characteristic
               in service.characteristics) {
             debugPrint('Found characteristic: ${characteristic.uuid}');
 
-            String characteristicUuid = characteristic.uuid
-                .toString()
-                .toLowerCase();
+            String characteristicUuid = characteristic.uuid.toString();
 
             // Look for the write characteristic (0xDEAD)
-            if (characteristicUuid.contains('dead')) {
+            if (gattUuidIs(characteristicUuid, cmdCharacteristicUuid16)) {
               writeCharacteristic = characteristic;
               debugPrint('Found write characteristic: ${characteristic.uuid}');
             }
 
             // Look for the read characteristic (0xFEF4)
-            if (characteristicUuid.contains('fef4')) {
+            if (gattUuidIs(characteristicUuid, statusCharacteristicUuid16)) {
               readCharacteristic = characteristic;
               debugPrint('Found read characteristic: ${characteristic.uuid}');
             }
+
+            // Session history download (0xFEF5)
+            if (gattUuidIs(characteristicUuid, historyCharacteristicUuid16)) {
+              historyCharacteristic = characteristic;
+            }
           }
         }
       }
@@ -196,6 +201,7 @@ class _ScanPageState extends State<ScanPage> {
           ControlsScreen(
             dhtCharacteristic: _selectedCharacteristic!,
             readCharacteristic: readCharacteristic,
+            historyCharacteristic: historyCharacteristic,
           ),
         );
       }
@@ -289,10 +295,12 @@ class _ScanPageState extends State<ScanPage> {
   }
 
   Widget _buildDeviceList() {
-    // Filter devices to show only those with "evolte" in their name
+    // Evolte chargers by name, or by the status beacon when the scan
+    // response with the name has not come in yet
     final filteredResults = _scanResults.where((result) {
-      final deviceName = result.device.platformName.toLowerCase();
-      return deviceName.contains('evolte') || deviceName.contains('evolte_01');
+      final deviceName = _deviceName(result).toLowerCase();
+      return deviceName.contains('evolte') ||
+          ChargerBeacon.fromScan(result.advertisementData) != null;
     }).toList();
 
     if (filteredResults.isEmpty && !_isScanning) {
@@ -382,10 +390,18 @@ class _ScanPageState extends State<ScanPage> {
     );
   }
 
+  // The firmware sends its name in the scan response
+  String _deviceName(ScanResult result) {
+    final advName = result.advertisementData.advName;
+    return advName.isNotEmpty ? advName : result.device.platformName;
+  }
+
   Widget _buildDeviceTile(ScanResult result, int index) {
     final device = result.device;
-    final platformName = device.platformName;
-    final isConnectable = platformName.isNotEmpty;
+    final platformName = _deviceName(result);
+    final beacon = ChargerBeacon.fromScan(result.advertisementData);
+    final isConnectable =
+        platformName.isNotEmpty && (beacon?.connectable ?? true);
     final rssi = result.rssi;
 
     return Container(
@@ -411,12 +427,23 @@ class _ScanPageState extends State<ScanPage> {
           child: Icon(Icons.ev_station_outlined, size: 20.sp),
         ),
         title: Text(
-          isConnectable ? platformName : 'Unknown Device',
+          platformName.isNotEmpty ? platformName : 'Unknown Device',
           style: TextStyle(fontWeight: FontWeight.w600, fontSize: 16.sp),
         ),
         subtitle: Column(
           crossAxisAlignment: CrossAxisAlignment.start,
           children: [
+            if (beacon != null)
+              Text(
+                beacon.label,
+                style: TextStyle(
+                  color: beacon.state == ChargerBeacon.stateFault
+                      ? Colors.red
+                      : Colors.grey[700],
+                  fontSize: 12.sp,
+                  fontWeight: FontWeight.w500,
+                ),
+              ),
             if (device.remoteId.toString().isNotEmpty) ...[
               Text(
                 '${device.remoteId}',
@@ -473,7 +500,11 @@ class _ScanPageState extends State<ScanPage> {
               ),
             ),
             child: Text(
-              isConnectable ? 'Connect' : 'Unavailable',
+              isConnectable
+                  ? 'Connect'
+                  : (beacon != null && !beacon.connectable
+                        ? 'Busy'
+                        : 'Unavailable'),
               style: TextStyle(fontSize: 12.sp, fontWeight: FontWeight.w600),
             ),
           ),
@@ -5,6 +5,7 @@ import 'package:get/get.dart';
 import 'package:flutter_blue_plus/flutter_blue_plus.dart';
 import 'package:evolt_controller/app/favourites/favourite_controller.dart';
 import 'package:evolt_controller/app/devices/controls/controls_screen.dart';
+import 'package:evolt_controller/consts/gatt_uuids.dart';
 
 class FavouritesScreen extends StatefulWidget {
   const FavouritesScreen({super.key});
@@ -74,12 +75,14 @@ class _FavouritesScreenState extends State<FavouritesScreen> {
 
       BluetoothCharacteristic? writeChar;
       BluetoothCharacteristic? readChar;
+      BluetoothCharacteristic? historyChar;
 
       for (var service in services) {
         for (var char in service.characteristics) {
-          final uuid = char.uuid.toString().toLowerCase();
-          if (uuid.contains('dead')) writeChar = char;
-          if (uuid.contains('fef4')) readChar = char;
+          final uuid = char.uuid.toString();
+          if (gattUuidIs(uuid, cmdCharacteristicUuid16)) writeChar = char;
+          if (gattUuidIs(uuid, statusCharacteristicUuid16)) readChar = char;
+          if (gattUuidIs(uuid, historyCharacteristicUuid16)) historyChar = char;
         }
       }
 
@@ -95,6 +98,7 @@ class _FavouritesScreenState extends State<FavouritesScreen> {
         () => ControlsScreen(
           dhtCharacteristic: writeChar!,
           readCharacteristic: readChar,
+          historyCharacteristic: historyChar,
         ),
       );
     } catch (e) {
@@ -0,0 +1,27 @@
+// Generated from evolte_esp_code/main/gatt_schema.def by
+// evolte_esp_code/host/tools/gatt_dart.c, do not edit.
+
+const int chargerServiceUuid16 = 0x0180;
+const String chargerServiceUuid = '00000180-0000-1000-8000-00805f9b34fb';
+
+const int statusCharacteristicUuid16 = 0xFEF4;
+const String statusCharacteristicUuid = '0000fef4-0000-1000-8000-00805f9b34fb';
+
+const int cmdCharacteristicUuid16 = 0xDEAD;
+const String cmdCharacteristicUuid = '0000dead-0000-1000-8000-00805f9b34fb';
+
+const int historyCharacteristicUuid16 = 0xFEF5;
+const String historyCharacteristicUuid = '0000fef5-0000-1000-8000-00805f9b34fb';
+
+const int otaCharacteristicUuid16 = 0xFEF6;
+const String otaCharacteristicUuid = '0000fef6-0000-1000-8000-00805f9b34fb';
+
+const int diagCharacteristicUuid16 = 0xFEF7;
+const String diagCharacteristicUuid = '0000fef7-0000-1000-8000-00805f9b34fb';
+
+// True if a UUID as the BLE plugin prints it, short or full form, is uuid16
+bool gattUuidIs(String uuid, int uuid16) {
+  final short = uuid16.toRadixString(16).padLeft(4, '0');
+  final u = uuid.toLowerCase();
+  return u == short || u == '0000$short-0000-1000-8000-00805f9b34fb';
+}
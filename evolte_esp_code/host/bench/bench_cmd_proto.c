@@ -0,0 +1,51 @@
+// Commands per second through cmd_proto_dispatch for legacy text and
+// binary batches of increasing size.
+#include <stdio.h>
+#include <time.h>
+#include "cmd_proto.h"
+
+static volatile int sink;
+
+static int op_relay(const cmd_frame_t *frame, void *ctx)
+{
+    sink += frame->payload[1];
+    return 0;
+}
+
+static const cmd_op_t ops[CMD_OP_COUNT] = {
+    [CMD_OP_RELAY_SET] = {.fn = op_relay, .min_len = 2, .max_len = 2},
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, const uint8_t *buf, size_t len, int cmds_per_write)
+{
+    const long iters = 2000000 / cmds_per_write;
+    double t0 = now_ns();
+    for (long i = 0; i < iters; i++)
+        cmd_proto_dispatch(buf, len, ops, CMD_OP_COUNT, NULL);
+    double ns = now_ns() - t0;
+    double per_cmd = ns / ((double)iters * cmds_per_write);
+    printf("%-16s %3d cmd/write  %8.1f ns/cmd  %10.0f cmd/s\n", name, cmds_per_write, per_cmd, 1e9 / per_cmd);
+}
+
+int main(void)
+{
+    run("legacy text", (const uint8_t *)"LIGHT OFF", 9, 1);
+
+    uint8_t buf[CMD_PROTO_MAX_FRAMES * (CMD_PROTO_OVERHEAD + 2)];
+    const uint8_t on[2] = {0, 1};
+    for (int batch = 1; batch <= CMD_PROTO_MAX_FRAMES; batch *= 2)
+    {
+        size_t n = 0;
+        for (int i = 0; i < batch; i++)
+            n += cmd_proto_encode(&buf[n], sizeof(buf) - n, CMD_OP_RELAY_SET, (uint8_t)i, on, 2);
+        run("binary frames", buf, n, batch);
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Microbenchmarks of the firmware's BLE and HTTP entry points on the host.
+// Reports ns/op, heap allocations/op and NimBLE mbufs/op for each operation.
+//   bench_fw [--iters=N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cmd_proto.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+
+#define UUID_STATUS 0xFEF4
+#define UUID_CMD 0xDEAD
+
+static long iters = 200000;
+
+typedef void (*bench_fn)(long i);
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, bench_fn fn, long n)
+{
+    fake_alloc_stats_t a0, a1;
+
+    fn(0); // Warm up lazy state outside the measurement
+    fake_alloc_stats(&a0);
+    double t0 = now_ns();
+    for (long i = 0; i < n; i++)
+        fn(i);
+    double ns = now_ns() - t0;
+    fake_alloc_stats(&a1);
+
+    printf("%-28s %10.1f ns/op %8.2f allocs/op %8.2f mbufs/op\n", name, ns / n,
+           (double)(a1.heap_allocs - a0.heap_allocs) / n,
+           (double)(a1.mbuf_allocs - a0.mbuf_allocs) / n);
+}
+
+static void bench_write_text(long i)
+{
+    if (i & 1)
+        fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    else
+        fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8);
+}
+
+static uint8_t frames[2][CMD_PROTO_MAX_FRAMES * (CMD_PROTO_OVERHEAD + 2)];
+static size_t frame_len[2], batch_len;
+static uint8_t batch[CMD_PROTO_MAX_FRAMES * (CMD_PROTO_OVERHEAD + 2)];
+
+static void bench_write_frame(long i)
+{
+    fake_gatt_write(1, UUID_CMD, frames[i & 1], frame_len[i & 1]);
+}
+
+// Let the host task run the scheduler passes deferred beyond the budget
+static void bench_write_batch(long i)
+{
+    fake_gatt_write(1, UUID_CMD, batch, batch_len);
+    fake_time_advance_ms(0);
+}
+
+static void bench_read_status(long i)
+{
+    uint8_t out[BLE_ATT_ATTR_MAX_LEN];
+    size_t len;
+    fake_gatt_read(1, UUID_STATUS, out, sizeof(out), &len);
+}
+
+// Every write changes state and lands outside the coalescing window
+static void bench_write_notify(long i)
+{
+    fake_time_advance_ms(CONFIG_EVOLTE_NOTIFY_COALESCE_MS);
+    bench_write_frame(i);
+}
+
+static void bench_gap_cycle(long i)
+{
+    fake_gap_connect(2);
+    fake_gap_subscribe(2, UUID_STATUS, true, false);
+    fake_gap_disconnect(2);
+}
+
+static void bench_http_root(long i)
+{
+    static fake_http_resp_t resp;
+    fake_http_request(HTTP_GET, "/", NULL, 0, &resp);
+}
+
+static void bench_http_config(long i)
+{
+    static fake_http_resp_t resp;
+    static const char body[] = "name=&ssid=site+net&password=secret";
+    fake_http_request(HTTP_POST, "/set_config", body, sizeof(body) - 1, &resp);
+}
+
+static void bench_api_status(long i)
+{
+    static fake_http_resp_t resp;
+    fake_http_request(HTTP_GET, "/api/status", NULL, 0, &resp);
+}
+
+static void bench_api_relay(long i)
+{
+    static fake_http_resp_t resp;
+    static const char *const body[2] = {"{\"channel\":0,\"on\":true}", "{\"channel\":0,\"on\":false}"};
+    fake_http_request(HTTP_POST, "/api/relay", body[i & 1], strlen(body[i & 1]), &resp);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (strncmp(argv[i], "--iters=", 8) == 0)
+            iters = atol(argv[i] + 8);
+
+    app_main();
+    fake_host_run(); // Wi-Fi and HTTP come up on a boot worker task
+
+    for (int s = 0; s < 2; s++)
+    {
+        const uint8_t payload[2] = {0, (uint8_t)!s};
+        frame_len[s] = cmd_proto_encode(frames[s], sizeof(frames[s]), CMD_OP_RELAY_SET, (uint8_t)s, payload, 2);
+    }
+    for (int f = 0; f < 8; f++)
+    {
+        const uint8_t payload[2] = {0, (uint8_t)(f & 1)};
+        batch_len += cmd_proto_encode(&batch[batch_len], sizeof(batch) - batch_len, CMD_OP_RELAY_SET,
+                                      (uint8_t)f, payload, 2);
+    }
+
+    printf("bench_fw: %ld iterations per operation\n", iters);
+    fake_gap_connect(1);
+    run("gatt write (text)", bench_write_text, iters);
+    run("gatt write (1 frame)", bench_write_frame, iters);
+    run("gatt write (8 frame batch)", bench_write_batch, iters);
+    run("gatt read status", bench_read_status, iters);
+
+    fake_gap_subscribe(1, UUID_STATUS, true, false);
+    run("gatt write + notify", bench_write_notify, iters / 10);
+    run("gap connect/sub/disconnect", bench_gap_cycle, iters / 10);
+    fake_gap_disconnect(1);
+
+    run("http GET /", bench_http_root, iters);
+    run("http POST /set_config", bench_http_config, iters);
+    run("http GET /api/status", bench_api_status, iters);
+    run("http POST /api/relay", bench_api_relay, iters);
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Bytes per second through the body parser for a provisioning-sized form
+// and JSON body, fed whole and in receive-sized chunks.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "http_body.h"
+
+#define N_FIELDS 12
+
+static char vals[N_FIELDS][64];
+static char names[N_FIELDS][16];
+static http_body_field_t fields[N_FIELDS];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, http_body_kind_t kind, const char *body, size_t chunk)
+{
+    const long iters = 200000;
+    size_t len = strlen(body);
+    http_body_t p;
+    double t0 = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        http_body_init(&p, kind, fields, N_FIELDS);
+        for (size_t off = 0; off < len; off += chunk)
+            http_body_feed(&p, body + off, len - off < chunk ? len - off : chunk);
+        if (http_body_finish(&p) != HTTP_BODY_OK)
+        {
+            printf("%s: parse failed\n", name);
+            return;
+        }
+    }
+    double ns = now_ns() - t0;
+    printf("%-6s chunk %4zu  %4zu B  %8.1f ns/body  %7.1f MB/s\n", name, chunk, len, ns / iters,
+           (double)len * iters / ns * 1e3);
+}
+
+int main(void)
+{
+    static char form[2048], json[2048];
+    size_t nf = 0, nj = 0;
+
+    nj += snprintf(json + nj, sizeof(json) - nj, "{");
+    for (int i = 0; i < N_FIELDS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "field_%d", i);
+        fields[i] = (http_body_field_t){.name = names[i], .val = vals[i], .cap = sizeof(vals[i])};
+        nf += snprintf(form + nf, sizeof(form) - nf, "%sfield_%d=value+%%C3%%A9+number+%d", i ? "&" : "", i, i);
+        nj += snprintf(json + nj, sizeof(json) - nj, "%s\"field_%d\": \"value \\u00e9 number %d\"", i ? ", " : "",
+                       i, i);
+    }
+    snprintf(json + nj, sizeof(json) - nj, "}");
+
+    run("form", HTTP_BODY_FORM, form, 2048);
+    run("form", HTTP_BODY_FORM, form, 128);
+    run("json", HTTP_BODY_JSON, json, 2048);
+    run("json", HTTP_BODY_JSON, json, 128);
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Throughput and accuracy of the metering kernels on recorded waveforms:
+// ns per sample pair through meter_dsp_feed in DMA-frame sized blocks, and
+// the fixed-point aggregates next to a double precision reference.
+//   bench_meter_dsp [--iters=N] [--window-ms=N] [waveform.txt ...]
+// With no files, every waveform in bench/waveforms is used.
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "meter_dsp.h"
+#include "waveform.h"
+
+#define BLOCK 128 // Pairs per DMA frame in main/meter.c
+
+static long iters = 200;
+static uint32_t window_ms = 200;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Last whole window of the file in double precision
+static void reference(const waveform_t *w, uint32_t window, double *v_rms, double *i_rms, double *p)
+{
+    size_t start = (w->n / window - 1) * window;
+    double vm = 0, im = 0, vv = 0, ii = 0, vi = 0;
+    for (size_t k = start; k < start + window; k++)
+    {
+        vm += w->v[k];
+        im += w->i[k];
+    }
+    vm /= window;
+    im /= window;
+    for (size_t k = start; k < start + window; k++)
+    {
+        double a = w->v[k] - vm, b = w->i[k] - im;
+        vv += a * a;
+        ii += b * b;
+        vi += a * b;
+    }
+    double vs = w->v_uv_per_lsb / 1e6, is = w->i_ua_per_lsb / 1e6;
+    *v_rms = sqrt(vv / window) * vs;
+    *i_rms = sqrt(ii / window) * is;
+    *p = vi / window * vs * is;
+}
+
+static void run(const char *path)
+{
+    waveform_t w;
+    if (waveform_load(path, &w) != 0)
+    {
+        printf("%s: cannot load\n", path);
+        return;
+    }
+    const meter_dsp_cfg_t cfg = {.window = w.rate / 1000 * window_ms,
+                                 .sample_hz = w.rate,
+                                 .v_uv_per_lsb = w.v_uv_per_lsb,
+                                 .i_ua_per_lsb = w.i_ua_per_lsb};
+    if (w.n < cfg.window)
+    {
+        printf("%s: shorter than one window\n", path);
+        waveform_free(&w);
+        return;
+    }
+
+    meter_dsp_t m;
+    meter_dsp_out_t out[4], last = {0};
+    double t0 = now_ns();
+    for (long it = 0; it < iters; it++)
+    {
+        meter_dsp_init(&m, &cfg);
+        for (size_t off = 0; off < w.n; off += BLOCK)
+        {
+            size_t n = w.n - off < BLOCK ? w.n - off : BLOCK;
+            int done = meter_dsp_feed(&m, &w.v[off], &w.i[off], n, out, 4);
+            if (done > 0)
+                last = out[(done < 4 ? done : 4) - 1];
+        }
+    }
+    double ns = (now_ns() - t0) / ((double)iters * w.n);
+
+    double v_rms, i_rms, p;
+    reference(&w, cfg.window, &v_rms, &i_rms, &p);
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    printf("%-24s %6.2f ns/pair %7.1f Mpair/s  V %7.2f (%7.2f)  I %6.3f (%6.3f)  P %6d W (%7.1f)\n", name, ns,
+           1e3 / ns, last.v_rms_mv / 1e3, v_rms, last.i_rms_ma / 1e3, i_rms, (int)last.power_w, p);
+    waveform_free(&w);
+}
+
+int main(int argc, char **argv)
+{
+    int files = 0;
+    for (int a = 1; a < argc; a++)
+    {
+        if (strncmp(argv[a], "--iters=", 8) == 0)
+            iters = atol(argv[a] + 8);
+        else if (strncmp(argv[a], "--window-ms=", 12) == 0)
+            window_ms = (uint32_t)atol(argv[a] + 12);
+        else
+        {
+            run(argv[a]);
+            files++;
+        }
+    }
+    if (files > 0)
+        return 0;
+
+    DIR *d = opendir(EVOLTE_WAVEFORM_DIR);
+    struct dirent *e;
+    char path[512];
+    while (d && (e = readdir(d)) != NULL)
+    {
+        size_t len = strlen(e->d_name);
+        if (len < 4 || strcmp(e->d_name + len - 4, ".txt") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", EVOLTE_WAVEFORM_DIR, e->d_name);
+        run(path);
+    }
+    if (d)
+        closedir(d);
+    return 0;
+}
@@ -0,0 +1,224 @@
+// Site load balancing on simulated chargers. Each one runs site_alloc on its
+// own view of the site. Every round they take turns in random order: move
+// the limit, then broadcast the report, each copy of which is lost with the
+// given probability. Cars plug in and out one at a time; after each change
+// the rounds until every limit is at the fair split of the true site state
+// are counted, with the most the site ever drew over budget and the cost of
+// a round.
+//   bench_site_alloc [--chargers=N] [--changes=N] [--loss=PERCENT]
+//                    [--budget=AMPS] [--seed=N] [--max-rounds=N]
+// The budget defaults to 10 A per charger, cars want 16 or 32 A. Exits
+// non-zero if a change did not settle within max-rounds, or the site went
+// over budget with no loss.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "site_alloc.h"
+
+#define MIN_DA 60
+#define FALLBACK_DA 60
+#define GROUP 1
+
+typedef struct
+{
+    site_alloc_t s;
+    site_node_t *nodes;
+    uint16_t demand;
+} charger_t;
+
+static long chargers = 200;
+static long changes = 200;
+static double loss;
+static long budget_a;
+static long max_rounds = 100;
+static uint32_t rng = 1;
+
+static charger_t *site;
+static long *order;
+static site_node_t *truth;
+static uint16_t budget;
+static long draw; // Sum of every charger's limit
+static long over_max;
+static double round_ns;
+static long round_calls;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static bool lost(void)
+{
+    return next_rand() / 4294967296.0 < loss;
+}
+
+static void run_round(void)
+{
+    for (long i = chargers - 1; i > 0; i--)
+    {
+        long j = (long)(next_rand() % (uint32_t)(i + 1));
+        long t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (long k = 0; k < chargers; k++)
+    {
+        charger_t *c = &site[order[k]];
+        uint16_t before = site_alloc_self(&c->s)->alloc;
+        site_alloc_set_local(&c->s, budget, c->demand);
+        double t0 = now_ns();
+        uint16_t alloc = site_alloc_round(&c->s);
+        round_ns += now_ns() - t0;
+        round_calls++;
+        draw += (long)alloc - before;
+        if (draw - budget > over_max)
+            over_max = draw - budget;
+
+        uint8_t msg[SITE_MSG_LEN];
+        size_t len = site_alloc_report(&c->s, msg, sizeof(msg));
+        for (long d = 0; d < chargers; d++)
+            if (d != order[k] && !lost())
+                site_alloc_heard(&site[d].s, msg, len);
+    }
+}
+
+// Every limit at the split of the true state: reports as last sent, so
+// the split the chargers work out next
+static bool settled(void)
+{
+    for (long i = 0; i < chargers; i++)
+        truth[i] = *site_alloc_self(&site[i].s);
+    site_alloc_share(truth, (uint16_t)chargers, budget);
+    for (long i = 0; i < chargers; i++)
+        if (truth[i].alloc != truth[i].target)
+            return false;
+    return true;
+}
+
+static long settle(void)
+{
+    for (long r = 1; r <= max_rounds; r++)
+    {
+        run_round();
+        if (settled())
+            return r;
+    }
+    return -1;
+}
+
+static uint16_t car(void)
+{
+    return next_rand() & 1 ? 320 : 160;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *what, long *rounds, long n)
+{
+    if (n == 0)
+        return;
+    qsort(rounds, (size_t)n, sizeof(long), cmp_long);
+    double sum = 0;
+    for (long i = 0; i < n; i++)
+        sum += rounds[i];
+    printf("%-8s %5ld changes, rounds to settle: mean %5.2f  p50 %3ld  p99 %3ld  max %3ld\n", what, n, sum / n,
+           rounds[n / 2], rounds[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1], rounds[n - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    for (int a = 1; a < argc; a++)
+    {
+        if (strncmp(argv[a], "--chargers=", 11) == 0)
+            chargers = atol(argv[a] + 11);
+        else if (strncmp(argv[a], "--changes=", 10) == 0)
+            changes = atol(argv[a] + 10);
+        else if (strncmp(argv[a], "--loss=", 7) == 0)
+            loss = atof(argv[a] + 7) / 100;
+        else if (strncmp(argv[a], "--budget=", 9) == 0)
+            budget_a = atol(argv[a] + 9);
+        else if (strncmp(argv[a], "--seed=", 7) == 0)
+            rng = (uint32_t)atol(argv[a] + 7) | 1;
+        else if (strncmp(argv[a], "--max-rounds=", 13) == 0)
+            max_rounds = atol(argv[a] + 13);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[a]);
+            return 2;
+        }
+    }
+    if (budget_a == 0)
+        budget_a = chargers * 10;
+    if (chargers < 2 || chargers > UINT16_MAX || budget_a * 10 > UINT16_MAX)
+    {
+        fprintf(stderr, "need 2 or more chargers and a budget up to %d A\n", UINT16_MAX / 10);
+        return 2;
+    }
+    budget = (uint16_t)(budget_a * 10);
+
+    site = calloc((size_t)chargers, sizeof(*site));
+    order = calloc((size_t)chargers, sizeof(*order));
+    truth = calloc((size_t)chargers, sizeof(*truth));
+    for (long i = 0; i < chargers; i++)
+    {
+        site[i].nodes = calloc((size_t)chargers, sizeof(site_node_t));
+        site_alloc_init(&site[i].s, 0x24000000u + (uint32_t)i, GROUP, MIN_DA, FALLBACK_DA, site[i].nodes,
+                        (uint16_t)chargers);
+        site[i].demand = next_rand() & 1 ? car() : 0;
+        order[i] = i;
+    }
+
+    // Every charger hears all the others before anything is measured
+    double saved_loss = loss;
+    loss = 0;
+    if (settle() < 0)
+    {
+        printf("initial state did not settle in %ld rounds\n", max_rounds);
+        return 1;
+    }
+    loss = saved_loss;
+    over_max = 0;
+    round_ns = 0;
+    round_calls = 0;
+
+    long *in = calloc((size_t)changes, sizeof(long)), *out = calloc((size_t)changes, sizeof(long));
+    long n_in = 0, n_out = 0, unsettled = 0;
+    for (long e = 0; e < changes; e++)
+    {
+        charger_t *c = &site[next_rand() % (uint32_t)chargers];
+        bool plug = c->demand == 0;
+        c->demand = plug ? car() : 0;
+        long r = settle();
+        if (r < 0)
+        {
+            unsettled++;
+            r = max_rounds;
+        }
+        if (plug)
+            in[n_in++] = r;
+        else
+            out[n_out++] = r;
+    }
+
+    printf("%ld chargers, budget %ld A, %.1f%% of reports lost\n", chargers, budget_a, loss * 100);
+    report("plug in", in, n_in);
+    report("unplug", out, n_out);
+    printf("over budget at most %.1f A, %ld changes did not settle\n", over_max / 10.0, unsettled);
+    printf("round: %.2f us per charger\n", round_ns / round_calls / 1e3);
+    return unsettled > 0 || (loss == 0 && over_max > 0) ? 1 : 0;
+}
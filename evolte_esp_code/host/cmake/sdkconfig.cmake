@@ -0,0 +1,17 @@
+# Turn the project's sdkconfig into the sdkconfig.h the firmware includes, so
+# the host build sees the same CONFIG_* values as the target build.
+function(evolte_sdkconfig_header sdkconfig out)
+    file(STRINGS ${sdkconfig} lines REGEX "^CONFIG_[A-Za-z0-9_]+=")
+    set(body "// Generated from ${sdkconfig} by host/cmake/sdkconfig.cmake\n#pragma once\n")
+    foreach(line IN LISTS lines)
+        string(REGEX REPLACE "^(CONFIG_[A-Za-z0-9_]+)=(.*)$" "\\1" key "${line}")
+        string(REGEX REPLACE "^(CONFIG_[A-Za-z0-9_]+)=(.*)$" "\\2" value "${line}")
+        if(value STREQUAL "y")
+            set(value 1)
+        endif()
+        string(APPEND body "#define ${key} ${value}\n")
+    endforeach()
+    file(WRITE ${out}.tmp "${body}")
+    configure_file(${out}.tmp ${out} COPYONLY)
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${sdkconfig})
+endfunction()
@@ -0,0 +1,130 @@
+// Host fake of the ADC continuous driver. fake_adc_feed packs samples into
+// TYPE1 conversions and DMA frames like the hardware does, stores each full
+// frame in the driver pool, raises the conversion done callback and lets the
+// tasks run. A pool the firmware does not drain in time overflows.
+#include <stdlib.h>
+#include <string.h>
+#include "esp_adc/adc_continuous.h"
+#include "fake_hooks.h"
+
+#define MAX_POOL 16384
+#define MAX_FRAME 2048
+#define MAX_PATTERN 8
+
+struct adc_continuous_ctx_t
+{
+    adc_continuous_handle_cfg_t cfg;
+    adc_digi_pattern_config_t pattern[MAX_PATTERN];
+    uint32_t pattern_num;
+    adc_continuous_evt_cbs_t cbs;
+    void *user_data;
+    bool started;
+};
+
+static struct adc_continuous_ctx_t ctx;
+static uint8_t pool[MAX_POOL];
+static uint32_t pool_len;
+static uint8_t frame[MAX_FRAME];
+static uint32_t frame_len;
+static unsigned long overflows;
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *hdl_config,
+                                    adc_continuous_handle_t *ret_handle)
+{
+    if (hdl_config->conv_frame_size > MAX_FRAME || hdl_config->max_store_buf_size > MAX_POOL ||
+        hdl_config->conv_frame_size % SOC_ADC_DIGI_RESULT_BYTES)
+        return ESP_ERR_INVALID_ARG;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cfg = *hdl_config;
+    pool_len = frame_len = 0;
+    *ret_handle = &ctx;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config)
+{
+    // The ESP32 cannot run continuous mode outside 20 kHz..2 MHz
+    if (config->pattern_num == 0 || config->pattern_num > MAX_PATTERN || config->sample_freq_hz < 20000 ||
+        config->sample_freq_hz > 2000000 || config->format != ADC_DIGI_OUTPUT_FORMAT_TYPE1)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(handle->pattern, config->adc_pattern, sizeof(handle->pattern[0]) * config->pattern_num);
+    handle->pattern_num = config->pattern_num;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t handle,
+                                                  const adc_continuous_evt_cbs_t *cbs, void *user_data)
+{
+    handle->cbs = *cbs;
+    handle->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+    if (handle->pattern_num == 0)
+        return ESP_ERR_INVALID_STATE;
+    handle->started = true;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+    handle->started = false;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max,
+                              uint32_t *out_length, uint32_t timeout_ms)
+{
+    uint32_t n = length_max < pool_len ? length_max : pool_len;
+    n -= n % SOC_ADC_DIGI_RESULT_BYTES;
+    *out_length = n;
+    if (n == 0)
+        return ESP_ERR_TIMEOUT;
+    memcpy(buf, pool, n);
+    memmove(pool, pool + n, pool_len - n);
+    pool_len -= n;
+    return ESP_OK;
+}
+
+static void frame_done(void)
+{
+    adc_continuous_evt_data_t ev = {.conv_frame_buffer = frame, .size = frame_len};
+    frame_len = 0;
+    if (pool_len + ev.size > ctx.cfg.max_store_buf_size)
+    {
+        overflows++;
+        if (ctx.cbs.on_pool_ovf)
+            ctx.cbs.on_pool_ovf(&ctx, &ev, ctx.user_data);
+        return;
+    }
+    memcpy(pool + pool_len, frame, ev.size);
+    pool_len += ev.size;
+    if (ctx.cbs.on_conv_done)
+        ctx.cbs.on_conv_done(&ctx, &ev, ctx.user_data);
+    fake_host_run();
+}
+
+void fake_adc_feed(const uint16_t *a, const uint16_t *b, size_t n)
+{
+    if (!ctx.started)
+        return;
+    for (size_t k = 0; k < n; k++)
+    {
+        for (uint32_t p = 0; p < ctx.pattern_num; p++)
+        {
+            uint16_t raw = p == 0 ? a[k] : p == 1 ? b[k] : 0;
+            adc_digi_output_data_t d = {.type1 = {.data = raw & 0xFFF, .channel = ctx.pattern[p].channel}};
+            memcpy(&frame[frame_len], &d, SOC_ADC_DIGI_RESULT_BYTES);
+            frame_len += SOC_ADC_DIGI_RESULT_BYTES;
+            if (frame_len == ctx.cfg.conv_frame_size)
+                frame_done();
+        }
+    }
+}
+
+unsigned long fake_adc_overflows(void)
+{
+    return overflows;
+}
@@ -0,0 +1,67 @@
+// Counts heap allocations made by the firmware objects. The executables are
+// linked with -Wl,--wrap for malloc/calloc/realloc/free.
+#include <stddef.h>
+#include "esp_heap_caps.h"
+#include "fake_hooks.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+unsigned long fake_mbuf_allocs(void);
+
+static unsigned long heap_allocs, heap_frees;
+
+// Overridden by the firmware's, like on the target
+__attribute__((weak)) void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+}
+
+__attribute__((weak)) void esp_heap_trace_free_hook(void *ptr)
+{
+}
+
+void *__wrap_malloc(size_t size)
+{
+    heap_allocs++;
+    void *p = __real_malloc(size);
+    if (p)
+        esp_heap_trace_alloc_hook(p, size, 0);
+    return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    heap_allocs++;
+    void *p = __real_calloc(n, size);
+    if (p)
+        esp_heap_trace_alloc_hook(p, n * size, 0);
+    return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heap_allocs++;
+    void *p = __real_realloc(ptr, size);
+    if (p)
+        esp_heap_trace_alloc_hook(p, size, 0);
+    return p;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr)
+    {
+        heap_frees++;
+        esp_heap_trace_free_hook(ptr);
+    }
+    __real_free(ptr);
+}
+
+void fake_alloc_stats(fake_alloc_stats_t *out)
+{
+    out->heap_allocs = heap_allocs;
+    out->heap_frees = heap_frees;
+    out->mbuf_allocs = fake_mbuf_allocs();
+}
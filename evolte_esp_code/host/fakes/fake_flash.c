@@ -0,0 +1,200 @@
+// Host fake of esp_partition over simulated NOR flash. The partition table is
+// parsed from partitions.csv so sizes match the target. Erase sets a whole
+// sector to 0xFF and programming can only clear bits, like the real chip.
+// Power can be cut after a number of programmed bytes: the write in progress
+// stops part way and nothing after it reaches the flash until it is restored.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "fake_hooks.h"
+
+#define MAX_PARTS 12
+#define SECTOR 4096
+
+typedef struct
+{
+    esp_partition_t part;
+    uint8_t *mem;
+    uint32_t *erases; // Per sector
+} fake_part_t;
+
+static fake_part_t parts[MAX_PARTS];
+static int n_parts = -1;
+static long cut_budget = -1; // Bytes left before the power cut, -1 never
+static bool powered = true;
+
+static uint32_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+    if (*end == 'K' || *end == 'k')
+        v *= 1024;
+    else if (*end == 'M' || *end == 'm')
+        v *= 1024 * 1024;
+    return (uint32_t)v;
+}
+
+static char *field(char **p)
+{
+    char *s = *p;
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *e = strchr(s, ',');
+    if (e)
+    {
+        *e = '\0';
+        *p = e + 1;
+    }
+    else
+        *p = s + strlen(s);
+    for (char *t = s + strlen(s); t > s && (t[-1] == ' ' || t[-1] == '\n' || t[-1] == '\r'); t--)
+        t[-1] = '\0';
+    return s;
+}
+
+static int subtype_of(const char *type, const char *s)
+{
+    static const struct
+    {
+        const char *name;
+        int val;
+    } names[] = {{"factory", 0x00}, {"ota_0", 0x10}, {"ota_1", 0x11}, {"ota", 0x00},
+                 {"phy", 0x01},     {"nvs", 0x02},   {"coredump", 0x03}};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (strcmp(s, names[i].name) == 0)
+            return names[i].val;
+    return (int)strtol(s, NULL, 0);
+}
+
+static void table_load(void)
+{
+    n_parts = 0;
+    FILE *f = fopen(EVOLTE_PARTITIONS_CSV, "r");
+    if (f == NULL)
+        return;
+    char line[256];
+    uint32_t next = 0x9000; // After the partition table
+    while (fgets(line, sizeof(line), f) && n_parts < MAX_PARTS)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        char *p = line;
+        char *name = field(&p), *type = field(&p), *sub = field(&p), *off = field(&p), *size = field(&p);
+        fake_part_t *fp = &parts[n_parts++];
+        memset(fp, 0, sizeof(*fp));
+        snprintf(fp->part.label, sizeof(fp->part.label), "%s", name);
+        bool app = strcmp(type, "app") == 0;
+        fp->part.type = app ? ESP_PARTITION_TYPE_APP : ESP_PARTITION_TYPE_DATA;
+        fp->part.subtype = (esp_partition_subtype_t)subtype_of(type, sub);
+        uint32_t align = app ? 0x10000 : SECTOR;
+        fp->part.address = *off ? parse_size(off) : (next + align - 1) / align * align;
+        fp->part.size = parse_size(size);
+        fp->part.erase_size = SECTOR;
+        next = fp->part.address + fp->part.size;
+    }
+    fclose(f);
+}
+
+static fake_part_t *part_of(const esp_partition_t *p)
+{
+    fake_part_t *fp = (fake_part_t *)p;
+    if (fp->mem == NULL)
+    {
+        fp->mem = malloc(p->size);
+        fp->erases = calloc(p->size / SECTOR, sizeof(uint32_t));
+        memset(fp->mem, 0xFF, p->size);
+    }
+    return fp;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (n_parts < 0)
+        table_load();
+    for (int i = 0; i < n_parts; i++)
+    {
+        const esp_partition_t *p = &parts[i].part;
+        if ((type == ESP_PARTITION_TYPE_ANY || p->type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || p->subtype == subtype) &&
+            (label == NULL || strcmp(p->label, label) == 0))
+            return p;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, part_of(partition)->mem + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (dst_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *mem = part_of(partition)->mem + dst_offset;
+    const uint8_t *in = src;
+    for (size_t i = 0; i < size && powered; i++)
+    {
+        if (cut_budget == 0)
+        {
+            powered = false;
+            break;
+        }
+        mem[i] &= in[i];
+        if (cut_budget > 0)
+            cut_budget--;
+    }
+    return ESP_OK; // The writer never learns of the cut, the next boot does
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % SECTOR || size % SECTOR || offset + size > partition->size)
+        return ESP_ERR_INVALID_ARG;
+    fake_part_t *fp = part_of(partition);
+    if (!powered || cut_budget == 0)
+    {
+        powered = false;
+        return ESP_OK;
+    }
+    memset(fp->mem + offset, 0xFF, size);
+    for (size_t s = offset / SECTOR; s < (offset + size) / SECTOR; s++)
+        fp->erases[s]++;
+    return ESP_OK;
+}
+
+void fake_flash_cut_after(long bytes)
+{
+    cut_budget = bytes;
+    powered = true;
+}
+
+bool fake_flash_powered(void)
+{
+    return powered;
+}
+
+void fake_flash_wear(const char *label, uint32_t *min, uint32_t *max)
+{
+    fake_part_t *fp = part_of(esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, label));
+    *min = UINT32_MAX;
+    *max = 0;
+    for (uint32_t s = 0; s < fp->part.size / SECTOR; s++)
+    {
+        if (fp->erases[s] < *min)
+            *min = fp->erases[s];
+        if (fp->erases[s] > *max)
+            *max = fp->erases[s];
+    }
+}
+
+uint8_t *fake_flash_mem(const char *label)
+{
+    const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, label);
+    return p ? part_of(p)->mem : NULL;
+}
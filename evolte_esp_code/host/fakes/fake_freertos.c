@@ -0,0 +1,258 @@
+// Host fake of FreeRTOS tasks and direct-to-task notifications. Each task is
+// a thread, but a task only runs while the harness thread is parked in
+// fake_tasks_settle, so there is never more than one thread touching the
+// firmware at a time and tests see the same interleaving on every run.
+#include <pthread.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fake_hooks.h"
+#include "freertos/task.h"
+
+#define MAX_TASKS 48
+
+typedef struct
+{
+    TaskFunction_t fn;
+    void *param;
+    const char *name;
+    uint32_t stack_depth;
+    BaseType_t core_id;
+    UBaseType_t priority;
+    pthread_t thread;
+    bool started;
+    bool deleted;
+    bool waiting; // Blocked in ulTaskNotifyTake or vTaskDelay
+    bool delayed;
+    uint32_t wake_at;
+    uint32_t notify;
+} fake_task_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static fake_task_t tasks[MAX_TASKS];
+static int n_tasks;
+static bool running; // Harness lets tasks run
+static bool held;
+static __thread fake_task_t *current;
+static fake_task_t harness = {.name = "harness"};
+
+static void *task_entry(void *arg)
+{
+    fake_task_t *t = arg;
+    current = t;
+
+    pthread_mutex_lock(&lock);
+    while (!running)
+        pthread_cond_wait(&cond, &lock);
+    t->started = true;
+    t->waiting = false;
+    pthread_mutex_unlock(&lock);
+
+    t->fn(t->param);
+    fprintf(stderr, "fake task %s returned\n", t->name);
+    abort();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    if (n_tasks == MAX_TASKS)
+        return pdFALSE;
+
+    fake_task_t *t = &tasks[n_tasks++];
+    t->fn = fn;
+    t->param = param;
+    t->name = name;
+    t->stack_depth = stack_depth;
+    t->core_id = core_id;
+    t->priority = priority;
+    t->waiting = true;
+    if (pthread_create(&t->thread, NULL, task_entry, t) != 0)
+        return pdFALSE;
+    if (created_task)
+        *created_task = t;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    fake_task_t *t = current;
+    if (t == NULL)
+        return 0; // Not called from a fake task
+
+    pthread_mutex_lock(&lock);
+    t->waiting = true;
+    pthread_cond_broadcast(&cond);
+    while (!(running && t->notify > 0))
+        pthread_cond_wait(&cond, &lock);
+    t->waiting = false;
+
+    uint32_t n = t->notify;
+    t->notify = clear_on_exit ? 0 : n - 1;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    fake_task_t *t = task;
+    if (t == NULL)
+        return pdFALSE;
+    pthread_mutex_lock(&lock);
+    t->notify++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    return pdPASS;
+}
+
+// Interrupts are raised by the harness, between task runs
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_prio_woken)
+{
+    xTaskNotifyGive(task);
+    if (higher_prio_woken)
+        *higher_prio_woken = pdFALSE;
+}
+
+// Would this task run if the harness let it
+static bool task_ready(const fake_task_t *t)
+{
+    if (t->deleted)
+        return false;
+    if (!t->started || !t->waiting)
+        return true;
+    if (t->delayed)
+        return (int32_t)(fake_time_ms() - t->wake_at) >= 0;
+    return t->notify > 0;
+}
+
+static bool tasks_idle(void)
+{
+    for (int i = 0; i < n_tasks; i++)
+        if (task_ready(&tasks[i]))
+            return false;
+    return true;
+}
+
+bool fake_in_task(void)
+{
+    return current != NULL;
+}
+
+// From a task, block until the harness clock reaches the wake time
+void vTaskDelay(TickType_t ticks)
+{
+    fake_task_t *t = current;
+    if (t == NULL)
+    {
+        fake_time_advance_ms(ticks);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    t->wake_at = fake_time_ms() + ticks;
+    t->delayed = true;
+    t->waiting = true;
+    pthread_cond_broadcast(&cond);
+    while (!(running && task_ready(t)))
+        pthread_cond_wait(&cond, &lock);
+    t->delayed = false;
+    t->waiting = false;
+    pthread_mutex_unlock(&lock);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    fake_task_t *t = current;
+    if (task != NULL || t == NULL)
+    {
+        fprintf(stderr, "fake vTaskDelete only supports the calling task\n");
+        abort();
+    }
+    pthread_mutex_lock(&lock);
+    t->deleted = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_exit(NULL);
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    UBaseType_t n = 0;
+    for (int i = 0; i < n_tasks; i++)
+        n += !tasks[i].deleted;
+    return n;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *array, UBaseType_t size, configRUN_TIME_COUNTER_TYPE *total_run_time)
+{
+    if (size < uxTaskGetNumberOfTasks())
+        return 0;
+
+    UBaseType_t n = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < n_tasks; i++)
+    {
+        fake_task_t *t = &tasks[i];
+        if (t->deleted)
+            continue;
+        clockid_t clock;
+        struct timespec ts = {0};
+        if (pthread_getcpuclockid(t->thread, &clock) == 0)
+            clock_gettime(clock, &ts);
+        array[n++] = (TaskStatus_t){
+            .xHandle = t,
+            .pcTaskName = t->name,
+            .xTaskNumber = (UBaseType_t)i,
+            .eCurrentState = t == current ? eRunning : t->waiting ? eBlocked : eReady,
+            .uxCurrentPriority = t->priority,
+            .uxBasePriority = t->priority,
+            .ulRunTimeCounter = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000,
+            .usStackHighWaterMark = t->stack_depth,
+        };
+    }
+    pthread_mutex_unlock(&lock);
+    if (total_run_time)
+        *total_run_time = (uint64_t)fake_time_ms() * 1000;
+    return n;
+}
+
+BaseType_t xTaskGetCoreID(TaskHandle_t task)
+{
+    fake_task_t *t = task ? task : current;
+    return t ? t->core_id : 0;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current ? current : &harness;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return fake_time_ms();
+}
+
+void fake_tasks_settle(void)
+{
+    if (fake_in_task())
+        return; // A task cannot wait for itself
+
+    pthread_mutex_lock(&lock);
+    if (!held)
+    {
+        running = true;
+        pthread_cond_broadcast(&cond);
+        while (!tasks_idle())
+            pthread_cond_wait(&cond, &lock);
+        running = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void fake_tasks_hold(bool hold)
+{
+    pthread_mutex_lock(&lock);
+    held = hold;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,440 @@
+// Host fake of esp_http_server: handlers are registered in a table and
+// fake_http_request runs the matching one against an in-memory request.
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_http_server.h"
+#include "fake_hooks.h"
+#include "lwip/sockets.h"
+
+#define MAX_URIS 32
+#define MAX_SOCKS 16
+#define SOCK_BASE 1000 // Well clear of real descriptors
+#define SOCK_BUF 16384
+#define MAX_WORK 8
+
+static httpd_uri_t uris[MAX_URIS];
+static int n_uris;
+static int max_uris; // The server's max_uri_handlers, like the real one
+static int server_instance;
+static httpd_config_t server_config;
+
+// What the server sent on a socket and the peer has not read yet
+typedef struct
+{
+    bool open;
+    bool peer_closed;
+    uint32_t lru; // When it last sent a request, for lru_purge_enable
+    size_t window; // Receive buffer of the peer
+    size_t len;
+    char buf[SOCK_BUF];
+} fake_sock_t;
+
+static fake_sock_t socks[MAX_SOCKS];
+static uint32_t lru_clock;
+
+#define MAX_REQ_HDRS 4
+
+static struct
+{
+    const char *field;
+    const char *value;
+} req_hdrs[MAX_REQ_HDRS];
+static int n_req_hdrs;
+static size_t recv_max; // Next request only, 0 for no limit
+
+static struct
+{
+    httpd_work_fn_t fn;
+    void *arg;
+} work[MAX_WORK];
+static int n_work;
+
+typedef struct
+{
+    const char *body;
+    size_t len;
+    size_t off;
+    int fd;
+    fake_http_resp_t *resp;
+} fake_req_aux_t;
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    n_uris = 0;
+    server_config = *config;
+    max_uris = config->max_uri_handlers < MAX_URIS ? config->max_uri_handlers : MAX_URIS;
+    *handle = &server_instance;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    if (n_uris == max_uris)
+        return ESP_ERR_NO_MEM;
+    uris[n_uris++] = *uri_handler;
+    return ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    fake_req_aux_t *aux = r->aux;
+    size_t n = aux->len - aux->off;
+    if (n > buf_len)
+        n = buf_len;
+    if (recv_max != 0 && n > recv_max)
+        n = recv_max;
+    memcpy(buf, aux->body + aux->off, n);
+    aux->off += n;
+    return (int)n;
+}
+
+static esp_err_t copy_trunc(char *buf, size_t cap, const char *s, size_t len)
+{
+    if (cap == 0)
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    size_t n = len < cap - 1 ? len : cap - 1;
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+    return n < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *q = strchr(r->uri, '?');
+    if (q == NULL)
+        return ESP_ERR_NOT_FOUND;
+    return copy_trunc(buf, buf_len, q + 1, strlen(q + 1));
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t klen = strlen(key);
+    for (const char *p = qry; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL)
+    {
+        if (strncmp(p, key, klen) != 0 || p[klen] != '=')
+            continue;
+        const char *v = p + klen + 1;
+        return copy_trunc(val, val_size, v, strcspn(v, "&"));
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void fake_http_req_hdr(const char *field, const char *value)
+{
+    if (n_req_hdrs < MAX_REQ_HDRS)
+    {
+        req_hdrs[n_req_hdrs].field = field;
+        req_hdrs[n_req_hdrs].value = value;
+        n_req_hdrs++;
+    }
+}
+
+void fake_http_recv_max(size_t bytes)
+{
+    recv_max = bytes;
+}
+
+static const char *req_hdr(const char *field)
+{
+    for (int i = 0; i < n_req_hdrs; i++)
+        if (strcasecmp(req_hdrs[i].field, field) == 0)
+            return req_hdrs[i].value;
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    const char *v = req_hdr(field);
+    return v ? strlen(v) : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const char *v = req_hdr(field);
+    if (v == NULL)
+        return ESP_ERR_NOT_FOUND;
+    return copy_trunc(val, val_size, v, strlen(v));
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    fake_http_resp_t *resp = ((fake_req_aux_t *)r->aux)->resp;
+    size_t n = strlen(resp->hdrs);
+    snprintf(&resp->hdrs[n], sizeof(resp->hdrs) - n, "%s: %s\r\n", field, value);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((fake_req_aux_t *)r->aux)->resp->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    fake_http_resp_t *resp = ((fake_req_aux_t *)r->aux)->resp;
+    size_t len = buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len;
+    if (len > sizeof(resp->body))
+        len = sizeof(resp->body);
+    if (len)
+        memcpy(resp->body, buf, len);
+    resp->len = len;
+    return ESP_OK;
+}
+
+// Chunks are appended to the body, the empty one ending the response adds
+// nothing
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    fake_http_resp_t *resp = ((fake_req_aux_t *)r->aux)->resp;
+    if (buf == NULL)
+        return ESP_OK;
+    size_t len = buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len;
+    if (len > sizeof(resp->body) - resp->len)
+        len = sizeof(resp->body) - resp->len;
+    memcpy(&resp->body[resp->len], buf, len);
+    resp->len += len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str)
+{
+    return httpd_resp_send(r, str, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((fake_req_aux_t *)r->aux)->resp->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg)
+{
+    static const char *const status[] = {
+        [HTTPD_400_BAD_REQUEST] = "400 Bad Request",
+        [HTTPD_404_NOT_FOUND] = "404 Not Found",
+        [HTTPD_408_REQ_TIMEOUT] = "408 Request Timeout",
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = "500 Internal Server Error",
+    };
+    httpd_resp_set_status(r, status[error]);
+    httpd_resp_set_type(r, "text/plain");
+    return httpd_resp_sendstr(r, msg);
+}
+
+static esp_err_t run_request(httpd_method_t method, const char *uri, const char *body, size_t len, int fd,
+                             fake_http_resp_t *resp)
+{
+    for (int i = 0; i < n_uris; i++)
+    {
+        // Like httpd_uri_match_simple, the query is not part of the match
+        size_t path_len = strcspn(uri, "?");
+        if (uris[i].method != method || strlen(uris[i].uri) != path_len || strncmp(uris[i].uri, uri, path_len) != 0)
+            continue;
+
+        fake_req_aux_t aux = {.body = body, .len = len, .fd = fd, .resp = resp};
+        httpd_req_t req = {.handle = &server_instance, .method = method, .content_len = len,
+                           .aux = &aux, .user_ctx = uris[i].user_ctx};
+        snprintf((char *)req.uri, sizeof(req.uri), "%s", uri);
+        resp->status = "200 OK";
+        resp->type = "text/html";
+        resp->len = 0;
+        resp->hdrs[0] = '\0';
+        esp_err_t rc = uris[i].handler(&req);
+        n_req_hdrs = 0;
+        recv_max = 0;
+        fake_host_run();
+        return rc;
+    }
+    n_req_hdrs = 0;
+    recv_max = 0;
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t fake_http_request(httpd_method_t method, const char *uri, const char *body, size_t len,
+                            fake_http_resp_t *resp)
+{
+    return run_request(method, uri, body, len, -1, resp);
+}
+
+// ---- Sockets ----
+
+static fake_sock_t *sock_get(int fd)
+{
+    int i = fd - SOCK_BASE;
+    return i >= 0 && i < MAX_SOCKS && socks[i].open ? &socks[i] : NULL;
+}
+
+// A new connection, like the server's accept: refused once
+// max_open_sockets are open, unless lru_purge_enable closes the socket
+// that sent a request least recently. Returns the slot, -1 if refused.
+static int sock_accept(void)
+{
+    int n = 0, oldest = -1, free = -1;
+    for (int i = 0; i < MAX_SOCKS; i++)
+    {
+        if (!socks[i].open)
+        {
+            if (free < 0)
+                free = i;
+            continue;
+        }
+        n++;
+        if (oldest < 0 || socks[i].lru < socks[oldest].lru)
+            oldest = i;
+    }
+    if (n >= server_config.max_open_sockets)
+    {
+        if (!server_config.lru_purge_enable || oldest < 0)
+            return -1;
+        httpd_sess_trigger_close(&server_instance, SOCK_BASE + oldest);
+        free = oldest;
+    }
+    if (free < 0)
+        return -1;
+    memset(&socks[free], 0, sizeof(socks[free]));
+    socks[free].open = true;
+    socks[free].window = SOCK_BUF;
+    socks[free].lru = ++lru_clock;
+    return free;
+}
+
+int fake_http_stream(const char *uri, fake_http_resp_t *resp)
+{
+    int i = sock_accept();
+    if (i < 0)
+        return -1;
+    if (run_request(HTTP_GET, uri, NULL, 0, SOCK_BASE + i, resp) != ESP_OK)
+    {
+        socks[i].open = false;
+        return -1;
+    }
+    return SOCK_BASE + i;
+}
+
+int fake_http_connect(void)
+{
+    int i = sock_accept();
+    return i < 0 ? -1 : SOCK_BASE + i;
+}
+
+esp_err_t fake_http_request_on(int fd, httpd_method_t method, const char *uri, const char *body, size_t len,
+                               fake_http_resp_t *resp)
+{
+    fake_sock_t *s = sock_get(fd);
+    if (s == NULL)
+        return ESP_ERR_INVALID_STATE;
+    s->lru = ++lru_clock;
+    return run_request(method, uri, body, len, fd, resp);
+}
+
+size_t fake_sock_read(int fd, char *buf, size_t cap)
+{
+    fake_sock_t *s = &socks[fd - SOCK_BASE];
+    size_t n = s->len < cap - 1 ? s->len : cap - 1;
+    memcpy(buf, s->buf, n);
+    memmove(s->buf, s->buf + n, s->len - n);
+    s->len -= n;
+    buf[n] = '\0';
+    return n;
+}
+
+void fake_sock_set_window(int fd, size_t bytes)
+{
+    socks[fd - SOCK_BASE].window = bytes < SOCK_BUF ? bytes : SOCK_BUF;
+}
+
+bool fake_sock_is_open(int fd)
+{
+    return sock_get(fd) != NULL;
+}
+
+// The server notices the peer went away and ends the session
+void fake_sock_peer_close(int fd)
+{
+    fake_sock_t *s = sock_get(fd);
+    if (s == NULL)
+        return;
+    s->peer_closed = true;
+    httpd_sess_trigger_close(&server_instance, fd);
+    fake_host_run();
+}
+
+ssize_t fake_sock_send(int fd, const void *buf, size_t len, int flags)
+{
+    fake_sock_t *s = sock_get(fd);
+    if (s == NULL || s->peer_closed)
+    {
+        errno = s ? ECONNRESET : EBADF;
+        return -1;
+    }
+    size_t room = s->window > s->len ? s->window - s->len : 0;
+    if (room == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = len < room ? len : room;
+    memcpy(s->buf + s->len, buf, n);
+    s->len += n;
+    return (ssize_t)n;
+}
+
+int fake_sock_server_close(int fd)
+{
+    fake_sock_t *s = sock_get(fd);
+    if (s == NULL)
+        return -1;
+    s->open = false;
+    return 0;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return ((fake_req_aux_t *)r->aux)->fd;
+}
+
+// Blocking send, the peer always makes room eventually
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    fake_sock_t *s = sock_get(sockfd);
+    if (s == NULL || s->peer_closed || s->len + buf_len > SOCK_BUF)
+        return HTTPD_SOCK_ERR_FAIL;
+    memcpy(s->buf + s->len, buf, buf_len);
+    s->len += buf_len;
+    return (int)buf_len;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    if (sock_get(sockfd) == NULL)
+        return ESP_ERR_NOT_FOUND;
+    if (server_config.close_fn)
+        server_config.close_fn(handle, sockfd);
+    else
+        fake_sock_server_close(sockfd);
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t fn, void *arg)
+{
+    if (n_work == MAX_WORK)
+        return ESP_FAIL;
+    work[n_work].fn = fn;
+    work[n_work].arg = arg;
+    n_work++;
+    return ESP_OK;
+}
+
+bool fake_httpd_run_work(void)
+{
+    if (n_work == 0)
+        return false;
+    httpd_work_fn_t fn = work[0].fn;
+    void *arg = work[0].arg;
+    memmove(&work[0], &work[1], sizeof(work[0]) * (size_t)--n_work);
+    fn(arg);
+    return true;
+}
@@ -0,0 +1,430 @@
+// Host fakes of the small ESP-IDF services the firmware touches: logging,
+// esp_timer, GPIO, Wi-Fi, netif and the default event loop.
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/gpio.h"
+#include "esp_app_desc.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_netif_sntp.h"
+#include "esp_now.h"
+#include "esp_rom_sys.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "fake_hooks.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nimble/nimble_npl.h"
+
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+
+// ---- Logging ----
+
+static bool log_enabled(void)
+{
+    static int enabled = -1;
+    if (enabled < 0)
+        enabled = getenv("EVOLTE_FAKE_LOG") != NULL;
+    return enabled;
+}
+
+void fake_log(char level, const char *tag, const char *fmt, ...)
+{
+    if (!log_enabled())
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%c (%u) %s: ", level, fake_time_ms(), tag);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+int esp_rom_printf(const char *fmt, ...)
+{
+    if (!log_enabled())
+        return 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+// ---- App description / timer ----
+
+static const esp_app_desc_t app_desc = {
+    .magic_word = 0xABCD5432,
+    .version = "1.0.0-host",
+    .project_name = "BLE-Connect",
+};
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    return &app_desc;
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+static unsigned long restarts;
+
+void esp_restart(void)
+{
+    restarts++;
+}
+
+#define FAKE_HEAP_FREE (160 * 1024)
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return FAKE_HEAP_FREE;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return FAKE_HEAP_FREE;
+}
+
+unsigned long fake_restarts(void)
+{
+    return restarts;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)fake_time_ms() * 1000;
+}
+
+#define MAX_TIMERS 16
+
+// Timers ride on the porting layer callouts of the NimBLE fake
+struct esp_timer
+{
+    struct ble_npl_callout co;
+    esp_timer_cb_t cb;
+    void *arg;
+    uint32_t period_ms;
+};
+
+static struct esp_timer timers[MAX_TIMERS];
+static int n_timers;
+
+static uint32_t us_to_ms(uint64_t us)
+{
+    return (uint32_t)((us + 999) / 1000);
+}
+
+static void timer_fire(struct ble_npl_event *ev)
+{
+    struct esp_timer *t = ble_npl_event_get_arg(ev);
+    if (t->period_ms)
+        ble_npl_callout_reset(&t->co, t->period_ms);
+    t->cb(t->arg);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (n_timers == MAX_TIMERS)
+        return ESP_ERR_NO_MEM;
+    struct esp_timer *t = &timers[n_timers++];
+    t->cb = create_args->callback;
+    t->arg = create_args->arg;
+    ble_npl_callout_init(&t->co, NULL, timer_fire, t);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (ble_npl_callout_is_active(&timer->co))
+        return ESP_ERR_INVALID_STATE;
+    timer->period_ms = 0;
+    ble_npl_callout_reset(&timer->co, us_to_ms(timeout_us));
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (ble_npl_callout_is_active(&timer->co))
+        return ESP_ERR_INVALID_STATE;
+    timer->period_ms = us_to_ms(period);
+    ble_npl_callout_reset(&timer->co, timer->period_ms);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!ble_npl_callout_is_active(&timer->co))
+        return ESP_ERR_INVALID_STATE;
+    ble_npl_callout_stop(&timer->co);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    ble_npl_callout_stop(&timer->co);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return ble_npl_callout_is_active(&timer->co);
+}
+
+// ---- FreeRTOS semaphores ----
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    static int mutexes;
+    return &mutexes;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return pdTRUE;
+}
+
+// ---- GPIO ----
+
+#define GPIO_COUNT 40
+
+static int gpio_levels[GPIO_COUNT];
+static unsigned long gpio_writes;
+static bool gpio_failing[GPIO_COUNT];
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_COUNT)
+        return ESP_ERR_INVALID_ARG;
+    if (gpio_failing[gpio_num])
+        return ESP_FAIL;
+    gpio_levels[gpio_num] = level ? 1 : 0;
+    gpio_writes++;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return (gpio_num < 0 || gpio_num >= GPIO_COUNT) ? 0 : gpio_levels[gpio_num];
+}
+
+int fake_gpio_get(int pin)
+{
+    return gpio_get_level(pin);
+}
+
+unsigned long fake_gpio_writes(void)
+{
+    return gpio_writes;
+}
+
+void fake_gpio_fail(int pin, bool fail)
+{
+    gpio_failing[pin] = fail;
+}
+
+// ---- Event loop ----
+
+#define MAX_HANDLERS 8
+
+static struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t fn;
+    void *arg;
+} handlers[MAX_HANDLERS];
+static int n_handlers;
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+                                              esp_event_handler_t event_handler, void *event_handler_arg,
+                                              esp_event_handler_instance_t *instance)
+{
+    if (n_handlers == MAX_HANDLERS)
+        return ESP_ERR_NO_MEM;
+    handlers[n_handlers].base = event_base;
+    handlers[n_handlers].id = event_id;
+    handlers[n_handlers].fn = event_handler;
+    handlers[n_handlers].arg = event_handler_arg;
+    if (instance)
+        *instance = &handlers[n_handlers];
+    n_handlers++;
+    return ESP_OK;
+}
+
+void fake_event_post(esp_event_base_t base, int32_t id, void *data)
+{
+    for (int i = 0; i < n_handlers; i++)
+        if (handlers[i].base == base && (handlers[i].id == id || handlers[i].id == ESP_EVENT_ANY_ID))
+            handlers[i].fn(handlers[i].arg, base, id, data);
+}
+
+// ---- Wi-Fi / netif ----
+
+static wifi_config_t sta_config;
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    return NULL;
+}
+
+static esp_sntp_config_t sntp_config;
+
+esp_err_t esp_netif_sntp_init(const esp_sntp_config_t *config)
+{
+    sntp_config = *config;
+    return ESP_OK;
+}
+
+const char *fake_sntp_server(void)
+{
+    return sntp_config.num_of_servers ? sntp_config.servers[0] : NULL;
+}
+
+void fake_sntp_sync(int64_t unix_us)
+{
+    struct timeval tv = {.tv_sec = (time_t)(unix_us / 1000000), .tv_usec = (suseconds_t)(unix_us % 1000000)};
+    if (sntp_config.sync_cb)
+        sntp_config.sync_cb(&tv);
+    fake_host_run();
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    sta_config = *conf;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    return ESP_OK;
+}
+
+const char *fake_wifi_ssid(void)
+{
+    return (const char *)sta_config.sta.ssid;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6])
+{
+    static const uint8_t sta_mac[6] = {0x24, 0x0A, 0xC4, 0x12, 0x34, 0x56};
+    memcpy(mac, sta_mac, sizeof(sta_mac));
+    mac[5] += ifx;
+    return ESP_OK;
+}
+
+// ---- ESP-NOW ----
+
+static bool espnow_up;
+static esp_now_recv_cb_t espnow_recv;
+static uint8_t espnow_peer[ESP_NOW_ETH_ALEN];
+static bool espnow_has_peer;
+static uint8_t espnow_last[ESP_NOW_MAX_DATA_LEN];
+static size_t espnow_last_len;
+static unsigned long espnow_sends;
+
+esp_err_t esp_now_init(void)
+{
+    espnow_up = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+    if (!espnow_up)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    espnow_recv = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+    if (!espnow_up)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    memcpy(espnow_peer, peer->peer_addr, sizeof(espnow_peer));
+    espnow_has_peer = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+    if (!espnow_up)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    if (!espnow_has_peer || memcmp(peer_addr, espnow_peer, sizeof(espnow_peer)) != 0)
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    if (len > ESP_NOW_MAX_DATA_LEN)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(espnow_last, data, len);
+    espnow_last_len = len;
+    espnow_sends++;
+    return ESP_OK;
+}
+
+unsigned long fake_espnow_sent(uint8_t *buf, size_t cap, size_t *len)
+{
+    size_t n = espnow_last_len < cap ? espnow_last_len : cap;
+    memcpy(buf, espnow_last, n);
+    *len = n;
+    return espnow_sends;
+}
+
+void fake_espnow_recv(const uint8_t mac[6], const uint8_t *data, size_t len)
+{
+    uint8_t src[ESP_NOW_ETH_ALEN], dst[ESP_NOW_ETH_ALEN];
+    memcpy(src, mac, sizeof(src));
+    memset(dst, 0xFF, sizeof(dst));
+    wifi_pkt_rx_ctrl_t rx = {.rssi = -60};
+    esp_now_recv_info_t info = {.src_addr = src, .des_addr = dst, .rx_ctrl = &rx};
+    if (espnow_recv)
+        espnow_recv(&info, data, (int)len);
+}
@@ -0,0 +1,823 @@
+// Host fake of the NimBLE host: mbuf pool, GATT table registration and access,
+// GAP advertising state and the porting layer clock and callouts.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fake_hooks.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "os/os_mempool.h"
+#include "sdkconfig.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+
+struct ble_hs_cfg ble_hs_cfg;
+
+// ---- Clock and callouts ----
+
+static ble_npl_time_t now_ticks;
+static void link_tick(void);
+static struct ble_npl_callout *callouts;
+static struct ble_npl_eventq dflt_eventq;
+static pthread_mutex_t evq_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ble_npl_event *evq_head, *evq_tail;
+
+ble_npl_time_t ble_npl_time_get(void)
+{
+    return now_ticks;
+}
+
+ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms)
+{
+    return ms;
+}
+
+uint32_t ble_npl_time_ticks_to_ms32(ble_npl_time_t ticks)
+{
+    return ticks;
+}
+
+uint32_t fake_time_ms(void)
+{
+    return now_ticks;
+}
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->fn = fn;
+    ev->arg = arg;
+}
+
+// Like the FreeRTOS port, putting an event that is already queued is a no-op
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    pthread_mutex_lock(&evq_lock);
+    if (!ev->queued)
+    {
+        ev->queued = true;
+        ev->next = NULL;
+        if (evq_tail)
+            evq_tail->next = ev;
+        else
+            evq_head = ev;
+        evq_tail = ev;
+    }
+    pthread_mutex_unlock(&evq_lock);
+}
+
+static struct ble_npl_event *eventq_get(void)
+{
+    pthread_mutex_lock(&evq_lock);
+    struct ble_npl_event *ev = evq_head;
+    if (ev)
+    {
+        evq_head = ev->next;
+        if (evq_head == NULL)
+            evq_tail = NULL;
+        ev->queued = false;
+    }
+    pthread_mutex_unlock(&evq_lock);
+    return ev;
+}
+
+void fake_host_run(void)
+{
+    if (fake_in_task())
+        return;
+    for (;;)
+    {
+        fake_tasks_settle();
+        struct ble_npl_event *ev = eventq_get();
+        if (ev != NULL)
+            ev->fn(ev);
+        else if (!fake_httpd_run_work())
+            break;
+    }
+}
+
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq,
+                          ble_npl_event_fn *ev_cb, void *ev_arg)
+{
+    memset(co, 0, sizeof(*co));
+    co->ev.fn = ev_cb;
+    co->ev.arg = ev_arg;
+}
+
+ble_npl_error_t ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks)
+{
+    if (!co->armed)
+    {
+        co->next = callouts;
+        callouts = co;
+    }
+    co->armed = true;
+    co->expiry = now_ticks + ticks;
+    return BLE_NPL_OK;
+}
+
+void ble_npl_callout_stop(struct ble_npl_callout *co)
+{
+    for (struct ble_npl_callout **p = &callouts; *p; p = &(*p)->next)
+        if (*p == co)
+        {
+            *p = co->next;
+            break;
+        }
+    co->armed = false;
+}
+
+bool ble_npl_callout_is_active(struct ble_npl_callout *co)
+{
+    return co->armed;
+}
+
+// Run the earliest callout that is due, returns false when none is
+static bool run_due_callout(void)
+{
+    struct ble_npl_callout *due = NULL;
+    for (struct ble_npl_callout *co = callouts; co; co = co->next)
+        if ((ble_npl_stime_t)(co->expiry - now_ticks) <= 0 &&
+            (due == NULL || (ble_npl_stime_t)(co->expiry - due->expiry) < 0))
+            due = co;
+    if (due == NULL)
+        return false;
+    ble_npl_callout_stop(due);
+    due->ev.fn(&due->ev);
+    fake_host_run();
+    return true;
+}
+
+void fake_time_advance_ms(uint32_t ms)
+{
+    fake_host_run();
+    while (run_due_callout())
+        ;
+    for (uint32_t i = 0; i < ms; i++)
+    {
+        now_ticks++;
+        link_tick();
+        fake_host_run();
+        while (run_due_callout())
+            ;
+    }
+}
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void)
+{
+    return &dflt_eventq;
+}
+
+esp_err_t nimble_port_init(void)
+{
+    return ESP_OK;
+}
+
+void nimble_port_run(void)
+{
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn)
+{
+    if (ble_hs_cfg.sync_cb)
+        ble_hs_cfg.sync_cb();
+}
+
+// ---- Mbufs ----
+
+#define MSYS_COUNT (CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT + CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT)
+
+static struct os_mbuf msys[MSYS_COUNT];
+static bool msys_used[MSYS_COUNT];
+static unsigned long mbuf_allocs;
+
+struct os_mempool
+{
+    const char *name;
+    int first, count, block_size;
+    int min_free;
+};
+
+static struct os_mempool msys_pools[] = {
+    {"msys_1", 0, CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT, CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE,
+     CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT},
+    {"msys_2", CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT, CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT,
+     CONFIG_BT_NIMBLE_MSYS_2_BLOCK_SIZE, CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT},
+};
+
+static int pool_free(const struct os_mempool *mp)
+{
+    int n = 0;
+    for (int i = mp->first; i < mp->first + mp->count; i++)
+        n += !msys_used[i];
+    return n;
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+    for (int i = 0; i < MSYS_COUNT; i++)
+        if (!msys_used[i])
+        {
+            msys_used[i] = true;
+            msys[i].om_data = msys[i].om_buf;
+            msys[i].om_len = 0;
+            msys[i].om_pkt_len = 0;
+            msys[i].om_next = NULL;
+            mbuf_allocs++;
+            struct os_mempool *mp = &msys_pools[i < CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT ? 0 : 1];
+            int free = pool_free(mp);
+            if (free < mp->min_free)
+                mp->min_free = free;
+            return &msys[i];
+        }
+    return NULL;
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om)
+{
+    if (om)
+        msys_used[om - msys] = false;
+    return 0;
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    if ((size_t)om->om_len + len > sizeof(om->om_buf))
+        return BLE_HS_ENOMEM;
+    memcpy(&om->om_data[om->om_len], data, len);
+    om->om_len += len;
+    om->om_pkt_len += len;
+    return 0;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    if (off < 0 || len < 0 || off + len > om->om_len)
+        return -1;
+    memcpy(dst, &om->om_data[off], len);
+    return 0;
+}
+
+int os_msys_count(void)
+{
+    return MSYS_COUNT;
+}
+
+int os_msys_num_free(void)
+{
+    int n = 0;
+    for (int i = 0; i < MSYS_COUNT; i++)
+        n += !msys_used[i];
+    return n;
+}
+
+struct os_mempool *os_mempool_info_get_next(struct os_mempool *mp, struct os_mempool_info *omi)
+{
+    size_t i = mp ? (size_t)(mp - msys_pools) + 1 : 0;
+    if (i >= sizeof(msys_pools) / sizeof(msys_pools[0]))
+        return NULL;
+    mp = &msys_pools[i];
+    omi->omi_block_size = mp->block_size;
+    omi->omi_num_blocks = mp->count;
+    omi->omi_num_free = pool_free(mp);
+    omi->omi_min_free = mp->min_free;
+    snprintf(omi->omi_name, sizeof(omi->omi_name), "%s", mp->name);
+    return mp;
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    struct os_mbuf *om = os_msys_get_pkthdr(0, 0);
+    if (om && os_mbuf_append(om, buf, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
+    return om;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t n = om->om_len < max_len ? om->om_len : max_len;
+    memcpy(flat, om->om_data, n);
+    if (out_copy_len)
+        *out_copy_len = n;
+    return n < om->om_len ? BLE_HS_EMSGSIZE : 0;
+}
+
+// ---- UUIDs ----
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2)
+{
+    return (int)ble_uuid_u16(uuid1) - (int)ble_uuid_u16(uuid2);
+}
+
+uint16_t ble_uuid_u16(const ble_uuid_t *uuid)
+{
+    return uuid->type == BLE_UUID_TYPE_16 ? ((const ble_uuid16_t *)uuid)->value : 0;
+}
+
+// ---- GATT server ----
+
+#define MAX_SVC_TABLES 4
+
+static const struct ble_gatt_svc_def *svc_tables[MAX_SVC_TABLES];
+static int n_svc_tables;
+static uint16_t next_handle = 1;
+
+static fake_gatt_tx_t last_tx;
+static unsigned long tx_count;
+
+// Sent notifications, oldest dropped when the harness does not keep up
+#define TX_LOG_LEN 256
+static fake_gatt_tx_t tx_log[TX_LOG_LEN];
+static unsigned long tx_log_head, tx_log_tail;
+
+// Radio model: packets waiting for a connection event, holding their mbufs
+#define LINK_QUEUE_LEN MSYS_COUNT
+static uint32_t link_interval_ms;
+static int link_per_event;
+static struct
+{
+    uint16_t conn_handle;
+    uint16_t att_handle;
+    bool indication;
+    struct os_mbuf *om;
+} link_queue[LINK_QUEUE_LEN];
+static int link_len;
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs)
+{
+    return 0;
+}
+
+// Assign handles in declaration order like NimBLE does: service, then for
+// each characteristic a declaration and a value handle (plus a CCCD)
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs)
+{
+    if (n_svc_tables == MAX_SVC_TABLES)
+        return BLE_HS_ENOMEM;
+    svc_tables[n_svc_tables++] = svcs;
+
+    for (const struct ble_gatt_svc_def *s = svcs; s->type != BLE_GATT_SVC_TYPE_END; s++)
+    {
+        next_handle++;
+        for (const struct ble_gatt_chr_def *c = s->characteristics; c && c->uuid; c++)
+        {
+            next_handle++;
+            if (c->val_handle)
+                *c->val_handle = next_handle;
+            next_handle++;
+            if (c->flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE))
+                next_handle++;
+        }
+    }
+    return 0;
+}
+
+static const struct ble_gatt_chr_def *chr_find(uint16_t uuid16)
+{
+    for (int t = 0; t < n_svc_tables; t++)
+        for (const struct ble_gatt_svc_def *s = svc_tables[t]; s->type != BLE_GATT_SVC_TYPE_END; s++)
+            for (const struct ble_gatt_chr_def *c = s->characteristics; c && c->uuid; c++)
+                if (ble_uuid_u16(c->uuid) == uuid16)
+                    return c;
+    return NULL;
+}
+
+uint16_t fake_gatt_val_handle(uint16_t uuid16)
+{
+    const struct ble_gatt_chr_def *c = chr_find(uuid16);
+    return c && c->val_handle ? *c->val_handle : 0;
+}
+
+int fake_gatt_write(uint16_t conn_handle, uint16_t uuid16, const void *data, size_t len)
+{
+    const struct ble_gatt_chr_def *c = chr_find(uuid16);
+    if (c == NULL || !(c->flags & (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP)))
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, (uint16_t)len);
+    if (om == NULL)
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_WRITE_CHR, .om = om, .chr = c};
+    int rc = c->access_cb(conn_handle, c->val_handle ? *c->val_handle : 0, &ctxt, c->arg);
+    os_mbuf_free_chain(om);
+    fake_host_run();
+    return rc;
+}
+
+int fake_gatt_read(uint16_t conn_handle, uint16_t uuid16, void *out, size_t cap, size_t *out_len)
+{
+    const struct ble_gatt_chr_def *c = chr_find(uuid16);
+    if (c == NULL || !(c->flags & BLE_GATT_CHR_F_READ))
+        return BLE_ATT_ERR_READ_NOT_PERMITTED;
+
+    struct os_mbuf *om = os_msys_get_pkthdr(0, 0);
+    if (om == NULL)
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_READ_CHR, .om = om, .chr = c};
+    int rc = c->access_cb(conn_handle, c->val_handle ? *c->val_handle : 0, &ctxt, c->arg);
+    if (rc == 0)
+    {
+        size_t n = om->om_len < cap ? om->om_len : cap;
+        memcpy(out, om->om_data, n);
+        if (out_len)
+            *out_len = n;
+    }
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+static void tx_done(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om, bool indication)
+{
+    last_tx.conn_handle = conn_handle;
+    last_tx.attr_handle = att_handle;
+    last_tx.indication = indication;
+    last_tx.len = om->om_len;
+    memcpy(last_tx.data, om->om_data, om->om_len);
+    tx_count++;
+    os_mbuf_free_chain(om);
+
+    if (tx_log_head - tx_log_tail == TX_LOG_LEN)
+        tx_log_tail++;
+    tx_log[tx_log_head++ % TX_LOG_LEN] = last_tx;
+}
+
+static int gatts_tx(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om, bool indication)
+{
+    if (link_interval_ms == 0)
+    {
+        tx_done(conn_handle, att_handle, om, indication);
+        return 0;
+    }
+    if (link_len == LINK_QUEUE_LEN)
+    {
+        os_mbuf_free_chain(om);
+        return BLE_HS_ENOMEM;
+    }
+    link_queue[link_len].conn_handle = conn_handle;
+    link_queue[link_len].att_handle = att_handle;
+    link_queue[link_len].indication = indication;
+    link_queue[link_len].om = om;
+    link_len++;
+    return 0;
+}
+
+// A connection event: the oldest queued packets go out
+static void link_tick(void)
+{
+    if (link_interval_ms == 0 || now_ticks % link_interval_ms != 0)
+        return;
+    int n = link_len < link_per_event ? link_len : link_per_event;
+    for (int i = 0; i < n; i++)
+        tx_done(link_queue[i].conn_handle, link_queue[i].att_handle, link_queue[i].om, link_queue[i].indication);
+    memmove(link_queue, &link_queue[n], (size_t)(link_len - n) * sizeof(link_queue[0]));
+    link_len -= n;
+}
+
+// Packets still queued for a connection that went away are never sent
+static void link_drop(uint16_t conn_handle)
+{
+    int n = 0;
+    for (int i = 0; i < link_len; i++)
+        if (link_queue[i].conn_handle == conn_handle)
+            os_mbuf_free_chain(link_queue[i].om);
+        else
+            link_queue[n++] = link_queue[i];
+    link_len = n;
+}
+
+void fake_gatt_link(uint32_t interval_ms, int per_event)
+{
+    link_interval_ms = interval_ms;
+    link_per_event = per_event;
+}
+
+bool fake_gatt_tx_pop(fake_gatt_tx_t *out)
+{
+    if (tx_log_tail == tx_log_head)
+        return false;
+    *out = tx_log[tx_log_tail++ % TX_LOG_LEN];
+    return true;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om)
+{
+    return gatts_tx(conn_handle, att_handle, om, false);
+}
+
+int ble_gatts_indicate_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *om)
+{
+    return gatts_tx(conn_handle, chr_val_handle, om, true);
+}
+
+void ble_gatts_chr_updated(uint16_t chr_val_handle)
+{
+}
+
+unsigned long fake_gatt_tx_count(void)
+{
+    return tx_count;
+}
+
+const fake_gatt_tx_t *fake_gatt_tx_last(void)
+{
+    return &last_tx;
+}
+
+// ---- GAP ----
+
+static ble_gap_event_fn *gap_cb;
+static void *gap_cb_arg;
+static bool adv_active;
+static unsigned long adv_starts;
+static char device_name[CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN + 1] = CONFIG_BT_NIMBLE_SVC_GAP_DEVICE_NAME;
+
+#define MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+static struct ble_gap_conn_desc conns[MAX_CONNS];
+static bool conn_used[MAX_CONNS];
+
+// Parameter updates the peripheral asked for finish on the host task later,
+// like the real procedure, with what the central made of them
+static struct ble_npl_event conn_upd_ev[MAX_CONNS];
+static struct ble_gap_upd_params conn_upd_req[MAX_CONNS];
+static bool conn_upd_pending[MAX_CONNS];
+static bool conn_upd_reject;
+static uint16_t central_itvl_min = 6, central_itvl_max = 3200;
+static unsigned long conn_upd_requests;
+
+static uint8_t adv_mfg[BLE_HS_ADV_MAX_SZ];
+static size_t adv_mfg_len;
+static char adv_name[BLE_HS_ADV_MAX_SZ];
+static unsigned long adv_sets;
+
+// Bytes the fields take in an advertising PDU, each AD structure carries a
+// length and a type byte
+static size_t adv_fields_len(const struct ble_hs_adv_fields *f)
+{
+    return (f->flags ? 3 : 0) + (f->name ? 2 + f->name_len : 0) + (f->tx_pwr_lvl_is_present ? 3 : 0) +
+           (f->mfg_data ? 2 + f->mfg_data_len : 0);
+}
+
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *adv_fields)
+{
+    if (adv_fields_len(adv_fields) > BLE_HS_ADV_MAX_SZ)
+        return BLE_HS_EMSGSIZE;
+    adv_mfg_len = adv_fields->mfg_data ? adv_fields->mfg_data_len : 0;
+    if (adv_mfg_len)
+        memcpy(adv_mfg, adv_fields->mfg_data, adv_mfg_len);
+    adv_sets++;
+    return 0;
+}
+
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields)
+{
+    if (adv_fields_len(rsp_fields) > BLE_HS_ADV_MAX_SZ)
+        return BLE_HS_EMSGSIZE;
+    size_t n = rsp_fields->name ? rsp_fields->name_len : 0;
+    if (n)
+        memcpy(adv_name, rsp_fields->name, n);
+    adv_name[n] = '\0';
+    return 0;
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg)
+{
+    if (adv_active)
+        return BLE_HS_EALREADY;
+    gap_cb = cb;
+    gap_cb_arg = cb_arg;
+    adv_active = true;
+    adv_starts++;
+    return 0;
+}
+
+int ble_gap_adv_stop(void)
+{
+    if (!adv_active)
+        return BLE_HS_EALREADY;
+    adv_active = false;
+    return 0;
+}
+
+int ble_gap_adv_active(void)
+{
+    return adv_active;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+        if (conn_used[i] && conns[i].conn_handle == handle)
+        {
+            if (out_desc)
+                *out_desc = conns[i];
+            return 0;
+        }
+    return BLE_HS_ENOTCONN;
+}
+
+static void conn_upd_cb(struct ble_npl_event *ev)
+{
+    int i = (int)(intptr_t)ev->arg;
+    if (!conn_upd_pending[i])
+        return;
+    conn_upd_pending[i] = false;
+    struct ble_gap_event gev = {.type = BLE_GAP_EVENT_CONN_UPDATE};
+    gev.conn_update.conn_handle = conns[i].conn_handle;
+    gev.conn_update.status = conn_upd_reject ? BLE_HS_EREJECT : 0;
+    if (!conn_upd_reject)
+    {
+        // The central takes the longest interval asked for that it allows
+        const struct ble_gap_upd_params *p = &conn_upd_req[i];
+        uint16_t itvl = p->itvl_max < central_itvl_max ? p->itvl_max : central_itvl_max;
+        conns[i].conn_itvl = itvl > central_itvl_min ? itvl : central_itvl_min;
+        conns[i].conn_latency = p->latency;
+        conns[i].supervision_timeout = p->supervision_timeout;
+    }
+    fake_gap_event(&gev);
+}
+
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+        if (conn_used[i] && conns[i].conn_handle == conn_handle)
+        {
+            if (conn_upd_pending[i])
+                return BLE_HS_EALREADY;
+            if (params->itvl_min > params->itvl_max || params->itvl_min < 6 || params->itvl_max > 3200 ||
+                params->supervision_timeout * 10 <= (1 + params->latency) * params->itvl_max * 5 / 4 * 2)
+                return BLE_HS_EINVAL;
+            conn_upd_requests++;
+            conn_upd_req[i] = *params;
+            conn_upd_pending[i] = true;
+            if (conn_upd_ev[i].fn == NULL)
+                ble_npl_event_init(&conn_upd_ev[i], conn_upd_cb, (void *)(intptr_t)i);
+            ble_npl_eventq_put(&dflt_eventq, &conn_upd_ev[i]);
+            return 0;
+        }
+    return BLE_HS_ENOTCONN;
+}
+
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason)
+{
+    return ble_gap_conn_find(conn_handle, NULL);
+}
+
+uint16_t ble_att_mtu(uint16_t conn_handle)
+{
+    return ble_gap_conn_find(conn_handle, NULL) == 0 ? BLE_ATT_MTU_DFLT : 0;
+}
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type)
+{
+    *out_addr_type = 0;
+    return 0;
+}
+
+int fake_gap_event(struct ble_gap_event *event)
+{
+    return gap_cb ? gap_cb(event, gap_cb_arg) : 0;
+}
+
+bool fake_gap_adv_active(void)
+{
+    return adv_active;
+}
+
+unsigned long fake_gap_adv_starts(void)
+{
+    return adv_starts;
+}
+
+size_t fake_gap_adv_mfg(uint8_t *buf, size_t cap)
+{
+    size_t n = adv_mfg_len < cap ? adv_mfg_len : cap;
+    memcpy(buf, adv_mfg, n);
+    return adv_mfg_len;
+}
+
+const char *fake_gap_adv_name(void)
+{
+    return adv_name;
+}
+
+unsigned long fake_gap_adv_sets(void)
+{
+    return adv_sets;
+}
+
+// A peripheral stops advertising when a central connects
+void fake_gap_connect(uint16_t conn_handle)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+        if (!conn_used[i])
+        {
+            memset(&conns[i], 0, sizeof(conns[i]));
+            conns[i].conn_handle = conn_handle;
+            conns[i].conn_itvl = 24; // 30 ms, a typical phone default
+            conns[i].supervision_timeout = 400;
+            conn_used[i] = true;
+            conn_upd_pending[i] = false;
+            break;
+        }
+    adv_active = false;
+    struct ble_gap_event ev = {.type = BLE_GAP_EVENT_CONNECT};
+    ev.connect.status = 0;
+    ev.connect.conn_handle = conn_handle;
+    fake_gap_event(&ev);
+}
+
+void fake_gap_disconnect(uint16_t conn_handle)
+{
+    struct ble_gap_event ev = {.type = BLE_GAP_EVENT_DISCONNECT};
+    ev.disconnect.reason = 0x213; // Remote user terminated connection
+    for (int i = 0; i < MAX_CONNS; i++)
+        if (conn_used[i] && conns[i].conn_handle == conn_handle)
+        {
+            ev.disconnect.conn = conns[i];
+            conn_used[i] = false;
+            conn_upd_pending[i] = false;
+        }
+    ev.disconnect.conn.conn_handle = conn_handle;
+    link_drop(conn_handle);
+    fake_gap_event(&ev);
+}
+
+void fake_gap_conn_params(uint16_t conn_handle, uint16_t itvl, uint16_t latency, uint16_t timeout)
+{
+    struct ble_gap_event ev = {.type = BLE_GAP_EVENT_CONN_UPDATE};
+    for (int i = 0; i < MAX_CONNS; i++)
+        if (conn_used[i] && conns[i].conn_handle == conn_handle)
+        {
+            conns[i].conn_itvl = itvl;
+            conns[i].conn_latency = latency;
+            conns[i].supervision_timeout = timeout;
+        }
+    ev.conn_update.conn_handle = conn_handle;
+    fake_gap_event(&ev);
+}
+
+void fake_gap_central_itvl(uint16_t itvl_min, uint16_t itvl_max, bool reject)
+{
+    central_itvl_min = itvl_min;
+    central_itvl_max = itvl_max;
+    conn_upd_reject = reject;
+}
+
+unsigned long fake_gap_update_requests(void)
+{
+    return conn_upd_requests;
+}
+
+void fake_gap_mtu(uint16_t conn_handle, uint16_t mtu)
+{
+    struct ble_gap_event ev = {.type = BLE_GAP_EVENT_MTU};
+    ev.mtu.conn_handle = conn_handle;
+    ev.mtu.channel_id = 4; // ATT
+    ev.mtu.value = mtu;
+    fake_gap_event(&ev);
+}
+
+void fake_gap_subscribe(uint16_t conn_handle, uint16_t uuid16, bool notify, bool indicate)
+{
+    struct ble_gap_event ev = {.type = BLE_GAP_EVENT_SUBSCRIBE};
+    ev.subscribe.conn_handle = conn_handle;
+    ev.subscribe.attr_handle = fake_gatt_val_handle(uuid16);
+    ev.subscribe.cur_notify = notify;
+    ev.subscribe.cur_indicate = indicate;
+    fake_gap_event(&ev);
+}
+
+// ---- GAP / GATT services ----
+
+const char *ble_svc_gap_device_name(void)
+{
+    return device_name;
+}
+
+int ble_svc_gap_device_name_set(const char *name)
+{
+    if (strlen(name) >= sizeof(device_name))
+        return BLE_HS_EINVAL;
+    strcpy(device_name, name);
+    return 0;
+}
+
+void ble_svc_gap_init(void)
+{
+}
+
+void ble_svc_gatt_init(void)
+{
+}
+
+// Shared with fake_alloc.c
+unsigned long fake_mbuf_allocs(void)
+{
+    return mbuf_allocs;
+}
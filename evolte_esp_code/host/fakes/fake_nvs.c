@@ -0,0 +1,196 @@
+// Host fake of NVS. Every entry has a committed value, which survives
+// fake_nvs_power_cycle, and an optional staged value written by nvs_set_*
+// that nvs_commit makes durable. Sets and commits are counted so tests can
+// check how often the firmware would touch flash.
+#include <string.h>
+#include "fake_hooks.h"
+#include "nvs_flash.h"
+
+#define MAX_NAMESPACES 8
+#define MAX_ENTRIES 64
+#define MAX_VALUE 512
+
+typedef struct
+{
+    bool present;
+    size_t len;
+    uint8_t data[MAX_VALUE];
+} nvs_value_t;
+
+typedef struct
+{
+    bool used;
+    int ns;
+    char key[16];
+    bool is_str;
+    bool staged_set;
+    nvs_value_t flash;
+    nvs_value_t staged;
+} nvs_entry_t;
+
+static char namespaces[MAX_NAMESPACES][16];
+static int n_namespaces;
+static nvs_entry_t entries[MAX_ENTRIES];
+static fake_nvs_stats_t stats;
+static int fail_commits;
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(entries, 0, sizeof(entries));
+    stats.erases++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(name) > 15)
+        return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < n_namespaces; i++)
+        if (strcmp(namespaces[i], name) == 0)
+        {
+            *out_handle = (nvs_handle_t)i + 1;
+            return ESP_OK;
+        }
+    if (n_namespaces == MAX_NAMESPACES)
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    strcpy(namespaces[n_namespaces], name);
+    *out_handle = (nvs_handle_t)++n_namespaces;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+static nvs_entry_t *entry_find(nvs_handle_t handle, const char *key, bool create)
+{
+    nvs_entry_t *free_slot = NULL;
+    for (int i = 0; i < MAX_ENTRIES; i++)
+    {
+        nvs_entry_t *e = &entries[i];
+        if (e->used && e->ns == (int)handle && strcmp(e->key, key) == 0)
+            return e;
+        if (!e->used && free_slot == NULL)
+            free_slot = e;
+    }
+    if (!create || free_slot == NULL || strlen(key) > 15)
+        return NULL;
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->used = true;
+    free_slot->ns = (int)handle;
+    strcpy(free_slot->key, key);
+    return free_slot;
+}
+
+// The value a reader sees: staged if there is one, else the committed one
+static const nvs_value_t *entry_value(const nvs_entry_t *e)
+{
+    return e->staged_set ? &e->staged : &e->flash;
+}
+
+static esp_err_t get(nvs_handle_t handle, const char *key, bool is_str, void *out, size_t *length)
+{
+    nvs_entry_t *e = entry_find(handle, key, false);
+    if (e == NULL || !entry_value(e)->present || e->is_str != is_str)
+        return ESP_ERR_NVS_NOT_FOUND;
+    const nvs_value_t *v = entry_value(e);
+    if (out == NULL)
+    {
+        *length = v->len;
+        return ESP_OK;
+    }
+    if (*length < v->len)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out, v->data, v->len);
+    *length = v->len;
+    return ESP_OK;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char *key, bool is_str, const void *value, size_t len)
+{
+    if (len > MAX_VALUE)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    nvs_entry_t *e = entry_find(handle, key, true);
+    if (e == NULL)
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    e->is_str = is_str;
+    e->staged_set = true;
+    e->staged.present = true;
+    e->staged.len = len;
+    memcpy(e->staged.data, value, len);
+    stats.sets++;
+    stats.bytes += len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return get(handle, key, true, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return set(handle, key, true, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return get(handle, key, false, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return set(handle, key, false, value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_entry_t *e = entry_find(handle, key, false);
+    if (e == NULL || !entry_value(e)->present)
+        return ESP_ERR_NVS_NOT_FOUND;
+    e->staged_set = true;
+    e->staged.present = false;
+    stats.sets++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    stats.commits++;
+    if (fail_commits)
+    {
+        fail_commits--;
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE; // Staged values stay staged
+    }
+    for (int i = 0; i < MAX_ENTRIES; i++)
+    {
+        nvs_entry_t *e = &entries[i];
+        if (e->used && e->ns == (int)handle && e->staged_set)
+        {
+            e->flash = e->staged;
+            e->staged_set = false;
+        }
+    }
+    return ESP_OK;
+}
+
+void fake_nvs_fail_commits(int n)
+{
+    fail_commits = n;
+}
+
+void fake_nvs_power_cycle(void)
+{
+    for (int i = 0; i < MAX_ENTRIES; i++)
+        entries[i].staged_set = false;
+}
+
+void fake_nvs_stats(fake_nvs_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,194 @@
+// Host fake of esp_ota_ops over the fake flash. Writes go to the partition
+// like the real ones, erasing each sector as the image reaches it. An image
+// is valid if it starts with the ESP image magic byte. The bootloader's
+// choice on reset, including rollback of an image that never confirmed
+// itself, is made by fake_ota_reboot.
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "fake_hooks.h"
+
+#define IMAGE_MAGIC 0xE9
+#define SECTOR 4096
+#define SLOTS 2
+
+typedef struct
+{
+    bool open;
+    const esp_partition_t *part;
+    uint32_t written;
+    uint32_t erased; // Bytes from the start that were erased
+} fake_ota_handle_t;
+
+static fake_ota_handle_t handles[2];
+
+static const esp_partition_t *running;
+static const esp_partition_t *boot;
+static const esp_partition_t *previous; // Booted before boot, for rollback
+static esp_ota_img_states_t state[SLOTS] = {ESP_OTA_IMG_UNDEFINED, ESP_OTA_IMG_UNDEFINED};
+
+static const esp_partition_t *slot_part(int slot)
+{
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0 + slot, NULL);
+}
+
+static int slot_of(const esp_partition_t *p)
+{
+    if (p == NULL || p->type != ESP_PARTITION_TYPE_APP || p->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_0 ||
+        p->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_0 + SLOTS)
+        return -1;
+    return (int)p->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    if (running == NULL)
+        running = boot = slot_part(0);
+    return running;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+    esp_ota_get_running_partition();
+    return boot;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    int slot = slot_of(start_from ? start_from : esp_ota_get_running_partition());
+    return slot < 0 ? slot_part(0) : slot_part((slot + 1) % SLOTS);
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    if (slot_of(partition) < 0)
+        return ESP_ERR_INVALID_ARG;
+    if (partition == esp_ota_get_running_partition())
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    if (image_size != OTA_SIZE_UNKNOWN && image_size != OTA_WITH_SEQUENTIAL_WRITES && image_size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    for (uint32_t h = 0; h < sizeof(handles) / sizeof(handles[0]); h++)
+    {
+        if (handles[h].open)
+            continue;
+        handles[h].open = true;
+        handles[h].part = partition;
+        handles[h].written = 0;
+        handles[h].erased = 0;
+        if (image_size != OTA_WITH_SEQUENTIAL_WRITES)
+        {
+            uint32_t len = image_size == OTA_SIZE_UNKNOWN ? partition->size
+                                                          : ((uint32_t)image_size + SECTOR - 1) / SECTOR * SECTOR;
+            esp_partition_erase_range(partition, 0, len);
+            handles[h].erased = len;
+        }
+        *out_handle = h + 1;
+        return ESP_OK;
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+static bool handle_ok(esp_ota_handle_t handle)
+{
+    return handle >= 1 && handle <= sizeof(handles) / sizeof(handles[0]) && handles[handle - 1].open;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (!handle_ok(handle))
+        return ESP_ERR_INVALID_ARG;
+    fake_ota_handle_t *h = &handles[handle - 1];
+    if (h->written == 0 && size > 0 && ((const uint8_t *)data)[0] != IMAGE_MAGIC)
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    if (h->written + size > h->part->size)
+        return ESP_ERR_INVALID_SIZE;
+    while (h->erased < h->written + size)
+    {
+        esp_partition_erase_range(h->part, h->erased, SECTOR);
+        h->erased += SECTOR;
+    }
+    esp_err_t rc = esp_partition_write(h->part, h->written, data, size);
+    if (rc == ESP_OK)
+        h->written += size;
+    return rc;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    if (!handle_ok(handle))
+        return ESP_ERR_NOT_FOUND;
+    handles[handle - 1].open = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (!handle_ok(handle))
+        return ESP_ERR_NOT_FOUND;
+    fake_ota_handle_t *h = &handles[handle - 1];
+    h->open = false;
+    uint8_t magic = 0;
+    if (h->written == 0 || esp_partition_read(h->part, 0, &magic, 1) != ESP_OK || magic != IMAGE_MAGIC)
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    int slot = slot_of(partition);
+    uint8_t magic = 0;
+    if (slot < 0)
+        return ESP_ERR_INVALID_ARG;
+    if (esp_partition_read(partition, 0, &magic, 1) != ESP_OK || magic != IMAGE_MAGIC)
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    esp_ota_get_running_partition();
+    if (partition != running)
+    {
+        state[slot] = ESP_OTA_IMG_NEW;
+        previous = running;
+    }
+    boot = partition;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+    int slot = slot_of(partition);
+    if (slot < 0 || ota_state == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (state[slot] == ESP_OTA_IMG_UNDEFINED)
+        return ESP_ERR_NOT_FOUND;
+    *ota_state = state[slot];
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    state[slot_of(esp_ota_get_running_partition())] = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    if (previous == NULL || previous == esp_ota_get_running_partition())
+        return ESP_ERR_OTA_ROLLBACK_FAILED;
+    state[slot_of(running)] = ESP_OTA_IMG_INVALID;
+    boot = previous;
+    esp_restart();
+    return ESP_OK;
+}
+
+void fake_ota_reboot(void)
+{
+    esp_ota_get_running_partition();
+    int slot = slot_of(boot);
+    // A new image gets one boot to confirm itself, one that did not falls back
+    if (state[slot] == ESP_OTA_IMG_NEW)
+        state[slot] = ESP_OTA_IMG_PENDING_VERIFY;
+    else if (state[slot] == ESP_OTA_IMG_PENDING_VERIFY && previous)
+    {
+        state[slot] = ESP_OTA_IMG_ABORTED;
+        boot = previous;
+    }
+    running = boot;
+}
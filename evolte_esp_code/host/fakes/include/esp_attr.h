@@ -0,0 +1,5 @@
+// Host fake of esp_attr.h, placement attributes mean nothing on the host
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
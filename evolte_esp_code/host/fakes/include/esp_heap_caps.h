@@ -0,0 +1,9 @@
+// Host fake of esp_heap_caps.h, only the allocation hooks. fake_alloc.c
+// calls them for every allocation the firmware objects make.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps);
+void esp_heap_trace_free_hook(void *ptr);
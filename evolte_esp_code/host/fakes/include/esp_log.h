@@ -0,0 +1,12 @@
+// Host fake of esp_log.h, silent unless EVOLTE_FAKE_LOG is set in the environment
+#pragma once
+
+#include "esp_err.h"
+
+void fake_log(char level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, fmt, ...) fake_log('E', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fake_log('W', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fake_log('I', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) fake_log('D', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) fake_log('V', tag, fmt, ##__VA_ARGS__)
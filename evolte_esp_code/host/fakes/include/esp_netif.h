@@ -0,0 +1,33 @@
+// Host fake of esp_netif.h
+#pragma once
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "lwip/ip4_addr.h"
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct
+{
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct
+{
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    int ip_changed;
+} ip_event_got_ip_t;
+
+extern esp_event_base_t const IP_EVENT;
+
+typedef enum
+{
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
@@ -0,0 +1,2 @@
+// Host fake of esp_nimble_hci.h
+#pragma once
@@ -0,0 +1,4 @@
+// Host fake of esp_rom_sys.h, silent unless EVOLTE_FAKE_LOG is set like esp_log.h
+#pragma once
+
+int esp_rom_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,6 @@
+// Entry points of main.c that the host harness drives directly
+#pragma once
+
+void app_main(void);
+void start_webserver(void);
+void wifi_init_sta(void);
@@ -0,0 +1,186 @@
+// Harness side of the host fakes: drive GATT, GAP, HTTP and event traffic
+// into the firmware and inspect what it did.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_event.h"
+#include "esp_http_server.h"
+#include "host/ble_hs.h"
+
+// ---- Clock and callouts ----
+
+uint32_t fake_time_ms(void);
+// Move the fake clock forward, running every callout that expires on the way
+void fake_time_advance_ms(uint32_t ms);
+
+// ---- Tasks ----
+
+// Let every fake FreeRTOS task run until it blocks again, then run the events
+// they posted to the NimBLE host queue and queued HTTP server work. The GATT,
+// HTTP and clock hooks call this after driving the firmware, so commands are
+// applied when they return.
+void fake_host_run(void);
+void fake_tasks_settle(void);
+// While held, tasks do not run, so submitted commands stay queued
+void fake_tasks_hold(bool hold);
+bool fake_in_task(void);
+
+// ---- GPIO ----
+
+int fake_gpio_get(int pin);
+unsigned long fake_gpio_writes(void);
+// gpio_set_level on this pin fails and leaves the level as it was
+void fake_gpio_fail(int pin, bool fail);
+
+// ---- GATT / GAP ----
+
+// Run the access callback of the characteristic with this 16-bit UUID
+int fake_gatt_write(uint16_t conn_handle, uint16_t uuid16, const void *data, size_t len);
+int fake_gatt_read(uint16_t conn_handle, uint16_t uuid16, void *out, size_t cap, size_t *out_len);
+uint16_t fake_gatt_val_handle(uint16_t uuid16);
+
+// Deliver a GAP event to the callback of the last ble_gap_adv_start
+int fake_gap_event(struct ble_gap_event *event);
+void fake_gap_connect(uint16_t conn_handle);
+void fake_gap_disconnect(uint16_t conn_handle);
+void fake_gap_mtu(uint16_t conn_handle, uint16_t mtu);
+// The central changes the connection parameters on its own
+void fake_gap_conn_params(uint16_t conn_handle, uint16_t itvl, uint16_t latency, uint16_t timeout);
+// What the central makes of ble_gap_update_params: an interval clamped to
+// [itvl_min, itvl_max], or a refusal. Updates complete on the next host run.
+void fake_gap_central_itvl(uint16_t itvl_min, uint16_t itvl_max, bool reject);
+unsigned long fake_gap_update_requests(void);
+void fake_gap_subscribe(uint16_t conn_handle, uint16_t uuid16, bool notify, bool indicate);
+bool fake_gap_adv_active(void);
+unsigned long fake_gap_adv_starts(void);
+// Advertising data as last set: manufacturer data (returns its length),
+// the scan response name, and how often the data was set
+size_t fake_gap_adv_mfg(uint8_t *buf, size_t cap);
+const char *fake_gap_adv_name(void);
+unsigned long fake_gap_adv_sets(void);
+
+// Notifications and indications sent by the firmware
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    bool indication;
+    uint16_t len;
+    uint8_t data[BLE_ATT_ATTR_MAX_LEN];
+} fake_gatt_tx_t;
+
+unsigned long fake_gatt_tx_count(void);
+const fake_gatt_tx_t *fake_gatt_tx_last(void);
+// Every one sent, oldest first, false once all were taken
+bool fake_gatt_tx_pop(fake_gatt_tx_t *out);
+// Model the radio: at most per_event packets leave every interval_ms and
+// hold their mbufs until then. An interval of 0 sends at once.
+void fake_gatt_link(uint32_t interval_ms, int per_event);
+
+// ---- HTTP ----
+
+typedef struct
+{
+    const char *status;
+    const char *type;
+    size_t len;
+    char hdrs[256]; // Set by the handler, "Field: value\r\n" each
+    char body[8192];
+} fake_http_resp_t;
+
+// A header of the next request only, up to four
+void fake_http_req_hdr(const char *field, const char *value);
+// The next request's body reaches the handler at most this many bytes per
+// httpd_req_recv, as if split across TCP segments
+void fake_http_recv_max(size_t bytes);
+
+esp_err_t fake_http_request(httpd_method_t method, const char *uri, const char *body, size_t len,
+                            fake_http_resp_t *resp);
+
+// GET on a socket that stays open afterwards, returns its fd or -1. What the
+// server sends on it is read back with fake_sock_read.
+int fake_http_stream(const char *uri, fake_http_resp_t *resp);
+// A keep-alive connection and a request on it, which marks it recently
+// used. Connecting returns -1 when the server has no socket to give; with
+// lru_purge_enable it closes the least recently used one instead.
+int fake_http_connect(void);
+esp_err_t fake_http_request_on(int fd, httpd_method_t method, const char *uri, const char *body, size_t len,
+                               fake_http_resp_t *resp);
+size_t fake_sock_read(int fd, char *buf, size_t cap);
+// Bytes the peer buffers before send() returns EAGAIN, reading frees them
+void fake_sock_set_window(int fd, size_t bytes);
+void fake_sock_peer_close(int fd);
+bool fake_sock_is_open(int fd);
+// Runs one httpd_queue_work item, false if there was none
+bool fake_httpd_run_work(void);
+
+// ---- ADC ----
+
+// Samples of the first and second pattern entries, converted and delivered
+// in DMA frames while the continuous driver is started
+void fake_adc_feed(const uint16_t *a, const uint16_t *b, size_t n);
+// Frames dropped because the driver pool was full
+unsigned long fake_adc_overflows(void);
+
+// ---- Events / Wi-Fi ----
+
+void fake_event_post(esp_event_base_t base, int32_t id, void *data);
+const char *fake_wifi_ssid(void);
+// Server given to esp_netif_sntp_init, NULL before
+const char *fake_sntp_server(void);
+// An SNTP reply arrived, with this time
+void fake_sntp_sync(int64_t unix_us);
+// Frames passed to esp_now_send so far; the last one is copied to buf
+unsigned long fake_espnow_sent(uint8_t *buf, size_t cap, size_t *len);
+// A frame from mac arrives, delivered on the calling thread
+void fake_espnow_recv(const uint8_t mac[6], const uint8_t *data, size_t len);
+
+// ---- NVS ----
+
+typedef struct
+{
+    unsigned long sets;    // nvs_set_* and nvs_erase_key calls
+    unsigned long commits; // nvs_commit calls
+    unsigned long bytes;   // Value bytes written by nvs_set_*
+    unsigned long erases;  // nvs_flash_erase calls
+} fake_nvs_stats_t;
+
+void fake_nvs_stats(fake_nvs_stats_t *out);
+// Drop values that were set but never committed, like a reset would
+void fake_nvs_power_cycle(void);
+// The next n nvs_commit calls fail and commit nothing
+void fake_nvs_fail_commits(int n);
+
+// ---- Flash ----
+
+// Cut power after this many more programmed bytes: the write in progress
+// stops there and later writes and erases are lost. Any value restores
+// power, -1 never cuts.
+void fake_flash_cut_after(long bytes);
+bool fake_flash_powered(void);
+// Fewest and most erases of any sector of the partition
+void fake_flash_wear(const char *label, uint32_t *min, uint32_t *max);
+// Raw contents of the partition, to corrupt it
+uint8_t *fake_flash_mem(const char *label);
+
+// ---- OTA / restart ----
+
+// esp_restart calls so far; the firmware keeps running after one
+unsigned long fake_restarts(void);
+// Reset as far as the bootloader is concerned: run the boot partition, a
+// new image pending verification and one that never confirmed itself
+// rolled back. The firmware is not restarted.
+void fake_ota_reboot(void);
+
+// ---- Allocation accounting ----
+
+typedef struct
+{
+    unsigned long heap_allocs; // malloc/calloc/realloc calls from the firmware objects
+    unsigned long heap_frees;
+    unsigned long mbuf_allocs;
+} fake_alloc_stats_t;
+
+void fake_alloc_stats(fake_alloc_stats_t *out);
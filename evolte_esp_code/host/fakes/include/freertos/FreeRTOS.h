@@ -0,0 +1,30 @@
+// Host fake of freertos/FreeRTOS.h
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portNUM_PROCESSORS 2
+#define configRUN_TIME_COUNTER_TYPE uint64_t
+
+// Every fake task and the harness count as core 0
+static inline BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+// Fake tasks never run at the same time as each other or the harness, so
+// critical sections need no lock
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
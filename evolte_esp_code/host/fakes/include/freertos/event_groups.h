@@ -0,0 +1,4 @@
+// Host fake of freertos/event_groups.h
+#pragma once
+
+#include "freertos/FreeRTOS.h"
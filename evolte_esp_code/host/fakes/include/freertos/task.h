@@ -0,0 +1,53 @@
+// Host fake of freertos/task.h. Tasks are threads that only run while the
+// harness waits for them in fake_tasks_settle, so tests stay deterministic.
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef enum
+{
+    eRunning,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid
+} eTaskState;
+
+typedef struct
+{
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    configRUN_TIME_COUNTER_TYPE ulRunTimeCounter;
+    void *pxStackBase;
+    uint32_t usStackHighWaterMark;
+} TaskStatus_t;
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_prio_woken);
+// Only vTaskDelete(NULL) from the task itself is supported
+void vTaskDelete(TaskHandle_t task);
+
+// Run time is the thread's CPU time and the total the fake clock, both in
+// us. The stack of a thread cannot be seen, every task reports it unused.
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *array, UBaseType_t size, configRUN_TIME_COUNTER_TYPE *total_run_time);
+BaseType_t xTaskGetCoreID(TaskHandle_t task);
+// The harness thread, which runs the NimBLE host and httpd work, has a
+// handle of its own
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
@@ -0,0 +1,14 @@
+// Host fake of lwip/ip4_addr.h
+#pragma once
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define IP2STR(ipaddr) esp_ip4_addr_get_byte(ipaddr, 0), esp_ip4_addr_get_byte(ipaddr, 1), \
+                       esp_ip4_addr_get_byte(ipaddr, 2), esp_ip4_addr_get_byte(ipaddr, 3)
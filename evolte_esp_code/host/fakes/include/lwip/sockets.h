@@ -0,0 +1,17 @@
+// Host fake of lwip/sockets.h. send and close go to the fake sockets of
+// fake_httpd.c, which model a peer with a limited receive window.
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0x08
+#endif
+
+ssize_t fake_sock_send(int fd, const void *buf, size_t len, int flags);
+int fake_sock_server_close(int fd);
+
+#define send fake_sock_send
+#define close fake_sock_server_close
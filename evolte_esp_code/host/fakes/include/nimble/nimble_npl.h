@@ -0,0 +1,58 @@
+// Host fake of the NimBLE porting layer: a millisecond tick and callouts that
+// fire when the harness advances the fake clock with fake_time_advance_ms
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t ble_npl_time_t;
+typedef int32_t ble_npl_stime_t;
+
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_event
+{
+    ble_npl_event_fn *fn;
+    void *arg;
+    bool queued;
+    struct ble_npl_event *next;
+};
+
+struct ble_npl_eventq
+{
+    int dummy;
+};
+
+struct ble_npl_callout
+{
+    struct ble_npl_event ev;
+    ble_npl_time_t expiry;
+    bool armed;
+    struct ble_npl_callout *next;
+};
+
+typedef enum
+{
+    BLE_NPL_OK = 0,
+} ble_npl_error_t;
+
+ble_npl_time_t ble_npl_time_get(void);
+ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms);
+uint32_t ble_npl_time_ticks_to_ms32(ble_npl_time_t ticks);
+
+// Events put on the default queue from other tasks run on the harness thread
+// the next time it lets the fake host task catch up
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq,
+                          ble_npl_event_fn *ev_cb, void *ev_arg);
+ble_npl_error_t ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks);
+void ble_npl_callout_stop(struct ble_npl_callout *co);
+bool ble_npl_callout_is_active(struct ble_npl_callout *co);
+
+static inline void *ble_npl_event_get_arg(struct ble_npl_event *ev)
+{
+    return ev->arg;
+}
@@ -0,0 +1,8 @@
+// Host fake of nimble/nimble_port_freertos.h. The host task is not started,
+// instead the sync callback runs straight away.
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn);
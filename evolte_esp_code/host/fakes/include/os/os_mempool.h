@@ -0,0 +1,19 @@
+// Host fake of os/os_mempool.h, only the pool walk. The fake mbufs are split
+// into the two msys pools of the sdkconfig, first msys_1 then msys_2.
+#pragma once
+
+#define OS_MEMPOOL_INFO_NAME_LEN 32
+
+struct os_mempool;
+
+struct os_mempool_info
+{
+    int omi_block_size;
+    int omi_num_blocks;
+    int omi_num_free;
+    int omi_min_free;
+    char omi_name[OS_MEMPOOL_INFO_NAME_LEN];
+};
+
+// The pool after mp, the first for NULL, or NULL after the last
+struct os_mempool *os_mempool_info_get_next(struct os_mempool *mp, struct os_mempool_info *omi);
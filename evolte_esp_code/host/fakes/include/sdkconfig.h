@@ -0,0 +1,4 @@
+// Host build: the real CONFIG_* values are generated from ../sdkconfig
+#pragma once
+
+#include "sdkconfig_gen.h"
@@ -0,0 +1,6 @@
+// Host fake of services/gap/ble_svc_gap.h
+#pragma once
+
+const char *ble_svc_gap_device_name(void);
+int ble_svc_gap_device_name_set(const char *name);
+void ble_svc_gap_init(void);
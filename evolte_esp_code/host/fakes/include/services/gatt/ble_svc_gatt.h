@@ -0,0 +1,4 @@
+// Host fake of services/gatt/ble_svc_gatt.h
+#pragma once
+
+void ble_svc_gatt_init(void);
@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "cmd_proto.h"
+
+static int op_any(const cmd_frame_t *frame, void *ctx)
+{
+    // Touch the whole payload so out of bounds views get caught by ASan
+    volatile uint8_t sum = 0;
+    for (uint8_t i = 0; i < frame->len; i++)
+        sum += frame->payload[i];
+    return sum;
+}
+
+static const cmd_op_t ops[CMD_OP_COUNT] = {
+    [CMD_OP_NOP] = {.fn = op_any, .min_len = 0, .max_len = 0},
+    [CMD_OP_RELAY_SET] = {.fn = op_any, .min_len = 2, .max_len = 2},
+};
+
+size_t fuzz_seed(uint8_t *out, size_t cap, unsigned idx)
+{
+    const uint8_t on[2] = {0, 1};
+    size_t n = 0;
+    for (unsigned i = 0; i <= idx % CMD_PROTO_MAX_FRAMES; i++)
+    {
+        size_t w = cmd_proto_encode(&out[n], cap - n, (uint8_t)(i & 1), (uint8_t)i, on, (uint8_t)((i & 1) * 2));
+        if (w == 0)
+            break;
+        n += w;
+    }
+    return n;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    int rc = cmd_proto_dispatch(data, size, ops, CMD_OP_COUNT, NULL);
+    if (rc > CMD_PROTO_MAX_FRAMES)
+        abort();
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_body.h"
+
+static char a[8], b[32];
+static http_body_field_t fields[] = {
+    {.name = "ssid", .val = a, .cap = sizeof(a)},
+    {.name = "password", .val = b, .cap = sizeof(b)},
+};
+
+size_t fuzz_seed(uint8_t *out, size_t cap, unsigned idx)
+{
+    static const char *const seeds[] = {
+        "ssid=ab%20c&password=x+y",
+        "{\"ssid\":\"\\u00e9\\ud83d\\ude00\",\"password\":12}",
+    };
+    const char *s = seeds[idx % 2];
+    size_t n = strlen(s) < cap ? strlen(s) : cap;
+    memcpy(out, s, n);
+    return n;
+}
+
+// The first byte picks the encoding and a split point, the rest is the body
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1)
+        return 0;
+    http_body_t p;
+    size_t split = data[0] >> 1;
+    http_body_init(&p, data[0] & 1 ? HTTP_BODY_JSON : HTTP_BODY_FORM, fields, 2);
+    data++, size--;
+    if (split > size)
+        split = size;
+    http_body_feed(&p, (const char *)data, split);
+    http_body_feed(&p, (const char *)data + split, size - split);
+    http_body_finish(&p);
+    for (int i = 0; i < 2; i++)
+        if (fields[i].len >= fields[i].cap || fields[i].val[fields[i].len] != '\0')
+            abort();
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Standalone driver for the fuzz targets when libFuzzer is not available.
+// Replays every file given on the command line, or runs -runs=N inputs
+// generated by mutating a small seed of valid frames.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Optional seed provided by the fuzz target
+__attribute__((weak)) size_t fuzz_seed(uint8_t *out, size_t cap, unsigned idx)
+{
+    return 0;
+}
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static int replay(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 1;
+    }
+    static uint8_t buf[1 << 16];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, n);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = 100000;
+    int replayed = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+            runs = strtoul(argv[i] + 6, NULL, 10);
+        else if (argv[i][0] != '-')
+        {
+            if (replay(argv[i]))
+                return 1;
+            replayed++;
+        }
+    }
+    if (replayed)
+        return 0;
+
+    uint8_t buf[512];
+    for (unsigned long r = 0; r < runs; r++)
+    {
+        size_t n = fuzz_seed(buf, sizeof(buf), (unsigned)r);
+        if (n == 0 || (rng() & 3) == 0)
+        {
+            n = rng() % sizeof(buf);
+            for (size_t i = 0; i < n; i++)
+                buf[i] = (uint8_t)rng();
+        }
+        else
+        {
+            // Flip, truncate or extend the seed a little
+            unsigned flips = rng() % 4;
+            for (unsigned i = 0; i < flips && n; i++)
+                buf[rng() % n] ^= (uint8_t)(1u << (rng() % 8));
+            if (rng() & 1)
+                n = rng() % (n + 1);
+        }
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+    printf("fuzz: %lu inputs, no crash\n", runs);
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Status beacon in the advertising data: the encoding of each state, and
+// against the whole firmware that relay and connection changes reach the
+// advertisement while an unchanged status never sets new data.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adv_beacon.h"
+#include "charger.h"
+#include "check.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+
+static uint8_t beacon[ADV_BEACON_LEN];
+
+static size_t adv_read(void)
+{
+    uint8_t buf[32];
+    size_t n = fake_gap_adv_mfg(buf, sizeof(buf));
+    CHECK(n == ADV_BEACON_LEN);
+    memcpy(beacon, buf, sizeof(beacon));
+    return n;
+}
+
+static int relay(const char *body)
+{
+    fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+    fake_host_run();
+    return atoi(resp.status);
+}
+
+static void test_encode(void)
+{
+    uint8_t b[ADV_BEACON_LEN];
+    status_snapshot_t snap = {.relay_count = 1};
+    CHECK(adv_beacon_encode(&snap, 3, 7, b, sizeof(b) - 1) == 0);
+    CHECK(adv_beacon_encode(&snap, 3, 7, b, sizeof(b)) == ADV_BEACON_LEN);
+    const uint8_t idle[ADV_BEACON_LEN] = {0xFF, 0xFF, ADV_BEACON_VERSION, ADV_BEACON_AVAILABLE, 0, 3, 0, 0, 0, 0, 7};
+    CHECK(memcmp(b, idle, sizeof(b)) == 0);
+
+    // Closed with a car drawing 7.26 kW, rounded to 100 W
+    snap.relay_mask = 1;
+    snap.power_w = 7260;
+    adv_beacon_encode(&snap, 2, 8, b, sizeof(b));
+    CHECK(b[3] == ADV_BEACON_CHARGING && b[4] == 1 && b[5] == 2 && b[6] == 73 && b[7] == 0);
+
+    // Closed, only noise on the meter
+    snap.power_w = 40;
+    adv_beacon_encode(&snap, 2, 8, b, sizeof(b));
+    CHECK(b[3] == ADV_BEACON_READY && b[6] == 0);
+    snap.power_w = -300;
+    adv_beacon_encode(&snap, 2, 8, b, sizeof(b));
+    CHECK(b[3] == ADV_BEACON_READY && b[6] == 0);
+
+    // A fault wins over everything, and a huge reading saturates
+    snap.error_flags = CHARGER_ERR_METER;
+    snap.power_w = 100000000;
+    adv_beacon_encode(&snap, 0, 9, b, sizeof(b));
+    CHECK(b[3] == ADV_BEACON_FAULT && b[6] == 0xFF && b[7] == 0xFF && b[8] == CHARGER_ERR_METER && b[9] == 0);
+}
+
+static void test_live(void)
+{
+    // Name in the scan response, status in the advertisement
+    CHECK(fake_gap_adv_active());
+    CHECK(strlen(fake_gap_adv_name()) > 0);
+    adv_read();
+    CHECK(beacon[2] == ADV_BEACON_VERSION && beacon[3] == ADV_BEACON_AVAILABLE);
+    CHECK(beacon[5] == CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
+
+    // Nothing changes: checked every period, never set again
+    unsigned long sets = fake_gap_adv_sets();
+    uint32_t checks = adv_beacon_stats()->checks;
+    fake_time_advance_ms(CONFIG_EVOLTE_BEACON_CHECK_MS * 10);
+    fake_host_run();
+    CHECK(fake_gap_adv_sets() == sets);
+    CHECK(adv_beacon_stats()->checks >= checks + 10);
+
+    // A relay closed over HTTP shows at once, with a new seq
+    uint8_t seq = beacon[10];
+    CHECK(relay("channel=0&on=1") == 200);
+    CHECK(fake_gap_adv_sets() == sets + 1);
+    adv_read();
+    CHECK(beacon[3] == ADV_BEACON_READY && beacon[4] == 1 && beacon[10] == (uint8_t)(seq + 1));
+    CHECK(relay("channel=0&on=0") == 200);
+    adv_read();
+    CHECK(beacon[3] == ADV_BEACON_AVAILABLE && beacon[4] == 0);
+
+    // A connection takes a slot; the advertisement, back after the
+    // connect, says so
+    fake_gap_connect(1);
+    fake_host_run();
+    CHECK(fake_gap_adv_active());
+    adv_read();
+    CHECK(beacon[5] == CONFIG_BT_NIMBLE_MAX_CONNECTIONS - 1);
+    fake_gap_disconnect(1);
+    fake_host_run();
+    adv_read();
+    CHECK(beacon[5] == CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+
+    test_encode();
+    test_live();
+
+    fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    char want[48];
+    snprintf(want, sizeof(want), "\"beacon\":{\"updates\":%lu}", (unsigned long)adv_beacon_stats()->updates);
+    CHECK(strstr(resp.body, want) != NULL);
+    return check_report("adv_beacon");
+}
@@ -0,0 +1,65 @@
+// Staged boot: BLE advertises straight out of app_main while the Wi-Fi
+// stage still waits on its worker task, HTTP follows Wi-Fi, and /diag/boot
+// reports when every stage started and finished.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+
+#define WIFI_STALL_MS 200
+
+static fake_http_resp_t resp;
+
+static int stage_field(const char *name, const char *field)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+    char *p = strstr(resp.body, key);
+    if (p == NULL)
+        return -2;
+    snprintf(key, sizeof(key), "\"%s\":", field);
+    p = strstr(p, key);
+    return p ? atoi(p + strlen(key)) : -2;
+}
+
+int main(void)
+{
+    // Hold the worker so Wi-Fi bring-up looks slow
+    fake_tasks_hold(true);
+    app_main();
+    CHECK(fake_gap_adv_active());
+    CHECK(fake_http_request(HTTP_GET, "/diag/boot", NULL, 0, &resp) == ESP_ERR_NOT_FOUND);
+
+    fake_time_advance_ms(WIFI_STALL_MS);
+    fake_tasks_hold(false);
+    fake_host_run();
+
+    CHECK(fake_http_request(HTTP_GET, "/diag/boot", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    CHECK(strcmp(resp.type, "application/json") == 0);
+    CHECK(strstr(resp.body, "\"reset_reason\":1") != NULL);
+
+    // BLE was done before the stall, Wi-Fi and HTTP after it
+    CHECK(stage_field("ble_adv", "done_us") == 0);
+    CHECK(stage_field("wifi", "start_us") == 0);
+    CHECK(stage_field("wifi", "done_us") == WIFI_STALL_MS * 1000);
+    CHECK(stage_field("http", "done_us") == WIFI_STALL_MS * 1000);
+    CHECK(stage_field("wifi_ip", "done_us") == -1);
+
+    // Advertising restarts on the host task, not the event task
+    ip_event_got_ip_t got_ip = {0};
+    fake_time_advance_ms(50);
+    unsigned long sets = fake_gap_adv_sets();
+    fake_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip);
+    CHECK(fake_gap_adv_sets() == sets);
+    fake_host_run();
+    CHECK(fake_gap_adv_sets() == sets + 1);
+    CHECK(fake_http_request(HTTP_GET, "/diag/boot", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    CHECK(stage_field("wifi_ip", "done_us") == (WIFI_STALL_MS + 50) * 1000);
+
+    return check_report("boot");
+}
@@ -0,0 +1,198 @@
+// Charge plans: windows past midnight and on chosen days, tariff bands and
+// price limits at a UTC offset, checked by hand; then random plans run on
+// the engine minute by minute for weeks, where the state it keeps from its
+// edges must always match evaluating every rule from scratch.
+#include <stdio.h>
+#include <string.h>
+#include "charge_plan.h"
+#include "check.h"
+
+#define CHANNELS 4
+// 2024-01-01 00:00 UTC, a Monday
+#define MONDAY (19723u * CHARGE_PLAN_DAY)
+#define AT(day, h, m) (MONDAY + (day) * CHARGE_PLAN_DAY + (h) * 60 + (m))
+
+static charge_engine_t engine;
+static uint32_t rng = 88172645;
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint8_t on_at(const charge_plan_t *plan, uint32_t utc_min)
+{
+    uint16_t price;
+    return charge_plan_eval(plan, utc_min, &price);
+}
+
+static uint16_t price_at(const charge_plan_t *plan, uint32_t utc_min)
+{
+    uint16_t price;
+    charge_plan_eval(plan, utc_min, &price);
+    return price;
+}
+
+static void test_windows(void)
+{
+    charge_plan_t plan;
+    charge_plan_clear(&plan);
+    CHECK(charge_plan_valid(&plan, CHANNELS) && charge_plan_channels(&plan) == 0);
+
+    // Monday night into Tuesday, one hour ahead of UTC
+    plan.tz_min = 60;
+    plan.windows[0] = (charge_window_t){.days = 0x01, .channel = 1, .start = 22 * 60, .end = 6 * 60};
+    CHECK(charge_plan_valid(&plan, CHANNELS) && charge_plan_channels(&plan) == 0x02);
+    CHECK(on_at(&plan, AT(0, 20, 59)) == 0);
+    CHECK(on_at(&plan, AT(0, 21, 0)) == 0x02);
+    CHECK(on_at(&plan, AT(1, 4, 59)) == 0x02);
+    CHECK(on_at(&plan, AT(1, 5, 0)) == 0);
+    CHECK(on_at(&plan, AT(1, 21, 0)) == 0); // Not on Tuesdays
+    CHECK(on_at(&plan, AT(-1, 23, 30)) == 0); // Sunday night is not Monday's
+
+    // Every day all day, and weekdays 9 to 17 on another channel
+    plan.windows[0] = (charge_window_t){.days = 0x7F, .channel = 0, .start = 300, .end = 300};
+    plan.windows[3] = (charge_window_t){.days = 0x1F, .channel = 2, .start = 9 * 60, .end = 17 * 60};
+    plan.tz_min = -300;
+    for (int day = 0; day < 7; day++)
+    {
+        CHECK(on_at(&plan, AT(day, 7, 0)) == 0x01);
+        CHECK(on_at(&plan, AT(day, 14, 0)) == (day < 5 ? 0x05 : 0x01));
+        CHECK(on_at(&plan, AT(day, 22, 0)) == 0x01);
+    }
+
+    // Out of range
+    plan.windows[3].channel = CHANNELS;
+    CHECK(!charge_plan_valid(&plan, CHANNELS));
+    plan.windows[3].days = 0;
+    CHECK(charge_plan_valid(&plan, CHANNELS)); // Unused, anything goes
+    plan.windows[2].end = CHARGE_PLAN_DAY;
+    CHECK(!charge_plan_valid(&plan, CHANNELS));
+    plan.windows[2].end = 0;
+    plan.tz_min = CHARGE_PLAN_TZ_MAX + 1;
+    CHECK(!charge_plan_valid(&plan, CHANNELS));
+    plan.tz_min = 0;
+    plan.cheap_mask = 1u << CHANNELS;
+    CHECK(!charge_plan_valid(&plan, CHANNELS));
+    plan.cheap_mask = 0;
+    plan.version++;
+    CHECK(!charge_plan_valid(&plan, CHANNELS));
+}
+
+static void test_tariffs(void)
+{
+    charge_plan_t plan;
+    charge_plan_clear(&plan);
+    plan.default_price = 30;
+    plan.max_price = 15;
+    plan.cheap_mask = 0x08;
+    // Off-peak nights, cheaper still at the weekend; the first band wins
+    plan.tariffs[0] = (charge_tariff_t){.days = 0x60, .start = 0, .end = 0, .price = 8};
+    plan.tariffs[1] = (charge_tariff_t){.days = 0x7F, .start = 23 * 60, .end = 7 * 60, .price = 12};
+    plan.tariffs[2] = (charge_tariff_t){.days = 0x7F, .start = 17 * 60, .end = 20 * 60, .price = 40};
+    CHECK(charge_plan_valid(&plan, CHANNELS) && charge_plan_channels(&plan) == 0x08);
+
+    CHECK(price_at(&plan, AT(2, 12, 0)) == 30 && on_at(&plan, AT(2, 12, 0)) == 0);
+    CHECK(price_at(&plan, AT(2, 18, 0)) == 40 && on_at(&plan, AT(2, 18, 0)) == 0);
+    CHECK(price_at(&plan, AT(2, 23, 0)) == 12 && on_at(&plan, AT(2, 23, 0)) == 0x08);
+    CHECK(price_at(&plan, AT(3, 6, 59)) == 12 && on_at(&plan, AT(3, 7, 0)) == 0);
+    CHECK(price_at(&plan, AT(5, 18, 0)) == 8 && on_at(&plan, AT(5, 18, 0)) == 0x08);
+    // Friday's night band still runs into Saturday morning, but Saturday's wins
+    CHECK(price_at(&plan, AT(5, 3, 0)) == 8);
+    CHECK(price_at(&plan, AT(7, 3, 0)) == 12); // Sunday's all-day band ended at midnight
+    CHECK(price_at(&plan, AT(7, 0, 0)) == 12 && price_at(&plan, AT(6, 23, 59)) == 8);
+
+    // At the limit counts as cheap
+    plan.max_price = 12;
+    CHECK(on_at(&plan, AT(2, 23, 0)) == 0x08);
+    plan.max_price = 11;
+    CHECK(on_at(&plan, AT(2, 23, 0)) == 0);
+}
+
+static uint16_t random_minute(void)
+{
+    // Often on the hour, so rules share edges
+    return (uint16_t)(next_rand() % 2 ? next_rand() % 24 * 60 : next_rand() % CHARGE_PLAN_DAY);
+}
+
+static void random_plan(charge_plan_t *plan)
+{
+    charge_plan_clear(plan);
+    plan->tz_min = (int16_t)(CHARGE_PLAN_TZ_MIN + (int)(next_rand() % 104) * 15);
+    plan->default_price = (uint16_t)(next_rand() % 50);
+    plan->max_price = (uint16_t)(next_rand() % 50);
+    plan->cheap_mask = (uint8_t)(next_rand() % (1u << CHANNELS));
+    for (int i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+        if (next_rand() % 3)
+            plan->windows[i] = (charge_window_t){.days = (uint8_t)(next_rand() % 0x80),
+                                                 .channel = (uint8_t)(next_rand() % CHANNELS),
+                                                 .start = random_minute(),
+                                                 .end = random_minute()};
+    for (int i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+        if (next_rand() % 3)
+            plan->tariffs[i] = (charge_tariff_t){.days = (uint8_t)(next_rand() % 0x80),
+                                                 .start = random_minute(),
+                                                 .end = random_minute(),
+                                                 .price = (uint16_t)(next_rand() % 50)};
+}
+
+// Wake only when the engine asks to, sometimes late, and check it against
+// the rules every minute in between
+static void test_engine(void)
+{
+    uint32_t minutes = 0, wakeups = 0, changes = 0;
+    for (int p = 0; p < 60; p++)
+    {
+        random_plan(&engine.plan);
+        CHECK(charge_plan_valid(&engine.plan, CHANNELS));
+        uint32_t now = AT(0, 0, 0) + next_rand() % (52 * 7 * CHARGE_PLAN_DAY);
+        charge_engine_start(&engine, now);
+        uint32_t wake = charge_engine_next(&engine);
+        uint8_t last = engine.on_mask;
+
+        for (uint32_t end = now + 3 * 7 * CHARGE_PLAN_DAY; now < end; now++)
+        {
+            uint32_t due = charge_engine_next(&engine);
+            if (wake != TW_NEVER && now >= wake)
+            {
+                CHECK(charge_engine_advance(&engine, now) == (due <= now));
+                wake = charge_engine_next(&engine);
+                CHECK(wake > now);
+                if (next_rand() % 16 == 0 && wake != TW_NEVER)
+                    wake += next_rand() % 90; // Comes back late
+                wakeups++;
+            }
+
+            // Up to date unless a wakeup is overdue
+            if (charge_engine_next(&engine) > now)
+            {
+                uint16_t price;
+                uint8_t on = charge_plan_eval(&engine.plan, now, &price);
+                CHECK(engine.on_mask == on && engine.price == price);
+                if (engine.on_mask != on || engine.price != price)
+                {
+                    printf("plan %d, minute %lu\n", p, (unsigned long)now);
+                    return;
+                }
+            }
+            changes += engine.on_mask != last;
+            last = engine.on_mask;
+            minutes++;
+        }
+    }
+    // Two wakeups a day per rule at most, instead of one a minute
+    CHECK(wakeups < minutes / 30 && changes > 100);
+    printf("%lu minutes, %lu wakeups, %lu changes\n", (unsigned long)minutes, (unsigned long)wakeups,
+           (unsigned long)changes);
+}
+
+int main(void)
+{
+    test_windows();
+    test_tariffs();
+    test_engine();
+    return check_report("charge_plan");
+}
@@ -0,0 +1,252 @@
+// Charge schedule on the whole firmware: plan and clock set with command
+// frames, relays switched on the minute by the timer with nothing polling,
+// a relay switched by hand left alone by later clock syncs, tariffs and the
+// price limit, the plan kept in NVS across a reset and a failed commit tried
+// again a few times, and /api/schedule.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "actuator.h"
+#include "charge_sched.h"
+#include "charger.h"
+#include "check.h"
+#include "cmd_proto.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+
+#define RELAY_GPIO 13
+// 2024-01-01 00:00 UTC, a Monday
+#define MONDAY 1704067200LL
+#define AT(day, h, m) (MONDAY + (day) * 86400LL + (h) * 3600LL + (m) * 60LL)
+#define TZ_MIN 60
+
+static uint8_t seq;
+
+static int send(uint8_t op, const uint8_t *payload, uint8_t len)
+{
+    static fake_http_resp_t resp;
+    uint8_t frame[CMD_PROTO_OVERHEAD + CMD_PROTO_MAX_PAYLOAD];
+    size_t n = cmd_proto_encode(frame, sizeof(frame), op, seq++, payload, len);
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, n, &resp) == ESP_OK);
+    fake_time_advance_ms(0); // The schedule's timer runs at once
+    return atoi(resp.status);
+}
+
+static void time_set(int64_t unix_s, int16_t tz)
+{
+    uint32_t t = (uint32_t)unix_s;
+    uint8_t p[6] = {t, t >> 8, t >> 16, t >> 24, (uint8_t)tz, (uint8_t)((uint16_t)tz >> 8)};
+    CHECK(send(CMD_OP_TIME_SET, p, sizeof(p)) == 200);
+}
+
+static void window_set(uint8_t idx, uint8_t days, uint8_t ch, uint16_t start, uint16_t end)
+{
+    uint8_t p[7] = {idx, days, ch, start, start >> 8, end, end >> 8};
+    CHECK(send(CMD_OP_PLAN_WINDOW, p, sizeof(p)) == 200);
+}
+
+static void tariff_set(uint8_t idx, uint8_t days, uint16_t start, uint16_t end, uint16_t price)
+{
+    uint8_t p[8] = {idx, days, start, start >> 8, end, end >> 8, price, price >> 8};
+    CHECK(send(CMD_OP_PLAN_TARIFF, p, sizeof(p)) == 200);
+}
+
+static void prices_set(uint16_t def, uint16_t max, uint8_t cheap)
+{
+    uint8_t p[5] = {def, def >> 8, max, max >> 8, cheap};
+    CHECK(send(CMD_OP_PLAN_PRICES, p, sizeof(p)) == 200);
+}
+
+static void relay_by_hand(bool on)
+{
+    fake_http_resp_t resp;
+    const char *body = on ? "channel=0&on=1" : "channel=0&on=0";
+    CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+    fake_host_run();
+}
+
+static unsigned long nvs_commits(void)
+{
+    fake_nvs_stats_t st;
+    fake_nvs_stats(&st);
+    return st.commits;
+}
+
+static void test_no_clock(void)
+{
+    CHECK(fake_sntp_server() && strcmp(fake_sntp_server(), CONFIG_EVOLTE_SNTP_SERVER) == 0);
+
+    // Monday night into Tuesday, local time; nothing runs without a clock
+    window_set(0, 0x01, 0, 22 * 60, 6 * 60);
+    int64_t now;
+    CHECK(!charge_sched_clock(&now));
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    CHECK(actuator_stats(ACTUATOR_SRC_TIMER)->submitted == 0);
+
+    // Out of range: a channel the charger lacks, an offset no zone has
+    window_set(1, 0x01, CHARGER_RELAY_COUNT, 0, 60);
+    time_set(AT(0, 12, 0), 15 * 60);
+    charge_sched_state_t st;
+    charge_sched_get(&st);
+    CHECK(!st.clock_set && st.plan.windows[1].days == 0);
+    CHECK(charge_sched_stats()->clock_sets == 0);
+}
+
+static void test_edges(void)
+{
+    // 21:59:30 local: off now, on at the minute
+    time_set(AT(0, 20, 59) + 30, TZ_MIN);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    unsigned long writes = fake_gpio_writes();
+    fake_time_advance_ms(29999);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    fake_time_advance_ms(1);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+    CHECK(fake_gpio_writes() == writes + 1);
+    CHECK(actuator_stats(ACTUATOR_SRC_TIMER)->executed == 2);
+
+    // Off by hand: a later sync moves the clock but leaves the relay
+    relay_by_hand(false);
+    fake_sntp_sync(AT(1, 2, 0) * 1000000);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    int64_t now;
+    CHECK(charge_sched_clock(&now) && now == AT(1, 2, 0) * 1000000);
+
+    // Tuesday 06:00 local ends it, and it is back on Monday 22:00
+    fake_sntp_sync((AT(1, 4, 59) + 59) * 1000000);
+    fake_time_advance_ms(1000);
+    charge_sched_state_t st;
+    charge_sched_get(&st);
+    CHECK(st.on_mask == 0 && st.wake_min != TW_NEVER);
+    fake_sntp_sync((AT(7, 20, 59) + 59) * 1000000);
+    relay_by_hand(true);
+    relay_by_hand(false);
+    fake_time_advance_ms(999);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    fake_time_advance_ms(1);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+    CHECK(charge_sched_stats()->wakeups >= 2);
+}
+
+static void test_tariffs(void)
+{
+    // Only the price decides now: cheap nights from 01:00 to 05:00 local
+    window_set(0, 0, 0, 0, 0);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1); // A channel no rule covers is left
+    prices_set(30, 15, 0x01);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    tariff_set(0, 0x7F, 60, 300, 10);
+
+    // 00:59:40 local on Tuesday
+    fake_sntp_sync((AT(8, 23, 59) + 40) * 1000000);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    fake_time_advance_ms(20000);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+    charge_sched_state_t st;
+    charge_sched_get(&st);
+    CHECK(st.price == 10 && st.on_mask == 1);
+
+    // Dearer than the limit from then on
+    prices_set(30, 9, 0x01);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0);
+    prices_set(30, 15, 0x01);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+}
+
+static void test_stored(void)
+{
+    // Changes of a burst share one commit
+    unsigned long commits = nvs_commits();
+    uint32_t plan_commits = charge_sched_stats()->commits;
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 1);
+    window_set(2, 0x60, 0, 9 * 60, 12 * 60);
+    window_set(2, 0x60, 0, 9 * 60, 13 * 60);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 2);
+    CHECK(charge_sched_stats()->commits == plan_commits + 2);
+
+    // Stored plans come back, one not yet committed does not
+    window_set(3, 0x01, 0, 0, 60);
+    fake_nvs_power_cycle();
+    charge_sched_init();
+    charge_sched_state_t st;
+    charge_sched_get(&st);
+    CHECK(st.plan.windows[2].days == 0x60 && st.plan.windows[2].end == 13 * 60);
+    CHECK(st.plan.windows[3].days == 0);
+    CHECK(st.plan.tariffs[0].price == 10 && st.plan.max_price == 15 && st.plan.tz_min == TZ_MIN);
+
+    // A failed commit is tried again after the same delay
+    fake_nvs_fail_commits(2);
+    window_set(3, 0x02, 0, 0, 60);
+    fake_time_advance_ms(2 * CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(charge_sched_stats()->commits == plan_commits + 2);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(charge_sched_stats()->commits == plan_commits + 3);
+    fake_nvs_power_cycle();
+    charge_sched_init();
+    charge_sched_get(&st);
+    CHECK(st.plan.windows[3].days == 0x02);
+
+    // Flash that keeps failing is tried a few times, then again with the
+    // next change
+    plan_commits = charge_sched_stats()->commits;
+    commits = nvs_commits();
+    fake_nvs_fail_commits(100);
+    window_set(3, 0x04, 0, 0, 60);
+    fake_time_advance_ms(10 * CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 3);
+    fake_nvs_fail_commits(0);
+    window_set(3, 0, 0, 0, 0);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 4);
+    CHECK(charge_sched_stats()->commits == plan_commits + 1);
+
+    // The same tariff again, whatever the caller left in the reserved byte,
+    // is no change
+    plan_commits = charge_sched_stats()->commits;
+    charge_tariff_t t = st.plan.tariffs[0];
+    t.reserved = 0xA5;
+    CHECK(charge_sched_set_tariff(0, &t) == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(charge_sched_stats()->commits == plan_commits);
+}
+
+static void test_http(void)
+{
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/schedule", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200 && strcmp(resp.type, "application/json") == 0);
+    resp.body[resp.len] = '\0';
+    CHECK(strstr(resp.body, "\"clock_set\":true") != NULL);
+    CHECK(strstr(resp.body, "\"tz_min\":60,") != NULL);
+    CHECK(strstr(resp.body, "\"windows\":[[2,96,0,540,780]],") != NULL);
+    CHECK(strstr(resp.body, "\"tariffs\":[[0,127,60,300,10]],") != NULL);
+    CHECK(strstr(resp.body, "\"cheap_mask\":1,") != NULL);
+
+    // Every rule in use still fits the reply
+    for (uint8_t i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+        window_set(i, 0x7F, 0, 1439, 1438);
+    for (uint8_t i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+        tariff_set(i, 0x7F, 1439, 1438, 65535);
+    CHECK(fake_http_request(HTTP_GET, "/api/schedule", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len] = '\0';
+    CHECK(atoi(resp.status) == 200 && strstr(resp.body, "\"timer\":{\"submitted\":") != NULL);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run(); // Wi-Fi and HTTP come up on a boot worker task
+
+    test_no_clock();
+    test_edges();
+    test_tariffs();
+    test_stored();
+    test_http();
+    return check_report("charge_sched");
+}
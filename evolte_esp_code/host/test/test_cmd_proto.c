@@ -0,0 +1,88 @@
+#include <string.h>
+#include "check.h"
+#include "cmd_proto.h"
+
+static int relay_calls;
+static uint8_t relay_last[2];
+
+static int op_nop(const cmd_frame_t *frame, void *ctx)
+{
+    return 0;
+}
+
+static int op_relay(const cmd_frame_t *frame, void *ctx)
+{
+    relay_calls++;
+    memcpy(relay_last, frame->payload, 2);
+    return 0;
+}
+
+static const cmd_op_t ops[CMD_OP_COUNT] = {
+    [CMD_OP_NOP] = {.fn = op_nop, .min_len = 0, .max_len = 0},
+    [CMD_OP_RELAY_SET] = {.fn = op_relay, .min_len = 2, .max_len = 2},
+};
+
+static void test_crc(void)
+{
+    CHECK(cmd_proto_crc16((const uint8_t *)"123456789", 9) == 0x29B1);
+}
+
+static void test_batch(void)
+{
+    uint8_t buf[64];
+    size_t n = 0;
+    const uint8_t on[2] = {0, 1}, off[2] = {0, 0};
+
+    n += cmd_proto_encode(&buf[n], sizeof(buf) - n, CMD_OP_RELAY_SET, 1, on, 2);
+    n += cmd_proto_encode(&buf[n], sizeof(buf) - n, CMD_OP_NOP, 2, NULL, 0);
+    n += cmd_proto_encode(&buf[n], sizeof(buf) - n, CMD_OP_RELAY_SET, 3, off, 2);
+    CHECK(n == 3 * CMD_PROTO_OVERHEAD + 4);
+
+    relay_calls = 0;
+    CHECK(cmd_proto_dispatch(buf, n, ops, CMD_OP_COUNT, NULL) == 3);
+    CHECK(relay_calls == 2);
+    CHECK(relay_last[1] == 0);
+
+    // A damaged last frame rejects the whole write
+    relay_calls = 0;
+    buf[n - 1] ^= 0xFF;
+    CHECK(cmd_proto_dispatch(buf, n, ops, CMD_OP_COUNT, NULL) == CMD_PROTO_ERR_CRC);
+    CHECK(relay_calls == 0);
+
+    CHECK(cmd_proto_dispatch(buf, n - 3, ops, CMD_OP_COUNT, NULL) == CMD_PROTO_ERR_TRUNCATED);
+}
+
+static void test_rejects(void)
+{
+    uint8_t buf[16];
+    const uint8_t one[1] = {0};
+
+    size_t n = cmd_proto_encode(buf, sizeof(buf), 0x7F, 0, NULL, 0);
+    CHECK(cmd_proto_dispatch(buf, n, ops, CMD_OP_COUNT, NULL) == CMD_PROTO_ERR_OPCODE);
+
+    n = cmd_proto_encode(buf, sizeof(buf), CMD_OP_RELAY_SET, 0, one, 1);
+    CHECK(cmd_proto_dispatch(buf, n, ops, CMD_OP_COUNT, NULL) == CMD_PROTO_ERR_LEN);
+
+    CHECK(cmd_proto_encode(buf, 4, CMD_OP_NOP, 0, NULL, 0) == 0);
+}
+
+static void test_legacy(void)
+{
+    relay_calls = 0;
+    CHECK(cmd_proto_dispatch((const uint8_t *)"LIGHT ON", 8, ops, CMD_OP_COUNT, NULL) == 1);
+    CHECK(relay_last[0] == 0 && relay_last[1] == 1);
+    CHECK(cmd_proto_dispatch((const uint8_t *)"LIGHT OFF\n", 10, ops, CMD_OP_COUNT, NULL) == 1);
+    CHECK(relay_last[1] == 0);
+    CHECK(relay_calls == 2);
+    CHECK(cmd_proto_dispatch((const uint8_t *)"LIGHT", 5, ops, CMD_OP_COUNT, NULL) == CMD_PROTO_ERR_UNKNOWN);
+}
+
+int main(void)
+{
+    test_crc();
+    test_batch();
+    test_rejects();
+    test_legacy();
+
+    return check_report("cmd_proto");
+}
@@ -0,0 +1,192 @@
+// Config store on the NVS fake: lazy defaults, one flash commit per burst of
+// changes from HTTP or BLE, changes applied even when flash fails, a failed
+// commit tried a few times and again with the next change, values surviving
+// a power cycle and uncommitted ones not.
+#include <string.h>
+#include "check.h"
+#include "cmd_proto.h"
+#include "config_store.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+#include "services/gap/ble_svc_gap.h"
+
+#define UUID_CMD 0xDEAD
+
+static unsigned long nvs_commits(void)
+{
+    fake_nvs_stats_t st;
+    fake_nvs_stats(&st);
+    return st.commits;
+}
+
+static void get(config_field_t f, char *out)
+{
+    config_get_str(f, out, 64);
+}
+
+static void test_defaults(void)
+{
+    char val[64];
+    get(CONFIG_BLE_NAME, val);
+    CHECK(strcmp(val, "eVolte_01") == 0);
+    CHECK(strcmp(ble_svc_gap_device_name(), "eVolte_01") == 0);
+    get(CONFIG_WIFI_SSID, val);
+    CHECK(val[0] == '\0');
+    CHECK(nvs_commits() == 0);
+}
+
+static void test_http_burst(void)
+{
+    fake_http_resp_t resp;
+    unsigned long commits = nvs_commits();
+    const char *body = "name=Bay+4&ssid=depot&password=hunter22";
+
+    CHECK(fake_http_request(HTTP_POST, "/set_config", body, strlen(body), &resp) == ESP_OK);
+    CHECK(nvs_commits() == commits);
+    CHECK(config_dirty_mask() == (CONFIG_BIT(CONFIG_BLE_NAME) | CONFIG_BIT(CONFIG_WIFI_SSID) |
+                                  CONFIG_BIT(CONFIG_WIFI_PASS)));
+
+    // Applied together once the commit delay is over
+    CHECK(strcmp(ble_svc_gap_device_name(), "eVolte_01") == 0);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 1);
+    CHECK(config_dirty_mask() == 0);
+    CHECK(strcmp(ble_svc_gap_device_name(), "Bay 4") == 0);
+    CHECK(strcmp(fake_wifi_ssid(), "depot") == 0);
+
+    // Writing the same values again touches nothing
+    CHECK(fake_http_request(HTTP_POST, "/set_config", body, strlen(body), &resp) == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 1);
+}
+
+static size_t config_frames(uint8_t *out, size_t cap, config_field_t field, const char *val, uint8_t seq)
+{
+    size_t n = 0, len = strlen(val);
+    for (size_t off = 0; off == 0 || off < len; off += CMD_PROTO_MAX_PAYLOAD - 2)
+    {
+        uint8_t payload[CMD_PROTO_MAX_PAYLOAD] = {field, (uint8_t)off};
+        size_t part = len - off < CMD_PROTO_MAX_PAYLOAD - 2 ? len - off : CMD_PROTO_MAX_PAYLOAD - 2;
+        memcpy(&payload[2], &val[off], part);
+        n += cmd_proto_encode(&out[n], cap - n, CMD_OP_CONFIG_SET, seq++, payload, (uint8_t)(part + 2));
+    }
+    return n;
+}
+
+static void test_ble_burst(void)
+{
+    const char *pass = "a-long-site-password-that-needs-two-frames";
+    uint8_t buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+    char val[64];
+    unsigned long commits = nvs_commits();
+
+    size_t n = config_frames(buf, sizeof(buf), CONFIG_WIFI_PASS, pass, 0);
+    n += config_frames(&buf[n], sizeof(buf) - n, CONFIG_BLE_NAME, "Bay 5", 4);
+    fake_gap_connect(1);
+    CHECK(fake_gatt_write(1, UUID_CMD, buf, n) == 0);
+    get(CONFIG_WIFI_PASS, val);
+    CHECK(strcmp(val, pass) == 0);
+
+    // A second write inside the window joins the same commit
+    n = config_frames(buf, sizeof(buf), CONFIG_WIFI_SSID, "depot-2", 9);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS / 2);
+    CHECK(fake_gatt_write(1, UUID_CMD, buf, n) == 0);
+    CHECK(nvs_commits() == commits);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 1);
+    CHECK(strcmp(ble_svc_gap_device_name(), "Bay 5") == 0);
+    CHECK(strcmp(fake_wifi_ssid(), "depot-2") == 0);
+    fake_gap_disconnect(1);
+}
+
+static void test_power_cycle(void)
+{
+    char val[64];
+
+    // Committed values come back, a change still waiting for its commit does not
+    CHECK(config_set_str(CONFIG_BLE_NAME, "Bay 6") == ESP_OK);
+    config_commit();
+    CHECK(config_set_str(CONFIG_BLE_NAME, "Bay 7") == ESP_OK);
+    fake_nvs_power_cycle();
+    config_store_init(NULL);
+
+    get(CONFIG_BLE_NAME, val);
+    CHECK(strcmp(val, "Bay 6") == 0);
+    get(CONFIG_WIFI_PASS, val);
+    CHECK(strcmp(val, "a-long-site-password-that-needs-two-frames") == 0);
+}
+
+static void test_failed_commit(void)
+{
+    char val[64];
+    unsigned long commits = nvs_commits();
+
+    // A commit that fails still applies the change, is tried again after the
+    // same delay, and a change in between goes with it
+    fake_nvs_fail_commits(1);
+    CHECK(config_set_str(CONFIG_BLE_NAME, "Bay 8") == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 1);
+    CHECK(config_dirty_mask() == CONFIG_BIT(CONFIG_BLE_NAME));
+    CHECK(strcmp(ble_svc_gap_device_name(), "Bay 8") == 0);
+    CHECK(config_set_str(CONFIG_WIFI_SSID, "depot-3") == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 2);
+    CHECK(config_dirty_mask() == 0);
+    CHECK(strcmp(fake_wifi_ssid(), "depot-3") == 0);
+
+    // Also with nothing else changing
+    fake_nvs_fail_commits(2);
+    CHECK(config_set_str(CONFIG_BLE_NAME, "Bay 9") == ESP_OK);
+    fake_time_advance_ms(3 * CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 5 && config_dirty_mask() == 0);
+
+    // Flash that keeps failing: applied at once, a few tries, then nothing
+    // until the next change
+    fake_nvs_fail_commits(100);
+    CHECK(config_set_str(CONFIG_BLE_NAME, "Bay 10") == ESP_OK);
+    fake_time_advance_ms(10 * CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(strcmp(ble_svc_gap_device_name(), "Bay 10") == 0);
+    CHECK(nvs_commits() == commits + 8);
+    CHECK(config_dirty_mask() == CONFIG_BIT(CONFIG_BLE_NAME));
+    fake_nvs_fail_commits(0);
+    CHECK(config_set_str(CONFIG_WIFI_SSID, "depot-4") == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(nvs_commits() == commits + 9 && config_dirty_mask() == 0);
+    CHECK(strcmp(fake_wifi_ssid(), "depot-4") == 0);
+
+    fake_nvs_power_cycle();
+    config_store_init(NULL);
+    get(CONFIG_BLE_NAME, val);
+    CHECK(strcmp(val, "Bay 10") == 0);
+}
+
+static void test_limits(void)
+{
+    char longest[64];
+    memset(longest, 'x', sizeof(longest));
+    longest[config_field_size(CONFIG_BLE_NAME)] = '\0';
+    CHECK(config_set_str(CONFIG_BLE_NAME, longest) == ESP_ERR_INVALID_SIZE);
+    longest[config_field_size(CONFIG_BLE_NAME) - 1] = '\0';
+    CHECK(config_set_str(CONFIG_BLE_NAME, longest) == ESP_OK);
+
+    // A piece may not start past the end of the current value
+    CHECK(config_set_part(CONFIG_WIFI_SSID, 40, (const uint8_t *)"x", 1) != ESP_OK);
+    CHECK(config_set_part(CONFIG_WIFI_SSID, 0, (const uint8_t *)"a\0b", 3) == ESP_ERR_INVALID_SIZE);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run(); // Wi-Fi and HTTP come up on a boot worker task
+
+    test_defaults();
+    test_http_burst();
+    test_ble_burst();
+    test_failed_commit();
+    test_power_cycle();
+    test_limits();
+
+    return check_report("config");
+}
@@ -0,0 +1,168 @@
+// Connection parameter policy against the whole firmware: a connection is
+// kept on short intervals while commands come in, relaxes to long intervals
+// with peripheral latency once idle, and comes back on the next command.
+// Refusals are retried a bounded number of times, and the central may change
+// the parameters on its own at any point.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "cmd_proto.h"
+#include "conn_policy.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "host/ble_hs.h"
+#include "sdkconfig.h"
+
+#define UUID_CMD 0xDEAD
+#define IDLE_MS (CONFIG_EVOLTE_CONN_IDLE_S * 1000)
+
+static uint8_t seq;
+
+// Worst case for a write to reach the charger: the peripheral listens once
+// every latency + 1 intervals
+static uint32_t link_latency_us(uint16_t conn)
+{
+    struct ble_gap_conn_desc desc;
+    CHECK(ble_gap_conn_find(conn, &desc) == 0);
+    return desc.conn_itvl * 1250u * (desc.conn_latency + 1);
+}
+
+static void nop(uint16_t conn)
+{
+    uint8_t frame[CMD_PROTO_OVERHEAD];
+    size_t len = cmd_proto_encode(frame, sizeof(frame), CMD_OP_NOP, ++seq, NULL, 0);
+    CHECK(fake_gatt_write(conn, UUID_CMD, frame, len) == 0);
+    fake_host_run();
+}
+
+static void advance(uint32_t ms)
+{
+    fake_time_advance_ms(ms);
+    fake_host_run();
+}
+
+static const char *diag(void)
+{
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/diag/ble", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    return resp.body;
+}
+
+static void test_active_idle(void)
+{
+    fake_gap_central_itvl(6, 3200, false);
+    fake_gap_connect(1);
+    fake_host_run();
+
+    // The phone's 30 ms default already serves a command in time
+    CHECK(link_latency_us(1) <= 50000);
+    CHECK(strstr(diag(), "{\"conn\":1,\"mode\":\"active\",\"itvl_us\":30000,\"latency\":0,") != NULL);
+
+    // Commands now and then keep it active
+    for (int i = 0; i < 5; i++)
+    {
+        advance(IDLE_MS / 2);
+        nop(1);
+        CHECK(link_latency_us(1) <= 50000);
+    }
+    CHECK(strstr(diag(), "\"mode\":\"active\"") != NULL);
+
+    // Quiet for the idle time: long intervals and peripheral latency
+    unsigned long reqs = fake_gap_update_requests();
+    advance(IDLE_MS + 10);
+    CHECK(fake_gap_update_requests() == reqs + 1);
+    CHECK(strstr(diag(), "\"mode\":\"idle\",\"itvl_us\":300000,\"latency\":4,\"timeout_ms\":6000,") != NULL);
+    printf("conn_policy: idle link sleeps up to %u ms\n", (unsigned)(link_latency_us(1) / 1000));
+    CHECK(link_latency_us(1) >= 150000);
+
+    // Idle stays idle without more requests
+    advance(IDLE_MS * 3);
+    CHECK(fake_gap_update_requests() == reqs + 1);
+
+    // The next command brings the short intervals back
+    nop(1);
+    CHECK(fake_gap_update_requests() == reqs + 2);
+    CHECK(link_latency_us(1) <= 50000);
+    const char *d = diag();
+    CHECK(strstr(d, "\"mode\":\"active\",\"itvl_us\":30000,\"latency\":0,\"timeout_ms\":4000,\"updates\":2,") != NULL);
+    unsigned long idle_ms = 0;
+    const char *p = strstr(d, "\"idle_ms\":");
+    CHECK(p != NULL && sscanf(p, "\"idle_ms\":%lu", &idle_ms) == 1);
+    CHECK(idle_ms >= IDLE_MS * 3 && idle_ms < IDLE_MS * 3 + 100);
+    fake_gap_disconnect(1);
+    fake_host_run();
+}
+
+static void test_slow_connect(void)
+{
+    // Moved to a long interval by the central while active: asked for a
+    // short one straight away
+    fake_gap_central_itvl(6, 3200, false);
+    fake_gap_connect(2);
+    fake_host_run();
+    unsigned long reqs = fake_gap_update_requests();
+    fake_gap_conn_params(2, 80, 0, 400);
+    CHECK(link_latency_us(2) == 100000);
+    CHECK(fake_gap_update_requests() == reqs + 1);
+    fake_host_run();
+    CHECK(link_latency_us(2) <= 50000);
+    fake_gap_disconnect(2);
+    fake_host_run();
+}
+
+static void test_refused(void)
+{
+    fake_gap_central_itvl(6, 3200, true);
+    fake_gap_connect(3);
+    fake_host_run();
+    unsigned long reqs = fake_gap_update_requests();
+    advance(IDLE_MS + 10);
+    CHECK(fake_gap_update_requests() == reqs + 1);
+
+    // Retried every CONN_POLICY_RETRY_MS, then left alone
+    advance(CONN_POLICY_RETRY_MS * (CONN_POLICY_TRIES + 3));
+    CHECK(fake_gap_update_requests() == reqs + CONN_POLICY_TRIES);
+    CHECK(strstr(diag(), "\"mode\":\"idle\",\"itvl_us\":30000,") != NULL);
+
+    // A central that lets through only short intervals still lets the link
+    // relax with peripheral latency
+    fake_gap_central_itvl(6, 24, false);
+    nop(3);
+    advance(IDLE_MS + 10);
+    CHECK(link_latency_us(3) == 150000);
+    CHECK(strstr(diag(), "\"mode\":\"idle\",\"itvl_us\":30000,\"latency\":4,") != NULL);
+
+    // The central goes back to a long interval on its own while a command
+    // is due: the policy asks again
+    nop(3);
+    CHECK(link_latency_us(3) <= 50000);
+    fake_gap_central_itvl(6, 3200, false);
+    fake_gap_conn_params(3, 200, 0, 600);
+    fake_host_run();
+    CHECK(link_latency_us(3) <= 50000);
+    fake_gap_disconnect(3);
+    fake_host_run();
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+
+    test_active_idle();
+    test_slow_connect();
+    test_refused();
+
+    fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    const conn_policy_stats_t *st = conn_policy_stats();
+    char want[128];
+    snprintf(want, sizeof(want), "\"link\":{\"requests\":%lu,\"updates\":%lu,\"refused\":%d,\"relaxed\":3}",
+             (unsigned long)st->requests, (unsigned long)st->updates, CONN_POLICY_TRIES);
+    CHECK(strstr(resp.body, want) != NULL);
+    CHECK(strstr(diag(), "\"links\":[]") != NULL);
+    return check_report("conn_policy");
+}
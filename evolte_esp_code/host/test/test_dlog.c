@@ -0,0 +1,104 @@
+// Deferred log: records drained by the dlog task decode back to the expected
+// text, a full ring drops and reports the loss, and statements above the
+// configured level leave no record.
+#include <stdio.h>
+#include <string.h>
+#include "check.h"
+#include "dlog.h"
+#include "dlog_text.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+
+#define UUID_CMD 0xDEAD
+
+static char lines[256][128];
+static int n_lines;
+
+static void capture(const uint8_t *rec, size_t len)
+{
+    dlog_text_rec_t r;
+    CHECK(dlog_text_parse(rec, len, &r) == (int)len);
+    if (n_lines < 256)
+        dlog_text_format(&r, lines[n_lines++], sizeof(lines[0]));
+}
+
+static bool logged(const char *text)
+{
+    for (int i = 0; i < n_lines; i++)
+        if (strstr(lines[i], text))
+            return true;
+    return false;
+}
+
+static void test_formats(void)
+{
+    // Every format must only use conversions a record can carry
+    static const char *const fmts[] = {
+#define DLOG_FMT(name, level, tag, fmt) fmt,
+#include "dlog_fmt.def"
+#undef DLOG_FMT
+    };
+    for (int id = 0; id < DLOG_FMT_COUNT; id++)
+    {
+        int n = dlog_text_conversions(fmts[id]);
+        CHECK(n >= 0 && n <= DLOG_MAX_ARGS);
+    }
+
+    // A record whose argument count does not match is flagged, not printed
+    dlog_text_rec_t rec = {.id = DLOG_GAP_MTU, .nargs = 1};
+    char text[128];
+    dlog_text_format(&rec, text, sizeof(text));
+    CHECK(text[0] == '?');
+    CHECK(dlog_text_line("I (5) boot: DL:zz", &rec) == -1);
+}
+
+static void test_drain_task(void)
+{
+    n_lines = 0;
+    fake_gap_connect(1);
+    fake_gap_mtu(1, 185);
+    fake_gatt_write(1, UUID_CMD, "\xA5\x01\x00\x02\x00\x01\x00\x00", 8);
+
+    // Nothing is formatted on the calling task
+    CHECK(n_lines == 0);
+    fake_time_advance_ms(100);
+    CHECK(logged("I (") && logged("GAP: Connect on 1, status 0"));
+    CHECK(logged("GAP: MTU 185 on connection 1"));
+    CHECK(logged("W (") && logged("BLE-Server: Rejected command frame: -2"));
+
+    // Debug level statements are compiled out at the default level
+    DLOG(GAP_ADV_COMPLETE, 0);
+    CHECK(dlog_drain() == (DLOG_LVL_GAP_ADV_COMPLETE <= CONFIG_EVOLTE_DLOG_LEVEL));
+    fake_gap_disconnect(1);
+}
+
+static void test_overflow(void)
+{
+    fake_time_advance_ms(100);
+    n_lines = 0;
+    uint32_t dropped = dlog_stats()->dropped;
+
+    for (int i = 0; i < CONFIG_EVOLTE_DLOG_RING_LEN + 10; i++)
+        DLOG(CMD_REJECTED, i);
+    CHECK(dlog_stats()->dropped == dropped + 10);
+    CHECK(dlog_drain() == CONFIG_EVOLTE_DLOG_RING_LEN);
+
+    // The loss is reported ahead of the next record
+    DLOG(CMD_REJECTED, 99);
+    CHECK(dlog_drain() == 2);
+    CHECK(strstr(lines[n_lines - 2], "dlog: 10 record(s) dropped") != NULL);
+    CHECK(strstr(lines[n_lines - 1], "frame: 99") != NULL);
+}
+
+int main(void)
+{
+    dlog_set_sink(capture);
+    app_main();
+    fake_time_advance_ms(100);
+
+    test_formats();
+    test_drain_task();
+    test_overflow();
+
+    return check_report("dlog");
+}
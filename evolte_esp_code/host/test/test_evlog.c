@@ -0,0 +1,349 @@
+// Session log on simulated NOR flash: encoding round trip and time range
+// queries, wear levelling over many laps of the ring, power cuts at every
+// byte of a write followed by a remount, then sessions and faults logged by
+// the whole firmware through the HTTP relay API.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "charger.h"
+#include "check.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "evlog.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+
+#define SECTORS 64
+#define SECTOR 4096
+#define RELAY_GPIO 13
+
+static uint32_t ts_next;
+
+static void flash_wipe(void)
+{
+    const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "evlog");
+    CHECK(p != NULL && p->size == SECTORS * SECTOR);
+    memset(fake_flash_mem("evlog"), 0xFF, p->size);
+}
+
+// Queue and write one record, so the queue never fills
+static void put(evlog_rec_t rec)
+{
+    evlog_append(&rec);
+    evlog_sync();
+}
+
+static evlog_rec_t energy(uint32_t i)
+{
+    return (evlog_rec_t){.type = EVLOG_ENERGY,
+                         .channel = 0,
+                         .ts = ts_next += 900,
+                         .energy_wh = 100 + i % 3000,
+                         .power_w = (int32_t)(i % 7000) - 100};
+}
+
+static bool rec_eq(const evlog_rec_t *a, const evlog_rec_t *b)
+{
+    return a->type == b->type && a->channel == b->channel && a->ts == b->ts && a->energy_wh == b->energy_wh &&
+           a->power_w == b->power_w && a->flags == b->flags;
+}
+
+// Skips BOOT records, whose time the test does not choose
+static bool next_logged(evlog_cursor_t *c, evlog_rec_t *rec)
+{
+    while (evlog_next(c, rec))
+        if (rec->type != EVLOG_BOOT)
+            return true;
+    return false;
+}
+
+// The widest record still fits the length nibble
+static void test_pack(void)
+{
+    evlog_rec_t wide = {.type = EVLOG_ENERGY,
+                        .channel = 255,
+                        .ts = UINT32_MAX,
+                        .energy_wh = UINT32_MAX,
+                        .power_w = INT32_MIN},
+                back;
+    uint8_t buf[EVLOG_PACK_MAX];
+    CHECK(evlog_pack(&wide, 0, buf) == EVLOG_PACK_MAX);
+    CHECK(evlog_unpack(buf, sizeof(buf), 0, &back) == EVLOG_PACK_MAX && rec_eq(&back, &wide));
+    CHECK(evlog_unpack(buf, sizeof(buf) - 1, 0, &back) == -1);
+}
+
+static void test_roundtrip(void)
+{
+    flash_wipe();
+    evlog_init();
+    evlog_sync();
+    const evlog_stats_t *st = evlog_stats();
+    CHECK(st->sectors == SECTORS && st->sectors_used == 1 && st->written == 1);
+
+    evlog_rec_t in[] = {
+        {.type = EVLOG_SESSION_START, .channel = 0, .ts = 1000},
+        {.type = EVLOG_ENERGY, .channel = 0, .ts = 1900, .energy_wh = 1840, .power_w = 7360},
+        {.type = EVLOG_ENERGY, .channel = 0, .ts = 2800, .energy_wh = 0, .power_w = -12},
+        {.type = EVLOG_FAULT, .ts = 2801, .flags = 0x80000002},
+        {.type = EVLOG_SESSION_STOP, .channel = 0, .ts = 200000, .energy_wh = 4000000000u},
+    };
+    int n = sizeof(in) / sizeof(in[0]);
+    for (int i = 0; i < n; i++)
+        put(in[i]);
+
+    evlog_cursor_t c;
+    evlog_rec_t out;
+    evlog_seek(&c, 0);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_BOOT && out.flags == ESP_RST_POWERON);
+    for (int i = 0; i < n; i++)
+        CHECK(evlog_next(&c, &out) && rec_eq(&out, &in[i]));
+    CHECK(!evlog_next(&c, &out));
+
+    // A cursor at the end picks up later records
+    put((evlog_rec_t){.type = EVLOG_SESSION_START, .channel = 0, .ts = 200001});
+    CHECK(evlog_next(&c, &out) && out.ts == 200001);
+
+    // Range query starts mid sector
+    evlog_seek(&c, 2800);
+    CHECK(evlog_next(&c, &out) && rec_eq(&out, &in[2]));
+
+    // Times never go backwards, the log clamps them
+    put((evlog_rec_t){.type = EVLOG_FAULT, .ts = 5, .flags = 1});
+    CHECK(evlog_next(&c, &out) && rec_eq(&out, &in[3]));
+    CHECK(evlog_next(&c, &out) && rec_eq(&out, &in[4]));
+    CHECK(evlog_next(&c, &out) && out.ts == 200001);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_FAULT && out.ts == 200001);
+    CHECK(!evlog_next(&c, &out));
+
+    // Remount finds the same records and carries on after them
+    evlog_init();
+    evlog_sync();
+    CHECK(evlog_now() >= 200001);
+    evlog_seek(&c, 200001);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_SESSION_START);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_FAULT);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_BOOT);
+    CHECK(!evlog_next(&c, &out));
+}
+
+// A session a day, ENERGY every 15 minutes of a two hour charge
+static void test_capacity(void)
+{
+    flash_wipe();
+    evlog_init();
+    ts_next = 1;
+    const evlog_stats_t *st = evlog_stats();
+    uint32_t sessions = 0;
+    while (st->sectors_lost == 0)
+    {
+        put((evlog_rec_t){.type = EVLOG_SESSION_START, .ts = ts_next += 57600});
+        for (uint32_t i = 0; i < 8; i++)
+            put(energy(i));
+        put((evlog_rec_t){.type = EVLOG_SESSION_STOP, .ts = ts_next += 1, .energy_wh = 14720});
+        sessions++;
+    }
+    printf("capacity: %u sessions of 10 records in %u sectors\n", (unsigned)sessions, SECTORS);
+    CHECK(sessions > 3000);
+    CHECK(st->write_errors == 0 && st->dropped == 0);
+}
+
+// Many laps of the ring: every sector erased as often as any other, and the
+// oldest records are given up a sector at a time
+static void test_wear(void)
+{
+    flash_wipe();
+    evlog_init();
+    ts_next = 1;
+    const evlog_stats_t *st = evlog_stats();
+    uint32_t min0, max0, min, max;
+    fake_flash_wear("evlog", &min0, &max0);
+    uint32_t i = 0;
+    while (st->sectors_lost < 5 * SECTORS + 17)
+        put(energy(i++));
+    fake_flash_wear("evlog", &min, &max);
+    CHECK(max - max0 - (min - min0) <= 1);
+    CHECK(st->sectors_used == SECTORS);
+
+    // Everything still held reads back in order and ends with the last record
+    evlog_cursor_t c;
+    evlog_rec_t out, prev = {0};
+    uint32_t n = 0;
+    evlog_seek(&c, 0);
+    while (evlog_next(&c, &out))
+    {
+        CHECK(out.ts > prev.ts);
+        prev = out;
+        n++;
+    }
+    ts_next -= 900;
+    evlog_rec_t last = energy(i - 1);
+    CHECK(rec_eq(&prev, &last));
+    CHECK(n > (SECTORS - 1) * (SECTOR / 10) && n < SECTORS * SECTOR / 6);
+
+    // A query starting before the oldest held record gets the oldest
+    evlog_rec_t first;
+    evlog_seek(&c, 1);
+    CHECK(evlog_next(&c, &first));
+    evlog_seek(&c, first.ts);
+    CHECK(evlog_next(&c, &out) && rec_eq(&out, &first));
+
+    // A cursor overtaken by the ring skips to what is left
+    evlog_seek(&c, 0);
+    CHECK(evlog_next(&c, &out));
+    for (uint32_t k = 0; k < SECTOR; k++)
+        put(energy(i++));
+    CHECK(evlog_next(&c, &out) && out.ts > first.ts);
+}
+
+// Cut power after every possible number of programmed bytes of a burst that
+// crosses into a new sector, then boot again
+static void test_power_cut(void)
+{
+    enum
+    {
+        BEFORE = 560, // Leaves the head sector almost full
+        BURST = 40
+    };
+    uint32_t torn = 0, cuts = 0;
+    for (long cut = 0;; cut++)
+    {
+        flash_wipe();
+        fake_flash_cut_after(-1);
+        evlog_init();
+        ts_next = 1;
+        evlog_rec_t burst[BURST];
+        for (uint32_t i = 0; i < BEFORE; i++)
+            put(energy(i));
+        for (uint32_t i = 0; i < BURST; i++)
+            burst[i] = energy(BEFORE + i);
+
+        fake_flash_cut_after(cut);
+        for (uint32_t i = 0; i < BURST; i++)
+            put(burst[i]);
+        bool was_cut = !fake_flash_powered();
+        fake_flash_cut_after(-1);
+        evlog_init();
+        torn += evlog_stats()->torn;
+
+        // Every record before the cut, then part of the burst, nothing else
+        evlog_cursor_t c;
+        evlog_rec_t out;
+        evlog_seek(&c, 0);
+        uint32_t ts = ts_next;
+        ts_next = 1;
+        for (uint32_t i = 0; i < BEFORE; i++)
+        {
+            evlog_rec_t want = energy(i);
+            CHECK(next_logged(&c, &out) && rec_eq(&out, &want));
+        }
+        ts_next = ts;
+        uint32_t got = 0;
+        while (next_logged(&c, &out))
+        {
+            CHECK(got < BURST && rec_eq(&out, &burst[got]));
+            got++;
+        }
+        CHECK(got == BURST || was_cut);
+
+        // and appending carries on after them
+        evlog_rec_t after = {.type = EVLOG_SESSION_STOP, .ts = ts_next += 1, .energy_wh = 7};
+        put(after);
+        CHECK(next_logged(&c, &out) && rec_eq(&out, &after));
+        CHECK(!next_logged(&c, &out));
+
+        cuts++;
+        if (!was_cut)
+            break;
+    }
+    CHECK(cuts > BURST * 6);
+    CHECK(torn > 0);
+}
+
+// A corrupt byte costs the rest of its sector and nothing more
+static void test_corrupt(void)
+{
+    flash_wipe();
+    evlog_init();
+    ts_next = 1;
+    for (uint32_t i = 0; i < 1500; i++)
+        put(energy(i));
+    fake_flash_mem("evlog")[100] ^= 0x10;
+    evlog_init();
+
+    evlog_cursor_t c;
+    evlog_rec_t out, prev = {0};
+    uint32_t n = 0;
+    bool gap = false;
+    evlog_seek(&c, 0);
+    while (next_logged(&c, &out))
+    {
+        gap |= prev.ts && out.ts != prev.ts + 900;
+        prev = out;
+        n++;
+    }
+    CHECK(gap);
+    CHECK(n > 1500 - SECTOR / 6 && n < 1500);
+    CHECK(out.ts == 1 + 1500 * 900);
+}
+
+static int http(httpd_method_t method, const char *uri, const char *body, fake_http_resp_t *resp)
+{
+    CHECK(fake_http_request(method, uri, body, body ? strlen(body) : 0, resp) == ESP_OK);
+    resp->body[resp->len < sizeof(resp->body) ? resp->len : sizeof(resp->body) - 1] = '\0';
+    return atoi(resp->status);
+}
+
+// Relay changes through the firmware become session records
+static void test_sessions(void)
+{
+    fake_http_resp_t resp;
+    evlog_cursor_t c;
+    evlog_rec_t out;
+
+    flash_wipe();
+    app_main();
+    fake_host_run();
+    evlog_seek(&c, 0);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_BOOT);
+
+    CHECK(http(HTTP_POST, "/api/relay", "channel=0&on=1", &resp) == 200);
+    fake_time_advance_ms(3000);
+    CHECK(http(HTTP_POST, "/api/relay", "channel=0&on=1", &resp) == 200);
+    CHECK(http(HTTP_POST, "/api/relay", "channel=0&on=0", &resp) == 200);
+    fake_host_run();
+
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_SESSION_START && out.channel == 0);
+    uint32_t start = out.ts;
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_SESSION_STOP && out.energy_wh == 0);
+    CHECK(out.ts - start >= 2 && out.ts - start <= 4);
+    CHECK(!evlog_next(&c, &out));
+
+    CHECK(http(HTTP_GET, "/api/counters", NULL, &resp) == 200);
+    CHECK(strstr(resp.body, "\"evlog\":{\"appended\":3,\"written\":3,\"dropped\":0,") != NULL);
+
+    // A fault is logged when it is raised, not with the next ENERGY record
+    fake_time_advance_ms(100 * 1000);
+    fake_gpio_fail(RELAY_GPIO, true);
+    CHECK(http(HTTP_POST, "/api/relay", "channel=0&on=1", &resp) == 200);
+    fake_gpio_fail(RELAY_GPIO, false);
+    fake_time_advance_ms((CONFIG_EVOLTE_EVLOG_ENERGY_S + 1) * 1000);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_FAULT && out.flags == CHARGER_ERR_RELAY_GPIO);
+    uint32_t fault = out.ts;
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_SESSION_START && out.ts == fault);
+    CHECK(evlog_next(&c, &out) && out.type == EVLOG_ENERGY);
+    CHECK(!evlog_next(&c, &out));
+    CHECK(http(HTTP_POST, "/api/relay", "channel=0&on=0", &resp) == 200);
+}
+
+int main(void)
+{
+    test_pack();
+    test_roundtrip();
+    test_capacity();
+    test_wear();
+    test_power_cut();
+    test_corrupt();
+    test_sessions();
+    return check_report("evlog");
+}
@@ -0,0 +1,236 @@
+// Firmware behaviour through the host fakes: GATT writes and reads,
+// status notifications, GAP advertising and the HTTP config handler.
+#include <string.h>
+#include "actuator.h"
+#include "check.h"
+#include "ble_session.h"
+#include "cmd_proto.h"
+#include "cmd_ring.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+#include "status_snapshot.h"
+
+#define UUID_STATUS 0xFEF4
+#define UUID_CMD 0xDEAD
+#define LIGHT_GPIO 13
+
+static void test_write_read(void)
+{
+    uint8_t val[64] = {0};
+    size_t len = 0;
+
+    // Writes from a handle without a session are refused
+    CHECK(fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8) == BLE_ATT_ERR_UNLIKELY);
+
+    fake_gap_connect(1);
+    CHECK(fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8) == 0);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 1);
+    fake_gap_mtu(1, 256);
+    CHECK(fake_gatt_read(1, UUID_STATUS, val, sizeof(val), &len) == 0);
+    CHECK(len == STATUS_SNAPSHOT_SIZE);
+    CHECK(val[0] == STATUS_SNAPSHOT_VERSION && val[1] == STATUS_SNAPSHOT_SIZE);
+    CHECK(val[3] == 1);                         // relay_mask
+    CHECK(val[12] == 0 && val[14] == 1);        // fw_version 1.0.0
+    CHECK(val[16] == 1);                        // cmds_run
+    CHECK(val[28] == 1);                        // sessions
+
+    uint8_t frame[16];
+    const uint8_t off[2] = {0, 0};
+    size_t n = cmd_proto_encode(frame, sizeof(frame), CMD_OP_RELAY_SET, 1, off, 2);
+    CHECK(fake_gatt_write(1, UUID_CMD, frame, n) == 0);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 0);
+
+    frame[n - 1] ^= 1;
+    CHECK(fake_gatt_write(1, UUID_CMD, frame, n) == BLE_ATT_ERR_UNLIKELY);
+    CHECK(fake_gatt_read(1, UUID_STATUS, val, sizeof(val), &len) == 0);
+    CHECK(val[3] == 0 && val[20] == 1); // relay off, one rejected write
+    fake_gap_disconnect(1);
+}
+
+// At the default MTU the snapshot needs a Read plus two Read Blobs; all must
+// see the same value even if the state changes in between
+static void test_long_read(void)
+{
+    uint8_t first[64], second[64], third[64];
+    size_t len;
+
+    fake_gap_connect(1);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    CHECK(fake_gatt_read(1, UUID_STATUS, first, sizeof(first), &len) == 0);
+    fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8);
+    CHECK(fake_gatt_read(1, UUID_STATUS, second, sizeof(second), &len) == 0);
+    CHECK(memcmp(first, second, STATUS_SNAPSHOT_SIZE) == 0);
+    CHECK(fake_gatt_read(1, UUID_STATUS, second, sizeof(second), &len) == 0);
+    CHECK(memcmp(first, second, STATUS_SNAPSHOT_SIZE) == 0);
+
+    // The long read is complete, the next one sees the new state
+    CHECK(fake_gatt_read(1, UUID_STATUS, third, sizeof(third), &len) == 0);
+    CHECK(first[3] == 0 && third[3] == 1);
+
+    // Notifications carry MTU - 3 bytes
+    fake_gap_subscribe(1, UUID_STATUS, true, false);
+    CHECK(fake_gatt_tx_last()->len == BLE_ATT_MTU_DFLT - 3);
+    fake_gap_disconnect(1);
+}
+
+static void test_notify(void)
+{
+    fake_gap_connect(1);
+    fake_gap_mtu(1, 256);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    fake_gap_subscribe(1, UUID_STATUS, true, false);
+
+    // The current value is pushed on subscribe
+    unsigned long tx = fake_gatt_tx_count();
+    CHECK(tx >= 1);
+    CHECK(fake_gatt_tx_last()->attr_handle == fake_gatt_val_handle(UUID_STATUS));
+
+    fake_time_advance_ms(1000);
+    fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8);
+    CHECK(fake_gatt_tx_count() == tx + 1);
+    CHECK(fake_gatt_tx_last()->data[3] == 1);
+
+    // Changes inside the window collapse into one push with the latest state
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    CHECK(fake_gatt_tx_count() == tx + 1);
+    fake_time_advance_ms(CONFIG_EVOLTE_NOTIFY_COALESCE_MS);
+    CHECK(fake_gatt_tx_count() == tx + 2);
+    CHECK(fake_gatt_tx_last()->data[3] == 0);
+
+    // Writing the same state again does not notify
+    fake_time_advance_ms(1000);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    fake_time_advance_ms(1000);
+    CHECK(fake_gatt_tx_count() == tx + 2);
+
+    fake_gap_disconnect(1);
+    CHECK(fake_gap_adv_active());
+}
+
+// The write handler only queues; the actuator task applies the command later
+static void test_actuator(void)
+{
+    fake_gap_connect(1);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    uint32_t executed = actuator_stats(ACTUATOR_SRC_BLE)->executed;
+
+    fake_tasks_hold(true);
+    CHECK(fake_gatt_write(1, UUID_CMD, "LIGHT ON", 8) == 0);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 0);
+    CHECK(actuator_depth(ACTUATOR_SRC_BLE) == 1);
+
+    fake_tasks_hold(false);
+    fake_host_run();
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 1);
+    CHECK(actuator_depth(ACTUATOR_SRC_BLE) == 0);
+    CHECK(actuator_stats(ACTUATOR_SRC_BLE)->executed == executed + 1);
+    CHECK(actuator_stats(ACTUATOR_SRC_BLE)->depth_max >= 1);
+
+    // A full ring leaves the rest of a batch in the session queue
+    uint8_t batch[CMD_PROTO_MAX_FRAMES * (CMD_PROTO_OVERHEAD + 2)];
+    size_t len = 0;
+    for (int i = 0; i < CMD_PROTO_MAX_FRAMES; i++)
+    {
+        const uint8_t payload[2] = {0, (uint8_t)(i & 1)};
+        len += cmd_proto_encode(&batch[len], sizeof(batch) - len, CMD_OP_RELAY_SET, (uint8_t)i, payload, 2);
+    }
+    fake_tasks_hold(true);
+    for (int i = 0; i < CMD_RING_LEN / CMD_PROTO_MAX_FRAMES + 1; i++)
+    {
+        CHECK(fake_gatt_write(1, UUID_CMD, batch, len) == 0);
+        fake_time_advance_ms(1);
+    }
+    CHECK(actuator_depth(ACTUATOR_SRC_BLE) == CMD_RING_LEN);
+    CHECK(ble_session_find(1)->q_count == CMD_PROTO_MAX_FRAMES);
+    fake_tasks_hold(false);
+    fake_time_advance_ms(2);
+    CHECK(actuator_depth(ACTUATOR_SRC_BLE) == 0);
+    CHECK(ble_session_find(1)->q_count == 0);
+    fake_gap_disconnect(1);
+}
+
+static void test_http_cmd(void)
+{
+    fake_http_resp_t resp;
+    uint8_t frame[16];
+    const uint8_t on[2] = {0, 1};
+    size_t n = cmd_proto_encode(frame, sizeof(frame), CMD_OP_RELAY_SET, 7, on, 2);
+
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, n, &resp) == ESP_OK);
+    CHECK(strcmp(resp.status, "200 OK") == 0);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 1);
+    CHECK(actuator_stats(ACTUATOR_SRC_HTTP)->executed == 1);
+
+    frame[n - 1] ^= 1;
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, n, &resp) == ESP_OK);
+    CHECK(strncmp(resp.status, "400", 3) == 0);
+
+    // A body split across segments is read whole, every frame runs
+    uint8_t two[32];
+    const uint8_t off[2] = {0, 0};
+    size_t len = cmd_proto_encode(two, sizeof(two), CMD_OP_RELAY_SET, 8, off, 2);
+    len += cmd_proto_encode(&two[len], sizeof(two) - len, CMD_OP_RELAY_SET, 9, on, 2);
+    fake_http_recv_max(3);
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)two, len, &resp) == ESP_OK);
+    CHECK(strcmp(resp.status, "200 OK") == 0);
+    CHECK(actuator_stats(ACTUATOR_SRC_HTTP)->executed == 3);
+
+    // More than one BLE write holds is refused before any of it runs
+    static uint8_t big[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU + 1];
+    for (size_t i = 0; i + n <= sizeof(big); i += n)
+        cmd_proto_encode(&big[i], n, CMD_OP_RELAY_SET, 10, off, 2);
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)big, sizeof(big), &resp) == ESP_OK);
+    CHECK(strncmp(resp.status, "413", 3) == 0);
+    CHECK(actuator_stats(ACTUATOR_SRC_HTTP)->executed == 3);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 1);
+}
+
+static void test_http_config(void)
+{
+    fake_http_resp_t resp;
+    // The page is the gzipped web UI, see test_web_ui
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(strncmp(resp.status, "200", 3) == 0 && (uint8_t)resp.body[0] == 0x1f);
+
+    const char *body = "name=eVolte_02&ssid=site+net&password=secret";
+    CHECK(fake_http_request(HTTP_POST, "/set_config", body, strlen(body), &resp) == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(strcmp(fake_wifi_ssid(), "site net") == 0);
+
+    // Any order, percent escapes, and a body longer than one receive chunk
+    char big[512];
+    int n = snprintf(big, sizeof(big), "pad=%0300d&password=p%%26ss&ssid=caf%%C3%%A9", 0);
+    CHECK(fake_http_request(HTTP_POST, "/set_config", big, (size_t)n, &resp) == ESP_OK);
+    CHECK(strcmp(resp.status, "200 OK") == 0);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(strcmp(fake_wifi_ssid(), "caf\xC3\xA9") == 0);
+
+    body = "{\"ssid\": \"lab\\u00e9\", \"password\": \"x\"}";
+    CHECK(fake_http_request(HTTP_POST, "/set_config", body, strlen(body), &resp) == ESP_OK);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    CHECK(strcmp(fake_wifi_ssid(), "lab\xC3\xA9") == 0);
+
+    body = "ssid=0123456789012345678901234567890123456789&password=x";
+    CHECK(fake_http_request(HTTP_POST, "/set_config", body, strlen(body), &resp) == ESP_OK);
+    CHECK(strncmp(resp.status, "400", 3) == 0);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run(); // Wi-Fi and HTTP come up on a boot worker task
+    CHECK(fake_gap_adv_active());
+
+    test_write_read();
+    test_long_read();
+    test_notify();
+    test_actuator();
+    test_http_cmd();
+    test_http_config();
+
+    return check_report("fw");
+}
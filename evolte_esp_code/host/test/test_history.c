@@ -0,0 +1,388 @@
+// History download against the whole firmware: a full log pulled through
+// the windowed notification pipeline over a modelled radio link, credit
+// flow control, resuming a transfer cut by a disconnect, also after the
+// ring reclaimed the oldest records, time ranges, the log read only on the
+// evlog task and the refusal on an MTU too small for a record.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "evlog.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "history_xfer.h"
+
+#define UUID_HISTORY 0xFEF5
+#define SESSIONS 1000
+#define RECORDS (SESSIONS * 10)
+// Downloads up to a whole ring, filled past the test's own records
+#define DL_MAX (RECORDS * 8)
+// 7.5 ms connection interval rounded up, packets per event a phone takes
+#define LINK_MS 8
+#define LINK_PER_EVENT 4
+#define WINDOW 16
+
+static evlog_rec_t logged[RECORDS + 1];
+static int n_logged;
+
+typedef struct
+{
+    evlog_rec_t recs[DL_MAX];
+    uint32_t n;
+    uint32_t next; // Index the next chunk must carry
+    uint32_t chunks;
+    uint32_t bytes;
+    bool end;
+    uint8_t flags;
+} download_t;
+
+static download_t dl;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool rec_eq(const evlog_rec_t *a, const evlog_rec_t *b)
+{
+    return a->type == b->type && a->channel == b->channel && a->ts == b->ts && a->energy_wh == b->energy_wh &&
+           a->power_w == b->power_w && a->flags == b->flags;
+}
+
+static void put(evlog_rec_t rec)
+{
+    evlog_append(&rec);
+    evlog_sync();
+    logged[n_logged++] = rec;
+}
+
+// A session a day with ENERGY records every 15 minutes, the STOP record in
+// the same second as the last of them
+static void fill_log(void)
+{
+    evlog_cursor_t c;
+    // The BOOT record the firmware logged comes first
+    evlog_seek(&c, 0);
+    CHECK(evlog_next(&c, &logged[0]) && logged[0].type == EVLOG_BOOT);
+    n_logged = 1;
+    uint32_t ts = logged[0].ts + 1;
+    for (int s = 0; s < SESSIONS; s++)
+    {
+        put((evlog_rec_t){.type = EVLOG_SESSION_START, .ts = ts += 57600});
+        for (int i = 0; i < 8; i++)
+            put((evlog_rec_t){.type = EVLOG_ENERGY, .ts = ts += 900, .energy_wh = 1800 + i, .power_w = 7200 - s});
+        put((evlog_rec_t){.type = EVLOG_SESSION_STOP, .ts = ts, .energy_wh = 14428});
+    }
+}
+
+// Where a cut transfer carries on: the time of the last record received and
+// how many received records carry it
+static void resume_point(uint32_t *from_ts, uint32_t *resume)
+{
+    *from_ts = dl.recs[dl.n - 1].ts;
+    *resume = 0;
+    for (uint32_t i = dl.n; i > 0 && dl.recs[i - 1].ts == *from_ts; i--)
+        (*resume)++;
+}
+
+static void open_req(uint16_t conn, uint32_t from_ts, uint32_t resume, uint8_t credits)
+{
+    uint8_t req[10] = {HISTORY_OP_OPEN};
+    put_le32(&req[1], from_ts);
+    put_le32(&req[5], resume);
+    req[9] = credits;
+    CHECK(fake_gatt_write(conn, UUID_HISTORY, req, sizeof(req)) == 0);
+}
+
+static void credit(uint16_t conn, uint8_t n)
+{
+    uint8_t req[2] = {HISTORY_OP_CREDIT, n};
+    CHECK(fake_gatt_write(conn, UUID_HISTORY, req, sizeof(req)) == 0);
+}
+
+// Decode the history chunks sent so far into dl, returns how many
+static int take_chunks(void)
+{
+    fake_gatt_tx_t tx;
+    uint16_t handle = fake_gatt_val_handle(UUID_HISTORY);
+    int n = 0;
+    while (fake_gatt_tx_pop(&tx))
+    {
+        if (tx.attr_handle != handle)
+            continue;
+        CHECK(tx.len >= HISTORY_CHUNK_HDR_LEN);
+        CHECK(!dl.end);
+        uint32_t index = get_le32(&tx.data[0]);
+        uint32_t ts = get_le32(&tx.data[4]);
+        dl.flags = tx.data[8];
+        size_t end = tx.len;
+        if (dl.flags & HISTORY_END)
+        {
+            CHECK(tx.len >= HISTORY_CHUNK_HDR_LEN + 4);
+            end -= 4;
+            CHECK(get_le32(&tx.data[end]) == evlog_now());
+        }
+        CHECK(index == dl.next || end == HISTORY_CHUNK_HDR_LEN);
+        for (size_t off = HISTORY_CHUNK_HDR_LEN; off < end;)
+        {
+            int len = evlog_unpack(&tx.data[off], end - off, ts, &dl.recs[dl.n]);
+            CHECK(len > 0 && dl.n < DL_MAX);
+            if (len <= 0)
+                break;
+            ts = dl.recs[dl.n++].ts;
+            dl.next++;
+            off += (size_t)len;
+        }
+        dl.chunks++;
+        dl.bytes += tx.len;
+        dl.end = dl.flags & HISTORY_END;
+        n++;
+    }
+    return n;
+}
+
+// Run the client side: grant a credit back for every chunk received
+static uint32_t run_transfer(uint16_t conn, uint32_t max_ms)
+{
+    uint32_t t0 = fake_time_ms();
+    while (!dl.end && fake_time_ms() - t0 < max_ms)
+    {
+        fake_time_advance_ms(1);
+        int n = take_chunks();
+        if (n > 0 && !dl.end)
+            credit(conn, (uint8_t)n);
+    }
+    return fake_time_ms() - t0;
+}
+
+static void connect(uint16_t conn, uint16_t mtu)
+{
+    fake_gap_connect(conn);
+    fake_gap_mtu(conn, mtu);
+    fake_gap_subscribe(conn, UUID_HISTORY, true, false);
+    fake_host_run();
+    take_chunks();
+}
+
+static void test_full(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(LINK_MS, LINK_PER_EVENT);
+    connect(1, 256);
+    open_req(1, 0, 0, WINDOW);
+    uint32_t ms = run_transfer(1, 60000);
+    CHECK(dl.end && dl.flags == HISTORY_END);
+    CHECK((int)dl.n == n_logged);
+    for (uint32_t i = 0; i < dl.n && i < (uint32_t)n_logged; i++)
+        CHECK(rec_eq(&dl.recs[i], &logged[i]));
+
+    // Every chunk but the last is close to full
+    CHECK(dl.bytes / dl.chunks > 256 - 3 - 4 - EVLOG_PACK_MAX);
+    uint32_t kbps = dl.bytes / (ms ? ms : 1);
+    printf("history: %u records, %u bytes in %u chunks, %u ms, %u KB/s\n", (unsigned)dl.n, (unsigned)dl.bytes,
+           (unsigned)dl.chunks, (unsigned)ms, (unsigned)kbps);
+    // The link model's ceiling is 4 * 253 bytes every 8 ms, 126 KB/s
+    CHECK(kbps >= 100);
+
+    const history_stats_t *st = history_xfer_stats();
+    CHECK(st->transfers == 1 && st->last_bytes == dl.bytes);
+    CHECK(st->last_ms <= ms);
+    fake_gap_disconnect(1);
+}
+
+// Without new credits the server stops at the window
+static void test_credits(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(0, 0);
+    connect(1, 256);
+    open_req(1, 0, 0, 3);
+    fake_time_advance_ms(50);
+    CHECK(take_chunks() == 3);
+    fake_time_advance_ms(50);
+    CHECK(take_chunks() == 0);
+    credit(1, 2);
+    fake_time_advance_ms(50);
+    CHECK(take_chunks() == 2);
+
+    // Stop ends it for good
+    uint8_t stop = HISTORY_OP_STOP;
+    CHECK(fake_gatt_write(1, UUID_HISTORY, &stop, 1) == 0);
+    credit(1, 10);
+    fake_time_advance_ms(50);
+    CHECK(take_chunks() == 0);
+    CHECK(!dl.end);
+
+    uint8_t bad[2] = {0x7F, 0};
+    CHECK(fake_gatt_write(1, UUID_HISTORY, bad, 2) == BLE_ATT_ERR_REQ_NOT_SUPPORTED);
+    CHECK(fake_gatt_write(1, UUID_HISTORY, bad, 0) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    fake_gap_disconnect(1);
+}
+
+// A transfer cut by a disconnect picks up where it stopped
+static void test_resume(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(LINK_MS, LINK_PER_EVENT);
+    connect(1, 256);
+    open_req(1, 0, 0, WINDOW);
+    run_transfer(1, 200);
+    CHECK(!dl.end && dl.n > 0);
+    fake_gap_disconnect(1);
+    fake_time_advance_ms(100);
+    take_chunks();
+
+    uint32_t from_ts, resume;
+    resume_point(&from_ts, &resume);
+    dl.next = resume;
+    connect(2, 256);
+    open_req(2, from_ts, resume, WINDOW);
+    run_transfer(2, 60000);
+    CHECK(dl.end);
+    CHECK((int)dl.n == n_logged);
+    for (uint32_t i = 0; i < dl.n && i < (uint32_t)n_logged; i++)
+        CHECK(rec_eq(&dl.recs[i], &logged[i]));
+    fake_gap_disconnect(2);
+}
+
+// A range starts at the first record at or after from_ts
+static void test_range(void)
+{
+    int mid = n_logged - 25;
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(0, 0);
+    connect(1, 256);
+    open_req(1, logged[mid].ts, 0, WINDOW);
+    run_transfer(1, 1000);
+    CHECK(dl.end && (int)dl.n == n_logged - mid);
+    CHECK(dl.n > 0 && rec_eq(&dl.recs[0], &logged[mid]));
+    fake_gap_disconnect(1);
+
+    // resume only skips records at from_ts: one of the two in the last
+    // second of a session, then never the next session's START
+    int stop = n_logged - 11;
+    CHECK(logged[stop].type == EVLOG_SESSION_STOP && logged[stop - 1].ts == logged[stop].ts);
+    for (uint32_t resume = 1; resume <= 3; resume += 2)
+    {
+        memset(&dl, 0, sizeof(dl));
+        dl.next = resume;
+        connect(1, 256);
+        open_req(1, logged[stop].ts, resume, WINDOW);
+        run_transfer(1, 1000);
+        int first = resume == 1 ? stop : stop + 1;
+        CHECK(dl.end && (int)dl.n == n_logged - first && rec_eq(&dl.recs[0], &logged[first]));
+        fake_gap_disconnect(1);
+    }
+}
+
+// The host task never reads the log: with the evlog task busy, as through
+// an erase, an open and its resume skip wait for it and nothing goes out
+static void test_off_host(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(0, 0);
+    connect(1, 256);
+    fake_tasks_hold(true);
+    CHECK(logged[20].type == EVLOG_SESSION_STOP && logged[19].ts == logged[20].ts);
+    open_req(1, logged[20].ts, 2, WINDOW);
+    fake_time_advance_ms(50);
+    CHECK(take_chunks() == 0);
+    fake_tasks_hold(false);
+    dl.n = 21;
+    dl.next = 2;
+    run_transfer(1, 1000);
+    CHECK(dl.end && (int)dl.n == n_logged);
+    CHECK(rec_eq(&dl.recs[21], &logged[21]));
+    fake_gap_disconnect(1);
+}
+
+// The ring reclaims the oldest sector while a transfer is cut: the resume
+// carries on after the last record received, and one whose from_ts is gone
+// starts at the oldest record left rather than skipping it
+static void test_reclaim(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    fake_gatt_link(LINK_MS, LINK_PER_EVENT);
+    connect(1, 256);
+    open_req(1, 0, 0, WINDOW);
+    run_transfer(1, 200);
+    CHECK(!dl.end && dl.n > (uint32_t)n_logged / 4);
+    fake_gap_disconnect(1);
+    fake_time_advance_ms(100);
+    take_chunks();
+
+    const evlog_stats_t *st = evlog_stats();
+    uint32_t lost = st->sectors_lost;
+    uint32_t ts = logged[n_logged - 1].ts;
+    while (st->sectors_lost == lost)
+    {
+        evlog_rec_t rec = {.type = EVLOG_ENERGY, .ts = ts += 900, .energy_wh = 1800};
+        evlog_append(&rec);
+        evlog_sync();
+    }
+    evlog_cursor_t c;
+    evlog_rec_t oldest;
+    evlog_seek(&c, 0);
+    CHECK(evlog_next(&c, &oldest));
+    CHECK(oldest.ts > logged[1].ts && oldest.ts < dl.recs[dl.n - 1].ts);
+
+    uint32_t have = dl.n, from_ts, resume;
+    resume_point(&from_ts, &resume);
+    dl.next = resume;
+    connect(2, 256);
+    fake_gatt_link(0, 0);
+    open_req(2, from_ts, resume, WINDOW);
+    run_transfer(2, 60000);
+    CHECK(dl.end);
+    for (uint32_t i = 0; i < (uint32_t)n_logged; i++)
+        CHECK(rec_eq(&dl.recs[i], &logged[i]));
+    CHECK(dl.n > have && dl.recs[n_logged].ts == logged[n_logged - 1].ts + 900);
+    fake_gap_disconnect(2);
+
+    memset(&dl, 0, sizeof(dl));
+    dl.next = 1;
+    connect(1, 256);
+    open_req(1, logged[1].ts, 1, WINDOW);
+    run_transfer(1, 60000);
+    CHECK(dl.end && dl.n > 0 && rec_eq(&dl.recs[0], &oldest));
+    fake_gap_disconnect(1);
+}
+
+static void test_small_mtu(void)
+{
+    memset(&dl, 0, sizeof(dl));
+    connect(1, 23);
+    open_req(1, 0, 0, WINDOW);
+    fake_time_advance_ms(10);
+    take_chunks();
+    CHECK(dl.end && dl.flags == (HISTORY_END | HISTORY_MTU) && dl.n == 0);
+    fake_gap_disconnect(1);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+    fill_log();
+    test_full();
+    test_credits();
+    test_resume();
+    test_range();
+    test_off_host();
+    test_reclaim();
+    test_small_mtu();
+
+    fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    CHECK(strstr(resp.body, "\"history\":{\"transfers\":") != NULL);
+    return check_report("history");
+}
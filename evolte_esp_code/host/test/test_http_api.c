@@ -0,0 +1,82 @@
+// HTTP API against the whole firmware: relay control through the actuator,
+// status and counters as JSON, config read and write by NVS key, and the
+// error replies a site controller has to handle.
+#include <stdlib.h>
+#include <string.h>
+#include "actuator.h"
+#include "check.h"
+#include "cmd_ring.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+
+#define LIGHT_GPIO 13
+
+static fake_http_resp_t resp;
+
+static int request(httpd_method_t method, const char *uri, const char *body)
+{
+    CHECK(fake_http_request(method, uri, body, body ? strlen(body) : 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    return atoi(resp.status);
+}
+
+static void test_relay(void)
+{
+    CHECK(request(HTTP_POST, "/api/relay", "{\"channel\": 0, \"on\": true}") == 200);
+    CHECK(strcmp(resp.type, "application/json") == 0);
+    CHECK(strstr(resp.body, "\"queued\":true") != NULL);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 1);
+
+    CHECK(request(HTTP_GET, "/api/status", NULL) == 200);
+    CHECK(strstr(resp.body, "\"relay_mask\":1") != NULL);
+    CHECK(strstr(resp.body, "\"fw_version\":\"1.0.0-host\"") != NULL);
+
+    CHECK(request(HTTP_POST, "/api/relay", "channel=0&on=off") == 200);
+    CHECK(fake_gpio_get(LIGHT_GPIO) == 0);
+
+    CHECK(request(HTTP_POST, "/api/relay", "channel=9&on=1") == 400);
+    CHECK(request(HTTP_POST, "/api/relay", "channel=0&on=maybe") == 400);
+    CHECK(request(HTTP_POST, "/api/relay", "{\"channel\":") == 400);
+    CHECK(strstr(resp.body, "\"error\"") != NULL);
+
+    CHECK(request(HTTP_GET, "/api/counters", NULL) == 200);
+    CHECK(strstr(resp.body, "\"http\":{\"submitted\":2,\"dropped\":0,\"executed\":2") != NULL);
+    CHECK(strstr(resp.body, "\"cmds_rejected\":3") != NULL);
+}
+
+static void test_busy(void)
+{
+    fake_tasks_hold(true);
+    for (int i = 0; i < CMD_RING_LEN; i++)
+        CHECK(request(HTTP_POST, "/api/relay", "channel=0&on=1") == 200);
+    CHECK(request(HTTP_POST, "/api/relay", "channel=0&on=1") == 503);
+    fake_tasks_hold(false);
+    fake_host_run();
+    CHECK(actuator_depth(ACTUATOR_SRC_HTTP) == 0);
+}
+
+static void test_config(void)
+{
+    CHECK(request(HTTP_POST, "/api/config", "{\"wifi_pass\":\"s3cret\",\"ble_name\":\"eVolte_07\"}") == 200);
+    CHECK(strstr(resp.body, "\"pending\":5") != NULL);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+
+    CHECK(request(HTTP_GET, "/api/config", NULL) == 200);
+    CHECK(strstr(resp.body, "\"ble_name\":\"eVolte_07\"") != NULL);
+    CHECK(strstr(resp.body, "wifi_pass") == NULL);
+    CHECK(strstr(resp.body, "s3cret") == NULL);
+
+    CHECK(request(HTTP_POST, "/api/config", "ble_name=0123456789012345678901234567890123") == 400);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+
+    test_relay();
+    test_busy();
+    test_config();
+    return check_report("http_api");
+}
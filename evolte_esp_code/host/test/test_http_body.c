@@ -0,0 +1,92 @@
+// Streaming body parser: form and JSON bodies fed whole and one byte at a
+// time, percent and \u decoding, field order, unknown and oversize fields.
+#include <string.h>
+#include "check.h"
+#include "http_body.h"
+
+enum
+{
+    F_NAME,
+    F_SSID,
+    F_PASS,
+    F_COUNT
+};
+
+static char name[16], ssid[32], pass[8];
+static http_body_field_t fields[F_COUNT] = {
+    [F_NAME] = {.name = "name", .val = name, .cap = sizeof(name)},
+    [F_SSID] = {.name = "ssid", .val = ssid, .cap = sizeof(ssid)},
+    [F_PASS] = {.name = "password", .val = pass, .cap = sizeof(pass)},
+};
+
+// Same result whatever the chunking
+static int parse(http_body_kind_t kind, const char *body, http_body_t *out)
+{
+    http_body_t bytewise;
+    http_body_init(&bytewise, kind, fields, F_COUNT);
+    for (size_t i = 0; body[i]; i++)
+        http_body_feed(&bytewise, &body[i], 1);
+    int rc1 = http_body_finish(&bytewise);
+    char ssid1[sizeof(ssid)];
+    strcpy(ssid1, ssid);
+
+    http_body_init(out, kind, fields, F_COUNT);
+    http_body_feed(out, body, strlen(body));
+    int rc = http_body_finish(out);
+    CHECK(rc == rc1);
+    CHECK(rc != HTTP_BODY_OK || strcmp(ssid, ssid1) == 0);
+    return rc;
+}
+
+static void test_form(void)
+{
+    http_body_t p;
+    CHECK(parse(HTTP_BODY_FORM, "password=a%26b&junk=zzz&ssid=my+net%21&name=", &p) == HTTP_BODY_OK);
+    CHECK(strcmp(ssid, "my net!") == 0);
+    CHECK(strcmp(pass, "a&b") == 0);
+    CHECK(http_body_has(&p, F_NAME) && name[0] == '\0');
+
+    // Encoded keys, a key without '=', last value wins
+    CHECK(parse(HTTP_BODY_FORM, "ss%69d=one&name&ssid=two", &p) == HTTP_BODY_OK);
+    CHECK(strcmp(ssid, "two") == 0);
+    CHECK(http_body_has(&p, F_NAME) && !http_body_has(&p, F_PASS));
+
+    CHECK(parse(HTTP_BODY_FORM, "", &p) == HTTP_BODY_OK);
+    CHECK(p.seen == 0);
+
+    CHECK(parse(HTTP_BODY_FORM, "password=12345678", &p) == HTTP_BODY_ERR_TOO_LONG);
+    CHECK(parse(HTTP_BODY_FORM, "password=1234567", &p) == HTTP_BODY_OK);
+    // Unknown fields may be any size
+    CHECK(parse(HTTP_BODY_FORM, "some_very_long_unknown_key_name_exceeding_limit=xxxxxxxxxxxxxxxxxxx", &p) ==
+          HTTP_BODY_OK);
+    CHECK(parse(HTTP_BODY_FORM, "ssid=%zz", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_FORM, "ssid=a%00b", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_FORM, "ssid=a%4", &p) == HTTP_BODY_ERR_INCOMPLETE);
+}
+
+static void test_json(void)
+{
+    http_body_t p;
+    CHECK(parse(HTTP_BODY_JSON, " { \"ssid\" : \"caf\\u00e9 \\\"x\\\"\", \"n\": -1.5e3, \"name\":\"\\ud83d\\ude00\","
+                                "\"password\": true }\r\n",
+                &p) == HTTP_BODY_OK);
+    CHECK(strcmp(ssid, "caf\xC3\xA9 \"x\"") == 0);
+    CHECK(strcmp(name, "\xF0\x9F\x98\x80") == 0);
+    CHECK(strcmp(pass, "true") == 0);
+
+    CHECK(parse(HTTP_BODY_JSON, "{}", &p) == HTTP_BODY_OK);
+    CHECK(parse(HTTP_BODY_JSON, "{\"ssid\":\"a\"", &p) == HTTP_BODY_ERR_INCOMPLETE);
+    CHECK(parse(HTTP_BODY_JSON, "{\"ssid\":{\"a\":1}}", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_JSON, "{\"ssid\":\"a\"} x", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_JSON, "{\"ssid\":\"\\ud83d\"}", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_JSON, "{\"ssid\":\"\\u0000\"}", &p) == HTTP_BODY_ERR_SYNTAX);
+    CHECK(parse(HTTP_BODY_JSON, "{\"password\":\"123456789\"}", &p) == HTTP_BODY_ERR_TOO_LONG);
+    CHECK(parse(HTTP_BODY_JSON, "{\"a\":1,}", &p) == HTTP_BODY_ERR_SYNTAX);
+}
+
+int main(void)
+{
+    test_form();
+    test_json();
+    return check_report("http_body");
+}
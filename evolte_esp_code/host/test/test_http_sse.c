@@ -0,0 +1,241 @@
+// Server-sent events on /api/events: the full status on connect, then deltas
+// as relays and sessions change, counters on the telemetry timer, and a
+// reader too slow for the window skipping ahead without holding back the
+// others, streams kept while polling clients take every other socket, a new
+// error flag, and counters at their largest still fitting an event and
+// /api/counters.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "actuator.h"
+#include "adv_beacon.h"
+#include "charger.h"
+#include "check.h"
+#include "conn_policy.h"
+#include "dlog.h"
+#include "evlog.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "history_xfer.h"
+#include "http_sse.h"
+#include "meter.h"
+#include "ota_update.h"
+#include "sdkconfig.h"
+#include "web_ui.h"
+
+#define RELAY_GPIO 13
+
+static fake_http_resp_t resp;
+static char rx[8192];
+
+static int open_stream(void)
+{
+    int fd = fake_http_stream("/api/events", &resp);
+    CHECK(fd >= 0);
+    return fd;
+}
+
+static void relay(int on)
+{
+    char body[32];
+    snprintf(body, sizeof(body), "channel=0&on=%d", on);
+    CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+}
+
+// Id of the last event in what was read, -1 if none
+static long last_id(const char *s)
+{
+    long id = -1;
+    for (const char *p = strstr(s, "id: "); p; p = strstr(p + 1, "id: "))
+        id = strtol(p + 4, NULL, 10);
+    return id;
+}
+
+static void test_stream(int fd)
+{
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "Content-Type: text/event-stream") != NULL);
+    CHECK(strstr(rx, "event: status\ndata: {\"relay_count\":") != NULL);
+    CHECK(strstr(rx, "\"relay_mask\":0") != NULL);
+
+    relay(1);
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "event: status\ndata: {\"relay_mask\":1,") != NULL);
+    // Only what changed, plus the clock
+    CHECK(strstr(rx, "relay_count") == NULL);
+    CHECK(strstr(rx, "\"uptime_s\":") != NULL);
+    CHECK(strstr(rx, "\n\n") != NULL);
+
+    fake_gap_connect(1);
+    fake_host_run();
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "{\"sessions\":1,") != NULL);
+    fake_gap_disconnect(1);
+    fake_host_run();
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "{\"sessions\":0,") != NULL);
+
+    fake_time_advance_ms(CONFIG_EVOLTE_SSE_TELEMETRY_MS);
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "event: counters\ndata: {\"cmds_run\":") != NULL);
+}
+
+// A reader that stops draining falls behind the window and skips to the
+// oldest event still in it; a reader keeping up sees every id
+static void test_slow(int fast)
+{
+    int slow = open_stream();
+    fake_sock_read(slow, rx, sizeof(rx));
+    relay(0);
+    fake_sock_read(slow, rx, sizeof(rx));
+    fake_sock_read(fast, rx, sizeof(rx));
+    long first = last_id(rx);
+    CHECK(first >= 0);
+    fake_sock_set_window(slow, 64);
+
+    unsigned long skipped = http_sse_stats()->skipped;
+    int n = 3 * CONFIG_EVOLTE_SSE_QUEUE_LEN;
+    for (int i = 0; i < n; i++)
+    {
+        relay(i & 1 ? 0 : 1);
+        fake_sock_read(fast, rx, sizeof(rx));
+        CHECK(last_id(rx) == first + 1 + i);
+    }
+
+    // Once it reads again it finishes the frame it was cut off in, then
+    // resumes with the oldest one still in the window
+    fake_sock_set_window(slow, sizeof(rx));
+    fake_sock_read(slow, rx, sizeof(rx));
+    relay(1);
+    fake_sock_read(slow, rx, sizeof(rx));
+    const char *next = strstr(rx, "\n\nid: ");
+    CHECK(next != NULL);
+    CHECK(strtol(next + 6, NULL, 10) == first + n + 2 - CONFIG_EVOLTE_SSE_QUEUE_LEN);
+    CHECK(last_id(rx) == first + n + 1);
+    CHECK(http_sse_stats()->skipped > skipped);
+
+    fake_sock_peer_close(slow);
+    CHECK(!fake_sock_is_open(slow));
+}
+
+// Controllers holding every other socket open and polling do not push an
+// event stream out: a connection past the last socket is refused instead
+static void test_pollers(int fd)
+{
+    int polls[16];
+    int n = 0;
+    for (; n < 16; n++)
+    {
+        polls[n] = fake_http_connect();
+        if (polls[n] < 0)
+            break;
+        for (int i = 0; i <= n; i++)
+            CHECK(fake_http_request_on(polls[i], HTTP_GET, "/api/status", NULL, 0, &resp) == ESP_OK);
+    }
+    CHECK(n > 0 && n < 16);
+    CHECK(fake_sock_is_open(fd));
+    fake_sock_read(fd, rx, sizeof(rx));
+    relay(0);
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "\"relay_mask\":0") != NULL);
+
+    for (int i = 0; i < n; i++)
+        fake_sock_peer_close(polls[i]);
+    int again = fake_http_connect();
+    CHECK(again >= 0);
+    fake_sock_peer_close(again);
+}
+
+// A new error flag is pushed even when no relay changed with it
+static void test_error(int fd)
+{
+    fake_sock_read(fd, rx, sizeof(rx));
+    fake_gpio_fail(RELAY_GPIO, true);
+    relay(0);
+    fake_gpio_fail(RELAY_GPIO, false);
+    CHECK(charger_error_flags() == CHARGER_ERR_RELAY_GPIO);
+    fake_sock_read(fd, rx, sizeof(rx));
+    CHECK(strstr(rx, "\"error_flags\":1") != NULL);
+}
+
+static void test_limit(void)
+{
+    int fds[CONFIG_EVOLTE_SSE_MAX_CLIENTS];
+    unsigned long clients = http_sse_stats()->clients;
+    for (unsigned long i = clients; i < CONFIG_EVOLTE_SSE_MAX_CLIENTS; i++)
+    {
+        fds[i] = open_stream();
+        CHECK(strcmp(resp.status, "200 OK") == 0);
+    }
+    fake_http_stream("/api/events", &resp);
+    CHECK(atoi(resp.status) == 503);
+    CHECK(http_sse_stats()->refused == 1);
+
+    // Closing one frees its slot
+    fake_sock_peer_close(fds[CONFIG_EVOLTE_SSE_MAX_CLIENTS - 1]);
+    CHECK(http_sse_stats()->clients == CONFIG_EVOLTE_SSE_MAX_CLIENTS - 1);
+    open_stream();
+    CHECK(strcmp(resp.status, "200 OK") == 0);
+}
+
+// Every counter of every module at all ones, put back afterwards
+#define STATS(get) {(void *)(get), sizeof(*(get))}
+static void test_long_counters(int fd)
+{
+    const struct
+    {
+        void *p;
+        size_t size;
+    } stats[] = {
+        STATS(charger_stats()),
+        STATS(actuator_stats(ACTUATOR_SRC_BLE)),
+        STATS(actuator_stats(ACTUATOR_SRC_HTTP)),
+        STATS(actuator_stats(ACTUATOR_SRC_TIMER)),
+        STATS(dlog_stats()),
+        STATS(meter_stats()),
+        STATS(evlog_stats()),
+        STATS(history_xfer_stats()),
+        STATS(ota_update_stats()),
+        STATS(conn_policy_stats()),
+        STATS(adv_beacon_stats()),
+        STATS(web_ui_stats()),
+    };
+    static uint8_t saved[sizeof(stats) / sizeof(stats[0])][256];
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+    {
+        CHECK(stats[i].size <= sizeof(saved[i]));
+        memcpy(saved[i], stats[i].p, stats[i].size);
+        memset(stats[i].p, 0xFF, stats[i].size);
+    }
+
+    fake_sock_read(fd, rx, sizeof(rx));
+    unsigned long events = http_sse_stats()->events;
+    fake_time_advance_ms(CONFIG_EVOLTE_SSE_TELEMETRY_MS);
+    size_t n = fake_sock_read(fd, rx, sizeof(rx));
+    rx[n] = '\0';
+    CHECK(http_sse_stats()->events == events + 1);
+    CHECK(strstr(rx, "event: counters\ndata: {\"cmds_run\":4294967295,") != NULL);
+    CHECK(strstr(rx, "\"config_commits\":") != NULL);
+    CHECK(n > 1300);
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200 && resp.len > 1300);
+
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+        memcpy(stats[i].p, saved[i], stats[i].size);
+}
+#undef STATS
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+
+    int fd = open_stream();
+    test_stream(fd);
+    test_slow(fd);
+    test_pollers(fd);
+    test_error(fd);
+    test_limit();
+    test_long_counters(fd);
+    return check_report("http_sse");
+}
@@ -0,0 +1,194 @@
+// Memory budget: the block pools hand out distinct blocks, fail cleanly
+// when empty and keep their peak, and once booted a workload over every
+// interface makes no heap allocation on a guarded task, with an exemption
+// that only covers the task holding it. The harness stands in for the
+// NimBLE host and httpd tasks, so it guards itself.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "cmd_proto.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "freertos/task.h"
+#include "history_xfer.h"
+#include "mem_budget.h"
+#include "perf.h"
+
+#define UUID_STATUS 0xFEF4
+#define UUID_HISTORY 0xFEF5
+#define UUID_DIAG 0xFEF7
+#define UUID_CMD 0xDEAD
+
+static void test_pool(void)
+{
+    mem_pool_stats_t st;
+    mem_pool_stats(MEM_POOL_ATT, &st);
+    CHECK(strcmp(st.name, "ATT") == 0 && st.block_size == MEM_POOL_BLOCK_ATT);
+    CHECK(st.used == 0 && st.peak == 0 && st.fails == 0);
+
+    uint8_t *b[3];
+    for (int i = 0; i < 3; i++)
+    {
+        b[i] = mem_pool_get(MEM_POOL_ATT);
+        CHECK(b[i] != NULL && ((uintptr_t)b[i] & 7) == 0);
+        memset(b[i], i, MEM_POOL_BLOCK_ATT);
+    }
+    CHECK(b[0] != b[1] && b[1] != b[2] && b[0] != b[2]);
+    CHECK(b[0][MEM_POOL_BLOCK_ATT - 1] == 0 && b[1][0] == 1); // No overlap
+    CHECK(mem_pool_get(MEM_POOL_ATT) == NULL);
+
+    mem_pool_put(MEM_POOL_ATT, b[1]);
+    CHECK(mem_pool_get(MEM_POOL_ATT) == b[1]);
+    for (int i = 0; i < 3; i++)
+        mem_pool_put(MEM_POOL_ATT, b[i]);
+    mem_pool_put(MEM_POOL_ATT, NULL);
+
+    mem_pool_stats(MEM_POOL_ATT, &st);
+    CHECK(st.used == 0 && st.peak == 3 && st.fails == 1);
+}
+
+// With every block out, requests that need one are turned away, not queued
+static void test_exhausted(void)
+{
+    void *b[3];
+    for (int i = 0; i < 3; i++)
+        b[i] = mem_pool_get(MEM_POOL_ATT);
+    static fake_http_resp_t resp;
+    uint8_t frame[CMD_PROTO_OVERHEAD];
+    size_t len = cmd_proto_encode(frame, sizeof(frame), CMD_OP_NOP, 1, NULL, 0);
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, len, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 503);
+    uint8_t buf[64];
+    size_t n;
+    CHECK(fake_gatt_read(1, UUID_DIAG, buf, sizeof(buf), &n) == BLE_ATT_ERR_INSUFFICIENT_RES);
+    for (int i = 0; i < 3; i++)
+        mem_pool_put(MEM_POOL_ATT, b[i]);
+
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, len, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+}
+
+static void workload(void)
+{
+    static fake_http_resp_t resp;
+    static char rx[4096];
+    uint8_t buf[256];
+    size_t len;
+
+    for (int i = 0; i < 20; i++)
+    {
+        CHECK(fake_gatt_write(1, UUID_CMD, i & 1 ? "LIGHT ON" : "LIGHT OFF", i & 1 ? 8 : 9) == 0);
+        CHECK(fake_gatt_read(1, UUID_STATUS, buf, sizeof(buf), &len) == 0);
+        uint8_t req[2] = {(uint8_t)(i % PERF_PAGE_COUNT), 0};
+        CHECK(fake_gatt_write(1, UUID_DIAG, req, sizeof(req)) == 0);
+        CHECK(fake_gatt_read(1, UUID_DIAG, buf, sizeof(buf), &len) == 0);
+
+        uint8_t frame[CMD_PROTO_OVERHEAD];
+        size_t n = cmd_proto_encode(frame, sizeof(frame), CMD_OP_NOP, (uint8_t)i, NULL, 0);
+        CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, n, &resp) == ESP_OK);
+        const char *body = i & 1 ? "channel=0&on=1" : "channel=0&on=0";
+        CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+        CHECK(fake_http_request(HTTP_GET, "/api/status", NULL, 0, &resp) == ESP_OK);
+        CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+        CHECK(fake_http_request(HTTP_GET, "/metrics", NULL, 0, &resp) == ESP_OK);
+        CHECK(fake_http_request(HTTP_GET, "/app.js", NULL, 0, &resp) == ESP_OK);
+        fake_time_advance_ms(100);
+        fake_host_run();
+    }
+
+    int fd = fake_http_stream("/api/events", &resp);
+    CHECK(fd >= 0);
+    fake_gatt_write(1, UUID_CMD, "LIGHT OFF", 9);
+    fake_time_advance_ms(CONFIG_EVOLTE_SSE_TELEMETRY_MS);
+    fake_host_run();
+    CHECK(fake_sock_read(fd, rx, sizeof(rx)) > 0);
+
+    // A history download, which the log holds the relay switches of
+    uint8_t open[10] = {HISTORY_OP_OPEN};
+    open[9] = 8;
+    CHECK(fake_gatt_write(1, UUID_HISTORY, open, sizeof(open)) == 0);
+    for (int i = 0; i < 20; i++)
+    {
+        fake_time_advance_ms(1);
+        fake_host_run();
+    }
+    fake_gatt_tx_t tx;
+    int chunks = 0;
+    uint16_t handle = fake_gatt_val_handle(UUID_HISTORY);
+    while (fake_gatt_tx_pop(&tx))
+        chunks += tx.attr_handle == handle;
+    CHECK(chunks > 0);
+}
+
+static void test_steady(void)
+{
+    mem_budget_guard();
+    fake_alloc_stats_t before, after;
+    fake_alloc_stats(&before);
+    workload();
+    fake_alloc_stats(&after);
+    CHECK(after.heap_allocs == before.heap_allocs);
+    CHECK(mem_budget_heap()->allocs == 0);
+
+    // A stray allocation on a guarded task is counted, and shows in /metrics
+    void *volatile p = malloc(24);
+    free(p);
+    CHECK(mem_budget_heap()->allocs == 1 && mem_budget_heap()->bytes == 24);
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/metrics", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    CHECK(strstr(resp.body, "\nevolte_heap_steady_allocs_total 1\n") != NULL);
+
+    // Unless exempt
+    mem_budget_exempt(true);
+    p = malloc(24);
+    free(p);
+    mem_budget_exempt(false);
+    CHECK(mem_budget_heap()->allocs == 1);
+}
+
+static void stray(void *arg)
+{
+    mem_budget_guard();
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        void *volatile p = malloc(40);
+        free(p);
+    }
+}
+
+// The exemption covers the task that asked for it, not one that allocates
+// meanwhile
+static void test_exempt_own_task(void)
+{
+    TaskHandle_t other;
+    CHECK(xTaskCreatePinnedToCore(stray, "stray", 2048, NULL, 1, &other, 0) == pdPASS);
+    fake_host_run();
+    CHECK(mem_budget_heap()->allocs == 1);
+
+    mem_budget_exempt(true);
+    xTaskNotifyGive(other);
+    fake_host_run();
+    void *volatile p = malloc(24);
+    free(p);
+    mem_budget_exempt(false);
+    CHECK(mem_budget_heap()->allocs == 2 && mem_budget_heap()->bytes == 24 + 40);
+}
+
+int main(void)
+{
+    test_pool();
+
+    app_main();
+    fake_host_run();
+    fake_gap_connect(1);
+    fake_gap_mtu(1, 185);
+    fake_gap_subscribe(1, UUID_HISTORY, true, false);
+    fake_host_run();
+
+    test_exhausted();
+    test_steady();
+    test_exempt_own_task();
+    return check_report("mem_budget");
+}
@@ -0,0 +1,246 @@
+// Metering: the fixed-point kernels against a double precision reference on
+// the recorded waveforms, chunking and energy bookkeeping, then the whole
+// pipeline from DMA frames to the status snapshot and HTTP API.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "meter.h"
+#include "meter_dsp.h"
+#include "sdkconfig.h"
+#include "status_snapshot.h"
+#include "waveform.h"
+
+#define UUID_STATUS 0xFEF4
+
+static const char *const files[] = {"ev_1ph_16a_50hz.txt", "ev_1ph_24a_60hz.txt", "idle_50hz.txt"};
+
+static waveform_t load(const char *name)
+{
+    char path[512];
+    waveform_t w = {0};
+    snprintf(path, sizeof(path), "%s/%s", EVOLTE_WAVEFORM_DIR, name);
+    CHECK(waveform_load(path, &w) == 0);
+    return w;
+}
+
+static meter_dsp_cfg_t cfg_for(const waveform_t *w, uint32_t window_ms)
+{
+    return (meter_dsp_cfg_t){.window = w->rate / 1000 * window_ms,
+                             .sample_hz = w->rate,
+                             .v_uv_per_lsb = w->v_uv_per_lsb,
+                             .i_ua_per_lsb = w->i_ua_per_lsb};
+}
+
+static bool near(double got, double want, double rel, double abs_tol)
+{
+    return fabs(got - want) <= fabs(want) * rel + abs_tol;
+}
+
+static void test_isqrt(void)
+{
+    CHECK(meter_dsp_isqrt64(0) == 0);
+    CHECK(meter_dsp_isqrt64(1) == 1);
+    CHECK(meter_dsp_isqrt64(15) == 3);
+    CHECK(meter_dsp_isqrt64(16) == 4);
+    CHECK(meter_dsp_isqrt64(UINT64_MAX) == 0xFFFFFFFFu);
+    for (uint64_t x = 1; x < (1ull << 60); x = x * 3 + 7)
+    {
+        uint64_t r = meter_dsp_isqrt64(x);
+        CHECK(r * r <= x && (r + 1) * (r + 1) > x);
+    }
+}
+
+// Every window of every recording within 0.1% (plus a count of noise) of
+// the double precision result
+static void test_recorded(void)
+{
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+    {
+        waveform_t w = load(files[f]);
+        meter_dsp_cfg_t cfg = cfg_for(&w, 100);
+        meter_dsp_t m;
+        meter_dsp_out_t out[8];
+        meter_dsp_init(&m, &cfg);
+        int n = meter_dsp_feed(&m, w.v, w.i, w.n, out, 8);
+        CHECK(n == (int)(w.n / cfg.window));
+
+        double vs = w.v_uv_per_lsb / 1e3, is = w.i_ua_per_lsb / 1e3; // mV, mA per count
+        for (int k = 0; k < n && k < 8; k++)
+        {
+            double vm = 0, im = 0, vv = 0, ii = 0, vi = 0, vpk = 0, ipk = 0;
+            const uint16_t *v = &w.v[k * cfg.window], *i = &w.i[k * cfg.window];
+            for (uint32_t j = 0; j < cfg.window; j++)
+            {
+                vm += v[j];
+                im += i[j];
+            }
+            vm /= cfg.window;
+            im /= cfg.window;
+            for (uint32_t j = 0; j < cfg.window; j++)
+            {
+                vv += (v[j] - vm) * (v[j] - vm);
+                ii += (i[j] - im) * (i[j] - im);
+                vi += (v[j] - vm) * (i[j] - im);
+                vpk = fmax(vpk, fabs(v[j] - vm));
+                ipk = fmax(ipk, fabs(i[j] - im));
+            }
+            CHECK(near(out[k].v_rms_mv, sqrt(vv / cfg.window) * vs, 1e-3, vs));
+            CHECK(near(out[k].i_rms_ma, sqrt(ii / cfg.window) * is, 1e-3, is));
+            CHECK(near(out[k].power_w, vi / cfg.window * vs * is / 1e6, 1e-3, 1));
+            // Peaks are taken from the previous window's DC level
+            if (k > 0)
+            {
+                CHECK(near(out[k].v_peak_mv, vpk * vs, 0, 2 * vs));
+                CHECK(near(out[k].i_peak_ma, ipk * is, 0, 2 * is));
+            }
+        }
+        waveform_free(&w);
+    }
+
+    waveform_t w = load("ev_1ph_16a_50hz.txt");
+    meter_dsp_cfg_t cfg = cfg_for(&w, 200);
+    meter_dsp_t m;
+    meter_dsp_out_t out;
+    meter_dsp_init(&m, &cfg);
+    CHECK(meter_dsp_feed(&m, w.v, w.i, cfg.window, &out, 1) == 1);
+    CHECK(near(out.v_rms_mv, 230000 * 1.0002, 0.005, 0)); // 2% third harmonic
+    CHECK(near(out.i_rms_ma, 16000 * 1.0084, 0.005, 0));  // 12% + 5%
+    waveform_free(&w);
+}
+
+// Any chunking of the input gives the same windows
+static void test_chunks(void)
+{
+    waveform_t w = load("ev_1ph_24a_60hz.txt");
+    meter_dsp_cfg_t cfg = cfg_for(&w, 50);
+    meter_dsp_t a, b;
+    meter_dsp_out_t whole[16], part[16], tmp[16];
+    meter_dsp_init(&a, &cfg);
+    meter_dsp_init(&b, &cfg);
+
+    int n = meter_dsp_feed(&a, w.v, w.i, w.n, whole, 16);
+    int got = 0;
+    srand(1);
+    for (size_t off = 0; off < w.n;)
+    {
+        size_t k = 1 + (size_t)rand() % 700;
+        if (k > w.n - off)
+            k = w.n - off;
+        int done = meter_dsp_feed(&b, &w.v[off], &w.i[off], k, tmp, 16);
+        for (int j = 0; j < done && got < 16; j++)
+            part[got++] = tmp[j];
+        off += k;
+    }
+    CHECK(got == n);
+    for (int k = 0; k < n && k < got; k++)
+    {
+        CHECK(whole[k].v_rms_mv == part[k].v_rms_mv && whole[k].i_rms_ma == part[k].i_rms_ma);
+        CHECK(whole[k].power_w == part[k].power_w && whole[k].energy_mj == part[k].energy_mj);
+        CHECK(whole[k].v_peak_mv == part[k].v_peak_mv && whole[k].i_peak_ma == part[k].i_peak_ma);
+    }
+    waveform_free(&w);
+}
+
+// Constant import adds up to P * t; export and idle add nothing
+static void test_energy(void)
+{
+    waveform_t w = load("ev_1ph_16a_50hz.txt");
+    meter_dsp_cfg_t cfg = cfg_for(&w, 200);
+    meter_dsp_t m;
+    meter_dsp_out_t out[2];
+    meter_dsp_init(&m, &cfg);
+
+    int64_t expect_mj = 0;
+    for (int rep = 0; rep < 50; rep++)
+    {
+        CHECK(meter_dsp_feed(&m, w.v, w.i, 2 * cfg.window, out, 2) == 2);
+        expect_mj += (int64_t)out[0].power_w * 200 + (int64_t)out[1].power_w * 200;
+    }
+    // 20 s at ~3.6 kW, the per-window power is rounded to whole watts
+    CHECK(near((double)out[1].energy_mj, (double)expect_mj, 1e-3, 0));
+    CHECK(out[1].energy_mj > 70000000);
+
+    // Swap the current's sign: exporting
+    uint16_t *inv = malloc(w.n * sizeof(uint16_t));
+    for (size_t k = 0; k < w.n; k++)
+        inv[k] = (uint16_t)(4096 - w.i[k]);
+    uint64_t before = out[1].energy_mj;
+    CHECK(meter_dsp_feed(&m, w.v, inv, 2 * cfg.window, out, 2) == 2);
+    CHECK(out[1].power_w < -3000);
+    CHECK(out[1].energy_mj == before);
+    free(inv);
+    waveform_free(&w);
+}
+
+// DMA frames in, snapshot and JSON out
+static void test_pipeline(void)
+{
+    fake_http_resp_t resp;
+    waveform_t w = load("ev_1ph_16a_50hz.txt");
+    CHECK(w.rate == CONFIG_EVOLTE_METER_SAMPLE_HZ);
+    CHECK(w.v_uv_per_lsb == CONFIG_EVOLTE_METER_V_UV_PER_LSB);
+    CHECK(w.i_ua_per_lsb == CONFIG_EVOLTE_METER_I_UA_PER_LSB);
+
+    fake_adc_feed(w.v, w.i, w.n);
+    const meter_stats_t *st = meter_stats();
+    // The tail of the file may still sit in a part-filled DMA frame
+    uint32_t window = CONFIG_EVOLTE_METER_SAMPLE_HZ / 1000 * CONFIG_EVOLTE_METER_WINDOW_MS;
+    CHECK(st->windows >= 1 && st->windows <= w.n / window);
+    CHECK(st->overruns == 0);
+
+    meter_dsp_out_t m;
+    meter_get(&m);
+    CHECK(near(m.v_rms_mv, 230000, 0.01, 0));
+    CHECK(near(m.i_rms_ma, 16000, 0.02, 0));
+    CHECK(m.power_w > 3400 && m.power_w < 3800);
+
+    uint8_t val[64];
+    size_t len;
+    fake_gap_connect(1);
+    fake_gap_mtu(1, 256);
+    CHECK(fake_gatt_read(1, UUID_STATUS, val, sizeof(val), &len) == 0);
+    CHECK(len == STATUS_SNAPSHOT_SIZE && val[1] == STATUS_SNAPSHOT_SIZE);
+    uint32_t v_rms = val[32] | val[33] << 8 | val[34] << 16 | (uint32_t)val[35] << 24;
+    int32_t power = (int32_t)(val[40] | val[41] << 8 | val[42] << 16 | (uint32_t)val[43] << 24);
+    CHECK(v_rms == m.v_rms_mv);
+    CHECK(power == m.power_w);
+    fake_gap_disconnect(1);
+
+    CHECK(fake_http_request(HTTP_GET, "/api/status", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len] = '\0';
+    char want[64];
+    snprintf(want, sizeof(want), "\"meter\":{\"v_rms_mv\":%u,", (unsigned)m.v_rms_mv);
+    CHECK(strstr(resp.body, want) != NULL);
+    snprintf(want, sizeof(want), "\"power_w\":%d,", (int)m.power_w);
+    CHECK(strstr(resp.body, want) != NULL);
+
+    // A stalled task loses whole frames once the driver pool is full, and is
+    // told so by the overflow callback
+    fake_tasks_hold(true);
+    fake_adc_feed(w.v, w.i, w.n);
+    fake_tasks_hold(false);
+    fake_host_run();
+    CHECK(fake_adc_overflows() > 0);
+    CHECK(st->overruns == fake_adc_overflows());
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len] = '\0';
+    CHECK(strstr(resp.body, "\"meter\":{\"windows\":") != NULL);
+    waveform_free(&w);
+}
+
+int main(void)
+{
+    test_isqrt();
+    test_recorded();
+    test_chunks();
+    test_energy();
+
+    app_main();
+    fake_host_run();
+    test_pipeline();
+    return check_report("meter");
+}
@@ -0,0 +1,462 @@
+// Firmware update against the whole firmware: an image pushed over HTTP
+// and one streamed over the OTA characteristic with a disconnect half way,
+// each hashed while written and switched to only when it verifies; bad
+// hashes, non-images and oversize bodies refused; the rollback of a new
+// image that does not confirm itself in time; and delta patches against the
+// running image over both transports.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "esp_ota_ops.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include "ota_update.h"
+#include "sdkconfig.h"
+
+#define UUID_OTA 0xFEF6
+#define IMAGE_SIZE (600 * 1024 + 123)
+#define BLE_MTU 247
+#define BLE_DATA (BLE_MTU - 3 - 5)
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t image_sha[32];
+static uint8_t base[IMAGE_SIZE];
+
+// What the BLE client streams: the image, or a patch
+static const uint8_t *tx = image;
+static uint32_t tx_len = IMAGE_SIZE;
+static ota_fmt_t tx_fmt = OTA_FMT_IMAGE;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// A different image per seed, starting with the app image magic byte
+static void make_image(uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < sizeof(image); i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        image[i] = (uint8_t)x;
+    }
+    image[0] = 0xE9;
+    mbedtls_sha256(image, sizeof(image), image_sha, 0);
+}
+
+static bool slot_holds(const esp_partition_t *p)
+{
+    return memcmp(fake_flash_mem(p->label), image, sizeof(image)) == 0;
+}
+
+static esp_ota_img_states_t state_of(const esp_partition_t *p)
+{
+    esp_ota_img_states_t st = ESP_OTA_IMG_UNDEFINED;
+    esp_ota_get_state_partition(p, &st);
+    return st;
+}
+
+// The running image with a fix: a few bytes in the middle of the code
+// inserted, the end of the image pushed out
+static void make_fixed_image(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    memcpy(base, fake_flash_mem(running->label), sizeof(base));
+    size_t at = IMAGE_SIZE / 3, ins = 300;
+    memcpy(image, base, at);
+    for (size_t i = 0; i < ins; i++)
+        image[at + i] = (uint8_t)(i * 7);
+    memcpy(image + at + ins, base + at, IMAGE_SIZE - at - ins);
+    mbedtls_sha256(image, sizeof(image), image_sha, 0);
+}
+
+static esp_err_t post_to(const char *path, const uint8_t *sha, const void *body, size_t len,
+                         fake_http_resp_t *resp)
+{
+    char uri[96];
+    snprintf(uri, sizeof(uri), "%s", path);
+    if (sha)
+    {
+        char *p = uri + strlen(uri);
+        p += sprintf(p, "?sha256=");
+        for (int i = 0; i < 32; i++)
+            p += sprintf(p, "%02X", sha[i]);
+    }
+    esp_err_t rc = fake_http_request(HTTP_POST, uri, body, len, resp);
+    resp->body[resp->len < sizeof(resp->body) ? resp->len : sizeof(resp->body) - 1] = '\0';
+    return rc;
+}
+
+static esp_err_t post(const uint8_t *sha, const void *body, size_t len, fake_http_resp_t *resp)
+{
+    return post_to("/api/ota", sha, body, len, resp);
+}
+
+// A new image was flashed by cable before this boot and must confirm itself
+static void flash_pending_image(void)
+{
+    make_image(1);
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    esp_ota_handle_t h;
+    CHECK(esp_ota_begin(next, sizeof(image), &h) == ESP_OK);
+    CHECK(esp_ota_write(h, image, sizeof(image)) == ESP_OK);
+    CHECK(esp_ota_end(h) == ESP_OK);
+    CHECK(esp_ota_set_boot_partition(next) == ESP_OK);
+    fake_ota_reboot();
+    CHECK(esp_ota_get_running_partition() == next);
+    CHECK(state_of(next) == ESP_OTA_IMG_PENDING_VERIFY);
+}
+
+static void test_boot_confirms(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    CHECK(state_of(running) == ESP_OTA_IMG_VALID);
+    CHECK(!ota_update_stats()->pending_verify);
+    unsigned long restarts = fake_restarts();
+    fake_time_advance_ms(CONFIG_EVOLTE_OTA_CONFIRM_S * 1000 + 10);
+    CHECK(fake_restarts() == restarts);
+}
+
+static void test_http_refused(void)
+{
+    fake_http_resp_t resp;
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    uint32_t failed = ota_update_stats()->failed;
+    make_image(2);
+
+    CHECK(post(NULL, image, sizeof(image), &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 400 && strstr(resp.body, "sha256 missing"));
+
+    uint8_t bad[32];
+    memcpy(bad, image_sha, sizeof(bad));
+    bad[31] ^= 1;
+    CHECK(post(bad, image, sizeof(image), &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 400 && strstr(resp.body, "SHA-256 mismatch"));
+
+    image[0] = 0;
+    mbedtls_sha256(image, sizeof(image), image_sha, 0);
+    CHECK(post(image_sha, image, sizeof(image), &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 400 && strstr(resp.body, "Not an app image"));
+
+    // Refused from the length alone, nothing is read
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    CHECK(post(image_sha, image, next->size + 1, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 413);
+
+    CHECK(esp_ota_get_boot_partition() == boot);
+    CHECK(ota_update_stats()->failed == failed + 2);
+}
+
+static void test_http_update(void)
+{
+    fake_http_resp_t resp;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    unsigned long restarts = fake_restarts();
+    make_image(3);
+
+    CHECK(post(image_sha, image, sizeof(image), &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+    char expect[32];
+    snprintf(expect, sizeof(expect), "\"bytes\":%u", (unsigned)sizeof(image));
+    CHECK(strstr(resp.body, expect) != NULL);
+    CHECK(slot_holds(next));
+    CHECK(esp_ota_get_boot_partition() == next && esp_ota_get_running_partition() == running);
+    CHECK(state_of(next) == ESP_OTA_IMG_NEW);
+
+    // The reply goes out before the restart
+    CHECK(fake_restarts() == restarts);
+    fake_time_advance_ms(OTA_RESTART_MS);
+    CHECK(fake_restarts() == restarts + 1);
+}
+
+// The image from test_http_update never confirms, so it is rolled back
+static void test_rollback(void)
+{
+    const esp_partition_t *old = esp_ota_get_running_partition();
+    fake_ota_reboot();
+    const esp_partition_t *fresh = esp_ota_get_running_partition();
+    CHECK(fresh != old && state_of(fresh) == ESP_OTA_IMG_PENDING_VERIFY);
+
+    unsigned long restarts = fake_restarts();
+    ota_update_init();
+    CHECK(ota_update_stats()->pending_verify);
+    fake_time_advance_ms(CONFIG_EVOLTE_OTA_CONFIRM_S * 1000 - 10);
+    CHECK(fake_restarts() == restarts);
+    fake_time_advance_ms(20);
+    CHECK(fake_restarts() == restarts + 1);
+    CHECK(state_of(fresh) == ESP_OTA_IMG_INVALID);
+    CHECK(esp_ota_get_boot_partition() == old);
+
+    fake_ota_reboot();
+    CHECK(esp_ota_get_running_partition() == old);
+    ota_update_init();
+    CHECK(!ota_update_stats()->pending_verify);
+}
+
+// A fix to the running image sent as a patch, checked against the image
+// it was made for
+static void test_http_patch(void)
+{
+    fake_http_resp_t resp;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    uint32_t patches = ota_update_stats()->patches;
+    size_t patch_n;
+
+    // Made against some other build
+    make_image(6);
+    memcpy(base, image, sizeof(base));
+    make_image(7);
+    uint8_t *patch = ota_delta_make(base, sizeof(base), image, sizeof(image), &patch_n);
+    CHECK(post_to("/api/ota/patch", image_sha, patch, patch_n, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 409 && strstr(resp.body, "another image"));
+    free(patch);
+
+    make_fixed_image();
+    patch = ota_delta_make(base, sizeof(base), image, sizeof(image), &patch_n);
+    CHECK(patch_n < 4096);
+    uint8_t bad[32];
+    memcpy(bad, image_sha, sizeof(bad));
+    bad[0] ^= 1;
+    CHECK(post_to("/api/ota/patch", bad, patch, patch_n, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 400 && strstr(resp.body, "SHA-256 mismatch"));
+    CHECK(esp_ota_get_boot_partition() == running);
+
+    unsigned long restarts = fake_restarts();
+    CHECK(post_to("/api/ota/patch", image_sha, patch, patch_n, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+    char expect[32];
+    snprintf(expect, sizeof(expect), "\"bytes\":%u", (unsigned)patch_n);
+    CHECK(strstr(resp.body, expect) != NULL);
+    CHECK(slot_holds(next) && esp_ota_get_boot_partition() == next);
+    CHECK(ota_update_stats()->patches == patches + 1);
+    free(patch);
+
+    fake_time_advance_ms(OTA_RESTART_MS);
+    CHECK(fake_restarts() == restarts + 1);
+    fake_ota_reboot();
+    ota_update_init();
+    ota_update_confirm();
+    CHECK(esp_ota_get_running_partition() == next && state_of(next) == ESP_OTA_IMG_VALID);
+}
+
+// ---- BLE ----
+
+typedef struct
+{
+    bool got;
+    uint8_t status;
+    uint32_t off;
+} ble_reply_t;
+
+static uint32_t next_off, acked;
+
+// Apply the device's notifications to the client's send position
+static ble_reply_t take_replies(void)
+{
+    fake_gatt_tx_t tx;
+    ble_reply_t last = {0};
+    uint16_t handle = fake_gatt_val_handle(UUID_OTA);
+    while (fake_gatt_tx_pop(&tx))
+    {
+        if (tx.attr_handle != handle)
+            continue;
+        CHECK(tx.len == 5);
+        last = (ble_reply_t){.got = true, .status = tx.data[0], .off = get_le32(&tx.data[1])};
+        if (last.status == OTA_ST_OK && last.off > acked)
+            acked = last.off;
+        if (last.status == OTA_ST_SEQ)
+            next_off = last.off;
+    }
+    return last;
+}
+
+static void ble_begin(uint16_t conn)
+{
+    uint8_t req[38] = {OTA_OP_BEGIN};
+    put_le32(&req[1], tx_len);
+    memcpy(&req[5], image_sha, 32);
+    req[37] = (uint8_t)tx_fmt;
+    // Images are sent without the format byte, as older clients do
+    CHECK(fake_gatt_write(conn, UUID_OTA, req, tx_fmt == OTA_FMT_IMAGE ? 37 : 38) == 0);
+}
+
+static void ble_send(uint16_t conn, uint32_t off, size_t n)
+{
+    uint8_t req[5 + BLE_DATA] = {OTA_OP_DATA};
+    put_le32(&req[1], off);
+    memcpy(&req[5], &tx[off], n);
+    CHECK(fake_gatt_write(conn, UUID_OTA, req, 5 + n) == 0);
+}
+
+// Send within the window until the image is out or stop_at is reached
+static void ble_stream(uint16_t conn, uint32_t stop_at)
+{
+    while (next_off < stop_at)
+    {
+        while (next_off < stop_at && next_off - acked + BLE_DATA <= OTA_WINDOW)
+        {
+            size_t n = stop_at - next_off < BLE_DATA ? stop_at - next_off : BLE_DATA;
+            uint32_t off = next_off;
+            next_off += (uint32_t)n;
+            ble_send(conn, off, n);
+        }
+        fake_time_advance_ms(1);
+        take_replies();
+    }
+}
+
+static void ble_connect(uint16_t conn)
+{
+    fake_gap_connect(conn);
+    fake_gap_mtu(conn, BLE_MTU);
+    fake_gap_subscribe(conn, UUID_OTA, true, false);
+    fake_host_run();
+    take_replies();
+}
+
+static void test_ble_update(void)
+{
+    fake_http_resp_t resp;
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    unsigned long restarts = fake_restarts();
+    make_image(4);
+    next_off = acked = 0;
+
+    ble_connect(1);
+    ble_begin(1);
+    ble_reply_t r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_OK && r.off == 0);
+    ble_stream(1, IMAGE_SIZE / 3);
+
+    // Out of order data is refused with the offset to go back to
+    uint32_t expect = next_off;
+    ble_send(1, 0, BLE_DATA);
+    r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_SEQ && r.off == expect);
+
+    // Nobody else gets in while the owner is connected
+    ble_connect(2);
+    ble_begin(2);
+    CHECK(take_replies().status == OTA_ST_BUSY);
+    CHECK(post(image_sha, image, sizeof(image), &resp) == ESP_OK && atoi(resp.status) == 409);
+
+    // Dropped link: whatever reached the device is kept, BEGIN resumes
+    ble_stream(1, IMAGE_SIZE / 2);
+    fake_gap_disconnect(1);
+    fake_time_advance_ms(10);
+    ble_begin(2);
+    r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_OK && r.off == IMAGE_SIZE / 2);
+    next_off = acked = r.off;
+    ble_stream(2, IMAGE_SIZE);
+
+    uint8_t finish = OTA_OP_FINISH;
+    CHECK(fake_gatt_write(2, UUID_OTA, &finish, 1) == 0);
+    fake_time_advance_ms(1);
+    r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_DONE);
+    CHECK(slot_holds(next) && esp_ota_get_boot_partition() == next);
+    fake_time_advance_ms(OTA_RESTART_MS);
+    CHECK(fake_restarts() == restarts + 1);
+
+    CHECK(ota_update_stats()->last_bytes == IMAGE_SIZE);
+
+    // Boots into it and confirms
+    fake_ota_reboot();
+    ota_update_init();
+    CHECK(ota_update_stats()->pending_verify);
+    ota_update_confirm();
+    CHECK(state_of(next) == ESP_OTA_IMG_VALID);
+
+    // A corrupted stream fails verification and leaves the boot slot alone
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    make_image(5);
+    next_off = acked = 0;
+    ble_begin(2);
+    take_replies();
+    image[IMAGE_SIZE / 2] ^= 0x55;
+    ble_stream(2, IMAGE_SIZE);
+    CHECK(fake_gatt_write(2, UUID_OTA, &finish, 1) == 0);
+    fake_time_advance_ms(1);
+    r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_HASH);
+    CHECK(esp_ota_get_boot_partition() == boot);
+
+    uint8_t bad = 0x7F;
+    CHECK(fake_gatt_write(2, UUID_OTA, &bad, 1) == BLE_ATT_ERR_REQ_NOT_SUPPORTED);
+    CHECK(fake_gatt_write(2, UUID_OTA, &bad, 0) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    fake_gap_disconnect(2);
+}
+
+// A patch over BLE, through the same ring and acks as an image
+static void test_ble_patch(void)
+{
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    size_t patch_n;
+    make_fixed_image();
+    uint8_t *patch = ota_delta_make(base, sizeof(base), image, sizeof(image), &patch_n);
+    tx = patch;
+    tx_len = (uint32_t)patch_n;
+    tx_fmt = OTA_FMT_PATCH;
+    next_off = acked = 0;
+
+    ble_connect(3);
+    ble_begin(3);
+    ble_reply_t r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_OK && r.off == 0);
+    ble_stream(3, tx_len);
+    uint8_t finish = OTA_OP_FINISH;
+    CHECK(fake_gatt_write(3, UUID_OTA, &finish, 1) == 0);
+    fake_time_advance_ms(1);
+    r = take_replies();
+    CHECK(r.got && r.status == OTA_ST_DONE && r.off == tx_len);
+    CHECK(slot_holds(next) && esp_ota_get_boot_partition() == next);
+    CHECK(ota_update_stats()->last_bytes == patch_n);
+
+    // An unknown format is refused outright
+    uint8_t req[38] = {OTA_OP_BEGIN};
+    req[37] = 9;
+    CHECK(fake_gatt_write(3, UUID_OTA, req, sizeof(req)) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    fake_gap_disconnect(3);
+    fake_time_advance_ms(OTA_RESTART_MS);
+    free(patch);
+    tx = image;
+    tx_len = IMAGE_SIZE;
+    tx_fmt = OTA_FMT_IMAGE;
+}
+
+int main(void)
+{
+    flash_pending_image();
+    app_main();
+    fake_host_run();
+    test_boot_confirms();
+    test_http_refused();
+    test_http_update();
+    test_rollback();
+    test_http_patch();
+    test_ble_update();
+    test_ble_patch();
+
+    fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    CHECK(strstr(resp.body, "\"ota\":{\"updates\":4,\"patches\":2,") != NULL);
+    return check_report("ota");
+}
@@ -0,0 +1,252 @@
+// Delta update patches: made by the host tool from two builds of a synthetic
+// app image and applied by the firmware's streaming applier in random
+// chunks. A small fix must come out as a small patch, the rebuilt image must
+// be exact, and a patch for another image, a corrupt or a truncated one must
+// never pass as complete.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include "ota_patch.h"
+
+// Like an app image: rodata first, then code with a 32-bit address every
+// record, mostly into rodata and now and then into code
+#define RODATA_SIZE (64 * 1024)
+#define CODE_SIZE (320 * 1024)
+#define IMAGE_MAX (RODATA_SIZE + CODE_SIZE + 4096)
+#define RECORD 32
+#define BASE_ADDR 0x3F400000u
+
+#define FIX_AT (RODATA_SIZE + CODE_SIZE * 2 / 5)
+#define FIX_INSERT 180
+#define FIX_EDIT_AT (RODATA_SIZE + CODE_SIZE * 7 / 10)
+#define FIX_EDIT_LEN 24
+
+static uint8_t old_img[IMAGE_MAX], new_img[IMAGE_MAX], out_img[IMAGE_MAX];
+static size_t old_n, new_n;
+
+static uint32_t rng;
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// The same build each time, with the fix to the code or without it: bytes
+// inserted at FIX_AT move everything after them, including what addresses
+// point at, and a few bytes changed in place at FIX_EDIT_AT
+static size_t build(uint8_t *img, int fixed)
+{
+    size_t n = 0;
+    rng = 12345;
+    for (; n < RODATA_SIZE; n++)
+        img[n] = (uint8_t)(' ' + next_rand() % 64);
+    img[0] = 0xE9;
+
+    for (uint32_t code = 0; code < CODE_SIZE; code += RECORD)
+    {
+        if (fixed && RODATA_SIZE + code == FIX_AT)
+            for (int i = 0; i < FIX_INSERT; i++)
+                img[n++] = (uint8_t)(i * 37 + 11);
+        for (int i = 0; i < RECORD - 4; i++)
+            img[n++] = (uint8_t)next_rand();
+        uint32_t r = next_rand();
+        uint32_t target = r % 10 ? r % RODATA_SIZE : RODATA_SIZE + r % CODE_SIZE;
+        if (fixed && target >= FIX_AT)
+            target += FIX_INSERT;
+        put_le32(&img[n], BASE_ADDR + target);
+        n += 4;
+    }
+    if (fixed)
+        for (int i = 0; i < FIX_EDIT_LEN; i++)
+            img[FIX_EDIT_AT + FIX_INSERT + i] ^= 0x5A;
+    return n;
+}
+
+// ---- Applying through ota_patch with memory io ----
+
+typedef struct
+{
+    const uint8_t *old;
+    size_t old_n;
+    size_t n;
+    int refuse;
+} io_ctx_t;
+
+static int on_header(void *c, const ota_patch_hdr_t *hdr)
+{
+    io_ctx_t *io = c;
+    uint8_t sha[32];
+    mbedtls_sha256(io->old, io->old_n, sha, 0);
+    io->refuse = hdr->old_size != io->old_n || memcmp(sha, hdr->old_sha256, 32) != 0 || hdr->new_size > IMAGE_MAX;
+    return io->refuse ? -1 : 0;
+}
+
+static int read_old(void *c, uint32_t off, void *buf, size_t len)
+{
+    io_ctx_t *io = c;
+    CHECK(off + len <= io->old_n);
+    if (off + len > io->old_n)
+        return -1;
+    memcpy(buf, io->old + off, len);
+    return 0;
+}
+
+static int write_out(void *c, const void *data, size_t len)
+{
+    io_ctx_t *io = c;
+    CHECK(io->n + len <= IMAGE_MAX);
+    if (io->n + len > IMAGE_MAX)
+        return -1;
+    memcpy(out_img + io->n, data, len);
+    io->n += len;
+    return 0;
+}
+
+// Feeds the patch in random chunks of 1..max_chunk bytes, like a transport
+static int apply_chunked(const uint8_t *old, size_t on, const uint8_t *patch, size_t pn, size_t max_chunk,
+                         size_t *out_n)
+{
+    static ota_patch_t p;
+    io_ctx_t io = {.old = old, .old_n = on};
+    ota_patch_io_t pio = {.on_header = on_header, .read_old = read_old, .write = write_out, .ctx = &io};
+    ota_patch_init(&p, &pio);
+    int rc = OTA_PATCH_OK;
+    for (size_t off = 0; off < pn && rc == OTA_PATCH_OK;)
+    {
+        size_t n = 1 + next_rand() % max_chunk;
+        if (n > pn - off)
+            n = pn - off;
+        rc = ota_patch_feed(&p, patch + off, n);
+        off += n;
+    }
+    rc = ota_patch_finish(&p);
+    *out_n = io.n;
+    return rc;
+}
+
+static int rebuilt(size_t out_n)
+{
+    return out_n == new_n && memcmp(out_img, new_img, new_n) == 0;
+}
+
+static void test_small_fix(void)
+{
+    size_t patch_n, out_n;
+    uint8_t *patch = ota_delta_make(old_img, old_n, new_img, new_n, &patch_n);
+    CHECK(patch != NULL);
+    printf("ota_patch: %zu byte image, %zu byte fix: %zu byte patch\n", new_n, (size_t)FIX_INSERT + FIX_EDIT_LEN,
+           patch_n);
+    CHECK(patch_n < 4096);
+
+    CHECK(ota_delta_apply(old_img, old_n, patch, patch_n, out_img, sizeof(out_img), &out_n) == OTA_PATCH_OK);
+    CHECK(rebuilt(out_n));
+    for (size_t chunk = 1; chunk <= 1024; chunk *= 4)
+    {
+        memset(out_img, 0, sizeof(out_img));
+        CHECK(apply_chunked(old_img, old_n, patch, patch_n, chunk, &out_n) == OTA_PATCH_OK);
+        CHECK(rebuilt(out_n));
+    }
+
+    // Made for another build: refused at the header, nothing written
+    old_img[old_n / 2] ^= 1;
+    CHECK(apply_chunked(old_img, old_n, patch, patch_n, 300, &out_n) == OTA_PATCH_ERR_BASE);
+    CHECK(out_n == 0);
+    old_img[old_n / 2] ^= 1;
+
+    // Cut short anywhere: never complete
+    for (size_t cut = 0; cut < patch_n; cut += patch_n / 50 + 1)
+        CHECK(apply_chunked(old_img, old_n, patch, cut, 300, &out_n) != OTA_PATCH_OK);
+
+    // Corrupt anywhere past the header: an error, or an image the SHA-256
+    // check of the update rejects. Never more than new_size bytes.
+    int caught = 0, tries = 0;
+    for (size_t at = OTA_PATCH_HDR_LEN; at < patch_n; at += 7, tries++)
+    {
+        patch[at] ^= 0x24;
+        int rc = apply_chunked(old_img, old_n, patch, patch_n, 300, &out_n);
+        CHECK(out_n <= new_n);
+        caught += rc != OTA_PATCH_OK || !rebuilt(out_n);
+        patch[at] ^= 0x24;
+    }
+    // Only flag bits past the last item go unnoticed
+    CHECK(caught >= tries - 1);
+    free(patch);
+}
+
+static void test_identical_and_unrelated(void)
+{
+    size_t patch_n, out_n;
+    uint8_t *patch = ota_delta_make(old_img, old_n, old_img, old_n, &patch_n);
+    CHECK(patch != NULL && patch_n < OTA_PATCH_HDR_LEN + 64);
+    memcpy(new_img, old_img, old_n);
+    new_n = old_n;
+    CHECK(apply_chunked(old_img, old_n, patch, patch_n, 512, &out_n) == OTA_PATCH_OK && rebuilt(out_n));
+    free(patch);
+
+    // Nothing in common: still exact, and larger than the image by no more
+    // than LZSS's flag bit per literal
+    rng = 777;
+    new_n = 100 * 1024 + 3;
+    for (size_t i = 0; i < new_n; i++)
+        new_img[i] = (uint8_t)next_rand();
+    patch = ota_delta_make(old_img, old_n, new_img, new_n, &patch_n);
+    CHECK(patch != NULL && patch_n < new_n + new_n / 8 + 256);
+    CHECK(apply_chunked(old_img, old_n, patch, patch_n, 512, &out_n) == OTA_PATCH_OK && rebuilt(out_n));
+    free(patch);
+
+    // Against an empty old image
+    patch = ota_delta_make(old_img, 0, new_img, new_n, &patch_n);
+    CHECK(patch != NULL);
+    CHECK(apply_chunked(old_img, 0, patch, patch_n, 512, &out_n) == OTA_PATCH_OK && rebuilt(out_n));
+    free(patch);
+}
+
+static void test_malformed(void)
+{
+    size_t out_n;
+    uint8_t junk[OTA_PATCH_HDR_LEN + 8] = "EVD0";
+    CHECK(apply_chunked(old_img, old_n, junk, sizeof(junk), 16, &out_n) == OTA_PATCH_ERR_FORMAT);
+    CHECK(apply_chunked(old_img, old_n, junk, 10, 16, &out_n) == OTA_PATCH_ERR_TRUNCATED);
+
+    // A match reaching back before the start of the stream
+    ota_patch_hdr_t hdr = {0};
+    uint8_t p[OTA_PATCH_HDR_LEN + 3];
+    memcpy(p, OTA_PATCH_MAGIC, 4);
+    put_le32(&p[4], (uint32_t)old_n);
+    put_le32(&p[8], 16);
+    mbedtls_sha256(old_img, old_n, hdr.old_sha256, 0);
+    memcpy(&p[12], hdr.old_sha256, 32);
+    memset(&p[44], 0, 32);
+    p[OTA_PATCH_HDR_LEN] = 0x00;     // flags: a match
+    p[OTA_PATCH_HDR_LEN + 1] = 0x10; // 17 bytes back
+    p[OTA_PATCH_HDR_LEN + 2] = 0x00;
+    CHECK(apply_chunked(old_img, old_n, p, sizeof(p), 16, &out_n) == OTA_PATCH_ERR_FORMAT);
+}
+
+int main(void)
+{
+    old_n = build(old_img, 0);
+    new_n = build(new_img, 1);
+    CHECK(new_n == old_n + FIX_INSERT);
+    printf("ota_patch: applier state %zu bytes\n", sizeof(ota_patch_t));
+    CHECK(sizeof(ota_patch_t) <= 3 * 1024);
+
+    test_small_fix();
+    test_malformed();
+    test_identical_and_unrelated();
+    return check_report("ota_patch");
+}
@@ -0,0 +1,261 @@
+// Runtime counters: bucketing, quantiles and the 64-bit sum of the latency
+// histograms, then against the whole firmware that GATT, HTTP and relay
+// traffic is timed, and that the DIAG characteristic pages and /metrics
+// report it along with every task, mbuf pool and block pool, and say so when
+// there are more tasks than the list holds.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "cmd_proto.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+#include "perf.h"
+#include "sdkconfig.h"
+
+#define UUID_STATUS 0xFEF4
+#define UUID_CMD 0xDEAD
+#define UUID_DIAG 0xFEF7
+
+static void record_us(perf_site_t site, uint32_t us, int times)
+{
+    for (int i = 0; i < times; i++)
+        perf_record(site, perf_now() - us);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t site_count(perf_site_t site)
+{
+    perf_hist_t h;
+    perf_read(site, &h);
+    return h.count;
+}
+
+static void test_hist(void)
+{
+    perf_hist_t h;
+    perf_read(PERF_GPIO, &h);
+    CHECK(h.count == 0 && perf_quantile_us(&h, 500) == 0);
+
+    record_us(PERF_GPIO, 10, 10);
+    record_us(PERF_GPIO, 100, 90);
+    record_us(PERF_GPIO, 50000, 1);
+    perf_read(PERF_GPIO, &h);
+    CHECK(h.count == 101);
+    CHECK(h.sum_us == 10 * 10 + 100 * 90 + 50000);
+    CHECK(h.max_us == 50000);
+    CHECK(h.buckets[0] == 10 && h.buckets[3] == 90 && h.buckets[PERF_BUCKETS - 1] == 1);
+    CHECK(perf_quantile_us(&h, 50) == 16);
+    CHECK(perf_quantile_us(&h, 500) == 128);
+    CHECK(perf_quantile_us(&h, 990) == 128);
+    CHECK(perf_quantile_us(&h, 1000) == 50000);
+
+    // Bucket edges are inclusive
+    record_us(PERF_GATT_READ, 16, 1);
+    record_us(PERF_GATT_READ, 17, 1);
+    record_us(PERF_GATT_READ, 16384, 1);
+    record_us(PERF_GATT_READ, 16385, 1);
+    perf_read(PERF_GATT_READ, &h);
+    CHECK(h.buckets[0] == 1 && h.buckets[1] == 1 && h.buckets[10] == 1 && h.buckets[11] == 1);
+
+    // The sum carries past 32 bits
+    record_us(PERF_HTTP, 3000000000u, 2);
+    perf_read(PERF_HTTP, &h);
+    CHECK(h.sum_us == 6000000000ull && h.max_us == 3000000000u);
+}
+
+static size_t diag_read(uint16_t conn, uint8_t page, uint8_t first, uint8_t *buf, size_t cap)
+{
+    uint8_t req[2] = {page, first};
+    size_t len = 0;
+    CHECK(fake_gatt_write(conn, UUID_DIAG, req, sizeof(req)) == 0);
+    CHECK(fake_gatt_read(conn, UUID_DIAG, buf, cap, &len) == 0);
+    CHECK(len >= 4 && buf[0] == page && buf[2] == first);
+    return len;
+}
+
+static void test_timed(void)
+{
+    uint32_t reads = site_count(PERF_GATT_READ);
+    uint32_t writes = site_count(PERF_GATT_WRITE);
+    uint32_t http = site_count(PERF_HTTP);
+    uint32_t gpio = site_count(PERF_GPIO);
+
+    uint8_t buf[64];
+    size_t len;
+    CHECK(fake_gatt_read(1, UUID_STATUS, buf, sizeof(buf), &len) == 0);
+    uint8_t frame[CMD_PROTO_OVERHEAD];
+    len = cmd_proto_encode(frame, sizeof(frame), CMD_OP_NOP, 1, NULL, 0);
+    CHECK(fake_gatt_write(1, UUID_CMD, frame, len) == 0);
+    fake_host_run();
+    CHECK(site_count(PERF_GATT_READ) == reads + 1);
+    CHECK(site_count(PERF_GATT_WRITE) == writes + 1);
+
+    // A relay switched over HTTP: the handler, then the GPIO on the actuator
+    fake_http_resp_t resp;
+    const char *body = "channel=0&on=1";
+    CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+    fake_host_run();
+    CHECK(site_count(PERF_HTTP) == http + 1);
+    CHECK(site_count(PERF_GPIO) == gpio + 1);
+}
+
+static void test_diag(void)
+{
+    uint8_t buf[256];
+    size_t len;
+
+    // Nothing but the header fits the default MTU
+    len = diag_read(1, PERF_PAGE_LATENCY, 0, buf, sizeof(buf));
+    CHECK(len == 4 && buf[1] == PERF_SITE_COUNT && buf[3] == 0);
+
+    fake_gap_mtu(1, 185);
+    fake_host_run();
+    len = diag_read(1, PERF_PAGE_LATENCY, 0, buf, sizeof(buf));
+    CHECK(buf[3] == PERF_SITE_COUNT && len == 4 + 21 * PERF_SITE_COUNT);
+    const uint8_t *gpio = &buf[4 + 21 * PERF_GPIO];
+    perf_hist_t h;
+    perf_read(PERF_GPIO, &h);
+    CHECK(gpio[0] == PERF_GPIO && get_le32(&gpio[1]) == h.count);
+    CHECK(get_le32(&gpio[5]) == h.sum_us / h.count && get_le32(&gpio[9]) == 128);
+    CHECK(get_le32(&gpio[17]) == 50000);
+
+    // Tasks two at a time, every one of them once
+    fake_gap_mtu(1, 39);
+    fake_host_run();
+    int seen = 0, total = 0;
+    bool actuator = false, meter = false;
+    for (uint8_t first = 0; first == 0 || first < total; first += buf[3])
+    {
+        len = diag_read(1, PERF_PAGE_TASKS, first, buf, sizeof(buf));
+        total = buf[1];
+        CHECK(buf[3] == 2 || first + buf[3] == total);
+        CHECK(len == 4 + 17u * buf[3]);
+        for (int i = 0; i < buf[3]; i++)
+        {
+            const uint8_t *e = &buf[4 + 17 * i];
+            char name[13] = {0};
+            memcpy(name, e, 12);
+            actuator |= strcmp(name, "actuator") == 0;
+            meter |= strcmp(name, "meter") == 0;
+            CHECK(get_le16(&e[13]) <= 1000 && get_le16(&e[15]) > 0);
+        }
+        seen += buf[3];
+        if (buf[3] == 0)
+            break;
+    }
+    CHECK(total == (int)uxTaskGetNumberOfTasks() && seen == total);
+    CHECK(actuator && meter);
+
+    fake_gap_mtu(1, 185);
+    fake_host_run();
+    len = diag_read(1, PERF_PAGE_POOLS, 0, buf, sizeof(buf));
+    CHECK(buf[1] == 2 + MEM_POOL_COUNT && buf[3] == buf[1] && len == 4 + buf[1] * 20u);
+    CHECK(memcmp(&buf[4], "msys_1", 7) == 0);
+    CHECK(get_le16(&buf[16]) == CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE);
+    CHECK(get_le16(&buf[18]) == CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT);
+    CHECK(get_le16(&buf[22]) <= get_le16(&buf[20]));
+    // The firmware's own pools follow NimBLE's, the one serving this read out
+    const uint8_t *att = &buf[4 + 2 * 20];
+    CHECK(memcmp(att, "ATT", 4) == 0 && get_le16(&att[12]) == MEM_POOL_BLOCK_ATT);
+    CHECK(get_le16(&att[16]) < get_le16(&att[14]));
+
+    len = diag_read(1, PERF_PAGE_HEAP, 0, buf, sizeof(buf));
+    CHECK(len == 4 + 13 && get_le32(&buf[4]) > 0 && get_le32(&buf[12]) == fake_time_ms());
+    CHECK(buf[16] == uxTaskGetNumberOfTasks());
+
+    // Past the end, an unknown page, a malformed write
+    len = diag_read(1, PERF_PAGE_POOLS, 5, buf, sizeof(buf));
+    CHECK(len == 4 && buf[3] == 0);
+    uint8_t bad[3] = {PERF_PAGE_COUNT, 0, 0};
+    CHECK(fake_gatt_write(1, UUID_DIAG, bad, 1) == BLE_ATT_ERR_VALUE_NOT_ALLOWED);
+    CHECK(fake_gatt_write(1, UUID_DIAG, bad, 0) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    CHECK(fake_gatt_write(1, UUID_DIAG, bad, 3) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+}
+
+static void test_metrics(void)
+{
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/metrics", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200 && strncmp(resp.type, "text/plain", 10) == 0);
+    CHECK(resp.len < sizeof(resp.body));
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+
+    char want[96];
+    snprintf(want, sizeof(want), "evolte_latency_us_count{op=\"gpio\"} %lu\n",
+             (unsigned long)site_count(PERF_GPIO));
+    CHECK(strstr(resp.body, want) != NULL);
+    CHECK(strstr(resp.body, "evolte_latency_us_bucket{op=\"gpio\",le=\"128\"} 101\n") != NULL);
+    CHECK(strstr(resp.body, "evolte_latency_max_us{op=\"http\"} 3000000000\n") != NULL);
+    CHECK(strstr(resp.body, "evolte_task_stack_free_bytes{task=\"actuator\"} ") != NULL);
+    CHECK(strstr(resp.body, "evolte_task_cpu_us_total{task=\"meter\",core=") != NULL);
+    CHECK(strstr(resp.body, "\nevolte_tasks_unlisted 0\n") != NULL);
+    snprintf(want, sizeof(want), "evolte_mempool_blocks{pool=\"msys_2\"} %d\n", CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT);
+    CHECK(strstr(resp.body, want) != NULL);
+
+    // Every chunk arrived, the last line included
+    const char *last = "\nevolte_heap_min_free_bytes ";
+    const char *p = strstr(resp.body, last);
+    CHECK(p != NULL && p[strlen(p) - 1] == '\n' && strchr(p + 1, '\n') == &resp.body[resp.len - 1]);
+}
+
+static void parked(void *arg)
+{
+    for (;;)
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+// More tasks than the list holds: none listed, but the count says why
+static void test_many_tasks(void)
+{
+    static const char *const names[] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", "t8", "t9", "t10",
+                                        "t11", "t12", "t13", "t14", "t15", "t16", "t17", "t18", "t19",
+                                        "t20", "t21", "t22", "t23", "t24", "t25", "t26", "t27", "t28",
+                                        "t29", "t30", "t31", "t32"};
+    for (int i = 0; uxTaskGetNumberOfTasks() <= PERF_TASKS_MAX; i++)
+        CHECK(xTaskCreatePinnedToCore(parked, names[i], 2048, NULL, 1, NULL, 0) == pdPASS);
+    fake_host_run();
+    int running = (int)uxTaskGetNumberOfTasks();
+
+    uint8_t buf[200];
+    diag_read(1, PERF_PAGE_TASKS, 0, buf, sizeof(buf));
+    CHECK(buf[1] == 0 && buf[3] == 0);
+    diag_read(1, PERF_PAGE_HEAP, 0, buf, sizeof(buf));
+    CHECK(buf[16] == running);
+
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/metrics", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    char want[64];
+    snprintf(want, sizeof(want), "\nevolte_tasks %d\n", running);
+    CHECK(strstr(resp.body, want) != NULL);
+    snprintf(want, sizeof(want), "\nevolte_tasks_unlisted %d\n", running);
+    CHECK(strstr(resp.body, want) != NULL);
+}
+
+int main(void)
+{
+    test_hist();
+
+    app_main();
+    fake_host_run();
+    fake_gap_connect(1);
+    fake_host_run();
+
+    test_timed();
+    test_diag();
+    test_metrics();
+    test_many_tasks();
+    return check_report("perf");
+}
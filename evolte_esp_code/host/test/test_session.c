@@ -0,0 +1,109 @@
+// Session table stress test: connection churn across all slots, advertising
+// only while a slot is free, and round-robin fairness between a client that
+// floods full batches and clients that send single commands.
+#include <stdlib.h>
+#include <string.h>
+#include "ble_session.h"
+#include "check.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+
+#define UUID_CMD 0xDEAD
+#define CHURN_ROUNDS 20000
+
+static uint8_t batch[CMD_PROTO_MAX_FRAMES * (CMD_PROTO_OVERHEAD + 2)];
+static size_t batch_len;
+static uint8_t single[CMD_PROTO_OVERHEAD + 2];
+static size_t single_len;
+
+static void build_frames(void)
+{
+    for (int i = 0; i < CMD_PROTO_MAX_FRAMES; i++)
+    {
+        const uint8_t payload[2] = {0, (uint8_t)(i & 1)};
+        batch_len += cmd_proto_encode(&batch[batch_len], sizeof(batch) - batch_len, CMD_OP_RELAY_SET,
+                                      (uint8_t)i, payload, 2);
+    }
+    const uint8_t on[2] = {0, 1};
+    single_len = cmd_proto_encode(single, sizeof(single), CMD_OP_RELAY_SET, 0, on, 2);
+}
+
+static void test_churn(void)
+{
+    bool connected[64] = {false};
+    int open = 0;
+    srand(1234);
+
+    for (int r = 0; r < CHURN_ROUNDS; r++)
+    {
+        uint16_t h = (uint16_t)(rand() % 64);
+        if (connected[h])
+        {
+            CHECK(fake_gatt_write(h, UUID_CMD, single, single_len) == 0);
+            fake_gap_disconnect(h);
+            connected[h] = false;
+            open--;
+        }
+        else if (fake_gap_adv_active())
+        {
+            fake_gap_connect(h);
+            connected[h] = true;
+            open++;
+        }
+        fake_time_advance_ms(1);
+
+        CHECK(ble_session_free_slots() == BLE_SESSION_MAX - open);
+        CHECK(fake_gap_adv_active() == (open < BLE_SESSION_MAX));
+    }
+
+    for (uint16_t h = 0; h < 64; h++)
+        if (connected[h])
+            fake_gap_disconnect(h);
+    CHECK(ble_session_free_slots() == BLE_SESSION_MAX);
+}
+
+static void test_fairness(void)
+{
+    fake_gap_connect(1); // Noisy maintenance tool
+    fake_gap_connect(2); // Driver
+    fake_gap_connect(3); // Site operator
+    ble_session_t *noisy = ble_session_find(1);
+    ble_session_t *quiet1 = ble_session_find(2);
+    ble_session_t *quiet2 = ble_session_find(3);
+    CHECK(noisy && quiet1 && quiet2);
+    if (!noisy || !quiet1 || !quiet2)
+        return;
+
+    // The flood fills the noisy queue; a second batch does not fit
+    CHECK(fake_gatt_write(1, UUID_CMD, batch, batch_len) == 0);
+    CHECK(noisy->stats.cmds_run == CONFIG_EVOLTE_SCHED_BUDGET);
+    CHECK(fake_gatt_write(1, UUID_CMD, batch, batch_len) == BLE_ATT_ERR_PREPARE_QUEUE_FULL);
+    CHECK(noisy->stats.cmds_dropped == CMD_PROTO_MAX_FRAMES);
+
+    // Quiet clients get their command run in the very next pass
+    CHECK(fake_gatt_write(2, UUID_CMD, single, single_len) == 0);
+    CHECK(quiet1->stats.cmds_run == 1);
+    CHECK(fake_gatt_write(3, UUID_CMD, single, single_len) == 0);
+    CHECK(quiet2->stats.cmds_run == 1);
+    CHECK(noisy->stats.cmds_run < CMD_PROTO_MAX_FRAMES);
+
+    // Deferred passes drain the rest
+    fake_time_advance_ms(1);
+    CHECK(noisy->stats.cmds_run == CMD_PROTO_MAX_FRAMES);
+    CHECK(noisy->q_count == 0);
+
+    fake_gap_disconnect(1);
+    fake_gap_disconnect(2);
+    fake_gap_disconnect(3);
+}
+
+int main(void)
+{
+    app_main();
+    build_frames();
+
+    test_churn();
+    test_fairness();
+
+    return check_report("session");
+}
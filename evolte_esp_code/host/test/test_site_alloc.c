@@ -0,0 +1,265 @@
+// Site load balancing: the fair split checked by hand, with leftovers,
+// minimums and the queue when the minimums do not fit; then chargers
+// exchanging reports, where a car plugging in or out settles within the
+// documented rounds and the site never goes over budget on the way; the
+// fallback of a charger alone, a quiet charger's share held until it is
+// forgotten, and reports that must be turned away.
+#include <stdio.h>
+#include <string.h>
+#include "check.h"
+#include "site_alloc.h"
+
+#define MIN_DA 60
+#define FALLBACK_DA 60
+#define GROUP 7
+#define N 4
+
+static site_alloc_t site[N];
+static site_node_t tables[N][N];
+static uint16_t demand[N];
+static uint16_t budget[N];
+
+static void share_of(site_node_t *nodes, int n, uint16_t b)
+{
+    site_alloc_share(nodes, (uint16_t)n, b);
+}
+
+static void test_share(void)
+{
+    site_node_t x[5] = {
+        {.id = 1, .demand = 200, .min = MIN_DA, .ticket = 1},
+        {.id = 2, .demand = 600, .min = MIN_DA, .ticket = 2},
+        {.id = 3, .demand = 600, .min = MIN_DA, .ticket = 3},
+        {.id = 4, .demand = 0, .min = MIN_DA},
+        {.id = 5, .demand = 30, .min = MIN_DA, .ticket = 4},
+    };
+    share_of(x, 5, 1060);
+    CHECK(x[0].target == 200 && x[1].target == 400 && x[2].target == 400);
+    CHECK(x[3].target == 0 && x[4].target == MIN_DA);
+
+    // The rest of an uneven split goes to the lower ids
+    share_of(x, 5, 1062);
+    CHECK(x[0].target == 200 && x[1].target == 401 && x[2].target == 401);
+    share_of(x, 5, 1061);
+    CHECK(x[1].target == 401 && x[2].target == 400);
+
+    // Everyone gets all they want, the rest of the budget stays unused
+    share_of(x, 5, 5000);
+    CHECK(x[0].target == 200 && x[1].target == 600 && x[2].target == 600 && x[4].target == MIN_DA);
+
+    // Minimums that do not all fit: first come first served, a shared
+    // ticket going to the lower id
+    site_node_t q[5];
+    const uint32_t tickets[5] = {5, 1, 3, 2, 3};
+    for (int i = 0; i < 5; i++)
+        q[i] = (site_node_t){.id = 10 + i, .demand = 320, .min = MIN_DA, .ticket = tickets[i]};
+    share_of(q, 5, 200);
+    CHECK(q[0].target == 0 && q[4].target == 0);
+    CHECK(q[1].target == 67 && q[2].target == 67 && q[3].target == 66);
+    share_of(q, 5, 179);
+    CHECK(q[1].target == 90 && q[3].target == 89 && q[2].target == 0 && q[4].target == 0);
+    share_of(q, 5, 59);
+    for (int i = 0; i < 5; i++)
+        CHECK(q[i].target == 0);
+}
+
+static void site_init(uint16_t b)
+{
+    for (int i = 0; i < N; i++)
+    {
+        site_alloc_init(&site[i], 100 + i, GROUP, MIN_DA, FALLBACK_DA, tables[i], N);
+        demand[i] = 0;
+        budget[i] = b;
+    }
+}
+
+static uint32_t total(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < N; i++)
+        sum += site_alloc_self(&site[i])->alloc;
+    return sum;
+}
+
+// One round, each charger in turn reporting to the others right after it
+// moved; returns false if the site drew over limit on the way
+static bool round_all(uint32_t limit, uint8_t quiet)
+{
+    bool ok = true;
+    for (int i = 0; i < N; i++)
+    {
+        site_alloc_set_local(&site[i], budget[i], demand[i]);
+        site_alloc_round(&site[i]);
+        ok &= total() <= limit;
+        if (quiet >> i & 1)
+            continue;
+        uint8_t msg[SITE_MSG_LEN];
+        size_t len = site_alloc_report(&site[i], msg, sizeof(msg));
+        for (int j = 0; j < N; j++)
+            if (j != i)
+                site_alloc_heard(&site[j], msg, len);
+    }
+    return ok;
+}
+
+static uint16_t alloc_of(int i)
+{
+    return site_alloc_self(&site[i])->alloc;
+}
+
+// Rounds until no limit moves any more, after the one that did it last
+static int rounds_to_settle(uint32_t limit)
+{
+    int last = 0;
+    for (int r = 1; r <= 10; r++)
+    {
+        uint16_t before[N];
+        for (int i = 0; i < N; i++)
+            before[i] = alloc_of(i);
+        CHECK(round_all(limit, 0));
+        for (int i = 0; i < N; i++)
+            if (alloc_of(i) != before[i])
+                last = r;
+    }
+    return last;
+}
+
+static void test_rounds(void)
+{
+    site_init(640);
+    demand[0] = demand[1] = demand[2] = 320;
+    // The first to move has heard no one yet and takes the fallback
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(0) == FALLBACK_DA);
+    CHECK(rounds_to_settle(640) <= 3);
+    CHECK(alloc_of(0) == 214 && alloc_of(1) == 213 && alloc_of(2) == 213 && alloc_of(3) == 0);
+
+    // A fourth car: the others cut the round they hear of it, then it takes
+    // its share
+    demand[3] = 320;
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(3) == 0);
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(0) == 160 && alloc_of(2) == 160);
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(3) == 160 && total() == 640);
+    CHECK(rounds_to_settle(640) == 0);
+
+    // A car that wants less leaves the rest to the others, in two rounds
+    demand[1] = 100;
+    CHECK(rounds_to_settle(640) <= 2);
+    CHECK(alloc_of(1) == 100 && alloc_of(0) == 180 && alloc_of(2) == 180 && alloc_of(3) == 180);
+
+    // Unplugged: gone at once, shared out the round after
+    demand[0] = 0;
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(0) == 0);
+    CHECK(round_all(640, 0));
+    CHECK(alloc_of(2) == 270 && alloc_of(3) == 270);
+    CHECK(rounds_to_settle(640) == 0);
+
+    // The lowest budget any charger was set up with applies
+    budget[3] = 400;
+    CHECK(rounds_to_settle(640) <= 3);
+    CHECK(total() == 400 && site[0].budget == 400);
+    CHECK(alloc_of(1) == 100 && alloc_of(2) == 150 && alloc_of(3) == 150);
+}
+
+static void test_queue(void)
+{
+    // Room for two minimums: the third car waits until one leaves
+    site_init(150);
+    CHECK(rounds_to_settle(150) == 0);
+    demand[2] = 320;
+    CHECK(rounds_to_settle(150) <= 3);
+    demand[0] = 320;
+    CHECK(rounds_to_settle(150) <= 3);
+    demand[1] = 320;
+    CHECK(rounds_to_settle(150) <= 3);
+    CHECK(alloc_of(2) == 75 && alloc_of(0) == 75 && alloc_of(1) == 0);
+    CHECK(site_alloc_self(&site[1])->ticket > site_alloc_self(&site[0])->ticket);
+    demand[2] = 0;
+    CHECK(rounds_to_settle(150) <= 3);
+    CHECK(alloc_of(0) == 75 && alloc_of(1) == 75);
+}
+
+static void test_quiet(void)
+{
+    site_init(400);
+    demand[0] = demand[1] = 320;
+    CHECK(rounds_to_settle(400) <= 3);
+    CHECK(alloc_of(0) == 200 && alloc_of(1) == 200);
+
+    // Charger 1 loses its link as its car leaves. Its share stays held
+    // until it is forgotten, then 0 gets what it wants.
+    demand[1] = 0;
+    for (int r = 0; r < SITE_TIMEOUT_ROUNDS; r++)
+    {
+        CHECK(round_all(400, 0x02));
+        CHECK(alloc_of(0) == 200);
+    }
+    CHECK(round_all(400, 0x02));
+    CHECK(site[0].n == N - 1 && alloc_of(0) == 200);
+    CHECK(round_all(400, 0x02));
+    CHECK(alloc_of(0) == 320);
+
+    // Alone: the fallback, however much budget there is
+    site_alloc_t one;
+    site_node_t t[1];
+    site_alloc_init(&one, 1, GROUP, MIN_DA, FALLBACK_DA, t, 1);
+    site_alloc_set_local(&one, 1000, 320);
+    CHECK(site_alloc_round(&one) == FALLBACK_DA);
+    site_alloc_set_local(&one, 1000, 40);
+    CHECK(site_alloc_round(&one) == 40);
+}
+
+static void test_messages(void)
+{
+    site_init(400);
+    demand[1] = 123;
+    round_all(400, 0x0F);
+    uint8_t msg[SITE_MSG_LEN + 1];
+    CHECK(site_alloc_report(&site[1], msg, SITE_MSG_LEN - 1) == 0);
+    CHECK(site_alloc_report(&site[1], msg, sizeof(msg)) == SITE_MSG_LEN);
+    CHECK(msg[0] == SITE_MSG_MAGIC && msg[2] == GROUP && msg[4] == 101 && msg[10] == 123);
+
+    site_alloc_t *rx = &site[0];
+    CHECK(!site_alloc_heard(rx, msg, SITE_MSG_LEN - 1));
+    CHECK(!site_alloc_heard(rx, msg, SITE_MSG_LEN + 1));
+    uint8_t bad[SITE_MSG_LEN];
+    const int fields[3] = {0, 1, 2}; // Magic, version, group
+    for (int f = 0; f < 3; f++)
+    {
+        memcpy(bad, msg, sizeof(bad));
+        bad[fields[f]] ^= 0x40;
+        CHECK(!site_alloc_heard(rx, bad, sizeof(bad)));
+    }
+    site_alloc_report(&site[0], bad, sizeof(bad)); // Its own
+    CHECK(!site_alloc_heard(rx, bad, sizeof(bad)));
+    CHECK(rx->rejected == 6 && rx->n == 1);
+
+    CHECK(site_alloc_heard(rx, msg, SITE_MSG_LEN));
+    CHECK(rx->n == 2 && rx->nodes[1].id == 101 && rx->nodes[1].demand == 123);
+    CHECK(rx->nodes[1].budget == 400 && rx->nodes[1].min == MIN_DA && rx->nodes[1].ticket == 1);
+
+    // A full table turns newcomers away, not charger already known
+    site_alloc_t small;
+    site_node_t t[2];
+    site_alloc_init(&small, 50, GROUP, MIN_DA, FALLBACK_DA, t, 2);
+    CHECK(site_alloc_heard(&small, msg, SITE_MSG_LEN));
+    site_alloc_report(&site[2], bad, sizeof(bad));
+    CHECK(!site_alloc_heard(&small, bad, sizeof(bad)));
+    CHECK(site_alloc_heard(&small, msg, SITE_MSG_LEN));
+    CHECK(small.n == 2 && small.rejected == 1 && small.heard == 2);
+    CHECK(t[0].id == 50 && t[1].id == 101);
+}
+
+int main(void)
+{
+    test_share();
+    test_rounds();
+    test_queue();
+    test_quiet();
+    test_messages();
+    return check_report("site_alloc");
+}
@@ -0,0 +1,197 @@
+// Site balancing on the whole firmware: silent until site_budget is set,
+// alone on the fallback current, held off behind a charger that plugged in
+// first and back on once it leaves, reports of another site turned away,
+// /api/site, and the limit lifted when the budget goes back to 0. The other
+// charger is a site_alloc of its own, talking to the firmware through the
+// fake ESP-NOW.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "charger.h"
+#include "check.h"
+#include "cmd_proto.h"
+#include "config_store.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "sdkconfig.h"
+#include "site_link.h"
+
+#define RELAY_GPIO 13
+#define ROUND_MS CONFIG_EVOLTE_SITE_ROUND_MS
+#define PEER_ID 0x1000
+
+static const uint8_t peer_mac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x10, 0x00};
+static site_alloc_t peer;
+static site_node_t peer_nodes[4];
+static uint8_t seq;
+
+static void budget_set(const char *amps)
+{
+    static fake_http_resp_t resp;
+    uint8_t payload[CMD_PROTO_MAX_PAYLOAD] = {CONFIG_SITE_BUDGET, 0};
+    size_t len = strlen(amps);
+    memcpy(&payload[2], amps, len);
+    uint8_t frame[CMD_PROTO_OVERHEAD + CMD_PROTO_MAX_PAYLOAD];
+    size_t n = cmd_proto_encode(frame, sizeof(frame), CMD_OP_CONFIG_SET, seq++, payload, (uint8_t)(len + 2));
+    CHECK(fake_http_request(HTTP_POST, "/cmd", (const char *)frame, n, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+    fake_time_advance_ms(CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    fake_time_advance_ms(0); // Lifting the limit runs at once
+}
+
+static void relay_by_hand(bool on)
+{
+    fake_http_resp_t resp;
+    const char *body = on ? "channel=0&on=1" : "channel=0&on=0";
+    CHECK(fake_http_request(HTTP_POST, "/api/relay", body, strlen(body), &resp) == ESP_OK);
+    fake_host_run();
+}
+
+static unsigned long sent(uint8_t *msg)
+{
+    size_t len;
+    unsigned long n = fake_espnow_sent(msg, SITE_MSG_LEN, &len);
+    CHECK(n == 0 || len == SITE_MSG_LEN);
+    return n;
+}
+
+// One round of the other charger, then one of the firmware, each hearing
+// the other's report
+static void round_both(uint16_t peer_demand)
+{
+    uint8_t msg[SITE_MSG_LEN];
+    site_alloc_set_local(&peer, 100, peer_demand);
+    site_alloc_round(&peer);
+    site_alloc_report(&peer, msg, sizeof(msg));
+    fake_espnow_recv(peer_mac, msg, sizeof(msg));
+
+    unsigned long before = sent(msg);
+    fake_time_advance_ms(ROUND_MS);
+    CHECK(sent(msg) == before + 1);
+    CHECK(site_alloc_heard(&peer, msg, sizeof(msg)));
+}
+
+static void test_off(void)
+{
+    uint8_t msg[SITE_MSG_LEN];
+    fake_time_advance_ms(5 * ROUND_MS);
+    CHECK(sent(msg) == 0);
+    CHECK(charger_limit() == CHARGER_LIMIT_NONE);
+    relay_by_hand(true);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+    relay_by_hand(false);
+}
+
+static void test_alone(void)
+{
+    // 10 A for the site; this charger has heard no one yet
+    relay_by_hand(true);
+    budget_set("10");
+    uint8_t msg[SITE_MSG_LEN];
+    CHECK(sent(msg) == 0);
+    fake_time_advance_ms(ROUND_MS);
+    CHECK(sent(msg) == 1);
+    CHECK(msg[0] == SITE_MSG_MAGIC && msg[2] == CONFIG_EVOLTE_SITE_GROUP);
+    CHECK((msg[8] | msg[9] << 8) == 100 && (msg[10] | msg[11] << 8) == CONFIG_EVOLTE_CHARGE_MAX_DA);
+    CHECK((msg[14] | msg[15] << 8) == CONFIG_EVOLTE_SITE_FALLBACK_DA && msg[16] == 1);
+    CHECK(charger_limit() == CONFIG_EVOLTE_SITE_FALLBACK_DA);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+
+    // Unplugged: no demand, no ticket, the limit goes to 0
+    relay_by_hand(false);
+    fake_time_advance_ms(ROUND_MS);
+    sent(msg);
+    CHECK((msg[10] | msg[11] << 8) == 0 && msg[16] == 0);
+    CHECK(charger_limit() == 0);
+}
+
+static void test_queue(void)
+{
+    // The other charger's car came first; 10 A only holds one minimum
+    site_alloc_init(&peer, PEER_ID, CONFIG_EVOLTE_SITE_GROUP, CONFIG_EVOLTE_CHARGE_MIN_DA,
+                    CONFIG_EVOLTE_SITE_FALLBACK_DA, peer_nodes, 4);
+    round_both(320);
+    CHECK(site_alloc_self(&peer)->ticket == 1);
+    relay_by_hand(true);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 0); // Wanted on, held off by the limit
+    for (int r = 0; r < 3; r++)
+    {
+        round_both(320);
+        CHECK(charger_limit() == 0 && fake_gpio_get(RELAY_GPIO) == 0);
+    }
+    CHECK(charger_relay_want_mask() == 1);
+    CHECK(site_alloc_self(&peer)->alloc == 100);
+
+    // It leaves: this one takes the whole budget the round it hears of it
+    round_both(0);
+    CHECK(charger_limit() == 100 && fake_gpio_get(RELAY_GPIO) == 1);
+    site_link_state_t st;
+    site_link_get(&st);
+    CHECK(st.n == 2 && st.applied == 100 && st.nodes[0].id == PEER_ID);
+}
+
+static void test_other_site(void)
+{
+    site_link_state_t st;
+    site_link_get(&st);
+    uint32_t rejected = st.rejected;
+
+    site_alloc_t other;
+    site_node_t t[2];
+    uint8_t msg[SITE_MSG_LEN];
+    site_alloc_init(&other, 0x2000, CONFIG_EVOLTE_SITE_GROUP + 1, 60, 60, t, 2);
+    site_alloc_set_local(&other, 20, 320);
+    site_alloc_round(&other);
+    site_alloc_report(&other, msg, sizeof(msg));
+    fake_espnow_recv(peer_mac, msg, sizeof(msg));
+    fake_espnow_recv(peer_mac, msg, 3);
+    fake_time_advance_ms(ROUND_MS);
+
+    site_link_get(&st);
+    CHECK(st.rejected == rejected + 2 && st.applied == 100);
+    CHECK(charger_limit() == 100);
+}
+
+static void test_http(void)
+{
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/site", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200 && strcmp(resp.type, "application/json") == 0);
+    resp.body[resp.len] = '\0';
+    CHECK(strstr(resp.body, "\"budget\":100,") != NULL);
+    CHECK(strstr(resp.body, "\"limit\":100,") != NULL);
+    CHECK(strstr(resp.body, "\"chargers\":[[4096,0,0,0,0,") != NULL);
+    CHECK(strstr(resp.body, "[3289527382,320,100,100,2,0]]") != NULL);
+    CHECK(strstr(resp.body, "\"send_failed\":0,") != NULL);
+}
+
+static void test_lifted(void)
+{
+    // Off again: the limit goes, the relay stays as it was commanded
+    uint8_t msg[SITE_MSG_LEN];
+    unsigned long n = sent(msg);
+    budget_set("0");
+    CHECK(charger_limit() == CHARGER_LIMIT_NONE);
+    CHECK(fake_gpio_get(RELAY_GPIO) == 1);
+    fake_time_advance_ms(5 * ROUND_MS);
+    CHECK(sent(msg) == n);
+
+    static fake_http_resp_t resp;
+    CHECK(fake_http_request(HTTP_GET, "/api/site", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len] = '\0';
+    CHECK(strstr(resp.body, "\"budget\":0,") != NULL && strstr(resp.body, "\"limit\"") == NULL);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run(); // Wi-Fi and HTTP come up on a boot worker task
+
+    test_off();
+    test_alone();
+    test_queue();
+    test_other_site();
+    test_http();
+    test_lifted();
+    return check_report("site_link");
+}
@@ -0,0 +1,171 @@
+// Timer wheel against a plain list of deadlines: random adds, moves and
+// cancels over every level and past the last one, advances of any length,
+// and timers re-added from their own callback. Every timer must run exactly
+// at its tick, in order, and nothing early or twice.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "timer_wheel.h"
+
+#define N_TIMERS 256
+
+typedef struct
+{
+    tw_timer_t t; // First, the callback casts back
+    uint32_t due; // Reference deadline, 0 when not pending
+    uint32_t period;
+    uint32_t fired;
+} ref_timer_t;
+
+static tw_wheel_t wheel;
+static ref_timer_t timers[N_TIMERS];
+static uint32_t last_fire;
+static int bad_fires;
+static uint32_t rng = 2463534242u;
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Spread over all levels, sometimes past the end of the wheel
+static uint32_t random_delta(void)
+{
+    switch (next_rand() % 5)
+    {
+    case 0:
+        return next_rand() % 70;
+    case 1:
+        return next_rand() % 5000;
+    case 2:
+        return next_rand() % 300000;
+    case 3:
+        return next_rand() % 2000000;
+    default:
+        return 64u << (next_rand() % 14);
+    }
+}
+
+static void on_fire(tw_timer_t *t, void *ctx)
+{
+    ref_timer_t *r = (ref_timer_t *)t;
+    uint32_t now = wheel.now;
+    if (r->due != now || now < last_fire || t->pending)
+        bad_fires++;
+    last_fire = now;
+    r->fired++;
+    r->due = 0;
+    (*(int *)ctx)++;
+    if (r->period)
+    {
+        tw_add(&wheel, t, now + r->period);
+        r->due = now + r->period;
+    }
+}
+
+static void check_reference(uint32_t to)
+{
+    for (int i = 0; i < N_TIMERS; i++)
+    {
+        ref_timer_t *r = &timers[i];
+        CHECK(r->t.pending == (r->due != 0));
+        CHECK(r->due == 0 || r->due > to);
+    }
+}
+
+static uint32_t reference_next(void)
+{
+    uint32_t next = TW_NEVER;
+    for (int i = 0; i < N_TIMERS; i++)
+        if (timers[i].due && timers[i].due < next)
+            next = timers[i].due;
+    return next;
+}
+
+static void test_random(void)
+{
+    uint32_t now = 1000;
+    tw_init(&wheel, now);
+    last_fire = now;
+    int fires = 0, expected = 0;
+
+    for (int round = 0; round < 20000; round++)
+    {
+        int ops = (int)(next_rand() % 8);
+        for (int k = 0; k < ops; k++)
+        {
+            ref_timer_t *r = &timers[next_rand() % N_TIMERS];
+            if (next_rand() % 4 == 0)
+            {
+                tw_cancel(&wheel, &r->t);
+                r->due = 0;
+                continue;
+            }
+            uint32_t delta = random_delta();
+            r->period = next_rand() % 8 == 0 ? 1000 + random_delta() : 0;
+            tw_add(&wheel, &r->t, now + delta);
+            r->due = delta ? now + delta : now + 1;
+        }
+
+        // tw_next never lies past the first deadline
+        uint32_t first = reference_next();
+        CHECK(tw_next(&wheel) <= first);
+
+        uint32_t to = now + (next_rand() % 4 ? next_rand() % 3000 : random_delta());
+        for (int i = 0; i < N_TIMERS; i++)
+            for (uint32_t due = timers[i].due; due && due <= to; due = timers[i].period ? due + timers[i].period : 0)
+                expected++;
+        tw_advance(&wheel, to, on_fire, &fires);
+        CHECK(wheel.now == to);
+        now = to;
+        check_reference(now);
+        if (check_failures)
+            break;
+    }
+    CHECK(fires == expected && fires > 10000);
+    CHECK(bad_fires == 0);
+    printf("%d timers fired, wheel at %lu\n", fires, (unsigned long)now);
+}
+
+// Timers set for ticks already gone run on the next one; one add for the
+// tick that runs from within a callback waits for the following tick
+static void test_edges(void)
+{
+    static tw_timer_t a, b;
+    int fires = 0;
+    memset(timers, 0, sizeof(timers));
+    tw_init(&wheel, 5000);
+    last_fire = 5000;
+    CHECK(tw_next(&wheel) == TW_NEVER);
+
+    timers[0].due = 5001;
+    tw_add(&wheel, &timers[0].t, 4000);
+    CHECK(timers[0].t.expires == 5001 && tw_next(&wheel) == 5001);
+    tw_advance(&wheel, 5001, on_fire, &fires);
+    CHECK(fires == 1 && !timers[0].t.pending);
+
+    // The far end of the last level and beyond
+    tw_add(&wheel, &a, 5001 + (1u << 18) - 1);
+    tw_add(&wheel, &b, 5001 + (1u << 18) * 3);
+    CHECK(a.pending && b.pending);
+    tw_cancel(&wheel, &a);
+    tw_cancel(&wheel, &a);
+    CHECK(!a.pending);
+    tw_cancel(&wheel, &b);
+    CHECK(tw_next(&wheel) == TW_NEVER);
+
+    // Advancing an empty wheel just moves it
+    tw_advance(&wheel, 1u << 30, on_fire, &fires);
+    CHECK(wheel.now == 1u << 30 && fires == 1);
+}
+
+int main(void)
+{
+    test_random();
+    test_edges();
+    return check_report("timer_wheel");
+}
@@ -0,0 +1,134 @@
+// Web UI: every asset is served as the gzip stream of its file in main/web
+// with its ETag and caching headers, and a request carrying that ETag gets
+// 304 without a body.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "fake_fw.h"
+#include "fake_hooks.h"
+#include "web_ui.h"
+
+static const char *const files[WEB_ASSET_COUNT] = {
+#define WEB_ASSET(name, uri, file, type) [WEB_ASSET_##name] = file,
+#include "web_assets.def"
+#undef WEB_ASSET
+};
+
+static fake_http_resp_t resp;
+
+static uint32_t crc32(const uint8_t *p, size_t n)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (n--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static size_t read_file(const char *name, uint8_t *buf, size_t cap)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", EVOLTE_WEB_DIR, name);
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if (f == NULL)
+        return 0;
+    size_t n = fread(buf, 1, cap, f);
+    fclose(f);
+    return n;
+}
+
+static bool has_hdr(const char *line)
+{
+    return strstr(resp.hdrs, line) != NULL;
+}
+
+static void test_assets(void)
+{
+    static uint8_t src[32768];
+    for (int i = 0; i < WEB_ASSET_COUNT; i++)
+    {
+        const web_asset_t *a = &web_assets[i];
+        CHECK(fake_http_request(HTTP_GET, a->uri, NULL, 0, &resp) == ESP_OK);
+        CHECK(atoi(resp.status) == 200 && strcmp(resp.type, a->type) == 0);
+        CHECK(resp.len == a->len && memcmp(resp.body, a->data, a->len) == 0);
+        char etag[64];
+        snprintf(etag, sizeof(etag), "ETag: %s\r\n", a->etag);
+        CHECK(has_hdr(etag) && has_hdr("Content-Encoding: gzip\r\n") && has_hdr("Cache-Control: no-cache\r\n"));
+
+        // A gzip stream without a timestamp, of exactly the file
+        const uint8_t *gz = a->data;
+        CHECK(gz[0] == 0x1f && gz[1] == 0x8b && gz[2] == 8 && get_le32(&gz[4]) == 0);
+        size_t n = read_file(files[i], src, sizeof(src));
+        CHECK(n > 0 && n < sizeof(src) && a->len < n);
+        CHECK(get_le32(&gz[a->len - 4]) == n && get_le32(&gz[a->len - 8]) == crc32(src, n));
+
+        for (int j = 0; j < i; j++)
+            CHECK(strcmp(web_assets[j].etag, a->etag) != 0);
+    }
+
+    // The query is not part of the match
+    CHECK(fake_http_request(HTTP_GET, "/app.js?v=2", NULL, 0, &resp) == ESP_OK);
+    CHECK(resp.len == web_assets[WEB_ASSET_APP_JS].len);
+}
+
+static void test_not_modified(void)
+{
+    const web_asset_t *index = &web_assets[WEB_ASSET_INDEX];
+    const web_ui_stats_t *st = web_ui_stats();
+    uint32_t sent = st->sent, not_modified = st->not_modified;
+
+    fake_http_req_hdr("If-None-Match", index->etag);
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 304 && resp.len == 0);
+    CHECK(has_hdr(index->etag) && !has_hdr("Content-Encoding"));
+
+    // Weak, in a list, any, and the header name in any case
+    char list[96];
+    snprintf(list, sizeof(list), "\"0123\", W/%s", index->etag);
+    fake_http_req_hdr("if-none-match", list);
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 304);
+    fake_http_req_hdr("If-None-Match", "*");
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 304);
+    CHECK(st->not_modified == not_modified + 3 && st->sent == sent);
+
+    // Another file's tag, or an old one, gets the file
+    fake_http_req_hdr("If-None-Match", web_assets[WEB_ASSET_STYLE].etag);
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200 && resp.len == index->len);
+    fake_http_req_hdr("If-None-Match", "\"0000000000000000\"");
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+    // Headers belong to one request
+    CHECK(fake_http_request(HTTP_GET, "/", NULL, 0, &resp) == ESP_OK);
+    CHECK(atoi(resp.status) == 200);
+    CHECK(st->sent == sent + 3);
+
+    CHECK(fake_http_request(HTTP_GET, "/api/counters", NULL, 0, &resp) == ESP_OK);
+    resp.body[resp.len < sizeof(resp.body) ? resp.len : sizeof(resp.body) - 1] = '\0';
+    char want[64];
+    snprintf(want, sizeof(want), "\"web\":{\"sent\":%lu,\"not_modified\":%lu}", (unsigned long)st->sent,
+             (unsigned long)st->not_modified);
+    CHECK(atoi(resp.status) == 200 && strstr(resp.body, want) != NULL);
+}
+
+int main(void)
+{
+    app_main();
+    fake_host_run();
+
+    test_assets();
+    test_not_modified();
+    return check_report("web_ui");
+}
@@ -0,0 +1,52 @@
+// Turn the deferred log lines of a captured console log back into text.
+//   dlog_decode [file...]      (reads stdin without arguments)
+// Other console lines are passed through, so a whole monitor capture can be
+// piped through it. Gaps in the record sequence, e.g. lost UART bytes, are
+// marked.
+#include <stdio.h>
+#include <string.h>
+#include "dlog_text.h"
+
+static int last_seq = -1;
+
+static void decode(FILE *f)
+{
+    char line[512], text[256];
+    dlog_text_rec_t rec;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (dlog_text_line(line, &rec) != 0)
+        {
+            fputs(line, stdout);
+            continue;
+        }
+        if (last_seq >= 0 && rec.seq != (uint8_t)(last_seq + 1))
+            printf("-- %u record(s) missing from the capture --\n", (uint8_t)(rec.seq - last_seq - 1));
+        last_seq = rec.seq;
+        dlog_text_format(&rec, text, sizeof(text));
+        puts(text);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        decode(stdin);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *f = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+        if (f == NULL)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        decode(f);
+        if (f != stdin)
+            fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include "dlog.h"
+#include "dlog_text.h"
+
+typedef struct
+{
+    int level;
+    const char *tag;
+    const char *fmt;
+} fmt_entry_t;
+
+static const fmt_entry_t formats[DLOG_FMT_COUNT] = {
+#define DLOG_FMT(name, lvl, tg, f) [DLOG_##name] = {.level = lvl, .tag = tg, .fmt = f},
+#include "dlog_fmt.def"
+#undef DLOG_FMT
+};
+
+static const char level_char[] = "NEWIDV";
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int dlog_text_parse(const uint8_t *buf, size_t len, dlog_text_rec_t *rec)
+{
+    if (len < DLOG_REC_HDR_LEN)
+        return -1;
+    rec->id = (uint16_t)(buf[0] | (buf[1] << 8));
+    rec->nargs = buf[2];
+    rec->seq = buf[3];
+    rec->ts_ms = get_le32(&buf[4]);
+    if (rec->nargs > DLOG_MAX_ARGS || len < DLOG_REC_HDR_LEN + 4 * (size_t)rec->nargs)
+        return -1;
+    for (int i = 0; i < rec->nargs; i++)
+        rec->args[i] = get_le32(&buf[DLOG_REC_HDR_LEN + 4 * i]);
+    return DLOG_REC_HDR_LEN + 4 * rec->nargs;
+}
+
+int dlog_text_conversions(const char *fmt)
+{
+    int n = 0;
+    for (const char *p = fmt; *p; p++)
+    {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        while (*p && strchr("-+ #0123456789", *p))
+            p++;
+        if (*p == '\0' || !strchr("diuxX", *p))
+            return -1;
+        n++;
+    }
+    return n;
+}
+
+int dlog_text_format(const dlog_text_rec_t *rec, char *out, size_t cap)
+{
+    if (rec->id >= DLOG_FMT_COUNT)
+        return snprintf(out, cap, "? (%u) dlog: unknown format %u", rec->ts_ms, rec->id);
+
+    const fmt_entry_t *f = &formats[rec->id];
+    if (dlog_text_conversions(f->fmt) != rec->nargs)
+        return snprintf(out, cap, "? (%u) %s: %u argument(s) for \"%s\"", rec->ts_ms, f->tag, rec->nargs,
+                        f->fmt);
+
+    int n = snprintf(out, cap, "%c (%u) %s: ", level_char[f->level], rec->ts_ms, f->tag);
+    if (n < 0 || (size_t)n >= cap)
+        return n;
+    // Unused trailing arguments are ignored by snprintf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    int m = snprintf(out + n, cap - n, f->fmt, rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+#pragma GCC diagnostic pop
+    return m < 0 ? m : n + m;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int dlog_text_line(const char *line, dlog_text_rec_t *rec)
+{
+    // The record may follow other console output on the same line
+    const char *p = strstr(line, DLOG_LINE_PREFIX);
+    if (p == NULL)
+        return -1;
+    p += strlen(DLOG_LINE_PREFIX);
+
+    uint8_t buf[DLOG_REC_MAX_LEN];
+    size_t len = 0;
+    while (hex_nibble(p[0]) >= 0 && hex_nibble(p[1]) >= 0 && len < sizeof(buf))
+    {
+        buf[len++] = (uint8_t)(hex_nibble(p[0]) << 4 | hex_nibble(p[1]));
+        p += 2;
+    }
+    return dlog_text_parse(buf, len, rec) == (int)len ? 0 : -1;
+}
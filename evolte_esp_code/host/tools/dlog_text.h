@@ -0,0 +1,28 @@
+// Text rendering of deferred log records (main/dlog.h), shared by the
+// dlog_decode tool and the host tests.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint16_t id;
+    uint8_t nargs;
+    uint8_t seq;
+    uint32_t ts_ms;
+    uint32_t args[4];
+} dlog_text_rec_t;
+
+// Parse one binary record, returns its length or -1 if it is malformed
+int dlog_text_parse(const uint8_t *buf, size_t len, dlog_text_rec_t *rec);
+
+// "I (1234) GAP: MTU 256 on connection 1", returns the text length
+int dlog_text_format(const dlog_text_rec_t *rec, char *out, size_t cap);
+
+// Parse a console line carrying one record ("DL:<hex>"), returns -1 if the
+// line is not a well-formed record line
+int dlog_text_line(const char *line, dlog_text_rec_t *rec);
+
+// Number of integer conversions in a format, -1 if it uses anything else
+int dlog_text_conversions(const char *fmt);
@@ -0,0 +1,103 @@
+// Generate the app's GATT UUID constants from main/gatt_schema.def.
+//   gatt_dart [out.dart]        (writes stdout without an argument)
+//   gatt_dart --check file      (exit 1 if file is not what would be written)
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host/ble_hs.h"
+
+typedef struct
+{
+    const char *name;
+    uint16_t uuid16;
+    const char *kind; // "Service" or "Characteristic"
+} gatt_entry_t;
+
+static const gatt_entry_t entries[] = {
+#define GATT_SVC(name, uuid16) {#name, uuid16, "Service"},
+#define GATT_CHR(name, uuid16, flags, rd, wr) {#name, uuid16, "Characteristic"},
+#define GATT_SVC_END(name)
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+};
+
+// CHARGER_STATUS -> chargerStatus
+static void camel(const char *name, char *out)
+{
+    bool upper = false;
+    for (; *name; name++)
+    {
+        if (*name == '_')
+        {
+            upper = true;
+            continue;
+        }
+        *out++ = upper ? (char)toupper((unsigned char)*name) : (char)tolower((unsigned char)*name);
+        upper = false;
+    }
+    *out = '\0';
+}
+
+static size_t generate(char *buf, size_t cap)
+{
+    size_t n = 0;
+    n += snprintf(buf + n, cap - n,
+                  "// Generated from evolte_esp_code/main/gatt_schema.def by\n"
+                  "// evolte_esp_code/host/tools/gatt_dart.c, do not edit.\n");
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++)
+    {
+        char id[64];
+        camel(entries[i].name, id);
+        n += snprintf(buf + n, cap - n,
+                      "\nconst int %s%sUuid16 = 0x%04X;\n"
+                      "const String %s%sUuid = '%08x-0000-1000-8000-00805f9b34fb';\n",
+                      id, entries[i].kind, entries[i].uuid16, id, entries[i].kind, entries[i].uuid16);
+    }
+    n += snprintf(buf + n, cap - n,
+                  "\n// True if a UUID as the BLE plugin prints it, short or full form, is uuid16\n"
+                  "bool gattUuidIs(String uuid, int uuid16) {\n"
+                  "  final short = uuid16.toRadixString(16).padLeft(4, '0');\n"
+                  "  final u = uuid.toLowerCase();\n"
+                  "  return u == short || u == '0000$short-0000-1000-8000-00805f9b34fb';\n"
+                  "}\n");
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static char out[8192], cur[8192];
+    size_t len = generate(out, sizeof(out));
+
+    if (argc == 3 && strcmp(argv[1], "--check") == 0)
+    {
+        FILE *f = fopen(argv[2], "rb");
+        if (f == NULL)
+        {
+            perror(argv[2]);
+            return 1;
+        }
+        size_t cur_len = fread(cur, 1, sizeof(cur), f);
+        fclose(f);
+        if (cur_len != len || memcmp(cur, out, len) != 0)
+        {
+            fprintf(stderr, "%s is stale, regenerate it with gatt_dart\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+
+    FILE *f = argc == 2 ? fopen(argv[1], "wb") : stdout;
+    if (f == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    fwrite(out, 1, len, f);
+    if (f != stdout)
+        fclose(f);
+    return 0;
+}
@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include "ota_patch.h"
+
+#define LZ_HASH_BITS 16
+#define LZ_CHAIN 256
+
+typedef struct
+{
+    uint8_t *p;
+    size_t n, cap;
+    int oom;
+} buf_t;
+
+static void put(buf_t *b, const void *data, size_t len)
+{
+    if (b->oom)
+        return;
+    if (b->n + len > b->cap)
+    {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->n + len)
+            cap *= 2;
+        uint8_t *p = realloc(b->p, cap);
+        if (p == NULL)
+        {
+            b->oom = 1;
+            return;
+        }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->n, data, len);
+    b->n += len;
+}
+
+static void put_u8(buf_t *b, uint8_t v)
+{
+    put(b, &v, 1);
+}
+
+static void put_le32(buf_t *b, uint32_t v)
+{
+    uint8_t p[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    put(b, p, sizeof(p));
+}
+
+static void put_varint(buf_t *b, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        put_u8(b, (uint8_t)(v | 0x80));
+    put_u8(b, (uint8_t)v);
+}
+
+// ---- Suffix array of old, prefix doubling with radix sorts ----
+
+// Sorted suffixes old[sa[i]..], including the empty one, which comes first
+static int32_t *suffix_array(const uint8_t *s, int32_t n)
+{
+    int32_t m = n + 1;
+    int32_t *sa = malloc(sizeof(int32_t) * m);
+    int32_t *rank = malloc(sizeof(int32_t) * m);
+    int32_t *tmp = malloc(sizeof(int32_t) * m);
+    int32_t *cnt = malloc(sizeof(int32_t) * (m > 257 ? m : 257));
+    if (!sa || !rank || !tmp || !cnt)
+    {
+        free(sa);
+        sa = NULL;
+        goto out;
+    }
+
+    for (int32_t i = 0; i < n; i++)
+        rank[i] = s[i] + 1;
+    rank[n] = 0;
+    int32_t ranks = 257;
+    for (int32_t k = 1;; k *= 2)
+    {
+        // A suffix shorter than k already has a rank of its own, the second
+        // key does not matter for it
+#define KEY2(i) ((i) + k <= n ? rank[(i) + k] : 0)
+        memset(cnt, 0, sizeof(int32_t) * ranks);
+        for (int32_t i = 0; i < m; i++)
+            cnt[KEY2(i)]++;
+        for (int32_t r = 1; r < ranks; r++)
+            cnt[r] += cnt[r - 1];
+        for (int32_t i = m - 1; i >= 0; i--)
+            tmp[--cnt[KEY2(i)]] = i;
+
+        memset(cnt, 0, sizeof(int32_t) * ranks);
+        for (int32_t i = 0; i < m; i++)
+            cnt[rank[i]]++;
+        for (int32_t r = 1; r < ranks; r++)
+            cnt[r] += cnt[r - 1];
+        for (int32_t j = m - 1; j >= 0; j--)
+            sa[--cnt[rank[tmp[j]]]] = tmp[j];
+
+        int32_t r = 0;
+        tmp[sa[0]] = 0;
+        for (int32_t j = 1; j < m; j++)
+        {
+            if (rank[sa[j]] != rank[sa[j - 1]] || KEY2(sa[j]) != KEY2(sa[j - 1]))
+                r++;
+            tmp[sa[j]] = r;
+        }
+#undef KEY2
+        memcpy(rank, tmp, sizeof(int32_t) * m);
+        ranks = r + 1;
+        if (ranks == m || k > n)
+            break;
+    }
+out:
+    free(rank);
+    free(tmp);
+    free(cnt);
+    return sa;
+}
+
+static int64_t match_len(const uint8_t *a, int64_t an, const uint8_t *b, int64_t bn)
+{
+    int64_t i = 0;
+    while (i < an && i < bn && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Longest match of new_ in old, by binary search of the suffix array
+static int64_t search(const int32_t *sa, const uint8_t *old, int64_t old_n, const uint8_t *new_, int64_t new_n,
+                      int64_t *pos)
+{
+    int64_t st = 0, en = old_n;
+    while (en - st >= 2)
+    {
+        int64_t x = st + (en - st) / 2;
+        int64_t l = old_n - sa[x] < new_n ? old_n - sa[x] : new_n;
+        if (memcmp(old + sa[x], new_, (size_t)l) < 0)
+            st = x;
+        else
+            en = x;
+    }
+    int64_t x = match_len(old + sa[st], old_n - sa[st], new_, new_n);
+    int64_t y = match_len(old + sa[en], old_n - sa[en], new_, new_n);
+    *pos = x > y ? sa[st] : sa[en];
+    return x > y ? x : y;
+}
+
+// ---- Patch ops ----
+
+static void put_diff(buf_t *b, const uint8_t *old, const uint8_t *new_, int64_t len)
+{
+    // Zero runs shorter than this stay inside the literals, a new run would
+    // cost more than the zeros themselves
+    enum { MIN_ZEROS = 3 };
+    int64_t i = 0;
+    while (i < len)
+    {
+        int64_t z = 0;
+        while (i + z < len && old[i + z] == new_[i + z])
+            z++;
+        put_varint(b, (uint64_t)z);
+        i += z;
+        if (i == len)
+            break;
+
+        int64_t l = 0;
+        for (int64_t zeros = 0; i + l < len; l++)
+        {
+            zeros = old[i + l] == new_[i + l] ? zeros + 1 : 0;
+            if (zeros == MIN_ZEROS)
+            {
+                l -= MIN_ZEROS - 1;
+                break;
+            }
+        }
+        put_varint(b, (uint64_t)l);
+        for (int64_t j = 0; j < l; j++)
+            put_u8(b, (uint8_t)(new_[i + j] - old[i + j]));
+        i += l;
+    }
+}
+
+static void put_ctrl(buf_t *b, const uint8_t *old, const uint8_t *new_, int64_t lastscan, int64_t lastpos,
+                     int64_t lenf, int64_t extra, int64_t seek)
+{
+    put_varint(b, (uint64_t)lenf);
+    put_varint(b, (uint64_t)extra);
+    put_varint(b, (uint64_t)(seek < 0 ? -2 * seek - 1 : 2 * seek));
+    put_diff(b, old + lastpos, new_ + lastscan, lenf);
+    put(b, new_ + lastscan + lenf, (size_t)extra);
+}
+
+// The matching of bsdiff 4.3: extend exact matches found in the suffix array
+// forwards and backwards as long as more than half of the bytes agree, the
+// rest goes in as literals
+static void diff_ops(const uint8_t *old, int64_t old_n, const uint8_t *new_, int64_t new_n, const int32_t *sa,
+                     buf_t *b)
+{
+    int64_t scan = 0, len = 0, pos = 0;
+    int64_t lastscan = 0, lastpos = 0, lastoffset = 0;
+
+    while (scan < new_n)
+    {
+        int64_t oldscore = 0;
+        int64_t scsc;
+        for (scsc = scan += len; scan < new_n; scan++)
+        {
+            len = search(sa, old, old_n, new_ + scan, new_n - scan, &pos);
+            for (; scsc < scan + len; scsc++)
+                if (scsc + lastoffset < old_n && old[scsc + lastoffset] == new_[scsc])
+                    oldscore++;
+            if ((len == oldscore && len != 0) || len > oldscore + 8)
+                break;
+            if (scan + lastoffset < old_n && old[scan + lastoffset] == new_[scan])
+                oldscore--;
+        }
+        if (len == oldscore && scan != new_n)
+            continue;
+
+        int64_t s = 0, sf = 0, lenf = 0;
+        for (int64_t i = 0; lastscan + i < scan && lastpos + i < old_n;)
+        {
+            if (old[lastpos + i] == new_[lastscan + i])
+                s++;
+            i++;
+            if (s * 2 - i > sf * 2 - lenf)
+            {
+                sf = s;
+                lenf = i;
+            }
+        }
+
+        int64_t lenb = 0;
+        if (scan < new_n)
+        {
+            int64_t sb = 0;
+            s = 0;
+            for (int64_t i = 1; scan >= lastscan + i && pos >= i; i++)
+            {
+                if (old[pos - i] == new_[scan - i])
+                    s++;
+                if (s * 2 - i > sb * 2 - lenb)
+                {
+                    sb = s;
+                    lenb = i;
+                }
+            }
+        }
+
+        if (lastscan + lenf > scan - lenb)
+        {
+            int64_t overlap = (lastscan + lenf) - (scan - lenb);
+            int64_t ss = 0, lens = 0;
+            s = 0;
+            for (int64_t i = 0; i < overlap; i++)
+            {
+                if (new_[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i])
+                    s++;
+                if (new_[scan - lenb + i] == old[pos - lenb + i])
+                    s--;
+                if (s > ss)
+                {
+                    ss = s;
+                    lens = i + 1;
+                }
+            }
+            lenf += lens - overlap;
+            lenb -= lens;
+        }
+
+        put_ctrl(b, old, new_, lastscan, lastpos, lenf, (scan - lenb) - (lastscan + lenf),
+                 (pos - lenb) - (lastpos + lenf));
+        lastscan = scan - lenb;
+        lastpos = pos - lenb;
+        lastoffset = pos - scan;
+    }
+}
+
+// ---- LZSS ----
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u >> (32 - LZ_HASH_BITS);
+}
+
+static void lz_compress(const uint8_t *in, size_t n, buf_t *out)
+{
+    int32_t *head = malloc(sizeof(int32_t) << LZ_HASH_BITS);
+    int32_t *prev = malloc(sizeof(int32_t) * (n ? n : 1));
+    if (!head || !prev)
+    {
+        out->oom = 1;
+        goto done;
+    }
+    memset(head, 0xff, sizeof(int32_t) << LZ_HASH_BITS);
+
+    size_t flag_at = 0;
+    int items = 8;
+    for (size_t pos = 0; pos < n && !out->oom;)
+    {
+        if (items == 8)
+        {
+            flag_at = out->n;
+            put_u8(out, 0);
+            items = 0;
+        }
+
+        size_t best = 0, best_off = 0;
+        size_t max = n - pos < OTA_PATCH_MAX_MATCH ? n - pos : OTA_PATCH_MAX_MATCH;
+        if (max >= OTA_PATCH_MIN_MATCH)
+        {
+            int32_t cand = head[lz_hash(in + pos)];
+            for (int chain = 0; cand >= 0 && pos - cand <= OTA_PATCH_WINDOW && chain < LZ_CHAIN; chain++)
+            {
+                size_t l = 0;
+                while (l < max && in[cand + l] == in[pos + l])
+                    l++;
+                if (l > best)
+                {
+                    best = l;
+                    best_off = pos - cand;
+                    if (l == max)
+                        break;
+                }
+                cand = prev[cand];
+            }
+        }
+
+        size_t adv = 1;
+        if (best >= OTA_PATCH_MIN_MATCH)
+        {
+            uint8_t hi = (uint8_t)((best_off - 1) >> 8 << 4);
+            put_u8(out, (uint8_t)(best_off - 1));
+            if (best >= 18)
+            {
+                put_u8(out, hi | 0x0f);
+                put_u8(out, (uint8_t)(best - 18));
+            }
+            else
+            {
+                put_u8(out, hi | (uint8_t)(best - OTA_PATCH_MIN_MATCH));
+            }
+            adv = best;
+        }
+        else
+        {
+            out->p[flag_at] |= (uint8_t)(1 << items);
+            put_u8(out, in[pos]);
+        }
+        items++;
+
+        for (; adv; adv--, pos++)
+        {
+            if (n - pos < OTA_PATCH_MIN_MATCH)
+                continue;
+            uint32_t h = lz_hash(in + pos);
+            prev[pos] = head[h];
+            head[h] = (int32_t)pos;
+        }
+    }
+done:
+    free(head);
+    free(prev);
+}
+
+uint8_t *ota_delta_make(const uint8_t *old, size_t old_n, const uint8_t *new_, size_t new_n, size_t *patch_n)
+{
+    if (old_n >= INT32_MAX || new_n > UINT32_MAX)
+        return NULL;
+    int32_t *sa = suffix_array(old, (int32_t)old_n);
+    if (sa == NULL)
+        return NULL;
+    buf_t ops = {0};
+    diff_ops(old, (int64_t)old_n, new_, (int64_t)new_n, sa, &ops);
+    free(sa);
+
+    buf_t out = {0};
+    uint8_t sha[32];
+    put(&out, OTA_PATCH_MAGIC, 4);
+    put_le32(&out, (uint32_t)old_n);
+    put_le32(&out, (uint32_t)new_n);
+    mbedtls_sha256(old, old_n, sha, 0);
+    put(&out, sha, sizeof(sha));
+    mbedtls_sha256(new_, new_n, sha, 0);
+    put(&out, sha, sizeof(sha));
+    lz_compress(ops.p, ops.n, &out);
+    free(ops.p);
+
+    if (ops.oom || out.oom)
+    {
+        free(out.p);
+        return NULL;
+    }
+    *patch_n = out.n;
+    return out.p;
+}
+
+// ---- Applying, through the firmware's own applier ----
+
+typedef struct
+{
+    const uint8_t *old;
+    size_t old_n;
+    uint8_t *new_;
+    size_t cap, n;
+} mem_io_t;
+
+static int mem_header(void *ctx, const ota_patch_hdr_t *hdr)
+{
+    mem_io_t *m = ctx;
+    return hdr->old_size == m->old_n && hdr->new_size <= m->cap ? 0 : -1;
+}
+
+static int mem_read(void *ctx, uint32_t off, void *buf, size_t len)
+{
+    mem_io_t *m = ctx;
+    if (off + len > m->old_n)
+        return -1;
+    memcpy(buf, m->old + off, len);
+    return 0;
+}
+
+static int mem_write(void *ctx, const void *data, size_t len)
+{
+    mem_io_t *m = ctx;
+    if (m->n + len > m->cap)
+        return -1;
+    memcpy(m->new_ + m->n, data, len);
+    m->n += len;
+    return 0;
+}
+
+int ota_delta_apply(const uint8_t *old, size_t old_n, const uint8_t *patch, size_t patch_n, uint8_t *new_,
+                    size_t new_cap, size_t *new_n)
+{
+    mem_io_t m = {.old = old, .old_n = old_n, .new_ = new_, .cap = new_cap};
+    ota_patch_io_t io = {.on_header = mem_header, .read_old = mem_read, .write = mem_write, .ctx = &m};
+    ota_patch_t p;
+    ota_patch_init(&p, &io);
+    ota_patch_feed(&p, patch, patch_n);
+    int rc = ota_patch_finish(&p);
+    *new_n = m.n;
+    return rc;
+}
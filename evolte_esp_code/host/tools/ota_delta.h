@@ -0,0 +1,16 @@
+// Delta update patches (main/ota_patch.h) between two firmware images,
+// shared by the ota_diff tool and the host tests.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bsdiff's matching on a suffix array of the old image, so code that only
+// moved, or whose addresses shifted, costs next to nothing, then LZSS. The
+// patch is malloc'd, NULL if out of memory.
+uint8_t *ota_delta_make(const uint8_t *old, size_t old_n, const uint8_t *new_, size_t new_n, size_t *patch_n);
+
+// Rebuilds new from old and the patch, 0 on success. new_ must have room for
+// the patch's new_size bytes.
+int ota_delta_apply(const uint8_t *old, size_t old_n, const uint8_t *patch, size_t patch_n, uint8_t *new_,
+                    size_t new_cap, size_t *new_n);
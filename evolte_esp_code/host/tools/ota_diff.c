@@ -0,0 +1,87 @@
+// Make a delta update patch between two builds of the firmware.
+//   ota_diff <old.bin> <new.bin> <patch>
+// old.bin is the image the charger runs now, new.bin the one it should run
+// (build/BLE-Connect.bin). The patch is applied back to old.bin before it is
+// written, so a patch that would not rebuild new.bin is never produced.
+// Send it with POST /api/ota/patch?sha256=<sha256 of new.bin>.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ota_delta.h"
+
+static uint8_t *load(const char *path, size_t *n)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    *n = 0;
+    for (;;)
+    {
+        if (*n == cap)
+        {
+            cap = cap ? cap * 2 : 1 << 20;
+            uint8_t *p = realloc(buf, cap);
+            if (p == NULL)
+            {
+                free(buf);
+                fclose(f);
+                fprintf(stderr, "%s: out of memory\n", path);
+                return NULL;
+            }
+            buf = p;
+        }
+        size_t got = fread(buf + *n, 1, cap - *n, f);
+        if (got == 0)
+            break;
+        *n += got;
+    }
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <old.bin> <new.bin> <patch>\n", argv[0]);
+        return 2;
+    }
+    size_t old_n, new_n, patch_n, check_n;
+    uint8_t *old = load(argv[1], &old_n);
+    uint8_t *new_ = old ? load(argv[2], &new_n) : NULL;
+    if (new_ == NULL)
+        return 1;
+
+    uint8_t *patch = ota_delta_make(old, old_n, new_, new_n, &patch_n);
+    uint8_t *check = malloc(new_n ? new_n : 1);
+    if (patch == NULL || check == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    int rc = ota_delta_apply(old, old_n, patch, patch_n, check, new_n, &check_n);
+    if (rc != 0 || check_n != new_n || memcmp(check, new_, new_n) != 0)
+    {
+        fprintf(stderr, "patch does not rebuild %s (%d), not written\n", argv[2], rc);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[3], "wb");
+    if (f == NULL || fwrite(patch, 1, patch_n, f) != patch_n || fclose(f) != 0)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+    printf("old %zu bytes, new %zu bytes, patch %zu bytes (%.1f%% of new)\n", old_n, new_n, patch_n,
+           new_n ? 100.0 * patch_n / new_n : 0.0);
+    free(check);
+    free(patch);
+    free(new_);
+    free(old);
+    return 0;
+}
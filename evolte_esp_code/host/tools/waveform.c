@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "waveform.h"
+
+int waveform_load(const char *path, waveform_t *w)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    memset(w, 0, sizeof(*w));
+    size_t cap = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long a, b;
+        if (line[0] == '#')
+        {
+            sscanf(line, "# rate %u", &w->rate);
+            sscanf(line, "# v_uv_per_lsb %u", &w->v_uv_per_lsb);
+            sscanf(line, "# i_ua_per_lsb %u", &w->i_ua_per_lsb);
+            continue;
+        }
+        if (sscanf(line, "%lu %lu", &a, &b) != 2)
+            continue;
+        if (w->n == cap)
+        {
+            cap = cap ? 2 * cap : 4096;
+            w->v = realloc(w->v, cap * sizeof(*w->v));
+            w->i = realloc(w->i, cap * sizeof(*w->i));
+        }
+        w->v[w->n] = (uint16_t)a;
+        w->i[w->n] = (uint16_t)b;
+        w->n++;
+    }
+    fclose(f);
+    if (w->n == 0 || w->rate == 0)
+    {
+        waveform_free(w);
+        return -1;
+    }
+    return 0;
+}
+
+void waveform_free(waveform_t *w)
+{
+    free(w->v);
+    free(w->i);
+    w->v = w->i = NULL;
+    w->n = 0;
+}
@@ -0,0 +1,21 @@
+// Recorded metering waveforms (bench/waveforms/*.txt), shared by the DSP
+// bench and the host tests. Text, one "v i" pair of raw ADC counts per line,
+// with "# rate", "# v_uv_per_lsb" and "# i_ua_per_lsb" header comments.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t rate;
+    uint32_t v_uv_per_lsb;
+    uint32_t i_ua_per_lsb;
+    size_t n;
+    uint16_t *v;
+    uint16_t *i;
+} waveform_t;
+
+// 0 on success, -1 if the file cannot be read or has no samples
+int waveform_load(const char *path, waveform_t *w);
+void waveform_free(waveform_t *w);
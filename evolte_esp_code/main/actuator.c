@@ -0,0 +1,106 @@
+#include "actuator.h"
+#include "cmd_ring.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+
+#define ACTUATOR_STACK 3072
+#define ACTUATOR_PRIO 5
+// The NimBLE host and the Wi-Fi stack live on core 0
+#define ACTUATOR_CORE (portNUM_PROCESSORS - 1)
+
+static const char *TAG = "actuator";
+
+static cmd_ring_t rings[ACTUATOR_SRC_COUNT];
+MEM_BUDGET_FITS(CMD_RINGS, rings);
+static actuator_stats_t stats[ACTUATOR_SRC_COUNT];
+static actuator_exec_fn actuator_exec;
+static TaskHandle_t actuator_task_handle;
+
+static void run_item(actuator_src_t src, const cmd_ring_item_t *item)
+{
+    cmd_frame_t frame;
+    cmd_view(&item->cmd, &frame);
+    actuator_exec(&frame, src, item->conn_handle);
+
+    actuator_stats_t *st = &stats[src];
+    uint32_t lat = (uint32_t)(esp_timer_get_time() - item->t_enq_us);
+    st->executed++;
+    st->lat_last_us = lat;
+    st->lat_sum_us += lat;
+    if (lat > st->lat_max_us)
+        st->lat_max_us = lat;
+}
+
+static void actuator_task(void *param)
+{
+    cmd_ring_item_t item;
+
+    mem_budget_guard();
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Alternate between the producers so neither can starve the other
+        bool more = true;
+        while (more)
+        {
+            more = false;
+            for (int src = 0; src < ACTUATOR_SRC_COUNT; src++)
+                if (cmd_ring_pop(&rings[src], &item))
+                {
+                    run_item(src, &item);
+                    more = true;
+                }
+        }
+    }
+}
+
+void actuator_init(actuator_exec_fn exec)
+{
+    actuator_exec = exec;
+    for (int i = 0; i < ACTUATOR_SRC_COUNT; i++)
+        cmd_ring_init(&rings[i]);
+    if (xTaskCreatePinnedToCore(actuator_task, "actuator", ACTUATOR_STACK, NULL, ACTUATOR_PRIO,
+                                &actuator_task_handle, ACTUATOR_CORE) != pdPASS)
+        ESP_LOGE(TAG, "Failed to start the actuator task");
+}
+
+bool actuator_submit(actuator_src_t src, uint16_t conn_handle, const cmd_t *cmd)
+{
+    actuator_stats_t *st = &stats[src];
+    cmd_ring_item_t item = {
+        .cmd = *cmd,
+        .conn_handle = conn_handle,
+        .t_enq_us = esp_timer_get_time(),
+    };
+
+    if (!cmd_ring_push(&rings[src], &item))
+    {
+        st->dropped++;
+        return false;
+    }
+    st->submitted++;
+    uint32_t depth = cmd_ring_depth(&rings[src]);
+    if (depth > st->depth_max)
+        st->depth_max = depth;
+    xTaskNotifyGive(actuator_task_handle);
+    return true;
+}
+
+uint32_t actuator_space(actuator_src_t src)
+{
+    return CMD_RING_LEN - cmd_ring_depth(&rings[src]);
+}
+
+uint32_t actuator_depth(actuator_src_t src)
+{
+    return cmd_ring_depth(&rings[src]);
+}
+
+const actuator_stats_t *actuator_stats(actuator_src_t src)
+{
+    return &stats[src];
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cmd_proto.h"
+
+// Command execution task. BLE and HTTP handlers, the charge schedule and
+// site balancing only validate and submit;
+// the actuator task drains one SPSC ring per producer and runs the commands,
+// so a slow command never holds up the NimBLE host task or the web server.
+
+typedef enum
+{
+    ACTUATOR_SRC_BLE = 0, // Producer: NimBLE host task (session scheduler)
+    ACTUATOR_SRC_HTTP,    // Producer: httpd task
+    ACTUATOR_SRC_TIMER,   // Producer: esp_timer task (charge_sched, site_link)
+    ACTUATOR_SRC_COUNT
+} actuator_src_t;
+
+typedef struct
+{
+    // Written by the producer
+    uint32_t submitted;
+    uint32_t dropped;   // Ring full
+    uint32_t depth_max; // Deepest the ring has been after a push
+    // Written by the actuator task
+    uint32_t executed;
+    uint32_t lat_last_us; // Submit to execute
+    uint32_t lat_max_us;
+    uint64_t lat_sum_us;
+} actuator_stats_t;
+
+// Runs on the actuator task for every command, in submit order per source
+typedef void (*actuator_exec_fn)(const cmd_frame_t *frame, actuator_src_t src, uint16_t conn_handle);
+
+void actuator_init(actuator_exec_fn exec);
+
+// Queue one command. Must only be called from the producer task of src.
+// Returns false if the ring is full.
+bool actuator_submit(actuator_src_t src, uint16_t conn_handle, const cmd_t *cmd);
+
+// Free ring slots for src, lets a producer check a whole batch fits first
+uint32_t actuator_space(actuator_src_t src);
+
+uint32_t actuator_depth(actuator_src_t src);
+const actuator_stats_t *actuator_stats(actuator_src_t src);
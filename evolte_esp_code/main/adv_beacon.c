@@ -0,0 +1,89 @@
+#include <string.h>
+#include "nimble/nimble_port.h"
+#include "sdkconfig.h"
+#include "adv_beacon.h"
+
+static adv_beacon_fill_fn fill_status;
+static void (*on_changed)(void);
+static struct ble_npl_callout check_timer;
+static adv_beacon_stats_t stats;
+
+static uint8_t seq;
+static uint8_t data[ADV_BEACON_LEN];
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+size_t adv_beacon_encode(const status_snapshot_t *snap, uint8_t free_slots, uint8_t seq, uint8_t *buf,
+                         size_t cap)
+{
+    if (cap < ADV_BEACON_LEN)
+        return 0;
+
+    uint8_t state = ADV_BEACON_AVAILABLE;
+    if (snap->error_flags)
+        state = ADV_BEACON_FAULT;
+    else if (snap->relay_mask && snap->power_w >= ADV_BEACON_CHARGING_W)
+        state = ADV_BEACON_CHARGING;
+    else if (snap->relay_mask)
+        state = ADV_BEACON_READY;
+
+    uint32_t power = snap->power_w > 0 ? ((uint32_t)snap->power_w + 50) / 100 : 0;
+    put_le16(&buf[0], ADV_BEACON_COMPANY_ID);
+    buf[2] = ADV_BEACON_VERSION;
+    buf[3] = state;
+    buf[4] = snap->relay_mask;
+    buf[5] = free_slots;
+    put_le16(&buf[6], power > UINT16_MAX ? UINT16_MAX : (uint16_t)power);
+    put_le16(&buf[8], (uint16_t)snap->error_flags);
+    buf[10] = seq;
+    return ADV_BEACON_LEN;
+}
+
+bool adv_beacon_update(void)
+{
+    status_snapshot_t snap;
+    uint8_t buf[ADV_BEACON_LEN];
+    fill_status(&snap);
+    uint8_t free_slots = snap.sessions < CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+                             ? (uint8_t)(CONFIG_BT_NIMBLE_MAX_CONNECTIONS - snap.sessions)
+                             : 0;
+
+    stats.checks++;
+    adv_beacon_encode(&snap, free_slots, seq, buf, sizeof(buf));
+    if (memcmp(buf, data, sizeof(data)) == 0)
+        return false;
+    buf[10] = ++seq;
+    memcpy(data, buf, sizeof(data));
+    stats.updates++;
+    return true;
+}
+
+static void check_timer_cb(struct ble_npl_event *ev)
+{
+    if (adv_beacon_update())
+        on_changed();
+    ble_npl_callout_reset(&check_timer, ble_npl_time_ms_to_ticks32(CONFIG_EVOLTE_BEACON_CHECK_MS));
+}
+
+void adv_beacon_init(adv_beacon_fill_fn fill, void (*changed)(void))
+{
+    fill_status = fill;
+    on_changed = changed;
+    adv_beacon_update();
+    ble_npl_callout_init(&check_timer, nimble_port_get_dflt_eventq(), check_timer_cb, NULL);
+    ble_npl_callout_reset(&check_timer, ble_npl_time_ms_to_ticks32(CONFIG_EVOLTE_BEACON_CHECK_MS));
+}
+
+const uint8_t *adv_beacon_data(void)
+{
+    return data;
+}
+
+const adv_beacon_stats_t *adv_beacon_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "status_snapshot.h"
+
+// Charger status in the manufacturer specific data of every advertisement,
+// so a scanning app shows a whole site without connecting to anything. The
+// device name moves to the scan response to make room. Little endian:
+//
+//   off  len  field
+//   0    2    company id (ADV_BEACON_COMPANY_ID)
+//   2    1    version (ADV_BEACON_VERSION)
+//   3    1    state (ADV_BEACON_*)
+//   4    1    relay_mask, bit n set = relay n closed
+//   5    1    free BLE session slots, 0 = not connectable now
+//   6    2    power in 100 W steps, rounded, 0 when not drawing
+//   8    2    error_flags, low 16 bits (CHARGER_ERR_*)
+//   10   1    seq, bumped on every change of the other fields
+//
+// Readers must ignore bytes past the ones they know. The controller is only
+// handed new advertising data when a field changes.
+
+// Reserved by the Bluetooth SIG for tests, until we have an assigned one
+#define ADV_BEACON_COMPANY_ID 0xFFFF
+#define ADV_BEACON_VERSION 1
+#define ADV_BEACON_LEN 11
+
+// Relays closed and at least this much power: a car is charging
+#define ADV_BEACON_CHARGING_W 100
+
+#define ADV_BEACON_AVAILABLE 0 // Relays open
+#define ADV_BEACON_READY 1     // Relays closed, nothing drawing
+#define ADV_BEACON_CHARGING 2
+#define ADV_BEACON_FAULT 3 // Any error flag set
+
+typedef void (*adv_beacon_fill_fn)(status_snapshot_t *snap);
+
+typedef struct
+{
+    uint32_t checks;  // Times the status was looked at
+    uint32_t updates; // Times the payload changed
+} adv_beacon_stats_t;
+
+// Returns ADV_BEACON_LEN, or 0 if cap is too small
+size_t adv_beacon_encode(const status_snapshot_t *snap, uint8_t free_slots, uint8_t seq, uint8_t *buf,
+                         size_t cap);
+
+// Looks at the status every CONFIG_EVOLTE_BEACON_CHECK_MS, since metered
+// power changes post no event, and calls changed when the payload did.
+// Host task only.
+void adv_beacon_init(adv_beacon_fill_fn fill, void (*changed)(void));
+
+// Re-encode from the current status, true if the payload changed
+bool adv_beacon_update(void);
+
+// Manufacturer data for ble_hs_adv_fields, company id included
+const uint8_t *adv_beacon_data(void);
+
+const adv_beacon_stats_t *adv_beacon_stats(void);
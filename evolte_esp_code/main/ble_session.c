@@ -0,0 +1,162 @@
+#include <string.h>
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "ble_session.h"
+#include "mem_budget.h"
+
+static ble_session_t sessions[BLE_SESSION_MAX];
+MEM_BUDGET_FITS(BLE_SESSIONS, sessions);
+static ble_session_exec_fn session_exec;
+static struct ble_npl_callout sched_timer;
+static int rr_next; // Session that gets the first turn in the next round
+
+static void sched_timer_cb(struct ble_npl_event *ev)
+{
+    ble_session_schedule();
+}
+
+void ble_session_init(ble_session_exec_fn exec)
+{
+    memset(sessions, 0, sizeof(sessions));
+    session_exec = exec;
+    rr_next = 0;
+    ble_npl_callout_init(&sched_timer, nimble_port_get_dflt_eventq(), sched_timer_cb, NULL);
+}
+
+ble_session_t *ble_session_find(uint16_t conn_handle)
+{
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+        if (sessions[i].in_use && sessions[i].conn_handle == conn_handle)
+            return &sessions[i];
+    return NULL;
+}
+
+ble_session_t *ble_session_at(int idx)
+{
+    return (idx >= 0 && idx < BLE_SESSION_MAX && sessions[idx].in_use) ? &sessions[idx] : NULL;
+}
+
+int ble_session_free_slots(void)
+{
+    int n = 0;
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+        n += !sessions[i].in_use;
+    return n;
+}
+
+void ble_session_update_auth(ble_session_t *s)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(s->conn_handle, &desc) != 0)
+        return;
+    if (desc.sec_state.authenticated)
+        s->auth = BLE_SESSION_AUTH_AUTHENTICATED;
+    else if (desc.sec_state.encrypted)
+        s->auth = BLE_SESSION_AUTH_ENCRYPTED;
+    else
+        s->auth = BLE_SESSION_AUTH_NONE;
+}
+
+ble_session_t *ble_session_open(uint16_t conn_handle)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s)
+        return s;
+
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+        if (!sessions[i].in_use)
+        {
+            s = &sessions[i];
+            memset(s, 0, sizeof(*s));
+            s->in_use = true;
+            s->conn_handle = conn_handle;
+            s->mtu = BLE_ATT_MTU_DFLT;
+            ble_session_update_auth(s);
+            return s;
+        }
+    return NULL;
+}
+
+void ble_session_close(uint16_t conn_handle)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s)
+        memset(s, 0, sizeof(*s));
+}
+
+size_t ble_session_long_read(ble_session_t *s, status_encode_fn encode, const uint8_t **val)
+{
+    ble_npl_time_t now = ble_npl_time_get();
+    uint16_t chunk = s->mtu - 1; // Payload of a Read / Read Blob Response
+
+    bool continuing = s->lr_sent != 0 && s->lr_sent < s->lr_len &&
+                      now - s->lr_time < ble_npl_time_ms_to_ticks32(BLE_SESSION_LONG_READ_MS);
+    if (!continuing)
+    {
+        s->lr_len = (uint8_t)encode(s->lr_val, sizeof(s->lr_val));
+        s->lr_sent = 0;
+    }
+    s->lr_sent += chunk;
+    s->lr_time = now;
+    *val = s->lr_val;
+    return s->lr_len;
+}
+
+static int enqueue_frame(const cmd_frame_t *frame, void *ctx)
+{
+    ble_session_t *s = ctx;
+    int idx = (s->q_head + s->q_count) % CONFIG_EVOLTE_SESSION_QUEUE_LEN;
+    cmd_copy(&s->queue[idx], frame);
+    s->q_count++;
+    return 0;
+}
+
+bool ble_session_enqueue(ble_session_t *s, const uint8_t *buf, size_t len, int count)
+{
+    if (CONFIG_EVOLTE_SESSION_QUEUE_LEN - s->q_count < count)
+    {
+        s->stats.cmds_dropped += count;
+        return false;
+    }
+    cmd_proto_run(buf, len, enqueue_frame, s);
+    s->stats.cmds_queued += count;
+    return true;
+}
+
+void ble_session_schedule(void)
+{
+    int budget = CONFIG_EVOLTE_SCHED_BUDGET;
+    bool more = true;
+
+    while (budget > 0 && more)
+    {
+        more = false;
+        for (int n = 0; n < BLE_SESSION_MAX && budget > 0; n++)
+        {
+            ble_session_t *s = &sessions[rr_next];
+            rr_next = (rr_next + 1) % BLE_SESSION_MAX;
+            if (!s->in_use || s->q_count == 0)
+                continue;
+
+            // The command stays queued if the executor cannot take it yet
+            if (!session_exec(s, &s->queue[s->q_head]))
+            {
+                ble_npl_callout_reset(&sched_timer, 1);
+                return;
+            }
+            s->q_head = (s->q_head + 1) % CONFIG_EVOLTE_SESSION_QUEUE_LEN;
+            s->q_count--;
+            s->stats.cmds_run++;
+            budget--;
+            more |= s->q_count > 0;
+        }
+    }
+
+    // Work left over: come back after the host task has had a look at its queue
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+        if (sessions[i].in_use && sessions[i].q_count > 0)
+        {
+            ble_npl_callout_reset(&sched_timer, 0);
+            return;
+        }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cmd_proto.h"
+#include "conn_policy.h"
+#include "history_xfer.h"
+#include "sdkconfig.h"
+#include "status_notify.h"
+#include "status_snapshot.h"
+
+// Per-connection state, one slot per CONFIG_BT_NIMBLE_MAX_CONNECTIONS.
+// Only touched from the NimBLE host task.
+
+#define BLE_SESSION_MAX CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+// A long read that stalls for longer than this starts over with a fresh value
+#define BLE_SESSION_LONG_READ_MS 1000
+
+#define BLE_SESSION_SUB_NOTIFY 0x01
+#define BLE_SESSION_SUB_INDICATE 0x02
+
+typedef enum
+{
+    BLE_SESSION_AUTH_NONE = 0,
+    BLE_SESSION_AUTH_ENCRYPTED,
+    BLE_SESSION_AUTH_AUTHENTICATED,
+} ble_session_auth_t;
+
+typedef struct
+{
+    uint32_t writes;        // ATT writes to the command characteristic
+    uint32_t writes_bad;    // Writes rejected by cmd_proto
+    uint32_t cmds_queued;   // Commands accepted into the session queue
+    uint32_t cmds_run;      // Commands handed to the actuator by the scheduler
+    uint32_t cmds_dropped;  // Commands refused because the queue was full
+} ble_session_stats_t;
+
+typedef struct
+{
+    bool in_use;
+    uint16_t conn_handle;
+    uint16_t mtu;
+    uint8_t sub_flags;
+    ble_session_auth_t auth;
+    ble_session_stats_t stats;
+    status_notify_conn_t notify;
+    history_conn_t history;
+    conn_policy_conn_t policy;
+
+    // DIAG page the next read returns (perf.h)
+    uint8_t diag_page;
+    uint8_t diag_first;
+
+    // Value being served by a long read (Read + Read Blob)
+    uint8_t lr_len;
+    uint16_t lr_sent;
+    ble_npl_time_t lr_time;
+    uint8_t lr_val[STATUS_SNAPSHOT_SIZE];
+
+    // Commands waiting for their round-robin turn
+    uint8_t q_head;
+    uint8_t q_count;
+    cmd_t queue[CONFIG_EVOLTE_SESSION_QUEUE_LEN];
+} ble_session_t;
+
+// Hands one command of a session queue on for execution. Returning false
+// leaves it at the head of the queue and retries on the next tick.
+typedef bool (*ble_session_exec_fn)(ble_session_t *s, const cmd_t *cmd);
+
+void ble_session_init(ble_session_exec_fn exec);
+
+ble_session_t *ble_session_open(uint16_t conn_handle);
+void ble_session_close(uint16_t conn_handle);
+ble_session_t *ble_session_find(uint16_t conn_handle);
+ble_session_t *ble_session_at(int idx);
+int ble_session_free_slots(void);
+void ble_session_update_auth(ble_session_t *s);
+
+// Value for one read of the status characteristic. Encodes a fresh value
+// unless a long read of a value larger than the MTU is still in progress.
+size_t ble_session_long_read(ble_session_t *s, status_encode_fn encode, const uint8_t **val);
+
+// Queue a whole validated write. Either every command is queued or none is.
+bool ble_session_enqueue(ble_session_t *s, const uint8_t *buf, size_t len, int count);
+
+// Run up to CONFIG_EVOLTE_SCHED_BUDGET queued commands, one per session in
+// turn, and defer the rest so other host events are handled in between
+void ble_session_schedule(void);
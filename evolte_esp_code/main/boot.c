@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include "boot.h"
+#include "dlog.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+
+#define BOOT_TASK_STACK 4096
+#define BOOT_TASK_PRIO 2
+
+static const boot_stage_def_t *stages;
+static int n_stages;
+static uint32_t started, done;
+static boot_stage_time_t times[BOOT_MAX_STAGES];
+MEM_BUDGET_FITS(BOOT_TIMES, times);
+static int64_t app_start_us;
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// True the first time a stage is marked done
+static bool mark_done(int stage)
+{
+    portENTER_CRITICAL(&boot_lock);
+    bool first = !(done & BOOT_BIT(stage));
+    if (first)
+    {
+        times[stage].done_us = esp_timer_get_time();
+        // Event stages can complete before their dependencies are marked done
+        if (!(started & BOOT_BIT(stage)))
+        {
+            started |= BOOT_BIT(stage);
+            times[stage].start_us = times[stage].done_us;
+        }
+        done |= BOOT_BIT(stage);
+    }
+    portEXIT_CRITICAL(&boot_lock);
+
+    if (first)
+        DLOG(BOOT_STAGE_DONE, stage, (uint32_t)times[stage].done_us);
+    return first;
+}
+
+static void worker_task(void *param)
+{
+    int stage = (int)(intptr_t)param;
+    stages[stage].fn();
+    boot_stage_done(stage);
+    vTaskDelete(NULL);
+}
+
+// Claim one stage that is ready to start, -1 if there is none
+static int claim_ready(void)
+{
+    int stage = -1;
+    portENTER_CRITICAL(&boot_lock);
+    for (int i = 0; i < n_stages; i++)
+    {
+        uint32_t bit = BOOT_BIT(i);
+        if (!(started & bit) && (stages[i].deps & done) == stages[i].deps)
+        {
+            started |= bit;
+            times[i].start_us = esp_timer_get_time();
+            stage = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&boot_lock);
+    return stage;
+}
+
+static void pump(void)
+{
+    int stage;
+    while ((stage = claim_ready()) >= 0)
+    {
+        const boot_stage_def_t *s = &stages[stage];
+        if (s->fn == NULL)
+            continue; // Waits for its event
+        if (s->own_task)
+        {
+            if (xTaskCreatePinnedToCore(worker_task, s->name, BOOT_TASK_STACK, (void *)(intptr_t)stage,
+                                        BOOT_TASK_PRIO, NULL, tskNO_AFFINITY) == pdPASS)
+                continue;
+        }
+        s->fn();
+        mark_done(stage);
+    }
+}
+
+void boot_start(const boot_stage_def_t *defs, int count)
+{
+    stages = defs;
+    n_stages = count < BOOT_MAX_STAGES ? count : BOOT_MAX_STAGES;
+    started = done = 0;
+    app_start_us = esp_timer_get_time();
+    for (int i = 0; i < BOOT_MAX_STAGES; i++)
+        times[i].start_us = times[i].done_us = -1;
+    pump();
+}
+
+void boot_stage_done(int stage)
+{
+    if (stage >= 0 && stage < n_stages && mark_done(stage))
+        pump();
+}
+
+bool boot_stage_is_done(int stage)
+{
+    return (done & BOOT_BIT(stage)) != 0;
+}
+
+const boot_stage_time_t *boot_stage_time(int stage)
+{
+    return &times[stage];
+}
+
+size_t boot_profile_json(char *buf, size_t cap)
+{
+    size_t n = 0;
+    int rc = snprintf(buf, cap, "{\"reset_reason\":%d,\"app_start_us\":%lld,\"stages\":[",
+                      (int)esp_reset_reason(), (long long)app_start_us);
+    for (int i = 0; rc >= 0 && i <= n_stages; i++)
+    {
+        n += (size_t)rc;
+        if (n >= cap)
+            return cap - 1;
+        if (i == n_stages)
+            rc = snprintf(buf + n, cap - n, "]}");
+        else
+            rc = snprintf(buf + n, cap - n, "%s{\"name\":\"%s\",\"start_us\":%lld,\"done_us\":%lld}",
+                          i ? "," : "", stages[i].name, (long long)times[i].start_us,
+                          (long long)times[i].done_us);
+    }
+    if (rc < 0)
+        return 0;
+    n += (size_t)rc;
+    return n < cap ? n : cap - 1;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Staged boot. Each stage names the stages it depends on and starts as soon
+// as they are all done, so independent bring-up overlaps instead of running
+// in a fixed order. Start and completion times are kept for /diag/boot.
+
+#define BOOT_MAX_STAGES 16
+#define BOOT_BIT(stage) (1u << (stage))
+
+typedef struct
+{
+    const char *name;
+    uint32_t deps;    // BOOT_BIT() of the stages that must be done first
+    void (*fn)(void); // NULL: completed later by boot_stage_done from an event
+    bool own_task;    // Run fn on a worker task so slow bring-up overlaps
+} boot_stage_def_t;
+
+typedef struct
+{
+    int64_t start_us; // esp_timer time, -1 until started
+    int64_t done_us;  // -1 until done
+} boot_stage_time_t;
+
+// Runs every stage whose dependencies are met, returns once the stages
+// that can run on the calling task have run
+void boot_start(const boot_stage_def_t *stages, int count);
+
+// Mark a stage done and start whatever was waiting for it. Safe from any task.
+void boot_stage_done(int stage);
+
+bool boot_stage_is_done(int stage);
+const boot_stage_time_t *boot_stage_time(int stage);
+
+// {"reset_reason":1,"app_start_us":...,"stages":[{"name":..,"start_us":..,"done_us":..},...]}
+size_t boot_profile_json(char *buf, size_t cap);
@@ -0,0 +1,162 @@
+#include <stddef.h>
+#include <string.h>
+#include "charge_plan.h"
+
+void charge_plan_clear(charge_plan_t *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->version = CHARGE_PLAN_VERSION;
+}
+
+static bool rule_valid(uint8_t days, uint16_t start, uint16_t end)
+{
+    return days < 0x80 && start < CHARGE_PLAN_DAY && end < CHARGE_PLAN_DAY;
+}
+
+bool charge_plan_valid(const charge_plan_t *plan, uint8_t channels)
+{
+    if (plan->version != CHARGE_PLAN_VERSION || plan->tz_min < CHARGE_PLAN_TZ_MIN ||
+        plan->tz_min > CHARGE_PLAN_TZ_MAX || plan->cheap_mask >> channels)
+        return false;
+    for (int i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+    {
+        const charge_window_t *w = &plan->windows[i];
+        if (!rule_valid(w->days, w->start, w->end) || (w->days && w->channel >= channels))
+            return false;
+    }
+    for (int i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+    {
+        const charge_tariff_t *t = &plan->tariffs[i];
+        if (!rule_valid(t->days, t->start, t->end))
+            return false;
+    }
+    return true;
+}
+
+uint8_t charge_plan_channels(const charge_plan_t *plan)
+{
+    uint8_t mask = plan->cheap_mask;
+    for (int i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+        if (plan->windows[i].days)
+            mask |= (uint8_t)(1u << plan->windows[i].channel);
+    return mask;
+}
+
+// Monday is 0; 1 January 1970 was a Thursday
+static unsigned day_of_week(uint32_t local_min)
+{
+    return (local_min / CHARGE_PLAN_DAY + 3) % 7;
+}
+
+bool charge_plan_in_rule(uint8_t days, uint16_t start, uint16_t end, uint32_t local_min)
+{
+    uint32_t mod = local_min % CHARGE_PLAN_DAY;
+    unsigned today = day_of_week(local_min);
+    if (start < end)
+        return (days >> today & 1) && mod >= start && mod < end;
+    // Past midnight: the part before it started today, the rest yesterday
+    if (mod >= start)
+        return days >> today & 1;
+    return mod < end && (days >> (today + 6) % 7 & 1);
+}
+
+static uint32_t local_time(const charge_plan_t *plan, uint32_t now_min)
+{
+    return (uint32_t)((int32_t)now_min + plan->tz_min);
+}
+
+uint8_t charge_plan_eval(const charge_plan_t *plan, uint32_t now_min, uint16_t *price)
+{
+    uint32_t local = local_time(plan, now_min);
+    uint8_t on = 0;
+    for (int i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+    {
+        const charge_window_t *w = &plan->windows[i];
+        if (w->days && charge_plan_in_rule(w->days, w->start, w->end, local))
+            on |= (uint8_t)(1u << w->channel);
+    }
+    *price = plan->default_price;
+    for (int i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+    {
+        const charge_tariff_t *t = &plan->tariffs[i];
+        if (t->days && charge_plan_in_rule(t->days, t->start, t->end, local))
+        {
+            *price = t->price;
+            break;
+        }
+    }
+    if (*price <= plan->max_price)
+        on |= plan->cheap_mask;
+    return on;
+}
+
+// ---- Engine ----
+
+// The state can only change where a rule starts or ends. Every rule has
+// both each day; on a day it skips, its timer runs for nothing.
+static void edge_arm(charge_engine_t *e, int rule)
+{
+    uint8_t days;
+    uint16_t start, end;
+    if (rule < CHARGE_PLAN_WINDOWS)
+    {
+        const charge_window_t *w = &e->plan.windows[rule];
+        days = w->days, start = w->start, end = w->end;
+    }
+    else
+    {
+        const charge_tariff_t *t = &e->plan.tariffs[rule - CHARGE_PLAN_WINDOWS];
+        days = t->days, start = t->start, end = t->end;
+    }
+    if (days == 0)
+    {
+        tw_cancel(&e->wheel, &e->edges[rule]);
+        return;
+    }
+
+    uint32_t mod = local_time(&e->plan, e->wheel.now) % CHARGE_PLAN_DAY;
+    uint32_t to_start = (start + CHARGE_PLAN_DAY - 1 - mod) % CHARGE_PLAN_DAY + 1;
+    uint32_t to_end = (end + CHARGE_PLAN_DAY - 1 - mod) % CHARGE_PLAN_DAY + 1;
+    tw_add(&e->wheel, &e->edges[rule], e->wheel.now + (to_start < to_end ? to_start : to_end));
+}
+
+static void edge_fired(tw_timer_t *t, void *ctx)
+{
+    charge_engine_t *e = ctx;
+    edge_arm(e, (int)(t - e->edges));
+}
+
+static void evaluate(charge_engine_t *e)
+{
+    e->on_mask = charge_plan_eval(&e->plan, e->wheel.now, &e->price);
+    e->evals++;
+}
+
+void charge_engine_start(charge_engine_t *e, uint32_t now_min)
+{
+    tw_init(&e->wheel, now_min);
+    for (int i = 0; i < CHARGE_PLAN_RULES; i++)
+    {
+        e->edges[i].pending = false;
+        edge_arm(e, i);
+    }
+    evaluate(e);
+}
+
+bool charge_engine_advance(charge_engine_t *e, uint32_t now_min)
+{
+    uint32_t next = tw_next(&e->wheel);
+    if (next == TW_NEVER || (int32_t)(now_min - next) < 0)
+    {
+        tw_advance(&e->wheel, now_min, edge_fired, e);
+        return false;
+    }
+    tw_advance(&e->wheel, now_min, edge_fired, e);
+    evaluate(e);
+    return true;
+}
+
+uint32_t charge_engine_next(const charge_engine_t *e)
+{
+    return tw_next(&e->wheel);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "timer_wheel.h"
+
+// Charge schedule, free of ESP-IDF: weekly charge windows per relay channel
+// and a tariff table, both in local time at a fixed offset from UTC. A
+// channel is on during any of its windows, and a channel in cheap_mask also
+// whenever the price is at most max_price. Times are minutes since the Unix
+// epoch. The engine keeps one wheel timer per rule at its next start or
+// end, so the plan is only looked at when something can change.
+
+#define CHARGE_PLAN_WINDOWS 8
+#define CHARGE_PLAN_TARIFFS 8
+#define CHARGE_PLAN_RULES (CHARGE_PLAN_WINDOWS + CHARGE_PLAN_TARIFFS)
+#define CHARGE_PLAN_VERSION 1
+#define CHARGE_PLAN_DAY 1440
+#define CHARGE_PLAN_TZ_MIN (-12 * 60)
+#define CHARGE_PLAN_TZ_MAX (14 * 60)
+
+// A rule covers [start, end) on each day of days, in minutes of the day. An
+// end at or before start runs past midnight into the next day, an end equal
+// to start lasts 24 hours.
+typedef struct
+{
+    uint8_t days; // Bit 0 Monday .. bit 6 Sunday, the day it starts on; 0: unused
+    uint8_t channel;
+    uint16_t start;
+    uint16_t end;
+} charge_window_t;
+
+typedef struct
+{
+    uint8_t days;
+    uint8_t reserved; // 0
+    uint16_t start;
+    uint16_t end;
+    uint16_t price; // Per kWh, in whatever unit the app uses
+} charge_tariff_t;
+
+// Stored as is, version first
+typedef struct
+{
+    uint8_t version;
+    uint8_t cheap_mask;     // Channels that charge whenever the price allows
+    int16_t tz_min;         // Local time minus UTC
+    uint16_t default_price; // Outside every tariff band
+    uint16_t max_price;
+    charge_window_t windows[CHARGE_PLAN_WINDOWS];
+    charge_tariff_t tariffs[CHARGE_PLAN_TARIFFS]; // The first that applies sets the price
+} charge_plan_t;
+
+// Compared and stored byte for byte, so no padding anywhere
+_Static_assert(sizeof(charge_plan_t) == 8 + 6 * CHARGE_PLAN_WINDOWS + 8 * CHARGE_PLAN_TARIFFS,
+               "charge_plan_t must have no padding");
+
+typedef struct
+{
+    charge_plan_t plan;
+    tw_wheel_t wheel;
+    tw_timer_t edges[CHARGE_PLAN_RULES]; // Windows, then tariffs
+    uint8_t on_mask; // Channels that should be on, as of the last edge
+    uint16_t price;
+    uint32_t evals;
+} charge_engine_t;
+
+// No rules, prices at 0
+void charge_plan_clear(charge_plan_t *plan);
+bool charge_plan_valid(const charge_plan_t *plan, uint8_t channels);
+// Channels some rule switches, the others are left alone
+uint8_t charge_plan_channels(const charge_plan_t *plan);
+bool charge_plan_in_rule(uint8_t days, uint16_t start, uint16_t end, uint32_t local_min);
+// Channels on at now and the price then, from every rule
+uint8_t charge_plan_eval(const charge_plan_t *plan, uint32_t now_min, uint16_t *price);
+
+// Evaluate engine->plan at now and arm a timer at the next edge of every
+// rule. Again after any change to the plan or the clock.
+void charge_engine_start(charge_engine_t *e, uint32_t now_min);
+// Run the wheel up to now. True if it had work due, on_mask and price
+// are then up to date.
+bool charge_engine_advance(charge_engine_t *e, uint32_t now_min);
+// Minute the wheel next has work at, an edge or timers moving down a
+// level; TW_NEVER with no rules
+uint32_t charge_engine_next(const charge_engine_t *e);
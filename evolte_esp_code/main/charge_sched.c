@@ -0,0 +1,301 @@
+#include <string.h>
+#include "actuator.h"
+#include "charge_sched.h"
+#include "charger.h"
+#include "config_store.h"
+#include "dlog.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mem_budget.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#define SCHED_NAMESPACE "sched"
+#define SCHED_KEY "plan"
+#define US_PER_MIN 60000000LL
+// Ring full: try the rest again this much later
+#define RETRY_US 100000
+// Failed plan commits in a row before waiting for the next change
+#define COMMIT_TRIES 3
+
+// Everything below is under lock, taken by the command handlers on the
+// actuator task, SNTP and the timer
+static SemaphoreHandle_t lock;
+static charge_engine_t engine;
+MEM_BUDGET_FITS(SCHED_ENGINE, engine);
+static int64_t wall_offset_us; // Unix time minus esp_timer time
+static bool clock_set;
+static bool restart;     // Plan or clock changed, start the engine over
+static uint8_t applied;  // Channel states last submitted
+static bool apply_all;   // Submit every channel of the plan, not just changes
+static uint8_t cmd_seq;
+static bool dirty;
+static int fails;        // Failed commits since the last change
+static nvs_handle_t nvs;
+static bool nvs_ok;
+static esp_timer_handle_t tick_timer;
+static esp_timer_handle_t commit_timer;
+static charge_sched_stats_t stats;
+
+static int64_t wall_now_us(void)
+{
+    return wall_offset_us + esp_timer_get_time();
+}
+
+// Caller holds lock. Relays go through the actuator ring of this timer's
+// task, ACTUATOR_SRC_TIMER; false if some did not fit.
+static bool apply(void)
+{
+    uint8_t channels = charge_plan_channels(&engine.plan);
+    uint8_t todo = apply_all ? channels : (uint8_t)((engine.on_mask ^ applied) & channels);
+    bool done = true;
+    for (uint8_t ch = 0; ch < CHARGER_RELAY_COUNT; ch++)
+    {
+        if (!(todo >> ch & 1))
+            continue;
+        uint8_t on = engine.on_mask >> ch & 1;
+        cmd_t cmd = {.opcode = CMD_OP_RELAY_SET, .seq = cmd_seq++, .len = 2, .payload = {ch, on}};
+        if (!actuator_submit(ACTUATOR_SRC_TIMER, 0, &cmd))
+        {
+            stats.dropped++;
+            done = false;
+            continue;
+        }
+        applied = (uint8_t)((applied & ~(1u << ch)) | on << ch);
+        stats.switches++;
+    }
+    if (done)
+        apply_all = false;
+    return done;
+}
+
+// Runs on the esp_timer task, the only place the plan is evaluated
+static void tick_cb(void *arg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!clock_set)
+    {
+        xSemaphoreGive(lock);
+        return;
+    }
+    int64_t now_us = wall_now_us();
+    uint32_t now_min = (uint32_t)(now_us / US_PER_MIN);
+    if (restart)
+    {
+        charge_engine_start(&engine, now_min);
+        restart = false;
+        DLOG(SCHED_START, now_min, engine.on_mask, engine.price);
+    }
+    else if (charge_engine_advance(&engine, now_min))
+    {
+        stats.wakeups++;
+        if ((engine.on_mask ^ applied) & charge_plan_channels(&engine.plan))
+            DLOG(SCHED_EDGE, now_min, engine.on_mask, engine.price);
+    }
+
+    int64_t delay = -1;
+    uint32_t next = charge_engine_next(&engine);
+    if (next != TW_NEVER)
+        delay = (int64_t)next * US_PER_MIN - now_us;
+    if (!apply() && (delay < 0 || delay > RETRY_US))
+        delay = RETRY_US;
+    esp_timer_stop(tick_timer);
+    if (delay >= 0)
+        esp_timer_start_once(tick_timer, (uint64_t)delay);
+    xSemaphoreGive(lock);
+}
+
+// Caller holds lock
+static void wake(void)
+{
+    restart = true;
+    esp_timer_stop(tick_timer);
+    esp_timer_start_once(tick_timer, 0);
+}
+
+// Caller holds lock. Whoever sets dirty arms the commit timer, so a burst
+// of changes costs one flash commit.
+static void mark_dirty(void)
+{
+    if (!dirty)
+        esp_timer_start_once(commit_timer, (uint64_t)CONFIG_EVOLTE_CONFIG_COMMIT_MS * 1000);
+    dirty = true;
+}
+
+// On the settings task, so the flash write stays off the esp_timer task
+static void plan_commit(void)
+{
+    charge_plan_t snap;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool todo = dirty;
+    dirty = false;
+    snap = engine.plan;
+    xSemaphoreGive(lock);
+    if (!todo || !nvs_ok)
+        return;
+
+    esp_err_t rc = nvs_set_blob(nvs, SCHED_KEY, &snap, sizeof(snap));
+    if (rc == ESP_OK)
+        rc = nvs_commit(nvs);
+    if (rc != ESP_OK)
+    {
+        // Try again after another delay, with any change since, a few times
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (++fails < COMMIT_TRIES)
+            mark_dirty();
+        xSemaphoreGive(lock);
+        DLOG(SCHED_COMMIT_FAILED, rc);
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    fails = 0;
+    xSemaphoreGive(lock);
+    stats.commits++;
+}
+
+static void commit_cb(void *arg)
+{
+    config_store_post(plan_commit);
+}
+
+// Caller holds lock. Runs the new plan now, stores it with the next commit.
+static void plan_changed(void)
+{
+    fails = 0;
+    mark_dirty();
+    apply_all = true;
+    wake();
+}
+
+void charge_sched_init(void)
+{
+    if (lock == NULL)
+        lock = xSemaphoreCreateMutex();
+    if (tick_timer == NULL)
+    {
+        esp_timer_create(&(esp_timer_create_args_t){.callback = tick_cb, .name = "charge_plan"}, &tick_timer);
+        esp_timer_create(&(esp_timer_create_args_t){.callback = commit_cb, .name = "plan_commit"}, &commit_timer);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    nvs_ok = nvs_open(SCHED_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK;
+    size_t len = sizeof(engine.plan);
+    // A plan from a build with another layout is dropped
+    if (!nvs_ok || nvs_get_blob(nvs, SCHED_KEY, &engine.plan, &len) != ESP_OK || len != sizeof(engine.plan) ||
+        !charge_plan_valid(&engine.plan, CHARGER_RELAY_COUNT))
+        charge_plan_clear(&engine.plan);
+    for (int i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+        engine.plan.tariffs[i].reserved = 0; // Padding in builds before it was named
+    dirty = false;
+    fails = 0;
+    restart = true;
+    if (clock_set)
+        wake();
+    xSemaphoreGive(lock);
+}
+
+void charge_sched_set_clock(int64_t unix_us)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    wall_offset_us = unix_us - esp_timer_get_time();
+    // Later syncs only move the clock, a relay switched by hand stays
+    if (!clock_set)
+        apply_all = true;
+    clock_set = true;
+    stats.clock_sets++;
+    wake();
+    xSemaphoreGive(lock);
+    DLOG(SCHED_CLOCK, (uint32_t)(unix_us / 1000000));
+}
+
+bool charge_sched_clock(int64_t *unix_us)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool set = clock_set;
+    *unix_us = set ? wall_now_us() : 0;
+    xSemaphoreGive(lock);
+    return set;
+}
+
+// Changes are made to a copy under lock, kept if the plan is still valid
+static charge_plan_t edit;
+
+static void edit_begin(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    edit = engine.plan;
+}
+
+static esp_err_t edit_end(void)
+{
+    esp_err_t rc = ESP_OK;
+    if (!charge_plan_valid(&edit, CHARGER_RELAY_COUNT))
+        rc = ESP_ERR_INVALID_ARG;
+    else if (memcmp(&edit, &engine.plan, sizeof(edit)) != 0)
+    {
+        engine.plan = edit;
+        plan_changed();
+    }
+    xSemaphoreGive(lock);
+    return rc;
+}
+
+esp_err_t charge_sched_set_tz(int16_t tz_min)
+{
+    edit_begin();
+    edit.tz_min = tz_min;
+    return edit_end();
+}
+
+// A rule without days is cleared, so an unused one always compares equal
+esp_err_t charge_sched_set_window(uint8_t idx, const charge_window_t *w)
+{
+    if (idx >= CHARGE_PLAN_WINDOWS)
+        return ESP_ERR_INVALID_ARG;
+    edit_begin();
+    edit.windows[idx] = w->days ? *w : (charge_window_t){0};
+    return edit_end();
+}
+
+esp_err_t charge_sched_set_tariff(uint8_t idx, const charge_tariff_t *t)
+{
+    if (idx >= CHARGE_PLAN_TARIFFS)
+        return ESP_ERR_INVALID_ARG;
+    edit_begin();
+    edit.tariffs[idx] = t->days ? (charge_tariff_t){.days = t->days, .start = t->start, .end = t->end, .price = t->price}
+                                : (charge_tariff_t){0};
+    return edit_end();
+}
+
+esp_err_t charge_sched_set_prices(uint16_t default_price, uint16_t max_price, uint8_t cheap_mask)
+{
+    edit_begin();
+    edit.default_price = default_price;
+    edit.max_price = max_price;
+    edit.cheap_mask = cheap_mask;
+    return edit_end();
+}
+
+void charge_sched_get(charge_sched_state_t *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    out->plan = engine.plan;
+    out->clock_set = clock_set;
+    out->unix_us = clock_set ? wall_now_us() : 0;
+    out->wake_min = TW_NEVER;
+    out->on_mask = 0;
+    out->price = engine.plan.default_price;
+    if (clock_set && !restart)
+    {
+        out->wake_min = charge_engine_next(&engine);
+        out->on_mask = engine.on_mask;
+        out->price = engine.price;
+    }
+    xSemaphoreGive(lock);
+}
+
+const charge_sched_stats_t *charge_sched_stats(void)
+{
+    return &stats;
+}
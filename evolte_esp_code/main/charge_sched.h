@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "charge_plan.h"
+#include "esp_err.h"
+
+// The charge plan on the charger: kept in NVS, run against a wall clock set
+// by the app or SNTP, and applied through the actuator like any command, so
+// relays follow the plan with no phone connected. One esp_timer sleeps
+// until the plan's next edge; changes to the plan or the clock wake it at
+// once. A channel is only switched when the plan's state for it changes,
+// so switching it by hand holds until the next edge or a change to the
+// plan.
+
+typedef struct
+{
+    uint32_t clock_sets;
+    uint32_t wakeups;  // Timer runs the plan had work at
+    uint32_t switches; // Relay commands submitted
+    uint32_t dropped;  // ... that did not fit the ring, retried
+    uint32_t commits;
+} charge_sched_stats_t;
+
+// Load the stored plan; the relays stay as they are until the clock is set
+void charge_sched_init(void);
+
+// Unix time in microseconds, from SNTP or the app
+void charge_sched_set_clock(int64_t unix_us);
+// False while the clock has not been set since boot
+bool charge_sched_clock(int64_t *unix_us);
+
+// Each change is checked, applied at once and stored like settings, after
+// CONFIG_EVOLTE_CONFIG_COMMIT_MS. ESP_ERR_INVALID_ARG if out of range.
+esp_err_t charge_sched_set_tz(int16_t tz_min);
+esp_err_t charge_sched_set_window(uint8_t idx, const charge_window_t *w);
+esp_err_t charge_sched_set_tariff(uint8_t idx, const charge_tariff_t *t);
+esp_err_t charge_sched_set_prices(uint16_t default_price, uint16_t max_price, uint8_t cheap_mask);
+
+typedef struct
+{
+    charge_plan_t plan;
+    bool clock_set;
+    int64_t unix_us;
+    uint32_t wake_min; // Next timer run, by the next edge; TW_NEVER if none
+    uint8_t on_mask;   // Channels the plan has on now
+    uint16_t price;
+} charge_sched_state_t;
+
+void charge_sched_get(charge_sched_state_t *out);
+const charge_sched_stats_t *charge_sched_stats(void);
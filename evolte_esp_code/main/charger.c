@@ -0,0 +1,120 @@
+#include "driver/gpio.h"
+#include "charger.h"
+#include "freertos/FreeRTOS.h"
+#include "perf.h"
+#include "sdkconfig.h"
+
+#define LIGHT_GPIO 13
+
+static const int relay_gpio[CHARGER_RELAY_COUNT] = {LIGHT_GPIO};
+static uint8_t relay_mask;
+static uint8_t want_mask;
+static uint16_t limit_da = CHARGER_LIMIT_NONE;
+// Raised by the actuator and meter tasks and by boot stages
+static portMUX_TYPE error_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t error_flags;
+static void (*error_cb)(uint32_t fresh);
+static charger_stats_t stats;
+
+void charger_init(void (*cb)(uint32_t fresh))
+{
+    error_cb = cb;
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << LIGHT_GPIO),
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = 0,
+        .pull_down_en = 0,
+        .intr_type = GPIO_INTR_DISABLE};
+    gpio_config(&io_conf);
+    gpio_set_level(LIGHT_GPIO, 0); // Default OFF
+}
+
+// Drive a channel to what it was commanded, unless the limit holds it off
+static bool relay_apply(uint8_t channel)
+{
+    uint8_t bit = 1u << channel;
+    bool on = (want_mask & bit) && limit_da >= CONFIG_EVOLTE_CHARGE_MIN_DA;
+
+    int64_t start = perf_now();
+    if (gpio_set_level(relay_gpio[channel], on) != ESP_OK)
+        charger_set_error(CHARGER_ERR_RELAY_GPIO);
+    perf_record(PERF_GPIO, start);
+
+    if (!!(relay_mask & bit) == on)
+        return false;
+    relay_mask ^= bit;
+    stats.relay_switches++;
+    return true;
+}
+
+bool charger_relay_set(uint8_t channel, bool on)
+{
+    if (channel >= CHARGER_RELAY_COUNT)
+        return false;
+    uint8_t bit = 1u << channel;
+    want_mask = on ? want_mask | bit : want_mask & ~bit;
+    return relay_apply(channel);
+}
+
+uint8_t charger_set_limit(uint16_t limit)
+{
+    bool held = limit < CONFIG_EVOLTE_CHARGE_MIN_DA;
+    limit_da = limit;
+    uint8_t switched = 0;
+    for (uint8_t ch = 0; ch < CHARGER_RELAY_COUNT; ch++)
+        if ((want_mask >> ch & 1) && !!(relay_mask >> ch & 1) == held && relay_apply(ch))
+            switched |= 1u << ch;
+    return switched;
+}
+
+uint16_t charger_limit(void)
+{
+    return limit_da;
+}
+
+bool charger_relay_get(uint8_t channel)
+{
+    return channel < CHARGER_RELAY_COUNT && (relay_mask & (1u << channel));
+}
+
+uint8_t charger_relay_mask(void)
+{
+    return relay_mask;
+}
+
+uint8_t charger_relay_want_mask(void)
+{
+    return want_mask;
+}
+
+uint32_t charger_error_flags(void)
+{
+    return error_flags;
+}
+
+bool charger_set_error(uint32_t flags)
+{
+    portENTER_CRITICAL(&error_lock);
+    uint32_t fresh = flags & ~error_flags;
+    error_flags |= flags;
+    portEXIT_CRITICAL(&error_lock);
+    if (fresh && error_cb)
+        error_cb(fresh);
+    return fresh != 0;
+}
+
+const charger_stats_t *charger_stats(void)
+{
+    return &stats;
+}
+
+void charger_count_cmd(uint8_t seq)
+{
+    stats.cmds_run++;
+    stats.last_seq = seq;
+}
+
+void charger_count_rejected(void)
+{
+    stats.cmds_rejected++;
+}
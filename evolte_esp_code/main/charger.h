@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Relay outputs and the charger-wide counters reported in the status snapshot
+
+#define CHARGER_RELAY_COUNT 1 // Channel 0 is LIGHT_GPIO
+#define CHARGER_LIMIT_NONE 0xFFFF
+
+// Bits of charger_error_flags()
+#define CHARGER_ERR_RELAY_GPIO 0x00000001 // gpio_set_level failed
+#define CHARGER_ERR_METER 0x00000002      // ADC sampling could not start
+
+typedef struct
+{
+    uint32_t cmds_run;       // Commands executed, any source
+    uint32_t cmds_rejected;  // Writes or requests refused by cmd_proto
+    uint32_t relay_switches; // Relay state changes
+    uint8_t last_seq;        // Sequence number of the last executed frame
+} charger_stats_t;
+
+// error_cb gets the flags charger_set_error newly raised, on the task that
+// raised them
+void charger_init(void (*error_cb)(uint32_t fresh));
+
+// Returns true if the relay changed state
+bool charger_relay_set(uint8_t channel, bool on);
+bool charger_relay_get(uint8_t channel);
+uint8_t charger_relay_mask(void);
+// Channels commanded on, whether or not the limit holds them off
+uint8_t charger_relay_want_mask(void);
+
+// Current limit in 0.1 A, CHARGER_LIMIT_NONE by default. Below
+// CONFIG_EVOLTE_CHARGE_MIN_DA a car cannot charge, so every relay is held
+// off; relay commands still take effect once the limit allows. Returns the
+// channels that switched.
+uint8_t charger_set_limit(uint16_t limit_da);
+uint16_t charger_limit(void);
+
+uint32_t charger_error_flags(void);
+// Returns true if any of flags was not set before
+bool charger_set_error(uint32_t flags);
+const charger_stats_t *charger_stats(void);
+void charger_count_cmd(uint8_t seq);
+void charger_count_rejected(void);
@@ -0,0 +1,165 @@
+#include <string.h>
+#include "cmd_proto.h"
+
+// CRC-16/CCITT-FALSE, nibble table keeps it at 32 bytes of flash
+static const uint16_t crc16_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+uint16_t cmd_proto_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = (uint16_t)(crc << 4) ^ crc16_nibble[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (uint16_t)(crc << 4) ^ crc16_nibble[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+size_t cmd_proto_encode(uint8_t *out, size_t cap, uint8_t opcode, uint8_t seq,
+                        const uint8_t *payload, uint8_t len)
+{
+    size_t total = CMD_PROTO_OVERHEAD + (size_t)len;
+    if (len > CMD_PROTO_MAX_PAYLOAD || total > cap)
+        return 0;
+
+    out[0] = CMD_PROTO_SOF;
+    out[1] = opcode;
+    out[2] = seq;
+    out[3] = len;
+    if (len)
+        memcpy(&out[CMD_PROTO_HDR_LEN], payload, len);
+
+    uint16_t crc = cmd_proto_crc16(&out[1], CMD_PROTO_HDR_LEN - 1 + len);
+    out[CMD_PROTO_HDR_LEN + len] = (uint8_t)crc;
+    out[CMD_PROTO_HDR_LEN + len + 1] = (uint8_t)(crc >> 8);
+    return total;
+}
+
+int cmd_proto_legacy(const uint8_t *buf, size_t len, cmd_frame_t *frame, uint8_t *payload)
+{
+    // The old app code could send a trailing NUL or newline, ignore it
+    while (len > 0 && (buf[len - 1] == '\0' || buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+        len--;
+
+    if (len == 8 && memcmp(buf, "LIGHT ON", 8) == 0)
+        payload[1] = 1;
+    else if (len == 9 && memcmp(buf, "LIGHT OFF", 9) == 0)
+        payload[1] = 0;
+    else
+        return CMD_PROTO_ERR_UNKNOWN;
+
+    payload[0] = 0; // Channel 0 is LIGHT_GPIO
+    frame->opcode = CMD_OP_RELAY_SET;
+    frame->seq = 0;
+    frame->len = 2;
+    frame->payload = payload;
+    return CMD_PROTO_OK;
+}
+
+// Decode the frame at buf without checking it, only used after validation
+static size_t frame_view(const uint8_t *buf, cmd_frame_t *frame)
+{
+    frame->opcode = buf[1];
+    frame->seq = buf[2];
+    frame->len = buf[3];
+    frame->payload = &buf[CMD_PROTO_HDR_LEN];
+    return CMD_PROTO_OVERHEAD + (size_t)frame->len;
+}
+
+static int check_op(const cmd_frame_t *frame, const cmd_op_t *ops, size_t n_ops)
+{
+    if (frame->opcode >= n_ops || ops[frame->opcode].fn == NULL)
+        return CMD_PROTO_ERR_OPCODE;
+    if (frame->len < ops[frame->opcode].min_len || frame->len > ops[frame->opcode].max_len)
+        return CMD_PROTO_ERR_LEN;
+    return CMD_PROTO_OK;
+}
+
+int cmd_proto_validate(const uint8_t *buf, size_t len, const cmd_op_t *ops, size_t n_ops)
+{
+    cmd_frame_t frame;
+    int rc;
+
+    if (len == 0)
+        return CMD_PROTO_ERR_TRUNCATED;
+
+    if (buf[0] != CMD_PROTO_SOF)
+    {
+        uint8_t payload[2];
+        rc = cmd_proto_legacy(buf, len, &frame, payload);
+        if (rc == CMD_PROTO_OK)
+            rc = check_op(&frame, ops, n_ops);
+        return rc == CMD_PROTO_OK ? 1 : rc;
+    }
+
+    size_t off = 0;
+    int count = 0;
+    while (off < len)
+    {
+        if (count == CMD_PROTO_MAX_FRAMES)
+            return CMD_PROTO_ERR_TOO_MANY;
+        if (len - off < CMD_PROTO_OVERHEAD || buf[off] != CMD_PROTO_SOF)
+            return CMD_PROTO_ERR_TRUNCATED;
+
+        size_t body = CMD_PROTO_HDR_LEN - 1 + (size_t)buf[off + 3];
+        if (len - off < 1 + body + CMD_PROTO_CRC_LEN)
+            return CMD_PROTO_ERR_TRUNCATED;
+
+        const uint8_t *crc = &buf[off + 1 + body];
+        if (cmd_proto_crc16(&buf[off + 1], body) != (uint16_t)(crc[0] | (crc[1] << 8)))
+            return CMD_PROTO_ERR_CRC;
+
+        off += frame_view(&buf[off], &frame);
+        rc = check_op(&frame, ops, n_ops);
+        if (rc != CMD_PROTO_OK)
+            return rc;
+        count++;
+    }
+    return count;
+}
+
+void cmd_proto_run(const uint8_t *buf, size_t len, cmd_op_fn fn, void *ctx)
+{
+    cmd_frame_t frame;
+
+    if (buf[0] != CMD_PROTO_SOF)
+    {
+        uint8_t payload[2];
+        if (cmd_proto_legacy(buf, len, &frame, payload) == CMD_PROTO_OK)
+            fn(&frame, ctx);
+        return;
+    }
+
+    for (size_t off = 0; off < len;)
+    {
+        off += frame_view(&buf[off], &frame);
+        fn(&frame, ctx);
+    }
+}
+
+typedef struct
+{
+    const cmd_op_t *ops;
+    void *ctx;
+} op_table_ctx_t;
+
+static int run_op(const cmd_frame_t *frame, void *ctx)
+{
+    const op_table_ctx_t *t = ctx;
+    return t->ops[frame->opcode].fn(frame, t->ctx);
+}
+
+int cmd_proto_dispatch(const uint8_t *buf, size_t len, const cmd_op_t *ops, size_t n_ops, void *ctx)
+{
+    // Pass 1 validates everything so a damaged batch never applies half way,
+    // pass 2 dispatches through the opcode table
+    int count = cmd_proto_validate(buf, len, ops, n_ops);
+    if (count > 0)
+    {
+        op_table_ctx_t t = {.ops = ops, .ctx = ctx};
+        cmd_proto_run(buf, len, run_op, &t);
+    }
+    return count;
+}
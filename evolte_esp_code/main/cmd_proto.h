@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary command frame written to the 0xDEAD characteristic.
+// Several frames may be packed back to back into one ATT write.
+//
+//   0     1       2     3     4 .. 4+len    4+len .. 6+len
+//   SOF   opcode  seq   len   payload       crc16 (LE)
+//
+// The CRC is CRC-16/CCITT-FALSE over opcode, seq, len and payload.
+// Anything that does not start with SOF is treated as a legacy text command.
+#define CMD_PROTO_SOF 0xA5
+#define CMD_PROTO_HDR_LEN 4
+#define CMD_PROTO_CRC_LEN 2
+#define CMD_PROTO_OVERHEAD (CMD_PROTO_HDR_LEN + CMD_PROTO_CRC_LEN)
+#define CMD_PROTO_MAX_PAYLOAD 32
+#define CMD_PROTO_MAX_FRAMES 16 // Frames accepted per write
+
+// Opcodes understood by the firmware
+enum
+{
+    CMD_OP_NOP = 0x00,        // No payload, used by the app to probe the link
+    CMD_OP_RELAY_SET = 0x01,  // payload: channel, state (0/1)
+    CMD_OP_CONFIG_SET = 0x02, // payload: field, offset, bytes (see config_fields.def)
+    // Charge schedule (charge_sched.h), multi-byte values little endian
+    CMD_OP_TIME_SET = 0x03,     // payload: unix time u32, UTC offset in minutes i16
+    CMD_OP_PLAN_WINDOW = 0x04,  // payload: index, days, channel, start u16, end u16; days 0 clears it
+    CMD_OP_PLAN_TARIFF = 0x05,  // payload: index, days, start u16, end u16, price u16
+    CMD_OP_PLAN_PRICES = 0x06,  // payload: default price u16, max price u16, cheap channel mask
+    // Sent by site balancing (site_link.h)
+    CMD_OP_CURRENT_LIMIT = 0x07, // payload: limit u16 in 0.1 A, 0xFFFF for none
+    CMD_OP_COUNT
+};
+
+// Errors returned by cmd_proto_dispatch; the whole write is rejected
+// before any handler runs so a damaged batch never applies half way.
+enum
+{
+    CMD_PROTO_OK = 0,
+    CMD_PROTO_ERR_TRUNCATED = -1, // Frame runs past the end of the write
+    CMD_PROTO_ERR_CRC = -2,       // CRC mismatch
+    CMD_PROTO_ERR_OPCODE = -3,    // No handler for the opcode
+    CMD_PROTO_ERR_LEN = -4,       // Payload length outside the handler's range
+    CMD_PROTO_ERR_TOO_MANY = -5,  // More than CMD_PROTO_MAX_FRAMES frames
+    CMD_PROTO_ERR_UNKNOWN = -6,   // Legacy text that matches no command
+};
+
+// View into the write buffer, nothing is copied
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t seq;
+    uint8_t len;
+    const uint8_t *payload;
+} cmd_frame_t;
+
+// Owned copy of a frame, used where commands are queued
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t seq;
+    uint8_t len;
+    uint8_t payload[CMD_PROTO_MAX_PAYLOAD];
+} cmd_t;
+
+typedef int (*cmd_op_fn)(const cmd_frame_t *frame, void *ctx);
+
+// One entry per opcode, indexed by opcode
+typedef struct
+{
+    cmd_op_fn fn;
+    uint8_t min_len;
+    uint8_t max_len;
+} cmd_op_t;
+
+uint16_t cmd_proto_crc16(const uint8_t *data, size_t len);
+
+// Encode one frame into out, returns the encoded length or 0 if it does not fit
+size_t cmd_proto_encode(uint8_t *out, size_t cap, uint8_t opcode, uint8_t seq,
+                        const uint8_t *payload, uint8_t len);
+
+// Map "LIGHT ON"/"LIGHT OFF" onto CMD_OP_RELAY_SET, returns CMD_PROTO_OK or CMD_PROTO_ERR_UNKNOWN
+int cmd_proto_legacy(const uint8_t *buf, size_t len, cmd_frame_t *frame, uint8_t *payload);
+
+// Check framing, CRC, opcode and payload length of every frame in buf.
+// Returns the number of commands or a negative CMD_PROTO_ERR_*.
+int cmd_proto_validate(const uint8_t *buf, size_t len, const cmd_op_t *ops, size_t n_ops);
+
+// Call fn for every frame of a buffer that passed cmd_proto_validate
+void cmd_proto_run(const uint8_t *buf, size_t len, cmd_op_fn fn, void *ctx);
+
+// Validate every frame in buf, then run the handler of each one in order.
+// Returns the number of commands dispatched or a negative CMD_PROTO_ERR_*.
+int cmd_proto_dispatch(const uint8_t *buf, size_t len, const cmd_op_t *ops, size_t n_ops, void *ctx);
+
+static inline void cmd_copy(cmd_t *dst, const cmd_frame_t *frame)
+{
+    dst->opcode = frame->opcode;
+    dst->seq = frame->seq;
+    dst->len = frame->len;
+    for (uint8_t i = 0; i < frame->len; i++)
+        dst->payload[i] = frame->payload[i];
+}
+
+static inline void cmd_view(const cmd_t *cmd, cmd_frame_t *frame)
+{
+    frame->opcode = cmd->opcode;
+    frame->seq = cmd->seq;
+    frame->len = cmd->len;
+    frame->payload = cmd->payload;
+}
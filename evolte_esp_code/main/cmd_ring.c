@@ -0,0 +1,40 @@
+#include "cmd_ring.h"
+
+void cmd_ring_init(cmd_ring_t *r)
+{
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+}
+
+bool cmd_ring_push(cmd_ring_t *r, const cmd_ring_item_t *item)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == CMD_RING_LEN)
+        return false;
+
+    r->items[head & (CMD_RING_LEN - 1)] = *item;
+    // Publish the slot only after it is written
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool cmd_ring_pop(cmd_ring_t *r, cmd_ring_item_t *item)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail)
+        return false;
+
+    *item = r->items[tail & (CMD_RING_LEN - 1)];
+    // Hand the slot back only after it has been copied out
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+uint32_t cmd_ring_depth(cmd_ring_t *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    return head - tail;
+}
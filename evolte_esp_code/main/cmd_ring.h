@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "cmd_proto.h"
+#include "sdkconfig.h"
+
+// Lock-free single-producer/single-consumer ring of commands. The producer
+// only writes head, the consumer only writes tail, so neither side ever
+// blocks or takes a lock. Each ring must have exactly one producer task.
+
+#define CMD_RING_LEN CONFIG_EVOLTE_CMD_RING_LEN
+
+_Static_assert((CMD_RING_LEN & (CMD_RING_LEN - 1)) == 0, "CMD_RING_LEN must be a power of two");
+
+typedef struct
+{
+    cmd_t cmd;
+    uint16_t conn_handle; // Originating BLE connection, 0 for HTTP
+    int64_t t_enq_us;     // esp_timer time of the push
+} cmd_ring_item_t;
+
+typedef struct
+{
+    atomic_uint_fast32_t head; // Next slot to fill, producer side
+    atomic_uint_fast32_t tail; // Next slot to drain, consumer side
+    cmd_ring_item_t items[CMD_RING_LEN];
+} cmd_ring_t;
+
+void cmd_ring_init(cmd_ring_t *r);
+
+// Producer side, false when the ring is full
+bool cmd_ring_push(cmd_ring_t *r, const cmd_ring_item_t *item);
+
+// Consumer side, false when the ring is empty
+bool cmd_ring_pop(cmd_ring_t *r, cmd_ring_item_t *item);
+
+// Items waiting, exact on either side, a snapshot anywhere else
+uint32_t cmd_ring_depth(cmd_ring_t *r);
@@ -0,0 +1,275 @@
+#include <stdbool.h>
+#include <string.h>
+#include "config_store.h"
+#include "dlog.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#define CONFIG_NAMESPACE "evolte"
+#define CONFIG_TASK_STACK 4096
+#define CONFIG_TASK_PRIO 2
+// Failed flash writes in a row before waiting for the next change
+#define CONFIG_COMMIT_TRIES 3
+// Different functions config_store_post can hold
+#define CONFIG_JOBS 4
+
+typedef struct
+{
+    const char *key;
+    const char *def;
+    uint16_t size;
+    uint16_t offset;
+} field_desc_t;
+
+// Cache storage, one member per field
+typedef struct
+{
+#define CONFIG_FIELD(name, key, size, def) char name[size];
+#include "config_fields.def"
+#undef CONFIG_FIELD
+} config_cache_t;
+
+static const field_desc_t fields[CONFIG_FIELD_COUNT] = {
+#define CONFIG_FIELD(name, k, sz, d) \
+    [CONFIG_##name] = {.key = k, .def = d, .size = sz, .offset = offsetof(config_cache_t, name)},
+#include "config_fields.def"
+#undef CONFIG_FIELD
+};
+
+_Static_assert(CONFIG_FIELD_COUNT <= 32, "dirty mask is 32 bits");
+
+static config_cache_t cache;
+static uint32_t loaded;
+static uint32_t dirty;   // Changed, not applied yet
+static uint32_t unsaved; // Applied, not in flash yet
+static uint32_t commits;
+static int fails;
+static nvs_handle_t nvs;
+static bool nvs_ok;
+static SemaphoreHandle_t lock;
+static esp_timer_handle_t commit_timer;
+static config_commit_fn commit_cb;
+
+static portMUX_TYPE job_lock = portMUX_INITIALIZER_UNLOCKED;
+static void (*jobs[CONFIG_JOBS])(void);
+static uint32_t jobs_pending;
+static TaskHandle_t task;
+
+static char *field_val(config_field_t f)
+{
+    return (char *)&cache + fields[f].offset;
+}
+
+// Caller holds lock
+static void field_load(config_field_t f)
+{
+    if (loaded & CONFIG_BIT(f))
+        return;
+    size_t len = fields[f].size;
+    if (!nvs_ok || nvs_get_str(nvs, fields[f].key, field_val(f), &len) != ESP_OK)
+        strcpy(field_val(f), fields[f].def);
+    loaded |= CONFIG_BIT(f);
+}
+
+// Flash writes wait here instead of on the esp_timer task, which every
+// other timer shares
+static void config_task(void *param)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&job_lock);
+        uint32_t pending = jobs_pending;
+        jobs_pending = 0;
+        portEXIT_CRITICAL(&job_lock);
+        for (int i = 0; i < CONFIG_JOBS; i++)
+            if (pending & (1u << i))
+                jobs[i]();
+    }
+}
+
+void config_store_post(void (*fn)(void))
+{
+    portENTER_CRITICAL(&job_lock);
+    int i = 0;
+    while (i < CONFIG_JOBS && jobs[i] != NULL && jobs[i] != fn)
+        i++;
+    if (i < CONFIG_JOBS)
+    {
+        jobs[i] = fn;
+        jobs_pending |= 1u << i;
+    }
+    portEXIT_CRITICAL(&job_lock);
+    xTaskNotifyGive(task);
+}
+
+static void commit_job(void)
+{
+    config_commit();
+}
+
+static void commit_timer_cb(void *arg)
+{
+    config_store_post(commit_job);
+}
+
+void config_store_init(config_commit_fn on_commit)
+{
+    commit_cb = on_commit;
+    loaded = 0;
+    dirty = 0;
+    unsaved = 0;
+    fails = 0;
+    if (lock == NULL)
+        lock = xSemaphoreCreateMutex();
+    nvs_ok = nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK;
+
+    if (commit_timer == NULL)
+    {
+        const esp_timer_create_args_t args = {.callback = commit_timer_cb, .name = "config"};
+        esp_timer_create(&args, &commit_timer);
+        xTaskCreatePinnedToCore(config_task, "config", CONFIG_TASK_STACK, NULL, CONFIG_TASK_PRIO, &task,
+                                tskNO_AFFINITY);
+    }
+}
+
+size_t config_field_size(config_field_t field)
+{
+    return fields[field].size;
+}
+
+void config_get_str(config_field_t field, char *out, size_t cap)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    field_load(field);
+    strncpy(out, field_val(field), cap);
+    out[cap - 1] = '\0';
+    xSemaphoreGive(lock);
+}
+
+// Caller holds lock
+static void arm_commit(void)
+{
+    esp_timer_stop(commit_timer);
+    esp_timer_start_once(commit_timer, (uint64_t)CONFIG_EVOLTE_CONFIG_COMMIT_MS * 1000);
+}
+
+// Caller holds lock. Whoever makes dirty non-zero arms the commit timer,
+// later changes ride along so a burst costs one flash commit. A change
+// after writes gave up tries them again.
+static void mark_dirty(config_field_t field)
+{
+    loaded |= CONFIG_BIT(field);
+    if (dirty == 0)
+    {
+        fails = 0;
+        arm_commit();
+    }
+    dirty |= CONFIG_BIT(field);
+}
+
+esp_err_t config_set_str(config_field_t field, const char *val)
+{
+    size_t len = strlen(val);
+    if (len >= fields[field].size)
+        return ESP_ERR_INVALID_SIZE;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    field_load(field);
+    if (strcmp(field_val(field), val) != 0)
+    {
+        memcpy(field_val(field), val, len + 1);
+        mark_dirty(field);
+    }
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t config_set_part(config_field_t field, size_t off, const uint8_t *data, size_t len)
+{
+    if (off + len >= fields[field].size || memchr(data, '\0', len))
+        return ESP_ERR_INVALID_SIZE;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    field_load(field);
+    char *val = field_val(field);
+    // A piece past the current end would leave a hole
+    if (off > strlen(val))
+    {
+        xSemaphoreGive(lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (memcmp(&val[off], data, len) != 0 || val[off + len] != '\0')
+    {
+        memcpy(&val[off], data, len);
+        val[off + len] = '\0';
+        mark_dirty(field);
+    }
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t config_commit(void)
+{
+    config_cache_t snap;
+    esp_err_t rc = ESP_OK;
+
+    // Copy out under the lock so readers never wait on flash
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t changed = dirty;
+    dirty = 0;
+    unsaved |= changed;
+    uint32_t mask = unsaved;
+    memcpy(&snap, &cache, sizeof(snap));
+    esp_timer_stop(commit_timer);
+    xSemaphoreGive(lock);
+
+    // Settings take effect whether or not flash takes them
+    if (changed && commit_cb)
+        commit_cb(changed);
+    if (mask == 0)
+        return ESP_OK;
+    if (!nvs_ok)
+        return ESP_ERR_INVALID_STATE;
+
+    for (int f = 0; f < CONFIG_FIELD_COUNT && rc == ESP_OK; f++)
+        if (mask & CONFIG_BIT(f))
+            rc = nvs_set_str(nvs, fields[f].key, (char *)&snap + fields[f].offset);
+    if (rc == ESP_OK)
+        rc = nvs_commit(nvs);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (rc != ESP_OK)
+    {
+        // Try again after another delay, along with any change since,
+        // until it looks like flash will not take it
+        if (++fails < CONFIG_COMMIT_TRIES && dirty == 0)
+            arm_commit();
+    }
+    else
+    {
+        unsaved &= ~mask;
+        fails = 0;
+        commits++;
+    }
+    xSemaphoreGive(lock);
+    if (rc != ESP_OK)
+        DLOG(CONFIG_COMMIT_FAILED, rc);
+    else
+        DLOG(CONFIG_COMMIT, mask);
+    return rc;
+}
+
+uint32_t config_dirty_mask(void)
+{
+    return dirty | unsaved;
+}
+
+uint32_t config_commits(void)
+{
+    return commits;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Settings kept in NVS behind a RAM cache. A field is read from flash the
+// first time it is asked for; writes only update the cache and mark the
+// field dirty, and CONFIG_EVOLTE_CONFIG_COMMIT_MS after the first write of
+// a burst the settings task applies every dirty field, then writes them to
+// flash together. A failed write is tried again a few times, and with the
+// next change. Safe to call from any task.
+
+typedef enum
+{
+#define CONFIG_FIELD(name, key, size, def) CONFIG_##name,
+#include "config_fields.def"
+#undef CONFIG_FIELD
+    CONFIG_FIELD_COUNT
+} config_field_t;
+
+#define CONFIG_BIT(field) (1u << (field))
+
+// Called on the settings task with the fields that changed, before they
+// are written to flash, so they apply even when flash cannot take them
+typedef void (*config_commit_fn)(uint32_t changed);
+
+void config_store_init(config_commit_fn on_commit);
+
+// Copy of the cached value, always NUL terminated
+void config_get_str(config_field_t field, char *out, size_t cap);
+
+// Replace the value; ESP_ERR_INVALID_SIZE if it does not fit
+esp_err_t config_set_str(config_field_t field, const char *val);
+
+// Write len bytes at off and end the value there, so a long value can be
+// sent in pieces starting at offset 0
+esp_err_t config_set_part(config_field_t field, size_t off, const uint8_t *data, size_t len);
+
+size_t config_field_size(config_field_t field);
+
+// Apply dirty fields and write them to flash now, from the calling task,
+// instead of waiting for the timer. ESP_ERR_INVALID_STATE without NVS.
+esp_err_t config_commit(void);
+
+// Run fn on the settings task, for other NVS users whose flash writes
+// should not hold up the caller. fn posted again before it ran runs once.
+void config_store_post(void (*fn)(void));
+
+// Fields not in flash yet
+uint32_t config_dirty_mask(void);
+uint32_t config_commits(void);
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "sdkconfig.h"
+#include "ble_session.h"
+#include "conn_policy.h"
+#include "dlog.h"
+
+static conn_policy_stats_t stats;
+static struct ble_npl_callout policy_timer;
+
+static const char *const mode_names[] = {"active", "idle"};
+
+// Whether the link already serves the mode. What counts is how long the
+// peripheral may go without listening, the interval times latency + 1.
+static bool satisfied(const conn_policy_conn_t *c)
+{
+    uint32_t period = (uint32_t)c->itvl * (c->latency + 1);
+    if (c->mode == CONN_POLICY_ACTIVE)
+        return period <= CONN_POLICY_ACTIVE_ITVL_MAX;
+    return period >= CONN_POLICY_IDLE_ITVL_MIN;
+}
+
+static void account(conn_policy_conn_t *c, ble_npl_time_t now)
+{
+    uint32_t ms = ble_npl_time_ticks_to_ms32(now - c->mode_since);
+    if (c->mode == CONN_POLICY_ACTIVE)
+        c->active_ms += ms;
+    else
+        c->idle_ms += ms;
+    c->mode_since = now;
+}
+
+static void set_mode(ble_session_t *s, conn_policy_mode_t mode, ble_npl_time_t now)
+{
+    account(&s->policy, now);
+    s->policy.mode = mode;
+    s->policy.tries = 0;
+    if (mode == CONN_POLICY_IDLE)
+    {
+        stats.relaxed++;
+        DLOG(GAP_CONN_IDLE, s->conn_handle);
+    }
+    else
+    {
+        DLOG(GAP_CONN_ACTIVE, s->conn_handle);
+    }
+}
+
+static void refresh(ble_session_t *s)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(s->conn_handle, &desc) != 0)
+        return;
+    s->policy.itvl = desc.conn_itvl;
+    s->policy.latency = desc.conn_latency;
+    s->policy.timeout = desc.supervision_timeout;
+}
+
+static void request(ble_session_t *s, ble_npl_time_t now)
+{
+    conn_policy_conn_t *c = &s->policy;
+    bool active = c->mode == CONN_POLICY_ACTIVE;
+    struct ble_gap_upd_params params = {
+        .itvl_min = active ? CONN_POLICY_ACTIVE_ITVL_MIN : CONN_POLICY_IDLE_ITVL_MIN,
+        .itvl_max = active ? CONN_POLICY_ACTIVE_ITVL_MAX : CONN_POLICY_IDLE_ITVL_MAX,
+        .latency = active ? 0 : CONN_POLICY_IDLE_LATENCY,
+        .supervision_timeout = active ? CONN_POLICY_ACTIVE_TIMEOUT : CONN_POLICY_IDLE_TIMEOUT,
+    };
+
+    // A request the host cannot start, say during another procedure, still
+    // uses up a try and is retried later
+    c->tries++;
+    c->next_try = now + ble_npl_time_ms_to_ticks32(CONN_POLICY_RETRY_MS);
+    if (ble_gap_update_params(s->conn_handle, &params) == 0)
+    {
+        c->pending = true;
+        stats.requests++;
+    }
+}
+
+// Moves the connection on and returns whether it has a deadline, the idle
+// timeout or a retry, in *due
+static bool check(ble_session_t *s, ble_npl_time_t now, ble_npl_time_t *due)
+{
+    conn_policy_conn_t *c = &s->policy;
+    ble_npl_time_t idle_at = c->last_activity + ble_npl_time_ms_to_ticks32(CONFIG_EVOLTE_CONN_IDLE_S * 1000);
+    if (c->mode == CONN_POLICY_ACTIVE && (ble_npl_stime_t)(now - idle_at) >= 0)
+        set_mode(s, CONN_POLICY_IDLE, now);
+
+    bool has_due = c->mode == CONN_POLICY_ACTIVE;
+    *due = idle_at;
+    if (c->pending || satisfied(c) || c->tries >= CONN_POLICY_TRIES)
+        return has_due;
+
+    if (c->tries == 0 || (ble_npl_stime_t)(now - c->next_try) >= 0)
+    {
+        request(s, now);
+        if (c->pending || c->tries >= CONN_POLICY_TRIES)
+            return has_due;
+    }
+    if (!has_due || (ble_npl_stime_t)(c->next_try - *due) < 0)
+        *due = c->next_try;
+    return true;
+}
+
+// Looks at every connection and arms the timer for the earliest deadline
+static void run(void)
+{
+    ble_npl_time_t now = ble_npl_time_get();
+    ble_npl_time_t next = 0, due;
+    bool rearm = false;
+
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+    {
+        ble_session_t *s = ble_session_at(i);
+        if (s && check(s, now, &due) && (!rearm || (ble_npl_stime_t)(due - next) < 0))
+        {
+            next = due;
+            rearm = true;
+        }
+    }
+
+    if (rearm)
+        ble_npl_callout_reset(&policy_timer, next - now);
+    else
+        ble_npl_callout_stop(&policy_timer);
+}
+
+static void policy_timer_cb(struct ble_npl_event *ev)
+{
+    run();
+}
+
+void conn_policy_init(void)
+{
+    ble_npl_callout_init(&policy_timer, nimble_port_get_dflt_eventq(), policy_timer_cb, NULL);
+}
+
+void conn_policy_open(uint16_t conn_handle)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL)
+        return;
+
+    // A new connection is active: the app connects to do something
+    ble_npl_time_t now = ble_npl_time_get();
+    s->policy.mode = CONN_POLICY_ACTIVE;
+    s->policy.last_activity = now;
+    s->policy.mode_since = now;
+    refresh(s);
+    run();
+}
+
+void conn_policy_conn_update(uint16_t conn_handle, int status)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL)
+        return;
+
+    conn_policy_conn_t *c = &s->policy;
+    bool ours = c->pending;
+    c->pending = false;
+    if (status == 0)
+    {
+        // The central's own change is answered at once, within the tries
+        // left for the mode
+        if (!ours)
+            c->next_try = ble_npl_time_get();
+        refresh(s);
+        c->updates++;
+        stats.updates++;
+        DLOG(GAP_CONN_PARAMS, conn_handle, c->itvl * 1250u, c->latency, c->timeout * 10u);
+    }
+    else
+    {
+        c->refused++;
+        stats.refused++;
+        DLOG(GAP_CONN_REFUSED, conn_handle, status);
+    }
+    run();
+}
+
+void conn_policy_activity(uint16_t conn_handle)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL)
+        return;
+
+    // While active only the time moves; the timer finds the later deadline
+    // when it fires
+    ble_npl_time_t now = ble_npl_time_get();
+    s->policy.last_activity = now;
+    if (s->policy.mode == CONN_POLICY_ACTIVE)
+        return;
+    set_mode(s, CONN_POLICY_ACTIVE, now);
+    run();
+}
+
+const conn_policy_stats_t *conn_policy_stats(void)
+{
+    return &stats;
+}
+
+size_t conn_policy_json(char *buf, size_t cap)
+{
+    ble_npl_time_t now = ble_npl_time_get();
+    size_t n = 0;
+    int rc = snprintf(buf, cap, "{\"idle_s\":%d,\"links\":[", CONFIG_EVOLTE_CONN_IDLE_S);
+    bool first = true;
+    for (int i = 0; rc >= 0 && i <= BLE_SESSION_MAX; i++)
+    {
+        n += (size_t)rc;
+        if (n >= cap)
+            return cap - 1;
+        if (i == BLE_SESSION_MAX)
+        {
+            rc = snprintf(buf + n, cap - n, "]}");
+            continue;
+        }
+        const ble_session_t *s = ble_session_at(i);
+        if (s == NULL)
+        {
+            rc = 0;
+            continue;
+        }
+
+        // Time in the current mode, not yet added up
+        const conn_policy_conn_t *c = &s->policy;
+        uint32_t cur = ble_npl_time_ticks_to_ms32(now - c->mode_since);
+        bool active = c->mode == CONN_POLICY_ACTIVE;
+        rc = snprintf(buf + n, cap - n,
+                      "%s{\"conn\":%u,\"mode\":\"%s\",\"itvl_us\":%lu,\"latency\":%u,\"timeout_ms\":%lu,"
+                      "\"updates\":%lu,\"refused\":%lu,\"active_ms\":%lu,\"idle_ms\":%lu}",
+                      first ? "" : ",", s->conn_handle, mode_names[c->mode], c->itvl * 1250ul, c->latency,
+                      c->timeout * 10ul, (unsigned long)c->updates, (unsigned long)c->refused,
+                      (unsigned long)(c->active_ms + (active ? cur : 0)),
+                      (unsigned long)(c->idle_ms + (active ? 0 : cur)));
+        first = false;
+    }
+    if (rc < 0)
+        return 0;
+    n += (size_t)rc;
+    return n < cap ? n : cap - 1;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nimble/nimble_npl.h"
+
+// Connection parameters by what the peer is doing. A connection that sends
+// commands is kept on short intervals so a command reaches the charger
+// within one of them. One that sent nothing for CONFIG_EVOLTE_CONN_IDLE_S
+// is asked for long intervals with peripheral latency, and the next command
+// asks for short ones again. Commands include the NOPs the app writes while
+// the controls screen is open, so the link stays fast for as long as a user
+// can press a button.
+//
+// The central decides. A refused or clamped request is retried a few times,
+// then left until the mode changes again.
+
+// Intervals in 1.25 ms units, supervision timeouts in 10 ms units
+#define CONN_POLICY_ACTIVE_ITVL_MIN 12 // 15 ms
+#define CONN_POLICY_ACTIVE_ITVL_MAX 24 // 30 ms
+#define CONN_POLICY_ACTIVE_TIMEOUT 400
+#define CONN_POLICY_IDLE_ITVL_MIN 120 // 150 ms
+#define CONN_POLICY_IDLE_ITVL_MAX 240 // 300 ms
+#define CONN_POLICY_IDLE_LATENCY 4
+#define CONN_POLICY_IDLE_TIMEOUT 600
+
+#define CONN_POLICY_RETRY_MS 5000
+#define CONN_POLICY_TRIES 3
+
+typedef enum
+{
+    CONN_POLICY_ACTIVE = 0,
+    CONN_POLICY_IDLE,
+} conn_policy_mode_t;
+
+// Policy state kept in each BLE session
+typedef struct
+{
+    uint8_t mode;
+    bool pending;  // ble_gap_update_params in flight
+    uint8_t tries; // Requests made for the current mode
+    ble_npl_time_t last_activity;
+    ble_npl_time_t next_try;
+    ble_npl_time_t mode_since;
+
+    // Parameters of the link now
+    uint16_t itvl;
+    uint16_t latency;
+    uint16_t timeout;
+
+    uint32_t updates; // Parameter changes, ours or the central's
+    uint32_t refused;
+    uint32_t active_ms; // Time spent in each mode, up to mode_since
+    uint32_t idle_ms;
+} conn_policy_conn_t;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t updates;
+    uint32_t refused;
+    uint32_t relaxed; // Times a connection went idle
+} conn_policy_stats_t;
+
+void conn_policy_init(void);
+
+// Called from BLE_GAP_EVENT_CONNECT, after the session is open, and from
+// BLE_GAP_EVENT_CONN_UPDATE
+void conn_policy_open(uint16_t conn_handle);
+void conn_policy_conn_update(uint16_t conn_handle, int status);
+
+// Called for every accepted write from the peer
+void conn_policy_activity(uint16_t conn_handle);
+
+const conn_policy_stats_t *conn_policy_stats(void);
+
+// GET /diag/ble: mode, parameters and counters of each connection. Read
+// from the server task without locking, so a value may be a moment old.
+size_t conn_policy_json(char *buf, size_t cap);
@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <string.h>
+#include "dlog.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+
+#define DLOG_RING_LEN CONFIG_EVOLTE_DLOG_RING_LEN
+#define DLOG_DRAIN_MS 100
+#define DLOG_TASK_STACK 2048
+#define DLOG_TASK_PRIO 1
+
+_Static_assert((DLOG_RING_LEN & (DLOG_RING_LEN - 1)) == 0, "DLOG_RING_LEN must be a power of two");
+
+typedef struct
+{
+    uint16_t id;
+    uint8_t nargs;
+    uint8_t seq;
+    uint32_t ts_ms;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_rec_t;
+
+// Several tasks log, so the ring is guarded by a spinlock held only for the
+// copy of one record
+static portMUX_TYPE dlog_lock = portMUX_INITIALIZER_UNLOCKED;
+static dlog_rec_t ring[DLOG_RING_LEN];
+MEM_BUDGET_FITS(DLOG_RING, ring);
+static uint32_t head, tail;
+static uint8_t next_seq;
+static uint32_t unreported; // Dropped since the last DROPPED record
+static dlog_stats_t stats;
+static dlog_sink_fn sink;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static size_t rec_encode(const dlog_rec_t *r, uint8_t *out)
+{
+    out[0] = (uint8_t)r->id;
+    out[1] = (uint8_t)(r->id >> 8);
+    out[2] = r->nargs;
+    out[3] = r->seq;
+    put_le32(&out[4], r->ts_ms);
+    for (int i = 0; i < r->nargs; i++)
+        put_le32(&out[DLOG_REC_HDR_LEN + 4 * i], r->args[i]);
+    return DLOG_REC_HDR_LEN + 4 * (size_t)r->nargs;
+}
+
+// One line per record so the decoder can pick them out of a mixed console log
+static void console_sink(const uint8_t *rec, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[sizeof(DLOG_LINE_PREFIX) + 2 * DLOG_REC_MAX_LEN + 1];
+    size_t n = strlen(DLOG_LINE_PREFIX);
+
+    memcpy(line, DLOG_LINE_PREFIX, n);
+    for (size_t i = 0; i < len; i++)
+    {
+        line[n++] = hex[rec[i] >> 4];
+        line[n++] = hex[rec[i] & 0x0F];
+    }
+    line[n++] = '\n';
+    line[n] = '\0';
+    esp_rom_printf("%s", line);
+}
+
+// Caller holds dlog_lock
+static bool ring_put(uint16_t id, const uint32_t *args, uint8_t nargs)
+{
+    if (head - tail == DLOG_RING_LEN)
+        return false;
+    dlog_rec_t *r = &ring[head % DLOG_RING_LEN];
+    r->id = id;
+    r->nargs = nargs;
+    r->seq = next_seq++;
+    r->ts_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    memcpy(r->args, args, 4 * (size_t)nargs);
+    head++;
+    stats.written++;
+    return true;
+}
+
+void dlog_write(dlog_id_t id, const uint32_t *args, uint8_t nargs)
+{
+    portENTER_CRITICAL(&dlog_lock);
+    // Report earlier losses first so the decoded log shows where the gap is
+    if (unreported && ring_put(DLOG_DROPPED, &unreported, 1))
+        unreported = 0;
+    if (unreported || !ring_put((uint16_t)id, args, nargs))
+    {
+        unreported++;
+        stats.dropped++;
+    }
+    portEXIT_CRITICAL(&dlog_lock);
+}
+
+int dlog_drain(void)
+{
+    uint8_t buf[DLOG_REC_MAX_LEN];
+    dlog_rec_t rec;
+    int n = 0;
+
+    for (;;)
+    {
+        portENTER_CRITICAL(&dlog_lock);
+        bool have = tail != head;
+        if (have)
+            rec = ring[tail++ % DLOG_RING_LEN];
+        portEXIT_CRITICAL(&dlog_lock);
+        if (!have)
+            break;
+
+        size_t len = rec_encode(&rec, buf);
+        (sink ? sink : console_sink)(buf, len);
+        stats.drained++;
+        n++;
+    }
+    return n;
+}
+
+static void dlog_task(void *param)
+{
+    mem_budget_guard();
+    for (;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+        dlog_drain();
+    }
+}
+
+void dlog_init(void)
+{
+    xTaskCreatePinnedToCore(dlog_task, "dlog", DLOG_TASK_STACK, NULL, DLOG_TASK_PRIO, NULL, tskNO_AFFINITY);
+}
+
+void dlog_set_sink(dlog_sink_fn fn)
+{
+    sink = fn;
+}
+
+const dlog_stats_t *dlog_stats(void)
+{
+    return &stats;
+}
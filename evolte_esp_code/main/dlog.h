@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Deferred binary log. A call site stores a format ID and its raw integer
+// arguments into a RAM ring; a low-priority task drains the ring to the
+// console as hex lines, and host/tools/dlog_decode turns them back into text.
+// Statements below CONFIG_EVOLTE_DLOG_LEVEL compile out entirely.
+//
+//   DLOG(GAP_MTU, mtu, conn_handle);
+//
+// Formats live in dlog_fmt.def.
+
+#define DLOG_LEVEL_NONE 0
+#define DLOG_LEVEL_ERROR 1
+#define DLOG_LEVEL_WARN 2
+#define DLOG_LEVEL_INFO 3
+#define DLOG_LEVEL_DEBUG 4
+#define DLOG_LEVEL_VERBOSE 5
+
+#define DLOG_MAX_ARGS 4
+
+// Console line prefix of a drained record
+#define DLOG_LINE_PREFIX "DL:"
+
+typedef enum
+{
+#define DLOG_FMT(name, level, tag, fmt) DLOG_##name,
+#include "dlog_fmt.def"
+#undef DLOG_FMT
+    DLOG_FMT_COUNT
+} dlog_id_t;
+
+enum
+{
+#define DLOG_FMT(name, level, tag, fmt) DLOG_LVL_##name = level,
+#include "dlog_fmt.def"
+#undef DLOG_FMT
+};
+
+// Wire format of a drained record, little-endian:
+//   0 id (u16)  2 nargs (u8)  3 seq (u8)  4 time ms (u32)  8 args (u32 each)
+#define DLOG_REC_HDR_LEN 8
+#define DLOG_REC_MAX_LEN (DLOG_REC_HDR_LEN + 4 * DLOG_MAX_ARGS)
+
+typedef struct
+{
+    uint32_t written; // Records stored in the ring
+    uint32_t dropped; // Records lost because the ring was full
+    uint32_t drained; // Records handed to the sink
+} dlog_stats_t;
+
+// Receives one encoded record at a time from the drain task
+typedef void (*dlog_sink_fn)(const uint8_t *rec, size_t len);
+
+void dlog_init(void);
+
+// Replace the console sink, NULL restores it
+void dlog_set_sink(dlog_sink_fn sink);
+
+// Hand every stored record to the sink, returns how many there were.
+// Called by the drain task; safe from any task.
+int dlog_drain(void);
+
+void dlog_write(dlog_id_t id, const uint32_t *args, uint8_t nargs);
+const dlog_stats_t *dlog_stats(void);
+
+#define DLOG(name, ...)                                                             \
+    do                                                                              \
+    {                                                                               \
+        if (DLOG_LVL_##name <= CONFIG_EVOLTE_DLOG_LEVEL)                            \
+        {                                                                           \
+            const uint32_t dlog_args_[] = {0, ##__VA_ARGS__};                       \
+            _Static_assert(sizeof(dlog_args_) / 4 - 1 <= DLOG_MAX_ARGS,             \
+                           "Too many DLOG arguments");                              \
+            dlog_write(DLOG_##name, &dlog_args_[1], sizeof(dlog_args_) / 4 - 1);    \
+        }                                                                           \
+    } while (0)
@@ -0,0 +1,520 @@
+#include <string.h>
+#include "dlog.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "evlog.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+#include "sdkconfig.h"
+
+#define EVLOG_LABEL "evlog"
+#define EVLOG_SECTOR 4096
+#define EVLOG_MAX_SECTORS 256
+#define EVLOG_MAGIC 0x314C5645 // "EVL1"
+#define EVLOG_HDR_LEN 13
+#define EVLOG_REC_MAX (EVLOG_PACK_MAX + 1) // And the CRC
+#define EVLOG_QUEUE_LEN CONFIG_EVOLTE_EVLOG_QUEUE_LEN
+#define EVLOG_TASK_STACK 3072
+#define EVLOG_TASK_PRIO 2
+
+// Fields each record type carries after the time delta
+#define F_CHANNEL 0x1
+#define F_ENERGY 0x2
+#define F_POWER 0x4
+#define F_FLAGS 0x8
+
+static const uint8_t type_fields[EVLOG_TYPE_COUNT] = {
+    [EVLOG_BOOT] = F_FLAGS,
+    [EVLOG_SESSION_START] = F_CHANNEL,
+    [EVLOG_SESSION_STOP] = F_CHANNEL | F_ENERGY,
+    [EVLOG_ENERGY] = F_CHANNEL | F_ENERGY | F_POWER,
+    [EVLOG_FAULT] = F_FLAGS,
+};
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t base_ts;
+    bool valid;
+} sector_t;
+
+static const esp_partition_t *part;
+static SemaphoreHandle_t lock; // Flash, index and head
+static sector_t sect[EVLOG_MAX_SECTORS];
+MEM_BUDGET_FITS(EVLOG_INDEX, sect);
+static uint32_t n_sectors;
+static int head = -1; // Sector being appended to, -1 if none yet
+static uint32_t head_off;
+static uint32_t last_ts;
+static bool sealed; // Head has a torn tail, start a new sector
+static uint32_t boot_base;
+static uint8_t sector_buf[EVLOG_SECTOR];
+MEM_BUDGET_FITS(EVLOG_SECTOR, sector_buf);
+
+// Records waiting for the task, several tasks append
+static portMUX_TYPE queue_lock = portMUX_INITIALIZER_UNLOCKED;
+static evlog_rec_t queue[EVLOG_QUEUE_LEN];
+MEM_BUDGET_FITS(EVLOG_QUEUE, queue);
+static uint32_t q_head, q_tail;
+static TaskHandle_t task;
+static void (*call_fn)(void);
+static evlog_stats_t stats;
+
+// ---- Encoding ----
+
+// Never 0xFF, so a record whose last byte was not programmed cannot pass
+static uint8_t crc8(const uint8_t *p, size_t len)
+{
+    uint8_t c = 0;
+    while (len--)
+    {
+        c ^= *p++;
+        for (int i = 0; i < 8; i++)
+            c = c & 0x80 ? (uint8_t)(c << 1 ^ 0x07) : (uint8_t)(c << 1);
+    }
+    return c == 0xFF ? 0xFE : c;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// -1 if it runs past end or is longer than 5 bytes
+static int get_varint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+    uint32_t r = 0;
+    for (int i = 0; i < 5 && p + i < end; i++)
+    {
+        r |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80))
+        {
+            *v = r;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+size_t evlog_pack(const evlog_rec_t *rec, uint32_t prev_ts, uint8_t *out)
+{
+    uint8_t f = type_fields[rec->type];
+    size_t n = 1;
+    n += put_varint(&out[n], rec->ts - prev_ts);
+    if (f & F_CHANNEL)
+        out[n++] = rec->channel;
+    if (f & F_ENERGY)
+        n += put_varint(&out[n], rec->energy_wh);
+    if (f & F_POWER)
+        n += put_varint(&out[n], (uint32_t)(rec->power_w << 1) ^ (uint32_t)(rec->power_w >> 31));
+    if (f & F_FLAGS)
+        n += put_varint(&out[n], rec->flags);
+    out[0] = (uint8_t)(rec->type << 4 | (n - 2)); // Never empty, the delta is always there
+    return n;
+}
+
+int evlog_unpack(const uint8_t *p, size_t avail, uint32_t prev_ts, evlog_rec_t *rec)
+{
+    if (avail < 2)
+        return -1;
+    uint8_t type = p[0] >> 4;
+    size_t len = (p[0] & 0x0F) + 1;
+    if (type == 0 || type >= EVLOG_TYPE_COUNT || len + 1 > avail)
+        return -1;
+
+    const uint8_t *q = p + 1, *end = p + 1 + len;
+    uint8_t f = type_fields[type];
+    uint32_t v;
+    int n;
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+#define FIELD(expr)                        \
+    if ((n = get_varint(q, end, &v)) < 0) \
+        return -1;                         \
+    q += n;                                \
+    expr;
+    FIELD(rec->ts = prev_ts + v)
+    if (f & F_CHANNEL)
+    {
+        if (q == end)
+            return -1;
+        rec->channel = *q++;
+    }
+    if (f & F_ENERGY)
+    {
+        FIELD(rec->energy_wh = v)
+    }
+    if (f & F_POWER)
+    {
+        FIELD(rec->power_w = (int32_t)(v >> 1) ^ -(int32_t)(v & 1))
+    }
+    if (f & F_FLAGS)
+    {
+        FIELD(rec->flags = v)
+    }
+#undef FIELD
+    return q == end ? (int)len + 1 : -1;
+}
+
+// Packed record and its CRC
+static size_t rec_encode(const evlog_rec_t *rec, uint32_t prev_ts, uint8_t *out)
+{
+    size_t n = evlog_pack(rec, prev_ts, out);
+    out[n] = crc8(out, n);
+    return n + 1;
+}
+
+// Length of the record at p, -1 if there is none: erased, torn or corrupt
+static int rec_decode(const uint8_t *p, size_t avail, uint32_t prev_ts, evlog_rec_t *rec)
+{
+    if (avail < 2)
+        return -1;
+    size_t len = (p[0] & 0x0F) + 2;
+    if (len + 1 > avail || crc8(p, len) != p[len] || evlog_unpack(p, len, prev_ts, rec) != (int)len)
+        return -1;
+    return (int)len + 1;
+}
+
+// ---- Sectors ----
+
+static size_t sector_addr(uint32_t s)
+{
+    return (size_t)s * EVLOG_SECTOR;
+}
+
+static bool hdr_read(uint32_t s, sector_t *out)
+{
+    uint8_t h[EVLOG_HDR_LEN];
+    uint32_t magic;
+    out->valid = false;
+    if (esp_partition_read(part, sector_addr(s), h, sizeof(h)) != ESP_OK)
+        return false;
+    memcpy(&magic, &h[0], 4);
+    if (magic != EVLOG_MAGIC || crc8(h, EVLOG_HDR_LEN - 1) != h[EVLOG_HDR_LEN - 1])
+        return false;
+    memcpy(&out->seq, &h[4], 4);
+    memcpy(&out->base_ts, &h[8], 4);
+    out->valid = true;
+    return true;
+}
+
+// Sector holding seq, -1 if it was overwritten or never written
+static int sector_of(uint32_t seq)
+{
+    if (head < 0 || (int32_t)(sect[head].seq - seq) < 0 || sect[head].seq - seq >= n_sectors)
+        return -1;
+    int s = (int)((head + n_sectors - (sect[head].seq - seq)) % n_sectors);
+    return sect[s].valid && sect[s].seq == seq ? s : -1;
+}
+
+// Oldest sequence number still held
+static uint32_t oldest_seq(void)
+{
+    for (uint32_t i = 1; i <= n_sectors; i++)
+    {
+        uint32_t s = (head + i) % n_sectors;
+        if (sect[s].valid)
+            return sect[s].seq;
+    }
+    return sect[head].seq;
+}
+
+// Caller holds lock. Erases the next sector of the ring, dropping the
+// oldest records once the ring is full.
+static bool sector_open(uint32_t ts)
+{
+    uint32_t s = head < 0 ? 0 : (head + 1) % n_sectors;
+    uint32_t seq = head < 0 ? 1 : sect[head].seq + 1;
+    if (sect[s].valid)
+    {
+        stats.sectors_lost++;
+        stats.sectors_used--;
+    }
+    sect[s].valid = false;
+    if (esp_partition_erase_range(part, sector_addr(s), EVLOG_SECTOR) != ESP_OK)
+        return false;
+    stats.erases++;
+
+    uint8_t h[EVLOG_HDR_LEN];
+    uint32_t magic = EVLOG_MAGIC;
+    memcpy(&h[0], &magic, 4);
+    memcpy(&h[4], &seq, 4);
+    memcpy(&h[8], &ts, 4);
+    h[EVLOG_HDR_LEN - 1] = crc8(h, EVLOG_HDR_LEN - 1);
+    if (esp_partition_write(part, sector_addr(s), h, sizeof(h)) != ESP_OK)
+        return false;
+
+    sect[s] = (sector_t){.seq = seq, .base_ts = ts, .valid = true};
+    stats.sectors_used++;
+    head = (int)s;
+    head_off = EVLOG_HDR_LEN;
+    last_ts = ts;
+    sealed = false;
+    return true;
+}
+
+// Caller holds lock
+static void rec_write(evlog_rec_t *rec)
+{
+    uint8_t buf[EVLOG_REC_MAX];
+    if (rec->ts < last_ts)
+        rec->ts = last_ts; // Keeps deltas unsigned
+    size_t len = rec_encode(rec, last_ts, buf);
+
+    if (head < 0 || sealed || head_off + len > EVLOG_SECTOR)
+    {
+        if (!sector_open(rec->ts))
+        {
+            stats.write_errors++;
+            sealed = true;
+            return;
+        }
+        len = rec_encode(rec, last_ts, buf);
+    }
+    if (esp_partition_write(part, sector_addr(head) + head_off, buf, len) != ESP_OK)
+    {
+        stats.write_errors++;
+        sealed = true;
+        return;
+    }
+    head_off += len;
+    last_ts = rec->ts;
+    stats.written++;
+}
+
+// ---- Mount ----
+
+// Caller holds lock. Finds the newest sector, then the end of its records.
+static void mount(void)
+{
+    head = -1;
+    sealed = false;
+    last_ts = 0;
+    for (uint32_t s = 0; s < n_sectors; s++)
+        if (hdr_read(s, &sect[s]))
+        {
+            stats.sectors_used++;
+            if (head < 0 || (int32_t)(sect[s].seq - sect[head].seq) > 0)
+                head = (int)s;
+        }
+    if (head < 0)
+        return;
+
+    esp_partition_read(part, sector_addr(head), sector_buf, EVLOG_SECTOR);
+    uint32_t off = EVLOG_HDR_LEN, ts = sect[head].base_ts;
+    evlog_rec_t rec;
+    int n;
+    while ((n = rec_decode(&sector_buf[off], EVLOG_SECTOR - off, ts, &rec)) > 0)
+    {
+        off += (uint32_t)n;
+        ts = rec.ts;
+    }
+    head_off = off;
+    last_ts = ts;
+    // Anything but erased flash after the last good record is a torn write,
+    // which cannot be written over
+    for (uint32_t i = off; i < EVLOG_SECTOR && !sealed; i++)
+        if (sector_buf[i] != 0xFF)
+            sealed = true;
+    if (sealed)
+        stats.torn++;
+}
+
+static void drain(void)
+{
+    for (;;)
+    {
+        evlog_rec_t rec;
+        portENTER_CRITICAL(&queue_lock);
+        bool have = q_tail != q_head;
+        if (have)
+            rec = queue[q_tail++ % EVLOG_QUEUE_LEN];
+        portEXIT_CRITICAL(&queue_lock);
+        if (!have)
+            break;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        rec_write(&rec);
+        xSemaphoreGive(lock);
+    }
+}
+
+static void evlog_task(void *param)
+{
+    mem_budget_guard();
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        drain();
+        void (*fn)(void) = __atomic_exchange_n(&call_fn, NULL, __ATOMIC_ACQ_REL);
+        if (fn)
+            fn();
+    }
+}
+
+void evlog_init(void)
+{
+    if (lock == NULL)
+        lock = xSemaphoreCreateMutex();
+    q_head = q_tail = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, EVLOG_LABEL);
+    if (part == NULL)
+    {
+        DLOG(EVLOG_NO_PARTITION);
+        return;
+    }
+    n_sectors = part->size / EVLOG_SECTOR;
+    if (n_sectors > EVLOG_MAX_SECTORS)
+        n_sectors = EVLOG_MAX_SECTORS;
+    stats.sectors = n_sectors;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    mount();
+    boot_base = last_ts - (uint32_t)(esp_timer_get_time() / 1000000);
+    xSemaphoreGive(lock);
+    DLOG(EVLOG_MOUNT, head < 0 ? 0 : sect[head].seq, head_off);
+
+    if (task == NULL)
+        xTaskCreatePinnedToCore(evlog_task, "evlog", EVLOG_TASK_STACK, NULL, EVLOG_TASK_PRIO, &task, tskNO_AFFINITY);
+    evlog_append(&(evlog_rec_t){.type = EVLOG_BOOT, .flags = (uint32_t)esp_reset_reason()});
+}
+
+uint32_t evlog_now(void)
+{
+    return boot_base + (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+void evlog_append(const evlog_rec_t *rec)
+{
+    if (part == NULL || rec->type == 0 || rec->type >= EVLOG_TYPE_COUNT)
+    {
+        stats.dropped++;
+        return;
+    }
+    bool ok;
+    portENTER_CRITICAL(&queue_lock);
+    ok = q_head - q_tail < EVLOG_QUEUE_LEN;
+    if (ok)
+    {
+        evlog_rec_t *q = &queue[q_head++ % EVLOG_QUEUE_LEN];
+        *q = *rec;
+        if (q->ts == 0)
+            q->ts = evlog_now();
+        stats.appended++;
+    }
+    else
+        stats.dropped++;
+    portEXIT_CRITICAL(&queue_lock);
+    if (ok && task)
+        xTaskNotifyGive(task);
+}
+
+void evlog_sync(void)
+{
+    if (part != NULL)
+        drain();
+}
+
+void evlog_call(void (*fn)(void))
+{
+    if (task == NULL)
+    {
+        fn(); // No partition: reads end at once without the lock
+        return;
+    }
+    __atomic_store_n(&call_fn, fn, __ATOMIC_RELEASE);
+    xTaskNotifyGive(task);
+}
+
+// ---- Queries ----
+
+void evlog_seek(evlog_cursor_t *c, uint32_t from_ts)
+{
+    memset(c, 0, sizeof(*c));
+    c->from = from_ts;
+    if (part == NULL)
+        return;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (head >= 0)
+    {
+        // Newest sector starting at or before from_ts, else the oldest; the
+        // index is in ring order, oldest just after head
+        c->seq = oldest_seq();
+        for (uint32_t i = 1; i <= n_sectors; i++)
+        {
+            const sector_t *s = &sect[(head + i) % n_sectors];
+            if (s->valid && s->base_ts <= from_ts)
+                c->seq = s->seq;
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+bool evlog_next(evlog_cursor_t *c, evlog_rec_t *rec)
+{
+    if (part == NULL)
+        return false;
+    bool found = false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    while (head >= 0 && !found)
+    {
+        int s = sector_of(c->seq);
+        if (s < 0)
+        {
+            // Overwritten since the cursor was placed, or a gap left by a
+            // failed erase: carry on with what is still there
+            uint32_t oldest = oldest_seq();
+            if ((int32_t)(c->seq - oldest) < 0)
+                c->seq = oldest;
+            else if (c->seq != sect[head].seq)
+                c->seq++;
+            else
+                break;
+            c->off = 0;
+            continue;
+        }
+        if (c->off == 0)
+        {
+            c->off = EVLOG_HDR_LEN;
+            c->ts = sect[s].base_ts;
+        }
+
+        uint8_t buf[EVLOG_REC_MAX];
+        size_t avail = EVLOG_SECTOR - c->off < sizeof(buf) ? EVLOG_SECTOR - c->off : sizeof(buf);
+        int n = -1;
+        if (s == head && c->off >= head_off)
+            n = -1; // Caught up with the writer
+        else if (esp_partition_read(part, sector_addr(s) + c->off, buf, avail) == ESP_OK)
+            n = rec_decode(buf, avail, c->ts, rec);
+
+        if (n < 0)
+        {
+            if (s == head)
+                break;
+            c->seq++;
+            c->off = 0;
+            continue;
+        }
+        c->off += (uint16_t)n;
+        c->ts = rec->ts;
+        found = rec->ts >= c->from;
+    }
+    xSemaphoreGive(lock);
+    return found;
+}
+
+const evlog_stats_t *evlog_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only charge session log on the "evlog" flash partition.
+//
+// The partition is a ring of sectors, written in order and erased one at a
+// time when the ring wraps, so every sector wears at the same rate. Each
+// sector starts with a header (magic, sequence number, time of its first
+// record, CRC) followed by records:
+//
+//   hdr    type << 4 | payload length - 1
+//   ...    payload: varints, the time as a delta from the previous record
+//          in the sector, then the fields the type carries (a channel is
+//          one byte)
+//   crc8   over hdr and payload
+//
+// A sector decodes on its own, and an erased byte (0xFF) or a bad CRC ends
+// it, so a record torn by power loss is dropped at the next boot along with
+// nothing else. Sector headers are indexed in RAM, so a time range query
+// finds its first sector without touching flash and reads only from there.
+//
+// Times are log seconds: uptime plus the last logged time before this boot,
+// so they only go forward across reboots but do not count time powered off.
+
+typedef enum
+{
+    EVLOG_BOOT = 1,      // flags: esp_reset_reason()
+    EVLOG_SESSION_START, // channel
+    EVLOG_SESSION_STOP,  // channel, energy_wh of the session
+    EVLOG_ENERGY,        // channel, energy_wh since the last record, power_w
+    EVLOG_FAULT,         // flags: CHARGER_ERR_* that appeared
+    EVLOG_TYPE_COUNT
+} evlog_type_t;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t channel;
+    uint32_t ts;
+    uint32_t energy_wh;
+    int32_t power_w;
+    uint32_t flags;
+} evlog_rec_t;
+
+// Position in the log for evlog_next
+typedef struct
+{
+    uint32_t seq; // Sector sequence number
+    uint16_t off; // Next record in the sector, 0 before its first
+    uint32_t ts;  // Time of the record before off
+    uint32_t from;
+} evlog_cursor_t;
+
+typedef struct
+{
+    uint32_t appended;       // Records accepted by evlog_append
+    uint32_t written;        // Records that reached flash
+    uint32_t dropped;        // Queue full or no partition
+    uint32_t erases;         // Sectors erased, each a full lap of one sector
+    uint32_t sectors_lost;   // Sectors of old records given up to the ring
+    uint32_t write_errors;
+    uint32_t torn;           // Torn records found at mount
+    uint32_t sectors;        // Sectors in the partition
+    uint32_t sectors_used;
+} evlog_stats_t;
+
+// Mount the partition, rebuild the index and log a BOOT record. Safe to
+// call again to remount, as after a simulated power cut on the host.
+void evlog_init(void);
+
+// Queue a record for the evlog task to write. Never blocks. A ts of 0 is
+// stamped with the current log time; times going backwards are clamped.
+void evlog_append(const evlog_rec_t *rec);
+// Write whatever is queued now, from the calling task
+void evlog_sync(void);
+// Run fn on the evlog task once the queue is written, for readers that must
+// not wait on the log lock, which an erase holds for a sector's time. Calls
+// requested before fn starts are served by one run; one fn at a time.
+void evlog_call(void (*fn)(void));
+
+uint32_t evlog_now(void);
+
+// Position c at the first record at or after from_ts
+void evlog_seek(evlog_cursor_t *c, uint32_t from_ts);
+// Next record, false at the end of the log. A cursor left at the end picks
+// up records appended later; one that fell behind the ring skips to the
+// oldest record still held.
+bool evlog_next(evlog_cursor_t *c, evlog_rec_t *rec);
+
+const evlog_stats_t *evlog_stats(void);
+
+// A record without its CRC, as stored and as sent by history transfers.
+// Times are a delta from prev_ts. Unpack returns the length taken, -1 if p
+// does not hold a whole record.
+#define EVLOG_PACK_MAX 17
+size_t evlog_pack(const evlog_rec_t *rec, uint32_t prev_ts, uint8_t *out);
+int evlog_unpack(const uint8_t *p, size_t avail, uint32_t prev_ts, evlog_rec_t *rec);
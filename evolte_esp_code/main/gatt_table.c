@@ -0,0 +1,116 @@
+#include "conn_policy.h"
+#include "gatt_table.h"
+#include "mem_budget.h"
+#include "perf.h"
+#include "sdkconfig.h"
+
+uint16_t gatt_val_handles[GATT_CHR_COUNT];
+
+int gatt_no_read(uint16_t conn_handle, struct os_mbuf *om)
+{
+    return BLE_ATT_ERR_READ_NOT_PERMITTED;
+}
+
+int gatt_no_write(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+}
+
+// Inlined into each access callback, so rd and wr are direct calls
+static inline int gatt_dispatch(uint16_t conn_handle, struct ble_gatt_access_ctxt *ctxt, gatt_read_fn *rd,
+                                gatt_write_fn *wr)
+{
+    int64_t start = perf_now();
+    switch (ctxt->op)
+    {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+    {
+        int rc = rd(conn_handle, ctxt->om);
+        perf_record(PERF_GATT_READ, start);
+        return rc;
+    }
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+    {
+        struct os_mbuf *om = ctxt->om;
+        const uint8_t *data = om->om_data;
+        uint16_t len = om->om_len;
+        uint8_t *flat = NULL;
+
+        // Long writes can arrive as a chained mbuf, only then flatten it
+        if (OS_MBUF_PKTLEN(om) != om->om_len)
+        {
+            flat = mem_pool_get(MEM_POOL_ATT);
+            if (flat == NULL)
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            if (ble_hs_mbuf_to_flat(om, flat, MEM_POOL_BLOCK_ATT, &len) != 0)
+            {
+                mem_pool_put(MEM_POOL_ATT, flat);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            data = flat;
+        }
+        // Any write the peer gets through counts as use of the link
+        int rc = wr(conn_handle, data, len);
+        mem_pool_put(MEM_POOL_ATT, flat);
+        if (rc == 0)
+            conn_policy_activity(conn_handle);
+        perf_record(PERF_GATT_WRITE, start);
+        return rc;
+    }
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+#define GATT_SVC(name, uuid16)
+#define GATT_CHR(name, uuid16, flags, rd, wr)                                                         \
+    static int gatt_access_##name(uint16_t conn_handle, uint16_t attr_handle,                        \
+                                  struct ble_gatt_access_ctxt *ctxt, void *arg)                      \
+    {                                                                                                \
+        return gatt_dispatch(conn_handle, ctxt, rd, wr);                                             \
+    }
+#define GATT_SVC_END(name)
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+
+// Every service's characteristics and terminator in one array, a service's
+// first slot continues the numbering where the previous terminator left off
+enum
+{
+#define GATT_SVC(name, uuid16) GATT_SLOT_##name##_FIRST, GATT_SLOT_##name##_HEAD = GATT_SLOT_##name##_FIRST - 1,
+#define GATT_CHR(name, uuid16, flags, rd, wr) GATT_SLOT_##name,
+#define GATT_SVC_END(name) GATT_SLOT_##name##_END,
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+};
+
+static const struct ble_gatt_chr_def gatt_chrs[] = {
+#define GATT_SVC(name, uuid16)
+#define GATT_CHR(name, uuid16, chr_flags, rd, wr)          \
+    [GATT_SLOT_##name] = {.uuid = BLE_UUID16_DECLARE(uuid16), \
+                          .flags = chr_flags,                 \
+                          .access_cb = gatt_access_##name,    \
+                          .val_handle = &gatt_val_handles[GATT_CHR_##name]},
+#define GATT_SVC_END(name) [GATT_SLOT_##name##_END] = {0},
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+};
+
+const struct ble_gatt_svc_def gatt_svcs[] = {
+#define GATT_SVC(name, uuid16)                       \
+    {.type = BLE_GATT_SVC_TYPE_PRIMARY,              \
+     .uuid = BLE_UUID16_DECLARE(uuid16),             \
+     .characteristics = &gatt_chrs[GATT_SLOT_##name##_FIRST]},
+#define GATT_CHR(name, uuid16, flags, rd, wr)
+#define GATT_SVC_END(name)
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+    {0}};
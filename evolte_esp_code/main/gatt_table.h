@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include "host/ble_hs.h"
+
+// The GATT table built from gatt_schema.def. Each characteristic gets its own
+// access callback that calls its handlers directly, writes arrive flattened.
+
+typedef int gatt_read_fn(uint16_t conn_handle, struct os_mbuf *om);
+typedef int gatt_write_fn(uint16_t conn_handle, const uint8_t *data, uint16_t len);
+
+typedef enum
+{
+#define GATT_SVC(name, uuid16)
+#define GATT_CHR(name, uuid16, flags, rd, wr) GATT_CHR_##name,
+#define GATT_SVC_END(name)
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+    GATT_CHR_COUNT
+} gatt_chr_t;
+
+// Prototypes of every handler the schema names
+#define GATT_SVC(name, uuid16)
+#define GATT_CHR(name, uuid16, flags, rd, wr) gatt_read_fn rd; gatt_write_fn wr;
+#define GATT_SVC_END(name)
+#include "gatt_schema.def"
+#undef GATT_SVC
+#undef GATT_CHR
+#undef GATT_SVC_END
+
+gatt_read_fn gatt_no_read;
+gatt_write_fn gatt_no_write;
+
+extern const struct ble_gatt_svc_def gatt_svcs[];
+
+// Value handles, filled in when the table is registered
+extern uint16_t gatt_val_handles[GATT_CHR_COUNT];
@@ -0,0 +1,330 @@
+#include <string.h>
+#include "ble_session.h"
+#include "dlog.h"
+#include "evlog.h"
+#include "freertos/FreeRTOS.h"
+#include "gatt_table.h"
+#include "history_xfer.h"
+#include "host/ble_hs.h"
+#include "mem_budget.h"
+#include "nimble/nimble_port.h"
+
+// Left for status notifications and incoming writes
+#define HISTORY_MBUF_RESERVE 4
+// Shortest MTU whose chunk fits the largest record
+#define HISTORY_MIN_MTU (3 + HISTORY_CHUNK_HDR_LEN + EVLOG_PACK_MAX + 4)
+#define HISTORY_CHUNK_MAX BLE_ATT_ATTR_MAX_LEN
+
+// The log side of a session's transfer, by session slot. The host task
+// hands a transfer over with gen and open, the evlog task hands a chunk
+// back with ready; chunk belongs to whichever side ready says.
+typedef struct
+{
+    uint32_t gen; // Transfer to read, 0 for none
+    bool open;    // Seek and skip to the resume point first
+    bool ready;
+    uint32_t from_ts;
+    uint32_t resume;
+    uint16_t cap;
+    uint16_t len;
+    uint32_t end_index; // resume plus records sent once chunk is
+    // evlog task only
+    bool have_rec; // rec was read from the log but did not fit the last chunk
+    uint32_t index;
+    evlog_cursor_t cur;
+    evlog_rec_t rec;
+    uint8_t chunk[HISTORY_CHUNK_MAX];
+} reader_t;
+
+static portMUX_TYPE reader_lock = portMUX_INITIALIZER_UNLOCKED;
+static reader_t readers[BLE_SESSION_MAX];
+MEM_BUDGET_FITS(HISTORY_READERS, readers);
+static uint32_t last_gen;
+
+static const uint16_t *history_handle;
+static struct ble_npl_callout pump_timer;
+static struct ble_npl_event ready_ev;
+static history_stats_t stats;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ---- evlog task ----
+
+// Fill the reader's chunk from the log, returns its length. An END chunk
+// leaves its last 4 bytes for the time, stamped when it goes out.
+static size_t chunk_build(reader_t *r, size_t cap)
+{
+    uint8_t *buf = r->chunk;
+    size_t n = HISTORY_CHUNK_HDR_LEN;
+    cap -= 4;
+    uint32_t first = r->index;
+    uint32_t base_ts = 0, prev_ts = 0;
+    uint8_t flags = 0;
+
+    for (;;)
+    {
+        if (!r->have_rec && !(r->have_rec = evlog_next(&r->cur, &r->rec)))
+        {
+            flags |= HISTORY_END;
+            break;
+        }
+        if (n == HISTORY_CHUNK_HDR_LEN)
+            base_ts = prev_ts = r->rec.ts;
+        uint8_t rec[EVLOG_PACK_MAX];
+        size_t len = evlog_pack(&r->rec, prev_ts, rec);
+        if (n + len > cap)
+            break;
+        memcpy(&buf[n], rec, len);
+        n += len;
+        prev_ts = r->rec.ts;
+        r->have_rec = false;
+        r->index++;
+    }
+    put_le32(&buf[0], first);
+    put_le32(&buf[4], base_ts);
+    buf[8] = flags;
+    return flags & HISTORY_END ? n + 4 : n;
+}
+
+// Build the next chunk of every transfer that has none waiting
+static void read_chunks(void)
+{
+    bool built = false;
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+    {
+        reader_t *r = &readers[i];
+        portENTER_CRITICAL(&reader_lock);
+        uint32_t gen = r->gen;
+        bool need = gen != 0 && !r->ready;
+        bool open = need && r->open;
+        uint32_t from_ts = r->from_ts, resume = r->resume;
+        uint16_t cap = r->cap;
+        if (open)
+            r->open = false;
+        portEXIT_CRITICAL(&reader_lock);
+        if (!need)
+            continue;
+
+        if (open)
+        {
+            // Only records at from_ts are skipped: with from_ts itself
+            // reclaimed the oldest record left goes out
+            evlog_seek(&r->cur, from_ts);
+            r->index = resume;
+            r->have_rec = false;
+            while (resume > 0 && (r->have_rec = evlog_next(&r->cur, &r->rec)) && r->rec.ts == from_ts)
+            {
+                r->have_rec = false;
+                resume--;
+            }
+        }
+        size_t len = chunk_build(r, cap);
+
+        // Dropped if the transfer was stopped or replaced meanwhile
+        portENTER_CRITICAL(&reader_lock);
+        if (r->gen == gen && !r->open)
+        {
+            r->len = (uint16_t)len;
+            r->end_index = r->index;
+            r->ready = true;
+            built = true;
+        }
+        portEXIT_CRITICAL(&reader_lock);
+    }
+    if (built)
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &ready_ev);
+}
+
+// ---- Host task ----
+
+static int chunk_send(ble_session_t *s, const uint8_t *buf, size_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(buf, len);
+    if (om == NULL)
+        return BLE_HS_ENOMEM;
+    return ble_gatts_notify_custom(s->conn_handle, *history_handle, om);
+}
+
+static void reader_stop(reader_t *r)
+{
+    portENTER_CRITICAL(&reader_lock);
+    r->gen = 0;
+    r->ready = false;
+    portEXIT_CRITICAL(&reader_lock);
+}
+
+static void transfer_done(history_conn_t *h, uint32_t records)
+{
+    h->active = false;
+    stats.transfers++;
+    stats.last_bytes = h->bytes;
+    stats.last_ms = ble_npl_time_ticks_to_ms32(ble_npl_time_get() - h->started);
+    DLOG(HISTORY_DONE, records, h->bytes, stats.last_ms);
+}
+
+// Send the chunks the evlog task has ready to sessions with credits, while
+// the host has mbufs for them, and have it build the next ones
+static void pump(void)
+{
+    bool sent = false;
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+    {
+        ble_session_t *s = ble_session_at(i);
+        reader_t *r = &readers[i];
+        if (s == NULL)
+        {
+            if (r->gen != 0)
+                reader_stop(r); // Disconnected mid transfer
+            continue;
+        }
+        history_conn_t *h = &s->history;
+        if (!h->active || !h->subscribed || h->credits == 0)
+            continue;
+        portENTER_CRITICAL(&reader_lock);
+        bool ready = r->ready;
+        portEXIT_CRITICAL(&reader_lock);
+        if (!ready)
+            continue;
+
+        if (os_msys_num_free() <= HISTORY_MBUF_RESERVE)
+        {
+            stats.mbuf_waits++;
+            ble_npl_callout_reset(&pump_timer, 1);
+            break;
+        }
+        bool end = r->chunk[8] & HISTORY_END;
+        if (end)
+            put_le32(&r->chunk[r->len - 4], evlog_now());
+        if (chunk_send(s, r->chunk, r->len) != 0)
+        {
+            // Kept ready, goes out on the retry
+            stats.mbuf_waits++;
+            ble_npl_callout_reset(&pump_timer, 1);
+            break;
+        }
+
+        h->credits--;
+        h->bytes += r->len;
+        stats.chunks++;
+        stats.bytes += r->len;
+        if (end)
+        {
+            reader_stop(r);
+            transfer_done(h, r->end_index - r->resume);
+            continue;
+        }
+        portENTER_CRITICAL(&reader_lock);
+        r->ready = false;
+        portEXIT_CRITICAL(&reader_lock);
+        sent = true;
+    }
+    if (sent)
+        evlog_call(read_chunks);
+}
+
+static void pump_cb(struct ble_npl_event *ev)
+{
+    pump();
+}
+
+static int slot_of(const ble_session_t *s)
+{
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+        if (ble_session_at(i) == s)
+            return i;
+    return -1;
+}
+
+static void transfer_open(ble_session_t *s, uint32_t from_ts, uint32_t resume, uint8_t credits)
+{
+    history_conn_t *h = &s->history;
+    reader_t *r = &readers[slot_of(s)];
+    h->active = false;
+    reader_stop(r);
+    if (s->mtu < HISTORY_MIN_MTU)
+    {
+        uint8_t refuse[HISTORY_CHUNK_HDR_LEN + 4] = {[8] = HISTORY_END | HISTORY_MTU};
+        put_le32(&refuse[HISTORY_CHUNK_HDR_LEN], evlog_now());
+        chunk_send(s, refuse, sizeof(refuse));
+        return;
+    }
+
+    portENTER_CRITICAL(&reader_lock);
+    r->gen = ++last_gen;
+    r->open = true;
+    r->from_ts = from_ts;
+    r->resume = resume;
+    r->cap = (size_t)s->mtu - 3 < HISTORY_CHUNK_MAX ? (uint16_t)(s->mtu - 3) : HISTORY_CHUNK_MAX;
+    portEXIT_CRITICAL(&reader_lock);
+    h->credits = credits;
+    h->bytes = 0;
+    h->started = ble_npl_time_get();
+    h->active = true;
+    evlog_call(read_chunks);
+    DLOG(HISTORY_OPEN, s->conn_handle, from_ts, resume);
+}
+
+int history_chr_write(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL)
+        return BLE_ATT_ERR_UNLIKELY;
+    if (len == 0)
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+
+    history_conn_t *h = &s->history;
+    switch (data[0])
+    {
+    case HISTORY_OP_OPEN:
+        if (len != 10)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        transfer_open(s, get_le32(&data[1]), get_le32(&data[5]), data[9]);
+        break;
+    case HISTORY_OP_CREDIT:
+        if (len != 2)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        h->credits = h->credits + data[1] > UINT8_MAX ? UINT8_MAX : (uint8_t)(h->credits + data[1]);
+        break;
+    case HISTORY_OP_STOP:
+        h->active = false;
+        reader_stop(&readers[slot_of(s)]);
+        break;
+    default:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    pump();
+    return 0;
+}
+
+void history_xfer_init(const uint16_t *val_handle)
+{
+    history_handle = val_handle;
+    ble_npl_callout_init(&pump_timer, nimble_port_get_dflt_eventq(), pump_cb, NULL);
+    ble_npl_event_init(&ready_ev, pump_cb, NULL);
+}
+
+void history_xfer_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL || attr_handle != *history_handle)
+        return;
+    s->history.subscribed = notify;
+    if (notify)
+        pump();
+}
+
+const history_stats_t *history_xfer_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "evlog.h"
+#include "nimble/nimble_npl.h"
+
+// Bulk download of the session log on the HISTORY characteristic: the
+// client writes requests without response, records come back packed into
+// notifications as fast as the link takes them.
+//
+// Requests:
+//   01 from_ts:u32 resume:u32 credits:u8   start a transfer of the records
+//                                          at or after from_ts, skipping the
+//                                          first resume of those at exactly
+//                                          from_ts
+//   02 credits:u8                          allow that many more chunks
+//   03                                     stop
+//
+// Each notification is one chunk and costs one credit:
+//   index:u32    resume plus the records sent before this chunk, so a lost
+//                chunk shows as a gap
+//   base_ts:u32  time the first record's delta is taken from
+//   flags:u8     HISTORY_END: last chunk of the transfer
+//                HISTORY_MTU: refused, the MTU cannot fit a record
+//   records      evlog_pack form, each timed from the one before
+//   now:u32      END chunks only: the current log time, so the client can
+//                date records against its own clock
+//
+// A dropped transfer resumes with from_ts = the time of the last record
+// received and resume = how many received records carry that time. Records
+// the ring reclaims in between cannot shift that point; had they been
+// counted from an earlier from_ts, the skip would run past records never
+// sent.
+//
+// Keeping a few credits outstanding keeps the pipeline full without
+// queueing more than the client can take.
+//
+// The log is only read on the evlog task, which builds each session's next
+// chunk ahead; the host task sends chunks that are ready and never waits on
+// flash.
+
+#define HISTORY_CHUNK_HDR_LEN 9
+#define HISTORY_END 0x01
+#define HISTORY_MTU 0x02
+
+#define HISTORY_OP_OPEN 0x01
+#define HISTORY_OP_CREDIT 0x02
+#define HISTORY_OP_STOP 0x03
+
+// Transfer state kept in each BLE session, host task only
+typedef struct
+{
+    bool subscribed;
+    bool active;
+    uint8_t credits;
+    uint32_t bytes;
+    ble_npl_time_t started;
+} history_conn_t;
+
+typedef struct
+{
+    uint32_t transfers; // Completed
+    uint32_t chunks;
+    uint32_t bytes;
+    uint32_t mbuf_waits; // Times the pipeline paused for free mbufs
+    uint32_t last_bytes; // Size and duration of the last completed transfer
+    uint32_t last_ms;
+} history_stats_t;
+
+void history_xfer_init(const uint16_t *val_handle);
+
+// Called from BLE_GAP_EVENT_SUBSCRIBE
+void history_xfer_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify);
+
+const history_stats_t *history_xfer_stats(void);
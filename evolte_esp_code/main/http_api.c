@@ -0,0 +1,908 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "actuator.h"
+#include "adv_beacon.h"
+#include "boot.h"
+#include "charge_sched.h"
+#include "charger.h"
+#include "config_store.h"
+#include "conn_policy.h"
+#include "dlog.h"
+#include "esp_app_desc.h"
+#include "esp_http_server.h"
+#include "evlog.h"
+#include "history_xfer.h"
+#include "http_api.h"
+#include "http_body.h"
+#include "http_sse.h"
+#include "mem_budget.h"
+#include "meter.h"
+#include "ota_update.h"
+#include "perf.h"
+#include "sdkconfig.h"
+#include "site_link.h"
+#include "web_ui.h"
+
+#define HTTP_RECV_CHUNK 128
+// Every reply fits an event too
+#define HTTP_RESP_LEN HTTP_SSE_DATA_MAX
+#define JSON_MAX_DEPTH 4
+// Image bytes per flash write, kept off the httpd task's stack
+#define HTTP_OTA_CHUNK 4096
+#define HTTP_OPEN_SOCKETS (CONFIG_EVOLTE_SSE_MAX_CLIENTS + CONFIG_EVOLTE_HTTP_POLL_SOCKETS)
+// httpd keeps 3 sockets of its own, the listener and its control pair
+_Static_assert(HTTP_OPEN_SOCKETS + 3 <= CONFIG_LWIP_MAX_SOCKETS, "raise LWIP_MAX_SOCKETS");
+
+static const http_api_hooks_t *hooks;
+static uint8_t api_seq;
+
+// ---- JSON replies ----
+
+// All handlers run on the one httpd task, so a single buffer serves them all
+static struct
+{
+    char buf[HTTP_RESP_LEN];
+    size_t len;
+    bool overflow;
+    int depth;
+    bool first[JSON_MAX_DEPTH];
+} out;
+MEM_BUDGET_FITS(HTTP_RESP, out);
+
+static void out_raw(const char *s, size_t n)
+{
+    if (out.len + n >= sizeof(out.buf))
+    {
+        out.overflow = true;
+        return;
+    }
+    memcpy(&out.buf[out.len], s, n);
+    out.len += n;
+}
+
+static void out_fmt(const char *fmt, unsigned long long v)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), fmt, v);
+    out_raw(num, (size_t)n);
+}
+
+static void json_begin(void)
+{
+    out.len = 0;
+    out.overflow = false;
+    out.depth = 0;
+    out.first[0] = true;
+    out_raw("{", 1);
+}
+
+static void json_str_val(const char *s)
+{
+    out_raw("\"", 1);
+    for (; *s; s++)
+    {
+        uint8_t c = (uint8_t)*s;
+        if (c == '"' || c == '\\')
+        {
+            out_raw("\\", 1);
+            out_raw(s, 1);
+        }
+        else if (c < 0x20)
+            out_fmt("\\u%04llx", c);
+        else
+            out_raw(s, 1);
+    }
+    out_raw("\"", 1);
+}
+
+static void json_sep(void)
+{
+    if (!out.first[out.depth])
+        out_raw(",", 1);
+    out.first[out.depth] = false;
+}
+
+static void json_key(const char *key)
+{
+    json_sep();
+    json_str_val(key);
+    out_raw(":", 1);
+}
+
+static void json_u64(const char *key, uint64_t v)
+{
+    json_key(key);
+    out_fmt("%llu", v);
+}
+
+static void json_i64(const char *key, int64_t v)
+{
+    json_key(key);
+    if (v < 0)
+        out_raw("-", 1);
+    out_fmt("%llu", v < 0 ? 0 - (uint64_t)v : (uint64_t)v);
+}
+
+static void json_bool(const char *key, bool v)
+{
+    json_key(key);
+    out_raw(v ? "true" : "false", v ? 4 : 5);
+}
+
+static void json_str(const char *key, const char *v)
+{
+    json_key(key);
+    json_str_val(v);
+}
+
+static void json_obj(const char *key)
+{
+    json_key(key);
+    out_raw("{", 1);
+    if (out.depth + 1 < JSON_MAX_DEPTH)
+        out.first[++out.depth] = true;
+}
+
+static void json_end(void)
+{
+    out_raw("}", 1);
+    if (out.depth > 0)
+        out.depth--;
+}
+
+static void json_arr(const char *key)
+{
+    json_key(key);
+    out_raw("[", 1);
+    if (out.depth + 1 < JSON_MAX_DEPTH)
+        out.first[++out.depth] = true;
+}
+
+static void json_arr_end(void)
+{
+    out_raw("]", 1);
+    if (out.depth > 0)
+        out.depth--;
+}
+
+// One array element that is itself an array of numbers
+static void json_row(const uint32_t *v, int n)
+{
+    json_sep();
+    out_raw("[", 1);
+    for (int i = 0; i < n; i++)
+    {
+        if (i)
+            out_raw(",", 1);
+        out_fmt("%llu", v[i]);
+    }
+    out_raw("]", 1);
+}
+
+static esp_err_t json_send(httpd_req_t *req)
+{
+    json_end();
+    if (out.overflow)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Reply too large");
+        return ESP_OK;
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, out.buf, out.len);
+}
+
+static esp_err_t json_error(httpd_req_t *req, const char *status, const char *msg)
+{
+    httpd_resp_set_status(req, status);
+    json_begin();
+    json_str("error", msg);
+    return json_send(req);
+}
+
+// ---- Request bodies ----
+
+// Stream the whole body through the parser, however large or chunked it is.
+// A body starting with '{' is JSON, anything else form encoded. seen gets a
+// bit per field present, NULL if not needed.
+static int recv_body(httpd_req_t *req, http_body_field_t *fields, int n_fields, uint32_t *seen)
+{
+    char chunk[HTTP_RECV_CHUNK];
+    http_body_t parser;
+    size_t left = req->content_len;
+    bool started = false;
+
+    while (left > 0)
+    {
+        int ret = httpd_req_recv(req, chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (ret <= 0)
+            return HTTP_BODY_ERR_INCOMPLETE;
+        left -= (size_t)ret;
+
+        // Leading whitespace is dropped until the first byte picks the encoding
+        int i = 0;
+        if (!started)
+        {
+            while (i < ret && (chunk[i] == ' ' || chunk[i] == '\t' || chunk[i] == '\r' || chunk[i] == '\n'))
+                i++;
+            if (i == ret)
+                continue;
+            http_body_init(&parser, chunk[i] == '{' ? HTTP_BODY_JSON : HTTP_BODY_FORM, fields, n_fields);
+            started = true;
+        }
+        if (http_body_feed(&parser, &chunk[i], (size_t)(ret - i)) != HTTP_BODY_OK)
+            return parser.err;
+    }
+    if (!started)
+        http_body_init(&parser, HTTP_BODY_FORM, fields, n_fields);
+    if (seen)
+        *seen = parser.seen;
+    return http_body_finish(&parser);
+}
+
+static esp_err_t body_error(httpd_req_t *req, int rc)
+{
+    return json_error(req, "400 Bad Request", rc == HTTP_BODY_ERR_TOO_LONG ? "Field too long" : "Malformed body");
+}
+
+// ---- Commands ----
+
+static int http_submit(const cmd_frame_t *frame, void *ctx)
+{
+    cmd_t cmd;
+    cmd_copy(&cmd, frame);
+    return actuator_submit(ACTUATOR_SRC_HTTP, 0, &cmd) ? 0 : -1;
+}
+
+_Static_assert(MEM_POOL_BLOCK_ATT >= CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU, "a body may be as long as a BLE write");
+
+// Same frames as the CMD characteristic, sent as the raw request body
+static esp_err_t cmd_post_frames(httpd_req_t *req, uint8_t *buf)
+{
+    // No more than one BLE write holds, and all of it, however it arrives
+    if (req->content_len > CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU)
+    {
+        charger_count_rejected();
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_sendstr(req, "Too long");
+        return ESP_OK;
+    }
+    size_t len = 0;
+    while (len < req->content_len)
+    {
+        int ret = httpd_req_recv(req, (char *)&buf[len], req->content_len - len);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (ret <= 0)
+            return ESP_FAIL;
+        len += (size_t)ret;
+    }
+    if (len == 0)
+        return ESP_FAIL;
+
+    int rc = cmd_proto_validate(buf, len, hooks->ops, CMD_OP_COUNT);
+    if (rc < 0)
+    {
+        charger_count_rejected();
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad command frame");
+        return ESP_OK;
+    }
+    // All or nothing, like a BLE write
+    if (actuator_space(ACTUATOR_SRC_HTTP) < (uint32_t)rc)
+    {
+        charger_count_rejected();
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Busy");
+        return ESP_OK;
+    }
+    cmd_proto_run(buf, len, http_submit, NULL);
+    httpd_resp_sendstr(req, "OK");
+    return ESP_OK;
+}
+
+static esp_err_t cmd_post_handler(httpd_req_t *req)
+{
+    uint8_t *buf = mem_pool_get(MEM_POOL_ATT);
+    if (buf == NULL)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Busy");
+        return ESP_OK;
+    }
+    esp_err_t rc = cmd_post_frames(req, buf);
+    mem_pool_put(MEM_POOL_ATT, buf);
+    return rc;
+}
+
+static bool parse_bool(const char *s, bool *out)
+{
+    if (strcmp(s, "1") == 0 || strcmp(s, "true") == 0 || strcmp(s, "on") == 0)
+        *out = true;
+    else if (strcmp(s, "0") == 0 || strcmp(s, "false") == 0 || strcmp(s, "off") == 0)
+        *out = false;
+    else
+        return false;
+    return true;
+}
+
+// Built into a RELAY_SET frame and run through the BLE command path
+static esp_err_t api_relay_post_handler(httpd_req_t *req)
+{
+    char channel[4], on[8];
+    http_body_field_t fields[] = {
+        {.name = "channel", .val = channel, .cap = sizeof(channel)},
+        {.name = "on", .val = on, .cap = sizeof(on)},
+    };
+    int rc = recv_body(req, fields, 2, NULL);
+    if (rc != HTTP_BODY_OK)
+    {
+        charger_count_rejected();
+        return body_error(req, rc);
+    }
+
+    char *end;
+    unsigned long ch = strtoul(channel, &end, 10);
+    bool state;
+    if (channel[0] == '\0' || *end != '\0' || ch >= CHARGER_RELAY_COUNT || !parse_bool(on, &state))
+    {
+        charger_count_rejected();
+        return json_error(req, "400 Bad Request", "Need channel and on");
+    }
+
+    cmd_t cmd = {.opcode = CMD_OP_RELAY_SET, .seq = api_seq++, .len = 2, .payload = {(uint8_t)ch, state}};
+    const cmd_op_t *op = &hooks->ops[cmd.opcode];
+    if (op->fn == NULL || cmd.len < op->min_len || cmd.len > op->max_len)
+        return json_error(req, "500 Internal Server Error", "Relay command not available");
+    if (!actuator_submit(ACTUATOR_SRC_HTTP, 0, &cmd))
+    {
+        charger_count_rejected();
+        return json_error(req, "503 Service Unavailable", "Busy");
+    }
+
+    json_begin();
+    json_bool("queued", true);
+    json_u64("seq", cmd.seq);
+    return json_send(req);
+}
+
+// ---- Telemetry ----
+
+// Straight from the meter rather than the snapshot, for the full energy
+// resolution
+static void json_meter(void)
+{
+    meter_dsp_out_t m;
+    meter_get(&m);
+    json_obj("meter");
+    json_u64("v_rms_mv", m.v_rms_mv);
+    json_u64("i_rms_ma", m.i_rms_ma);
+    json_i64("power_w", m.power_w);
+    json_u64("v_peak_mv", m.v_peak_mv);
+    json_u64("i_peak_ma", m.i_peak_ma);
+    json_u64("energy_mj", m.energy_mj);
+    json_end();
+}
+
+static esp_err_t api_status_get_handler(httpd_req_t *req)
+{
+    status_snapshot_t snap;
+    hooks->status(&snap);
+
+    json_begin();
+    json_u64("relay_count", snap.relay_count);
+    json_u64("relay_mask", snap.relay_mask);
+    json_u64("uptime_s", snap.uptime_s);
+    json_u64("error_flags", snap.error_flags);
+    json_str("fw_version", esp_app_get_description()->version);
+    json_u64("sessions", snap.sessions);
+    json_u64("last_seq", snap.last_seq);
+    json_meter();
+    return json_send(req);
+}
+
+static void json_actuator(const char *key, actuator_src_t src)
+{
+    const actuator_stats_t *st = actuator_stats(src);
+    json_obj(key);
+    json_u64("submitted", st->submitted);
+    json_u64("dropped", st->dropped);
+    json_u64("executed", st->executed);
+    json_u64("depth", actuator_depth(src));
+    json_u64("depth_max", st->depth_max);
+    json_u64("lat_max_us", st->lat_max_us);
+    json_u64("lat_avg_us", st->executed ? st->lat_sum_us / st->executed : 0);
+    json_end();
+}
+
+static void json_counters(void)
+{
+    const charger_stats_t *cs = charger_stats();
+    const dlog_stats_t *ds = dlog_stats();
+
+    json_u64("cmds_run", cs->cmds_run);
+    json_u64("cmds_rejected", cs->cmds_rejected);
+    json_u64("relay_switches", cs->relay_switches);
+    json_actuator("ble", ACTUATOR_SRC_BLE);
+    json_actuator("http", ACTUATOR_SRC_HTTP);
+    json_actuator("timer", ACTUATOR_SRC_TIMER);
+    json_obj("dlog");
+    json_u64("written", ds->written);
+    json_u64("dropped", ds->dropped);
+    json_u64("drained", ds->drained);
+    json_end();
+    const meter_stats_t *ms = meter_stats();
+    json_obj("meter");
+    json_u64("windows", ms->windows);
+    json_u64("frames", ms->frames);
+    json_u64("overruns", ms->overruns);
+    json_end();
+    const evlog_stats_t *es = evlog_stats();
+    json_obj("evlog");
+    json_u64("appended", es->appended);
+    json_u64("written", es->written);
+    json_u64("dropped", es->dropped);
+    json_u64("erases", es->erases);
+    json_u64("sectors_lost", es->sectors_lost);
+    json_u64("write_errors", es->write_errors);
+    json_u64("torn", es->torn);
+    json_u64("sectors", es->sectors);
+    json_u64("sectors_used", es->sectors_used);
+    json_end();
+    const history_stats_t *hs = history_xfer_stats();
+    json_obj("history");
+    json_u64("transfers", hs->transfers);
+    json_u64("chunks", hs->chunks);
+    json_u64("bytes", hs->bytes);
+    json_u64("mbuf_waits", hs->mbuf_waits);
+    json_u64("last_bytes", hs->last_bytes);
+    json_u64("last_ms", hs->last_ms);
+    json_end();
+    const ota_stats_t *os = ota_update_stats();
+    json_obj("ota");
+    json_u64("updates", os->updates);
+    json_u64("patches", os->patches);
+    json_u64("failed", os->failed);
+    json_u64("last_bytes", os->last_bytes);
+    json_u64("last_ms", os->last_ms);
+    json_bool("pending_verify", os->pending_verify);
+    json_end();
+    const conn_policy_stats_t *ps = conn_policy_stats();
+    json_obj("link");
+    json_u64("requests", ps->requests);
+    json_u64("updates", ps->updates);
+    json_u64("refused", ps->refused);
+    json_u64("relaxed", ps->relaxed);
+    json_end();
+    json_obj("beacon");
+    json_u64("updates", adv_beacon_stats()->updates);
+    json_end();
+    json_obj("web");
+    json_u64("sent", web_ui_stats()->sent);
+    json_u64("not_modified", web_ui_stats()->not_modified);
+    json_end();
+    json_u64("config_commits", config_commits());
+}
+
+static esp_err_t api_counters_get_handler(httpd_req_t *req)
+{
+    json_begin();
+    json_counters();
+    return json_send(req);
+}
+
+// ---- Charge schedule ----
+
+// Rules as rows in the order of their command payload, unused ones left out
+static esp_err_t api_schedule_get_handler(httpd_req_t *req)
+{
+    static charge_sched_state_t st;
+    charge_sched_get(&st);
+    const charge_plan_t *plan = &st.plan;
+
+    json_begin();
+    json_bool("clock_set", st.clock_set);
+    json_u64("time", (uint64_t)(st.unix_us / 1000000));
+    json_i64("tz_min", plan->tz_min);
+    if (st.wake_min != TW_NEVER)
+        json_u64("wake", (uint64_t)st.wake_min * 60);
+    json_u64("on_mask", st.on_mask);
+    json_u64("price", st.price);
+    json_u64("default_price", plan->default_price);
+    json_u64("max_price", plan->max_price);
+    json_u64("cheap_mask", plan->cheap_mask);
+    json_arr("windows");
+    for (int i = 0; i < CHARGE_PLAN_WINDOWS; i++)
+    {
+        const charge_window_t *w = &plan->windows[i];
+        if (w->days)
+            json_row((const uint32_t[]){i, w->days, w->channel, w->start, w->end}, 5);
+    }
+    json_arr_end();
+    json_arr("tariffs");
+    for (int i = 0; i < CHARGE_PLAN_TARIFFS; i++)
+    {
+        const charge_tariff_t *t = &plan->tariffs[i];
+        if (t->days)
+            json_row((const uint32_t[]){i, t->days, t->start, t->end, t->price}, 5);
+    }
+    json_arr_end();
+    const charge_sched_stats_t *ss = charge_sched_stats();
+    json_obj("stats");
+    json_u64("clock_sets", ss->clock_sets);
+    json_u64("wakeups", ss->wakeups);
+    json_u64("switches", ss->switches);
+    json_u64("dropped", ss->dropped);
+    json_u64("commits", ss->commits);
+    json_end();
+    return json_send(req);
+}
+
+// ---- Site balancing ----
+
+// Chargers in view as [id, demand, limit, share, ticket, rounds quiet], all
+// currents in 0.1 A
+static esp_err_t api_site_get_handler(httpd_req_t *req)
+{
+    static site_link_state_t st;
+    site_link_get(&st);
+
+    json_begin();
+    json_u64("budget", st.budget);
+    json_u64("group", st.group);
+    json_u64("id", st.self_id);
+    if (st.budget)
+        json_u64("applied", st.applied);
+    if (st.limit != CHARGER_LIMIT_NONE)
+        json_u64("limit", st.limit);
+    json_arr("chargers");
+    for (int i = 0; i < st.n; i++)
+    {
+        const site_node_t *x = &st.nodes[i];
+        json_row((const uint32_t[]){x->id, x->demand, x->alloc, x->target, x->ticket, x->silent}, 6);
+    }
+    json_arr_end();
+    const site_link_stats_t *ss = site_link_stats();
+    json_obj("stats");
+    json_u64("rounds", ss->rounds);
+    json_u64("sent", ss->sent);
+    json_u64("send_failed", ss->send_failed);
+    json_u64("heard", st.heard);
+    json_u64("rejected", st.rejected);
+    json_u64("limits", ss->limits);
+    json_u64("dropped", ss->dropped);
+    json_end();
+    return json_send(req);
+}
+
+// ---- Event stream ----
+
+// Last status sent on the stream, so events carry only what changed
+static status_snapshot_t sse_last;
+
+static const char *sse_build(uint32_t kind, bool full, size_t *len)
+{
+    json_begin();
+    if (kind == HTTP_SSE_COUNTERS)
+        json_counters();
+    else
+    {
+        status_snapshot_t snap;
+        hooks->status(&snap);
+        bool any = full;
+#define SSE_FIELD(name)                               \
+    if (full || snap.name != sse_last.name)           \
+    {                                                 \
+        json_u64(#name, snap.name);                   \
+        any = true;                                   \
+    }
+        SSE_FIELD(relay_count)
+        SSE_FIELD(relay_mask)
+        SSE_FIELD(error_flags)
+        SSE_FIELD(sessions)
+        SSE_FIELD(last_seq)
+#undef SSE_FIELD
+        if (!any)
+            return NULL;
+        json_u64("uptime_s", snap.uptime_s);
+        // A new client's snapshot must not swallow changes the others missed
+        if (!full)
+            sse_last = snap;
+    }
+    json_end();
+    if (out.overflow)
+        return NULL;
+    *len = out.len;
+    return out.buf;
+}
+
+static esp_err_t diag_boot_get_handler(httpd_req_t *req)
+{
+    size_t len = boot_profile_json(out.buf, sizeof(out.buf));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, out.buf, len);
+}
+
+static esp_err_t diag_ble_get_handler(httpd_req_t *req)
+{
+    size_t len = conn_policy_json(out.buf, sizeof(out.buf));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, out.buf, len);
+}
+
+static int metrics_write(void *ctx, const char *text, size_t len)
+{
+    return httpd_resp_send_chunk(ctx, text, (ssize_t)len) == ESP_OK ? 0 : -1;
+}
+
+// Prometheus text exposition, chunked since it outgrows the reply buffer
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    if (perf_metrics(metrics_write, req) != 0)
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// ---- Firmware update ----
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_hex(const char *s, uint8_t *out, size_t n)
+{
+    if (strlen(s) != n * 2)
+        return false;
+    for (size_t i = 0; i < n; i++)
+    {
+        int hi = hex_digit(s[2 * i]), lo = hex_digit(s[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+// The app image as the raw body, its SHA-256 in the query:
+//   POST /api/ota?sha256=<64 hex digits>
+// or a patch from host/tools/ota_diff against the running image, with the
+// SHA-256 of the image it rebuilds:
+//   POST /api/ota/patch?sha256=<64 hex digits>
+// Written to flash as it arrives; the charger restarts into it once it
+// verified
+static char ota_chunk[HTTP_OTA_CHUNK];
+MEM_BUDGET_FITS(HTTP_OTA_CHUNK, ota_chunk);
+
+static esp_err_t api_ota_post_handler(httpd_req_t *req)
+{
+    ota_fmt_t fmt = (ota_fmt_t)(uintptr_t)req->user_ctx;
+    char query[96], hex[65];
+    uint8_t sha[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "sha256", hex, sizeof(hex)) != ESP_OK || !parse_hex(hex, sha, sizeof(sha)))
+        return json_error(req, "400 Bad Request", "sha256 missing");
+
+    ota_status_t st = ota_update_begin(OTA_SRC_HTTP, fmt, req->content_len, sha);
+    if (st == OTA_ST_BUSY)
+        return json_error(req, "409 Conflict", "Update in progress");
+    if (st == OTA_ST_SIZE)
+        return json_error(req, "413 Payload Too Large", "Image does not fit");
+    if (st != OTA_ST_OK)
+        return json_error(req, "500 Internal Server Error", "Flash error");
+
+    size_t left = req->content_len;
+    while (left > 0 && st == OTA_ST_OK)
+    {
+        int ret = httpd_req_recv(req, ota_chunk, left < sizeof(ota_chunk) ? left : sizeof(ota_chunk));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (ret <= 0)
+        {
+            ota_update_abort();
+            return ESP_FAIL;
+        }
+        left -= (size_t)ret;
+        st = ota_update_write(ota_chunk, (size_t)ret);
+    }
+    if (st == OTA_ST_OK)
+        st = ota_update_finish();
+
+    switch (st)
+    {
+    case OTA_ST_DONE:
+        break;
+    case OTA_ST_HASH:
+        return json_error(req, "400 Bad Request", "SHA-256 mismatch");
+    case OTA_ST_IMAGE:
+        return json_error(req, "400 Bad Request", "Not an app image");
+    case OTA_ST_SIZE:
+        return json_error(req, "413 Payload Too Large", "Image does not fit");
+    case OTA_ST_BASE:
+        return json_error(req, "409 Conflict", "Patch is for another image");
+    case OTA_ST_PATCH:
+        return json_error(req, "400 Bad Request", "Corrupt patch");
+    default:
+        return json_error(req, "500 Internal Server Error", "Flash error");
+    }
+    const ota_stats_t *os = ota_update_stats();
+    json_begin();
+    json_u64("bytes", os->last_bytes);
+    json_u64("ms", os->last_ms);
+    json_u64("restart_ms", OTA_RESTART_MS);
+    return json_send(req);
+}
+
+// ---- Configuration ----
+
+static const char *const config_keys[CONFIG_FIELD_COUNT] = {
+#define CONFIG_FIELD(name, key, size, def) [CONFIG_##name] = key,
+#include "config_fields.def"
+#undef CONFIG_FIELD
+};
+
+static esp_err_t api_config_get_handler(httpd_req_t *req)
+{
+    char val[64];
+    json_begin();
+    for (int f = 0; f < CONFIG_FIELD_COUNT; f++)
+    {
+        if (f == CONFIG_WIFI_PASS)
+            continue; // Write only
+        config_get_str(f, val, sizeof(val));
+        json_str(config_keys[f], val);
+    }
+    return json_send(req);
+}
+
+// Any subset of the settings, by NVS key. Nothing is stored unless every
+// field parsed, and all of them land in one flash commit.
+static esp_err_t api_config_post_handler(httpd_req_t *req)
+{
+    static struct
+    {
+#define CONFIG_FIELD(name, key, size, def) char name[size];
+#include "config_fields.def"
+#undef CONFIG_FIELD
+    } vals;
+    http_body_field_t fields[CONFIG_FIELD_COUNT] = {
+#define CONFIG_FIELD(field, key, size, def) \
+    [CONFIG_##field] = {.name = key, .val = vals.field, .cap = sizeof(vals.field)},
+#include "config_fields.def"
+#undef CONFIG_FIELD
+    };
+
+    uint32_t seen;
+    int rc = recv_body(req, fields, CONFIG_FIELD_COUNT, &seen);
+    if (rc != HTTP_BODY_OK)
+        return body_error(req, rc);
+
+    for (int f = 0; f < CONFIG_FIELD_COUNT; f++)
+        if (seen & CONFIG_BIT(f))
+            config_set_str(f, fields[f].val);
+
+    json_begin();
+    json_u64("pending", config_dirty_mask());
+    json_u64("commit_ms", CONFIG_EVOLTE_CONFIG_COMMIT_MS);
+    return json_send(req);
+}
+
+// ---- Configuration form ----
+
+// Posted by the configuration page of earlier firmware, kept for scripts
+// that still use it
+static esp_err_t set_config_post_handler(httpd_req_t *req)
+{
+    char ble_name[32], ssid[32], password[64];
+    enum
+    {
+        F_NAME,
+        F_SSID,
+        F_PASSWORD,
+        F_COUNT
+    };
+    http_body_field_t fields[F_COUNT] = {
+        [F_NAME] = {.name = "name", .val = ble_name, .cap = sizeof(ble_name)},
+        [F_SSID] = {.name = "ssid", .val = ssid, .cap = sizeof(ssid)},
+        [F_PASSWORD] = {.name = "password", .val = password, .cap = sizeof(password)},
+    };
+
+    int rc = recv_body(req, fields, F_COUNT, NULL);
+    if (rc != HTTP_BODY_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            rc == HTTP_BODY_ERR_TOO_LONG ? "Field too long" : "Malformed body");
+        return ESP_OK;
+    }
+
+    // Stored together in one commit, which then renames and reconnects
+    if (ble_name[0])
+        config_set_str(CONFIG_BLE_NAME, ble_name);
+    if (ssid[0])
+    {
+        config_set_str(CONFIG_WIFI_SSID, ssid);
+        config_set_str(CONFIG_WIFI_PASS, password); // Empty for an open network
+    }
+
+    httpd_resp_sendstr(req, "Configuration updated. <a href='/'>Go Back</a>");
+    return ESP_OK;
+}
+
+static const httpd_uri_t api_uris[] = {
+#define WEB_ASSET(name, path, file, type) \
+    {.uri = path, .method = HTTP_GET, .handler = web_ui_get_handler, .user_ctx = (void *)&web_assets[WEB_ASSET_##name]},
+#include "web_assets.def"
+#undef WEB_ASSET
+    {.uri = "/set_config", .method = HTTP_POST, .handler = set_config_post_handler},
+    {.uri = "/cmd", .method = HTTP_POST, .handler = cmd_post_handler},
+    {.uri = "/diag/boot", .method = HTTP_GET, .handler = diag_boot_get_handler},
+    {.uri = "/diag/ble", .method = HTTP_GET, .handler = diag_ble_get_handler},
+    {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_get_handler},
+    {.uri = "/api/status", .method = HTTP_GET, .handler = api_status_get_handler},
+    {.uri = "/api/counters", .method = HTTP_GET, .handler = api_counters_get_handler},
+    {.uri = "/api/config", .method = HTTP_GET, .handler = api_config_get_handler},
+    {.uri = "/api/config", .method = HTTP_POST, .handler = api_config_post_handler},
+    {.uri = "/api/relay", .method = HTTP_POST, .handler = api_relay_post_handler},
+    {.uri = "/api/schedule", .method = HTTP_GET, .handler = api_schedule_get_handler},
+    {.uri = "/api/site", .method = HTTP_GET, .handler = api_site_get_handler},
+    {.uri = "/api/events", .method = HTTP_GET, .handler = http_sse_open},
+    {.uri = "/api/ota", .method = HTTP_POST, .handler = api_ota_post_handler, .user_ctx = (void *)OTA_FMT_IMAGE},
+    {.uri = "/api/ota/patch", .method = HTTP_POST, .handler = api_ota_post_handler, .user_ctx = (void *)OTA_FMT_PATCH},
+};
+
+#define API_URI_COUNT (sizeof(api_uris) / sizeof(api_uris[0]))
+
+// Every handler is registered behind this one, which times it and holds
+// the httpd task to the memory budget. The server hands it its api_uris
+// entry as user_ctx and it passes on the handler's own.
+static esp_err_t timed_handler(httpd_req_t *req)
+{
+    const httpd_uri_t *uri = req->user_ctx;
+    int64_t start = perf_now();
+    mem_budget_guard();
+    req->user_ctx = uri->user_ctx;
+    esp_err_t rc = uri->handler(req);
+    perf_record(PERF_HTTP, start);
+    return rc;
+}
+
+void http_api_start(const http_api_hooks_t *api_hooks)
+{
+    hooks = api_hooks;
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = API_URI_COUNT;
+    // A socket for every event stream plus a fixed few for controllers that
+    // keep their connection open and poll. No LRU purge: a stream never
+    // sends after its GET, so it would always be the one purged. Dead peers
+    // are found by TCP keep-alive instead of holding a socket forever.
+    config.max_open_sockets = HTTP_OPEN_SOCKETS;
+    config.lru_purge_enable = false;
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = 30;
+    config.keep_alive_interval = 5;
+    config.keep_alive_count = 3;
+    // Event streams keep their socket after the handler returns
+    config.close_fn = http_sse_close_fn;
+
+    httpd_handle_t server = NULL;
+    if (httpd_start(&server, &config) != ESP_OK)
+        return;
+    hooks->status(&sse_last);
+    http_sse_init(server, sse_build);
+    for (size_t i = 0; i < API_URI_COUNT; i++)
+    {
+        httpd_uri_t uri = api_uris[i];
+        uri.handler = timed_handler;
+        uri.user_ctx = (void *)&api_uris[i];
+        httpd_register_uri_handler(server, &uri);
+    }
+}
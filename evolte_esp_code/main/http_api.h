@@ -0,0 +1,37 @@
+#pragma once
+
+#include "cmd_proto.h"
+#include "status_snapshot.h"
+
+// HTTP API on esp_http_server, for site controllers that poll and drive
+// chargers over the LAN. Bodies may be form encoded or flat JSON, replies
+// are JSON built in one preallocated buffer.
+//
+//   GET  /api/status    charger state, same values as the status snapshot
+//   GET  /api/counters  command, actuator, log and link counters
+//   GET  /api/config    settings, secrets left out
+//   POST /api/config    any settings by NVS key, committed like BLE writes
+//   POST /api/relay     channel, on: queued on the actuator like a BLE command
+//   GET  /api/schedule  charge plan and its state; windows as [index, days,
+//                       channel, start, end], tariffs as [index, days, start,
+//                       end, price]. Set with command frames, see cmd_proto.h
+//   GET  /api/site      site balancing: budget, limit and the chargers in
+//                       view as [id, demand, limit, share, ticket, rounds
+//                       quiet], see site_link.h
+//   POST /api/ota       firmware image, see ota_update.h
+//   POST /api/ota/patch delta patch against the running image
+//   POST /cmd           raw command frames, as written to the CMD characteristic
+//   GET  /diag/boot     boot stage timing
+//   GET  /diag/ble      mode and parameters of each BLE connection
+//   GET  /metrics       runtime counters as Prometheus text, see perf.h
+//   GET  /, /app.js, /style.css  the web UI, see web_ui.h
+//   POST /set_config    settings as posted by the old configuration page
+
+typedef struct
+{
+    const cmd_op_t *ops;                     // The table BLE writes are validated against
+    void (*status)(status_snapshot_t *snap); // Current charger state
+} http_api_hooks_t;
+
+// Start the server and register every endpoint
+void http_api_start(const http_api_hooks_t *hooks);
@@ -0,0 +1,391 @@
+#include <string.h>
+#include "http_body.h"
+
+enum
+{
+    // Form
+    F_KEY,
+    F_VALUE,
+    F_PCT, // %XX in a key or value, ret_state says which
+    // JSON
+    J_START,
+    J_KEY_OR_END,   // After '{'
+    J_KEY_START,    // After ','
+    J_STRING,       // Key or value string, in_key says which
+    J_ESC,          // After '\'
+    J_HEX,          // \uXXXX digits
+    J_LOW_ESC,      // Expecting the '\' of a low surrogate
+    J_LOW_U,        // Expecting its 'u'
+    J_COLON,
+    J_VALUE,
+    J_LITERAL,
+    J_COMMA_OR_END,
+    J_DONE,
+};
+
+static int hex_val(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool json_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void fail(http_body_t *p, int err)
+{
+    if (p->err == HTTP_BODY_OK)
+        p->err = err;
+}
+
+// One decoded byte of the key or of the current field's value
+static void put(http_body_t *p, uint8_t c)
+{
+    if (c == '\0')
+    {
+        fail(p, HTTP_BODY_ERR_SYNTAX);
+        return;
+    }
+    if (p->in_key)
+    {
+        if (p->key_len < HTTP_BODY_KEY_MAX)
+            p->key[p->key_len++] = (char)c;
+        else
+            p->key_long = true; // Longer than any field name, so unknown
+        return;
+    }
+    if (p->cur < 0)
+        return;
+    http_body_field_t *f = &p->fields[p->cur];
+    if (f->len + 1 >= f->cap)
+    {
+        fail(p, HTTP_BODY_ERR_TOO_LONG);
+        return;
+    }
+    f->val[f->len++] = (char)c;
+    f->val[f->len] = '\0';
+}
+
+static void put_utf8(http_body_t *p, uint32_t cp)
+{
+    if (cp < 0x80)
+        put(p, (uint8_t)cp);
+    else if (cp < 0x800)
+    {
+        put(p, (uint8_t)(0xC0 | cp >> 6));
+        put(p, (uint8_t)(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        put(p, (uint8_t)(0xE0 | cp >> 12));
+        put(p, (uint8_t)(0x80 | ((cp >> 6) & 0x3F)));
+        put(p, (uint8_t)(0x80 | (cp & 0x3F)));
+    }
+    else
+    {
+        put(p, (uint8_t)(0xF0 | cp >> 18));
+        put(p, (uint8_t)(0x80 | ((cp >> 12) & 0x3F)));
+        put(p, (uint8_t)(0x80 | ((cp >> 6) & 0x3F)));
+        put(p, (uint8_t)(0x80 | (cp & 0x3F)));
+    }
+}
+
+static void key_begin(http_body_t *p)
+{
+    p->in_key = true;
+    p->key_len = 0;
+    p->key_long = false;
+}
+
+// The key is complete, route the value that follows
+static void key_end(http_body_t *p)
+{
+    p->in_key = false;
+    p->cur = -1;
+    if (p->key_long)
+        return;
+    p->key[p->key_len] = '\0';
+    for (int i = 0; i < p->n_fields; i++)
+    {
+        if (strcmp(p->fields[i].name, p->key) != 0)
+            continue;
+        p->cur = i;
+        p->seen |= 1u << i;
+        p->fields[i].len = 0;
+        p->fields[i].val[0] = '\0';
+        return;
+    }
+}
+
+void http_body_init(http_body_t *p, http_body_kind_t kind, http_body_field_t *fields, int n_fields)
+{
+    memset(p, 0, sizeof(*p));
+    p->kind = kind;
+    p->fields = fields;
+    p->n_fields = n_fields < HTTP_BODY_MAX_FIELDS ? n_fields : HTTP_BODY_MAX_FIELDS;
+    p->cur = -1;
+    for (int i = 0; i < p->n_fields; i++)
+    {
+        fields[i].len = 0;
+        if (fields[i].cap)
+            fields[i].val[0] = '\0';
+    }
+    if (kind == HTTP_BODY_FORM)
+    {
+        p->state = F_KEY;
+        key_begin(p);
+    }
+    else
+        p->state = J_START;
+}
+
+static void form_byte(http_body_t *p, char c)
+{
+    switch (p->state)
+    {
+    case F_KEY:
+    case F_VALUE:
+        if (c == '%')
+        {
+            p->ret_state = p->state;
+            p->state = F_PCT;
+            p->ndig = 0;
+            p->acc = 0;
+        }
+        else if (c == '=' && p->state == F_KEY)
+        {
+            key_end(p);
+            p->state = F_VALUE;
+        }
+        else if (c == '&')
+        {
+            if (p->state == F_KEY && p->key_len)
+                key_end(p); // Key without '=', an empty value
+            key_begin(p);
+            p->state = F_KEY;
+        }
+        else
+            put(p, c == '+' ? ' ' : (uint8_t)c);
+        break;
+    case F_PCT:
+    {
+        int v = hex_val(c);
+        if (v < 0)
+        {
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+            return;
+        }
+        p->acc = p->acc << 4 | (uint32_t)v;
+        if (++p->ndig == 2)
+        {
+            p->state = p->ret_state;
+            put(p, (uint8_t)p->acc);
+        }
+        break;
+    }
+    }
+}
+
+static void json_hex_done(http_body_t *p)
+{
+    uint32_t cp = p->acc;
+    if (p->hi_surrogate)
+    {
+        if (cp < 0xDC00 || cp > 0xDFFF)
+        {
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+            return;
+        }
+        cp = 0x10000 + ((uint32_t)(p->hi_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+        p->hi_surrogate = 0;
+    }
+    else if (cp >= 0xD800 && cp <= 0xDBFF)
+    {
+        p->hi_surrogate = (uint16_t)cp;
+        p->state = J_LOW_ESC;
+        return;
+    }
+    else if (cp >= 0xDC00 && cp <= 0xDFFF)
+    {
+        fail(p, HTTP_BODY_ERR_SYNTAX); // Lone low surrogate
+        return;
+    }
+    put_utf8(p, cp);
+    p->state = J_STRING;
+}
+
+static void json_string_end(http_body_t *p)
+{
+    if (p->in_key)
+    {
+        key_end(p);
+        p->state = J_COLON;
+    }
+    else
+    {
+        p->cur = -1;
+        p->state = J_COMMA_OR_END;
+    }
+}
+
+static void json_byte(http_body_t *p, char c)
+{
+    switch (p->state)
+    {
+    case J_START:
+        if (c == '{')
+            p->state = J_KEY_OR_END;
+        else if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_KEY_OR_END:
+    case J_KEY_START:
+        if (c == '"')
+        {
+            key_begin(p);
+            p->state = J_STRING;
+        }
+        else if (c == '}' && p->state == J_KEY_OR_END)
+            p->state = J_DONE;
+        else if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_STRING:
+        if (c == '"')
+            json_string_end(p);
+        else if (c == '\\')
+            p->state = J_ESC;
+        else if ((uint8_t)c < 0x20)
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        else
+            put(p, (uint8_t)c);
+        break;
+    case J_ESC:
+    {
+        static const char esc_in[] = "\"\\/bfnrt";
+        static const char esc_out[] = "\"\\/\b\f\n\r\t";
+        const char *e = c ? strchr(esc_in, c) : NULL;
+        if (c == 'u')
+        {
+            p->state = J_HEX;
+            p->ndig = 0;
+            p->acc = 0;
+        }
+        else if (e)
+        {
+            put(p, (uint8_t)esc_out[e - esc_in]);
+            p->state = J_STRING;
+        }
+        else
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    }
+    case J_HEX:
+    {
+        int v = hex_val(c);
+        if (v < 0)
+        {
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+            return;
+        }
+        p->acc = p->acc << 4 | (uint32_t)v;
+        if (++p->ndig == 4)
+            json_hex_done(p);
+        break;
+    }
+    case J_LOW_ESC:
+        if (c == '\\')
+            p->state = J_LOW_U;
+        else
+            fail(p, HTTP_BODY_ERR_SYNTAX); // Lone high surrogate
+        break;
+    case J_LOW_U:
+        if (c == 'u')
+        {
+            p->state = J_HEX;
+            p->ndig = 0;
+            p->acc = 0;
+        }
+        else
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_COLON:
+        if (c == ':')
+            p->state = J_VALUE;
+        else if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_VALUE:
+        if (c == '"')
+            p->state = J_STRING;
+        else if (c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+        {
+            p->state = J_LITERAL;
+            put(p, (uint8_t)c);
+        }
+        else if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX); // Nested objects and arrays too
+        break;
+    case J_LITERAL:
+        if (c == ',' || c == '}' || json_ws(c))
+        {
+            p->cur = -1;
+            p->state = J_COMMA_OR_END;
+            json_byte(p, c);
+        }
+        else if (c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                 c == 'E')
+            put(p, (uint8_t)c);
+        else
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_COMMA_OR_END:
+        if (c == ',')
+            p->state = J_KEY_START;
+        else if (c == '}')
+            p->state = J_DONE;
+        else if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    case J_DONE:
+        if (!json_ws(c))
+            fail(p, HTTP_BODY_ERR_SYNTAX);
+        break;
+    }
+}
+
+int http_body_feed(http_body_t *p, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len && p->err == HTTP_BODY_OK; i++)
+    {
+        if (p->kind == HTTP_BODY_FORM)
+            form_byte(p, data[i]);
+        else
+            json_byte(p, data[i]);
+    }
+    return p->err;
+}
+
+int http_body_finish(http_body_t *p)
+{
+    if (p->err != HTTP_BODY_OK)
+        return p->err;
+    if (p->kind == HTTP_BODY_FORM)
+    {
+        if (p->state == F_PCT)
+            fail(p, HTTP_BODY_ERR_INCOMPLETE);
+        else if (p->state == F_KEY && p->key_len)
+            key_end(p);
+    }
+    else if (p->state != J_DONE)
+        fail(p, HTTP_BODY_ERR_INCOMPLETE);
+    p->cur = -1;
+    return p->err;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental parser for request bodies, fed in whatever chunks
+// httpd_req_recv returns. Two encodings:
+//   form: key=value&key=value, '+' and %XX decoded in keys and values
+//   JSON: one flat object, string values unescaped (\uXXXX to UTF-8),
+//         numbers and true/false/null kept as their text
+// Values of known keys are decoded straight into caller buffers, unknown
+// keys are skipped, fields may come in any order and the last one wins.
+// Nothing is allocated.
+
+#define HTTP_BODY_KEY_MAX 31
+#define HTTP_BODY_MAX_FIELDS 32
+
+typedef enum
+{
+    HTTP_BODY_FORM,
+    HTTP_BODY_JSON,
+} http_body_kind_t;
+
+enum
+{
+    HTTP_BODY_OK = 0,
+    HTTP_BODY_ERR_SYNTAX = -1,     // Malformed encoding, or a NUL in a value
+    HTTP_BODY_ERR_TOO_LONG = -2,   // A known field does not fit its buffer
+    HTTP_BODY_ERR_INCOMPLETE = -3, // Body ended mid-token
+};
+
+typedef struct
+{
+    const char *name;
+    char *val;  // Decoded value, always NUL terminated
+    size_t cap; // Size of val, including the NUL
+    size_t len;
+} http_body_field_t;
+
+typedef struct
+{
+    http_body_kind_t kind;
+    http_body_field_t *fields;
+    int n_fields;
+    uint32_t seen; // Bit per field present in the body
+    int err;
+    int cur; // Field receiving bytes, -1 to skip
+    uint8_t state;
+    uint8_t ret_state; // Where an escape returns to
+    bool in_key;
+    uint8_t key_len;
+    bool key_long;
+    char key[HTTP_BODY_KEY_MAX + 1];
+    uint8_t ndig;
+    uint32_t acc;
+    uint16_t hi_surrogate;
+} http_body_t;
+
+void http_body_init(http_body_t *p, http_body_kind_t kind, http_body_field_t *fields, int n_fields);
+
+// HTTP_BODY_OK or the first error; after an error further input is ignored
+int http_body_feed(http_body_t *p, const char *data, size_t len);
+
+// End of body, reports a body cut off mid-token
+int http_body_finish(http_body_t *p);
+
+static inline bool http_body_has(const http_body_t *p, int field)
+{
+    return (p->seen >> field) & 1;
+}
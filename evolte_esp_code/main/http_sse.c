@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "http_sse.h"
+#include "lwip/sockets.h"
+#include "mem_budget.h"
+#include "sdkconfig.h"
+
+#define SSE_MAX_CLIENTS CONFIG_EVOLTE_SSE_MAX_CLIENTS
+#define SSE_QUEUE_LEN CONFIG_EVOLTE_SSE_QUEUE_LEN
+
+typedef struct
+{
+    uint16_t len;
+    char data[HTTP_SSE_FRAME_MAX];
+} sse_frame_t;
+
+// Touched only on the server task: handlers, queued work and close_fn
+typedef struct
+{
+    bool used;
+    int fd;
+    uint32_t next; // Id of the next event to send
+    // Rest of a frame a send took only part of, sent before anything else
+    uint16_t tail_len;
+    uint16_t tail_off;
+    char tail[HTTP_SSE_FRAME_MAX];
+} sse_client_t;
+
+static httpd_handle_t server;
+static http_sse_build_fn build;
+static sse_client_t clients[SSE_MAX_CLIENTS];
+static sse_frame_t window[SSE_QUEUE_LEN];
+MEM_BUDGET_FITS(SSE_CLIENTS, clients);
+MEM_BUDGET_FITS(SSE_WINDOW, window);
+_Static_assert(MEM_POOL_BLOCK_SSE_FRAME >= HTTP_SSE_FRAME_MAX, "the first event is a whole frame");
+static uint32_t head = 1; // Id of the next event, the first snapshot is 0
+static http_sse_stats_t stats;
+static esp_timer_handle_t telemetry_timer;
+
+// Written from any task
+static atomic_uint pending;
+static atomic_bool work_queued;
+
+static const char *const kind_names[] = {"status", "counters"};
+
+// "id: N\nevent: kind\ndata: {...}\n\n", 0 if it does not fit
+static size_t frame_format(char *buf, size_t cap, uint32_t id, uint32_t kind, const char *data, size_t len)
+{
+    int bit = kind == HTTP_SSE_STATUS ? 0 : 1;
+    int n = snprintf(buf, cap, "id: %u\nevent: %s\ndata: ", (unsigned)id, kind_names[bit]);
+    if (n < 0 || (size_t)n + len + 2 > cap)
+        return 0;
+    memcpy(buf + n, data, len);
+    memcpy(buf + n + len, "\n\n", 2);
+    return (size_t)n + len + 2;
+}
+
+static void client_drop(sse_client_t *c)
+{
+    // Ends up in http_sse_close_fn
+    httpd_sess_trigger_close(server, c->fd);
+}
+
+// false if the socket took only part of it or nothing; the caller stops there
+static bool client_send(sse_client_t *c, const char *data, size_t len)
+{
+    ssize_t n = send(c->fd, data, len, MSG_DONTWAIT);
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            client_drop(c);
+        return false;
+    }
+    if ((size_t)n < len)
+    {
+        // Keep the rest, the window slot may be reused before it goes out
+        memcpy(c->tail, data + n, len - (size_t)n);
+        c->tail_len = (uint16_t)(len - (size_t)n);
+        c->tail_off = 0;
+        return false;
+    }
+    return true;
+}
+
+static void client_flush(sse_client_t *c)
+{
+    if (c->tail_len)
+    {
+        ssize_t n = send(c->fd, c->tail + c->tail_off, c->tail_len, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client_drop(c);
+            return;
+        }
+        c->tail_off += (uint16_t)n;
+        c->tail_len -= (uint16_t)n;
+        if (c->tail_len)
+            return;
+    }
+
+    while (c->used && c->next != head)
+    {
+        if (head - c->next > SSE_QUEUE_LEN)
+        {
+            stats.skipped += head - c->next - SSE_QUEUE_LEN;
+            c->next = head - SSE_QUEUE_LEN;
+        }
+        const sse_frame_t *f = &window[c->next % SSE_QUEUE_LEN];
+        ssize_t n = send(c->fd, f->data, f->len, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client_drop(c);
+            return;
+        }
+        c->next++;
+        if ((size_t)n < f->len)
+        {
+            memcpy(c->tail, f->data + n, f->len - (size_t)n);
+            c->tail_len = (uint16_t)(f->len - (size_t)n);
+            c->tail_off = 0;
+            return;
+        }
+    }
+}
+
+static void window_put(uint32_t kind)
+{
+    size_t len;
+    const char *data = build(kind, false, &len);
+    if (data == NULL)
+        return;
+    sse_frame_t *f = &window[head % SSE_QUEUE_LEN];
+    f->len = (uint16_t)frame_format(f->data, sizeof(f->data), head, kind, data, len);
+    if (f->len == 0)
+        return;
+    head++;
+    stats.events++;
+}
+
+static void sse_work(void *arg)
+{
+    atomic_store(&work_queued, false);
+    uint32_t kinds = atomic_exchange(&pending, 0);
+
+    if (stats.clients == 0)
+        return; // Nobody to build events for
+    if (kinds & HTTP_SSE_STATUS)
+        window_put(HTTP_SSE_STATUS);
+    if (kinds & HTTP_SSE_COUNTERS)
+        window_put(HTTP_SSE_COUNTERS);
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++)
+        if (clients[i].used)
+            client_flush(&clients[i]);
+}
+
+void http_sse_notify(uint32_t kinds)
+{
+    if (server == NULL)
+        return;
+    atomic_fetch_or(&pending, kinds);
+    if (!atomic_exchange(&work_queued, true) && httpd_queue_work(server, sse_work, NULL) != ESP_OK)
+        atomic_store(&work_queued, false);
+}
+
+static void telemetry_cb(void *arg)
+{
+    if (stats.clients)
+        http_sse_notify(HTTP_SSE_COUNTERS);
+}
+
+esp_err_t http_sse_open(httpd_req_t *req)
+{
+    static const char hdr[] = "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/event-stream\r\n"
+                              "Cache-Control: no-cache\r\n"
+                              "Access-Control-Allow-Origin: *\r\n"
+                              "\r\n"
+                              "retry: 3000\n\n";
+    int fd = httpd_req_to_sockfd(req);
+    sse_client_t *c = NULL;
+    for (int i = 0; i < SSE_MAX_CLIENTS && c == NULL; i++)
+        if (!clients[i].used)
+            c = &clients[i];
+    char *frame = c && fd >= 0 ? mem_pool_get(MEM_POOL_SSE_FRAME) : NULL;
+    if (frame == NULL)
+    {
+        stats.refused++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Too many event streams");
+    }
+
+    if (httpd_socket_send(req->handle, fd, hdr, sizeof(hdr) - 1, 0) != (int)sizeof(hdr) - 1)
+    {
+        mem_pool_put(MEM_POOL_SSE_FRAME, frame);
+        return ESP_FAIL;
+    }
+    memset(c, 0, sizeof(*c));
+    c->used = true;
+    c->fd = fd;
+    c->next = head;
+    stats.clients++;
+
+    // Whole state first, as of the last event, the window then carries the
+    // deltas
+    size_t len;
+    const char *data = build(HTTP_SSE_STATUS, true, &len);
+    size_t n = data ? frame_format(frame, HTTP_SSE_FRAME_MAX, head - 1, HTTP_SSE_STATUS, data, len) : 0;
+    if (n)
+        client_send(c, frame, n);
+    mem_pool_put(MEM_POOL_SSE_FRAME, frame);
+    return ESP_OK;
+}
+
+void http_sse_close_fn(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++)
+    {
+        if (clients[i].used && clients[i].fd == sockfd)
+        {
+            clients[i].used = false;
+            stats.clients--;
+        }
+    }
+    close(sockfd);
+}
+
+void http_sse_init(httpd_handle_t hd, http_sse_build_fn fn)
+{
+    server = hd;
+    build = fn;
+    if (telemetry_timer == NULL)
+    {
+        const esp_timer_create_args_t args = {.callback = telemetry_cb, .name = "sse"};
+        if (esp_timer_create(&args, &telemetry_timer) == ESP_OK)
+            esp_timer_start_periodic(telemetry_timer, (uint64_t)CONFIG_EVOLTE_SSE_TELEMETRY_MS * 1000);
+    }
+}
+
+const http_sse_stats_t *http_sse_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Server-sent events for GET /api/events. Events go into a window of the
+// last CONFIG_EVOLTE_SSE_QUEUE_LEN that every client reads at its own pace
+// with non-blocking sends. A client more than a window behind skips what it
+// missed, which shows as a gap in the event ids, so a slow client never
+// holds up the server or the other clients.
+
+// Longest event data, the counters with every one at UINT32_MAX are about
+// 1420 bytes. The frame adds the longest header there is.
+#define HTTP_SSE_DATA_MAX 1536
+#define HTTP_SSE_FRAME_MAX (HTTP_SSE_DATA_MAX + sizeof("id: 4294967295\nevent: counters\ndata: \n\n") - 1)
+
+// Event kinds, bits for http_sse_notify
+#define HTTP_SSE_STATUS 0x1
+#define HTTP_SSE_COUNTERS 0x2
+
+// Data of one event of kind, NULL if there is nothing to send. full is set
+// for a client that just connected and needs the whole state, not a delta.
+// Runs on the server task.
+typedef const char *(*http_sse_build_fn)(uint32_t kind, bool full, size_t *len);
+
+typedef struct
+{
+    uint32_t clients; // Connected now
+    uint32_t refused; // Turned away, all slots taken
+    uint32_t events;  // Put in the window
+    uint32_t skipped; // Events clients missed by falling a window behind
+} http_sse_stats_t;
+
+void http_sse_init(httpd_handle_t server, http_sse_build_fn build);
+
+// GET handler, the socket then stays with the stream
+esp_err_t http_sse_open(httpd_req_t *req);
+
+// Something of kinds changed, safe from any task. Events are built on the
+// server task, so a burst of changes becomes one event.
+void http_sse_notify(uint32_t kinds);
+
+// The server's close_fn, ends a client's stream with its socket
+void http_sse_close_fn(httpd_handle_t hd, int sockfd);
+
+const http_sse_stats_t *http_sse_stats(void);
@@ -19,106 +19,392 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "lwip/ip4_addr.h"
+#include "esp_app_desc.h"
+#include "esp_timer.h"
+#include "esp_netif_sntp.h"
+#include "actuator.h"
+#include "adv_beacon.h"
+#include "ble_session.h"
+#include "boot.h"
+#include "charge_sched.h"
+#include "charger.h"
+#include "cmd_proto.h"
+#include "config_store.h"
+#include "conn_policy.h"
+#include "dlog.h"
+#include "evlog.h"
+#include "gatt_table.h"
+#include "history_xfer.h"
+#include "http_api.h"
+#include "http_sse.h"
+#include "mem_budget.h"
+#include "meter.h"
+#include "ota_update.h"
+#include "perf.h"
+#include "session_log.h"
+#include "site_link.h"
+#include "status_notify.h"
+#include "status_snapshot.h"
 
 char *TAG = "BLE-Server";
 uint8_t ble_addr_type;
 void ble_app_advertise(void);
+static void beacon_changed(void);
 
-#define LIGHT_GPIO 13
-static int light_state = 0;
+static uint32_t fw_version;
 
-// Write data to ESP32 defined as server
-static int device_write(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+// Posted by the actuator task and whoever raises a charger error, runs on
+// the NimBLE host task
+static struct ble_npl_event status_changed_ev;
+// Posted after a new BLE name reached flash
+static struct ble_npl_event name_changed_ev;
+// Posted by the esp_event task when Wi-Fi gets an address
+static struct ble_npl_event advertise_ev;
+
+static void wifi_apply_config(void);
+
+enum
 {
-    char *data = (char *)ctxt->om->om_data;
-    int data_len = ctxt->om->om_len;
+    BOOT_NVS,
+    BOOT_CONFIG,
+    BOOT_CHARGER,
+    BOOT_BLE,
+    BOOT_WIFI,
+    BOOT_BLE_ADV,
+    BOOT_HTTP,
+    BOOT_WIFI_IP,
+    BOOT_METER,
+    BOOT_EVLOG,
+    BOOT_OTA,
+    BOOT_STEADY,
+    BOOT_STAGE_COUNT
+};
+
+static int op_nop(const cmd_frame_t *frame, void *ctx)
+{
+    return 0;
+}
 
-    // Ensure null termination
-    char command[32];
-    memset(command, 0, sizeof(command));
-    if (data_len < sizeof(command) - 1)
+static int op_relay_set(const cmd_frame_t *frame, void *ctx)
+{
+    if (charger_relay_set(frame->payload[0], frame->payload[1] != 0))
     {
-        memcpy(command, data, data_len);
+        session_log_relay(frame->payload[0], frame->payload[1] != 0);
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &status_changed_ev);
     }
-    else
+    return 0;
+}
+
+static int op_config_set(const cmd_frame_t *frame, void *ctx)
+{
+    if (frame->payload[0] >= CONFIG_FIELD_COUNT)
+        return -1;
+    return config_set_part(frame->payload[0], frame->payload[1], &frame->payload[2], frame->len - 2);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+// The app sends its clock on connect, for chargers without Wi-Fi
+static int op_time_set(const cmd_frame_t *frame, void *ctx)
+{
+    const uint8_t *p = frame->payload;
+    if (charge_sched_set_tz((int16_t)get_le16(&p[4])) != ESP_OK)
+        return -1;
+    uint32_t unix_s = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    charge_sched_set_clock((int64_t)unix_s * 1000000);
+    return 0;
+}
+
+static int op_plan_window(const cmd_frame_t *frame, void *ctx)
+{
+    const uint8_t *p = frame->payload;
+    charge_window_t w = {.days = p[1], .channel = p[2], .start = get_le16(&p[3]), .end = get_le16(&p[5])};
+    return charge_sched_set_window(p[0], &w) == ESP_OK ? 0 : -1;
+}
+
+static int op_plan_tariff(const cmd_frame_t *frame, void *ctx)
+{
+    const uint8_t *p = frame->payload;
+    charge_tariff_t t = {.days = p[1], .start = get_le16(&p[2]), .end = get_le16(&p[4]), .price = get_le16(&p[6])};
+    return charge_sched_set_tariff(p[0], &t) == ESP_OK ? 0 : -1;
+}
+
+static int op_plan_prices(const cmd_frame_t *frame, void *ctx)
+{
+    const uint8_t *p = frame->payload;
+    return charge_sched_set_prices(get_le16(&p[0]), get_le16(&p[2]), p[4]) == ESP_OK ? 0 : -1;
+}
+
+static int op_current_limit(const cmd_frame_t *frame, void *ctx)
+{
+    uint8_t switched = charger_set_limit(get_le16(frame->payload));
+    for (uint8_t ch = 0; ch < CHARGER_RELAY_COUNT; ch++)
+        if (switched >> ch & 1)
+            session_log_relay(ch, charger_relay_get(ch));
+    if (switched)
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &status_changed_ev);
+    return 0;
+}
+
+// Dispatch table for cmd_proto, indexed by opcode
+static const cmd_op_t cmd_ops[CMD_OP_COUNT] = {
+    [CMD_OP_NOP] = {.fn = op_nop, .min_len = 0, .max_len = 0},
+    [CMD_OP_RELAY_SET] = {.fn = op_relay_set, .min_len = 2, .max_len = 2},
+    [CMD_OP_CONFIG_SET] = {.fn = op_config_set, .min_len = 2, .max_len = CMD_PROTO_MAX_PAYLOAD},
+    [CMD_OP_TIME_SET] = {.fn = op_time_set, .min_len = 6, .max_len = 6},
+    [CMD_OP_PLAN_WINDOW] = {.fn = op_plan_window, .min_len = 7, .max_len = 7},
+    [CMD_OP_PLAN_TARIFF] = {.fn = op_plan_tariff, .min_len = 8, .max_len = 8},
+    [CMD_OP_PLAN_PRICES] = {.fn = op_plan_prices, .min_len = 5, .max_len = 5},
+    [CMD_OP_CURRENT_LIMIT] = {.fn = op_current_limit, .min_len = 2, .max_len = 2},
+};
+
+static int cmd_proto_att_err(int rc)
+{
+    switch (rc)
     {
-        memcpy(command, data, sizeof(command) - 1);
+    case CMD_PROTO_ERR_TRUNCATED:
+    case CMD_PROTO_ERR_LEN:
+    case CMD_PROTO_ERR_TOO_MANY:
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    case CMD_PROTO_ERR_OPCODE:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
     }
+}
 
-    printf("Received command: '%s' (length: %d)\n", command, data_len);
+static void status_changed_cb(struct ble_npl_event *ev)
+{
+    status_notify_changed();
+    if (adv_beacon_update())
+        beacon_changed();
+    http_sse_notify(HTTP_SSE_STATUS);
+}
 
-    if (strcmp(command, "LIGHT ON") == 0)
-    {
-        printf("LIGHT ON - Turning ON GPIO %d\n", LIGHT_GPIO);
-        gpio_set_level(LIGHT_GPIO, 1);
-        light_state = 1;
+static void name_changed_cb(struct ble_npl_event *ev)
+{
+    char name[CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN + 1];
+    config_get_str(CONFIG_BLE_NAME, name, sizeof(name));
+    ble_svc_gap_device_name_set(name);
+    ble_app_advertise(); // Advertise with the new name (NO NimBLE re-init!)
+}
+
+static void advertise_cb(struct ble_npl_event *ev)
+{
+    ble_app_advertise();
+}
+
+// Settings take effect after the commit delay, on the settings task, as
+// they go to flash
+static void config_committed(uint32_t changed)
+{
+    if (changed & CONFIG_BIT(CONFIG_BLE_NAME))
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &name_changed_ev);
+    // Before Wi-Fi is up the boot stage picks the new credentials up itself
+    if ((changed & (CONFIG_BIT(CONFIG_WIFI_SSID) | CONFIG_BIT(CONFIG_WIFI_PASS))) && boot_stage_is_done(BOOT_WIFI))
+        wifi_apply_config();
+    if (changed & CONFIG_BIT(CONFIG_SITE_BUDGET))
+        site_link_reconfigure();
+}
+
+// Runs on the task that raised the error. Before BLE is up there is no one
+// to tell; the first status read has the flags.
+static void charger_error_raised(uint32_t fresh)
+{
+    session_log_fault(fresh);
+    if (boot_stage_is_done(BOOT_BLE))
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &status_changed_ev);
+}
+
+// Runs on the actuator task, BLE, HTTP, charge schedule and site commands alike
+static void actuator_run(const cmd_frame_t *frame, actuator_src_t src, uint16_t conn_handle)
+{
+    cmd_ops[frame->opcode].fn(frame, NULL);
+    charger_count_cmd(frame->seq);
+}
+
+// Scheduler callback, hands one queued command of a session to the actuator
+static bool session_exec(ble_session_t *s, const cmd_t *cmd)
+{
+    return actuator_submit(ACTUATOR_SRC_BLE, s->conn_handle, cmd);
+}
 
+// Command frames written to the CMD characteristic
+int cmd_chr_write(uint16_t conn_handle, const uint8_t *data, uint16_t data_len)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL)
+        return BLE_ATT_ERR_UNLIKELY;
+    s->stats.writes++;
+
+    int rc = cmd_proto_validate(data, data_len, cmd_ops, CMD_OP_COUNT);
+    if (rc == CMD_PROTO_ERR_UNKNOWN)
+    {
+        DLOG(CMD_UNKNOWN_TEXT, data_len);
+        return 0;
     }
-    else if (strcmp(command, "LIGHT OFF") == 0)
+    if (rc < 0)
     {
-        printf("LIGHT OFF - Turning OFF GPIO %d\n", LIGHT_GPIO);
-        gpio_set_level(LIGHT_GPIO, 0);
-        light_state = 0;
+        s->stats.writes_bad++;
+        charger_count_rejected();
+        DLOG(CMD_REJECTED, rc);
+        return cmd_proto_att_err(rc);
     }
 
+    // Commands wait for their turn so one busy phone cannot starve the others
+    if (!ble_session_enqueue(s, data, data_len, rc))
+    {
+        charger_count_rejected();
+        return BLE_ATT_ERR_PREPARE_QUEUE_FULL;
+    }
+    ble_session_schedule();
     return 0;
 }
 
-// Read data from ESP32 defined as server
+// Charger state as served over BLE and HTTP
+static void status_fill(status_snapshot_t *snap)
+{
+    const charger_stats_t *stats = charger_stats();
+    meter_dsp_out_t m;
+    meter_get(&m);
+    *snap = (status_snapshot_t){
+        .relay_count = CHARGER_RELAY_COUNT,
+        .relay_mask = charger_relay_mask(),
+        .uptime_s = (uint32_t)(esp_timer_get_time() / 1000000),
+        .error_flags = charger_error_flags(),
+        .fw_version = fw_version,
+        .cmds_run = stats->cmds_run,
+        .cmds_rejected = stats->cmds_rejected,
+        .relay_switches = stats->relay_switches,
+        .sessions = (uint8_t)(BLE_SESSION_MAX - ble_session_free_slots()),
+        .last_seq = stats->last_seq,
+        .v_rms_mv = m.v_rms_mv,
+        .i_rms_ma = m.i_rms_ma,
+        .power_w = m.power_w,
+        .energy_wh = (uint32_t)(m.energy_mj / 3600000),
+        .i_peak_ma = m.i_peak_ma,
+    };
+}
 
-static int device_read(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+// Status value served by reads and notifications of the STATUS characteristic
+static size_t status_encode(uint8_t *buf, size_t cap)
 {
-    // Get current GPIO state
-    //light_state = gpio_get_level(LIGHT_GPIO);
+    status_snapshot_t snap;
+    status_fill(&snap);
+    return status_snapshot_encode(&snap, buf, cap);
+}
 
-    // Debug print
-    printf("ESP32: Reading GPIO %d, level = %d\n", LIGHT_GPIO, light_state);
+// NimBLE calls this again for every Read Blob of a long read and slices the
+// value at the blob offset itself, so the session keeps the snapshot it
+// started with until the peer has read all of it
+int status_chr_read(uint16_t conn_handle, struct os_mbuf *om)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    uint8_t buf[STATUS_SNAPSHOT_SIZE];
+    const uint8_t *val = buf;
+    size_t len;
 
-    // Create status message
-    char status_msg[64];
-    snprintf(status_msg, sizeof(status_msg), "GPIO_13:%d", light_state);
+    if (s)
+        len = ble_session_long_read(s, status_encode, &val);
+    else
+        len = status_encode(buf, sizeof(buf));
 
-    printf("ESP32: Sending status: %s\n", status_msg);
+    int rc = os_mbuf_append(om, val, len);
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
 
-    os_mbuf_append(ctxt->om, status_msg, strlen(status_msg));
+// DIAG: a write picks the page and first entry, reads return them (perf.h)
+int diag_chr_write(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (len < 1 || len > 2)
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    if (data[0] >= PERF_PAGE_COUNT)
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    if (s == NULL)
+        return BLE_ATT_ERR_UNLIKELY;
+    s->diag_page = data[0];
+    s->diag_first = len > 1 ? data[1] : 0;
     return 0;
 }
 
-// Array of pointers to other service definitions
-// UUID - Universal Unique Identifier
-static const struct ble_gatt_svc_def gatt_svcs[] = {
-    {.type = BLE_GATT_SVC_TYPE_PRIMARY,
-     .uuid = BLE_UUID16_DECLARE(0x180), // Define UUID for device type
-     .characteristics = (struct ble_gatt_chr_def[]){
-         {.uuid = BLE_UUID16_DECLARE(0xFEF4), // Define UUID for reading
-          .flags = BLE_GATT_CHR_F_READ,
-          .access_cb = device_read},
-         {.uuid = BLE_UUID16_DECLARE(0xDEAD), // Define UUID for writing
-          .flags = BLE_GATT_CHR_F_WRITE,
-          .access_cb = device_write},
-         {0}}},
-    {0}};
+int diag_chr_read(uint16_t conn_handle, struct os_mbuf *om)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    uint8_t *buf = mem_pool_get(MEM_POOL_ATT);
+    if (buf == NULL)
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    // A page fits one read response, so it never changes under a Read Blob
+    size_t cap = (s ? s->mtu : BLE_ATT_MTU_DFLT) - 1;
+    if (cap > MEM_POOL_BLOCK_ATT)
+        cap = MEM_POOL_BLOCK_ATT;
+    size_t len = perf_diag_page(s ? s->diag_page : PERF_PAGE_LATENCY, s ? s->diag_first : 0, buf, cap);
+
+    int rc = os_mbuf_append(om, buf, len);
+    mem_pool_put(MEM_POOL_ATT, buf);
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
 
 // BLE event handling
 static int ble_gap_event(struct ble_gap_event *event, void *arg)
 {
     switch (event->type)
     {
-    // Advertise if connected
+    // Keep advertising while there are free session slots
     case BLE_GAP_EVENT_CONNECT:
-        ESP_LOGI("GAP", "BLE GAP EVENT CONNECT %s", event->connect.status == 0 ? "OK!" : "FAILED!");
-        if (event->connect.status != 0)
+        DLOG(GAP_CONNECT, event->connect.conn_handle, event->connect.status);
+        if (event->connect.status == 0 && ble_session_open(event->connect.conn_handle) == NULL)
         {
-            ble_app_advertise();
+            DLOG(GAP_NO_SESSION, event->connect.conn_handle);
+            ble_gap_terminate(event->connect.conn_handle, BLE_ERR_REM_USER_CONN_TERM);
         }
+        else if (event->connect.status == 0)
+            conn_policy_open(event->connect.conn_handle);
+        http_sse_notify(HTTP_SSE_STATUS); // Session count
+        ble_app_advertise();
         break;
-    // Advertise again after completion of the event
     case BLE_GAP_EVENT_DISCONNECT:
-        ESP_LOGI("GAP", "BLE GAP EVENT DISCONNECTED");
+        DLOG(GAP_DISCONNECT, event->disconnect.conn.conn_handle, event->disconnect.reason);
+        ble_session_close(event->disconnect.conn.conn_handle);
+        ota_update_conn_closed(event->disconnect.conn.conn_handle);
+        http_sse_notify(HTTP_SSE_STATUS);
         ble_app_advertise();
         break;
+    case BLE_GAP_EVENT_MTU:
+    {
+        ble_session_t *s = ble_session_find(event->mtu.conn_handle);
+        if (s)
+            s->mtu = event->mtu.value;
+        DLOG(GAP_MTU, event->mtu.value, event->mtu.conn_handle);
+        break;
+    }
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        conn_policy_conn_update(event->conn_update.conn_handle, event->conn_update.status);
+        break;
+    case BLE_GAP_EVENT_ENC_CHANGE:
+    {
+        ble_session_t *s = ble_session_find(event->enc_change.conn_handle);
+        if (s)
+            ble_session_update_auth(s);
+        break;
+    }
+    // Peer wrote a CCCD, track who wants status pushes and history chunks
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        status_notify_subscribe(event->subscribe.conn_handle, event->subscribe.attr_handle,
+                                event->subscribe.cur_notify, event->subscribe.cur_indicate);
+        history_xfer_subscribe(event->subscribe.conn_handle, event->subscribe.attr_handle,
+                               event->subscribe.cur_notify);
+        break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        if (event->notify_tx.status != 0)
+            status_notify_tx_done(event->notify_tx.conn_handle, event->notify_tx.indication);
+        break;
     case BLE_GAP_EVENT_ADV_COMPLETE:
-        ESP_LOGI("GAP", "BLE GAP EVENT");
+        DLOG(GAP_ADV_COMPLETE, event->adv_complete.reason);
         ble_app_advertise();
         break;
     default:
@@ -127,19 +413,46 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
     return 0;
 }
 
-// Define the BLE connection
-void ble_app_advertise(void)
+// Status beacon in the advertisement, the name in the scan response
+static void ble_app_set_adv_fields(void)
 {
-    // GAP - device name definition
     struct ble_hs_adv_fields fields;
-    const char *device_name;
     memset(&fields, 0, sizeof(fields));
-    device_name = ble_svc_gap_device_name(); // Read the BLE device name
-    fields.name = (uint8_t *)device_name;
-    fields.name_len = strlen(device_name);
-    fields.name_is_complete = 1;
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    fields.mfg_data = adv_beacon_data();
+    fields.mfg_data_len = ADV_BEACON_LEN;
     ble_gap_adv_set_fields(&fields);
 
+    // GAP - device name definition, cut to what fits a scan response
+    struct ble_hs_adv_fields rsp;
+    const char *device_name = ble_svc_gap_device_name();
+    size_t name_len = strlen(device_name);
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.name = (const uint8_t *)device_name;
+    rsp.name_len = name_len > BLE_HS_ADV_MAX_SZ - 2 ? BLE_HS_ADV_MAX_SZ - 2 : (uint8_t)name_len;
+    rsp.name_is_complete = rsp.name_len == name_len;
+    ble_gap_adv_rsp_set_fields(&rsp);
+}
+
+// Runs on the host task when a beacon field changed
+static void beacon_changed(void)
+{
+    if (ble_gap_adv_active())
+        ble_app_set_adv_fields();
+}
+
+// Define the BLE connection, a no-op while every session slot is taken.
+// Host task only.
+void ble_app_advertise(void)
+{
+    if (ble_session_free_slots() == 0)
+        return;
+
+    adv_beacon_update(); // Free slots changed
+    ble_app_set_adv_fields();
+    if (ble_gap_adv_active())
+        return; // Already advertising, the new fields are live
+
     // GAP - device connectivity definition
     struct ble_gap_adv_params adv_params;
     memset(&adv_params, 0, sizeof(adv_params));
@@ -153,27 +466,16 @@ void ble_app_on_sync(void)
 {
     ble_hs_id_infer_auto(0, &ble_addr_type); // Determines the best address type automatically
     ble_app_advertise();                     // Define the BLE connection
+    boot_stage_done(BOOT_BLE_ADV);
 }
 
 // The infinite task
 void host_task(void *param)
 {
+    mem_budget_guard();
     nimble_port_run(); // This function will return only when nimble_port_stop() is executed
 }
 
-// Add GPIO setup function
-void setup_light_gpio()
-{
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << LIGHT_GPIO),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = 0,
-        .pull_down_en = 0,
-        .intr_type = GPIO_INTR_DISABLE};
-    gpio_config(&io_conf);
-    gpio_set_level(LIGHT_GPIO, 0); // Default OFF
-}
-
 //// CODE For Local Server Starts
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
@@ -181,11 +483,20 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI("WIFI", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        ble_app_advertise(); // <-- Restart BLE advertising after WiFi reconnects
+        DLOG(WIFI_GOT_IP, IP2STR(&event->ip_info.ip));
+        boot_stage_done(BOOT_WIFI_IP);
+        // Restart BLE advertising after WiFi reconnects, on the host task
+        // that owns the beacon and GAP state
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &advertise_ev);
     }
 }
 
+// Runs on the lwIP task after every SNTP sync
+static void sntp_synced(struct timeval *tv)
+{
+    charge_sched_set_clock((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+}
+
 void wifi_init_sta(void)
 {
     esp_netif_init();
@@ -198,115 +509,88 @@ void wifi_init_sta(void)
     esp_event_handler_instance_t instance_any_id;
     esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, &instance_any_id);
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = "SUNSHINECDG",
-            .password = "sunshine_cdg2015",
-        },
-    };
     esp_wifi_set_mode(WIFI_MODE_STA);
-    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
     esp_wifi_start();
-    esp_wifi_connect();
-}
-esp_err_t set_config_post_handler(httpd_req_t *req)
-{
-    char buf[128];
-    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
-    if (ret <= 0)
-        return ESP_FAIL;
-    buf[ret] = 0;
-
-    // Parse form data (very basic, for demo)
-    char ble_name[32] = {0}, ssid[32] = {0}, password[64] = {0};
-    sscanf(buf, "name=%31[^&]&ssid=%31[^&]&password=%63s", ble_name, ssid, password);
-
-    // URL decode (replace + with space, decode %xx if needed)
-    for (int i = 0; ble_name[i]; i++)
-        if (ble_name[i] == '+')
-            ble_name[i] = ' ';
-    for (int i = 0; ssid[i]; i++)
-        if (ssid[i] == '+')
-            ssid[i] = ' ';
-    for (int i = 0; password[i]; i++)
-        if (password[i] == '+')
-            password[i] = ' ';
-
-    // Set BLE name (NO NimBLE re-init!)
-    if (strlen(ble_name) > 0)
-    {
-        ble_svc_gap_device_name_set(ble_name);
-        ble_app_advertise(); // Restart advertising with new name
-    }
+    wifi_apply_config();
+    site_link_init(); // ESP-NOW needs Wi-Fi started
 
-    // Set WiFi credentials and reconnect
-    if (strlen(ssid) > 0 && strlen(password) > 0)
+    // Starts polling once the station has an address
+    if (CONFIG_EVOLTE_SNTP_SERVER[0] != '\0')
     {
-        wifi_config_t wifi_config = {0};
-        strncpy((char *)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
-        strncpy((char *)wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
-        esp_wifi_disconnect();
-        esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-        esp_wifi_connect();
+        esp_sntp_config_t sntp = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_EVOLTE_SNTP_SERVER);
+        sntp.sync_cb = sntp_synced;
+        esp_netif_sntp_init(&sntp);
     }
-
-    httpd_resp_sendstr(req, "Configuration updated. <a href='/'>Go Back</a>");
-    return ESP_OK;
 }
 
-// Update your root_get_handler to include WiFi fields
-esp_err_t root_get_handler(httpd_req_t *req)
+// (Re)connect with the stored credentials, if there are any
+static void wifi_apply_config(void)
 {
-    const char *html_response =
-        "<!DOCTYPE html>"
-        "<html>"
-        "<head><title>ESP32 BLE Config</title></head>"
-        "<body>"
-        "<h2>ESP32 BLE & WiFi Config Server</h2>"
-        "<form method='POST' action='/set_config'>"
-        "Set BLE Name: <input name='name' maxlength='31'/><br>"
-        "WiFi SSID: <input name='ssid' maxlength='31'/><br>"
-        "WiFi Password: <input name='password' maxlength='63' type='password'/><br>"
-        "<input type='submit' value='Update'/>"
-        "</form>"
-        "</body></html>";
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_sendstr(req, html_response);
-    return ESP_OK;
+    wifi_config_t wifi_config = {0};
+    config_get_str(CONFIG_WIFI_SSID, (char *)wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid));
+    config_get_str(CONFIG_WIFI_PASS, (char *)wifi_config.sta.password, sizeof(wifi_config.sta.password));
+    if (wifi_config.sta.ssid[0] == '\0')
+        return;
+
+    esp_wifi_disconnect();
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_connect();
 }
+static const http_api_hooks_t api_hooks = {
+    .ops = cmd_ops,
+    .status = status_fill,
+};
 
-// Register the new handler in start_webserver
 void start_webserver(void)
 {
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    httpd_handle_t server = NULL;
-    if (httpd_start(&server, &config) == ESP_OK)
+    http_api_start(&api_hooks);
+}
+//// Code for Local Server Ends
+static void boot_nvs(void)
+{
+    esp_err_t rc = nvs_flash_init();
+    if (rc == ESP_ERR_NVS_NO_FREE_PAGES || rc == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
-        httpd_uri_t root_uri = {
-            .uri = "/",
-            .method = HTTP_GET,
-            .handler = root_get_handler,
-            .user_ctx = NULL};
-        httpd_register_uri_handler(server, &root_uri);
-
-        httpd_uri_t set_config_uri = {
-            .uri = "/set_config",
-            .method = HTTP_POST,
-            .handler = set_config_post_handler,
-            .user_ctx = NULL};
-        httpd_register_uri_handler(server, &set_config_uri);
+        nvs_flash_erase();
+        nvs_flash_init();
     }
 }
-//// Code for Local Server Ends
-void app_main()
+
+static void boot_config(void)
+{
+    config_store_init(config_committed);
+    charge_sched_init();
+}
+
+static void boot_charger(void)
+{
+    charger_init(charger_error_raised);
+    fw_version = status_snapshot_fw_version(esp_app_get_description()->version);
+    actuator_init(actuator_run);
+}
+
+static void boot_evlog(void)
+{
+    evlog_init();
+    session_log_init();
+}
+
+static void boot_ble(void)
 {
-    nvs_flash_init();
-    setup_light_gpio();
-    // wifi_init_sta();   // Initialize Wi-Fi station
-    // start_webserver(); // Start HTTP server
     //  esp_nimble_hci_and_controller_init();      // 2 - Initialize ESP controller
     nimble_port_init();                       // 3 - Initialize the host stack
-    ble_svc_gap_device_name_set("eVolte_01"); // 4 - Initialize NimBLE configuration - server name
+    ble_npl_event_init(&status_changed_ev, status_changed_cb, NULL);
+    ble_npl_event_init(&name_changed_ev, name_changed_cb, NULL);
+    ble_npl_event_init(&advertise_ev, advertise_cb, NULL);
+    ble_session_init(session_exec);
+    status_notify_init(&gatt_val_handles[GATT_CHR_STATUS], status_encode);
+    history_xfer_init(&gatt_val_handles[GATT_CHR_HISTORY]);
+    ota_update_ble_init(&gatt_val_handles[GATT_CHR_OTA]);
+    conn_policy_init();
+    adv_beacon_init(status_fill, beacon_changed);
+    char name[CONFIG_BT_NIMBLE_GAP_DEVICE_NAME_MAX_LEN + 1];
+    config_get_str(CONFIG_BLE_NAME, name, sizeof(name));
+    ble_svc_gap_device_name_set(name);        // 4 - Initialize NimBLE configuration - server name
     ble_svc_gap_init();                       // 4 - Initialize NimBLE configuration - gap service
     ble_svc_gatt_init();                      // 4 - Initialize NimBLE configuration - gatt service
     ble_gatts_count_cfg(gatt_svcs);           // 4 - Initialize NimBLE configuration - config gatt services
@@ -314,3 +598,33 @@ void app_main()
     ble_hs_cfg.sync_cb = ble_app_on_sync;     // 5 - Initialize application
     nimble_port_freertos_init(host_task);     // 6 - Run the thread
 }
+
+// BLE comes first so the charger is connectable before Wi-Fi has even
+// calibrated. Wi-Fi waits for the BLE controller because both bring up the
+// shared radio, then runs on its own task while BLE syncs and advertises.
+static const boot_stage_def_t boot_stages[BOOT_STAGE_COUNT] = {
+    [BOOT_NVS] = {.name = "nvs", .fn = boot_nvs},
+    [BOOT_CONFIG] = {.name = "config", .deps = BOOT_BIT(BOOT_NVS), .fn = boot_config},
+    [BOOT_CHARGER] = {.name = "charger", .fn = boot_charger},
+    [BOOT_BLE] = {.name = "ble", .deps = BOOT_BIT(BOOT_CONFIG) | BOOT_BIT(BOOT_CHARGER), .fn = boot_ble},
+    [BOOT_WIFI] = {.name = "wifi", .deps = BOOT_BIT(BOOT_BLE), .fn = wifi_init_sta, .own_task = true},
+    [BOOT_BLE_ADV] = {.name = "ble_adv", .deps = BOOT_BIT(BOOT_BLE)},
+    [BOOT_HTTP] = {.name = "http", .deps = BOOT_BIT(BOOT_WIFI), .fn = start_webserver},
+    [BOOT_WIFI_IP] = {.name = "wifi_ip", .deps = BOOT_BIT(BOOT_WIFI)},
+    [BOOT_METER] = {.name = "meter", .deps = BOOT_BIT(BOOT_CHARGER), .fn = meter_init},
+    [BOOT_EVLOG] = {.name = "evlog", .deps = BOOT_BIT(BOOT_METER), .fn = boot_evlog},
+    // A new image is kept once it is connectable over both radios and logging
+    [BOOT_OTA] = {.name = "ota",
+                  .deps = BOOT_BIT(BOOT_BLE_ADV) | BOOT_BIT(BOOT_HTTP) | BOOT_BIT(BOOT_EVLOG),
+                  .fn = ota_update_confirm},
+    // Bring-up allocates, running must not: guarded tasks are held to it
+    [BOOT_STEADY] = {.name = "steady", .deps = BOOT_BIT(BOOT_OTA), .fn = mem_budget_steady},
+};
+
+void app_main()
+{
+    perf_init();
+    dlog_init();
+    ota_update_init(); // Before any stage that could hang
+    boot_start(boot_stages, BOOT_STAGE_COUNT);
+}
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+
+#define MEM_GUARD_TASKS 8
+
+typedef struct
+{
+    const char *name;
+    uint8_t *mem;
+    uint16_t block_size;
+    uint8_t blocks;
+    uint32_t free_mask; // Bit n set: block n is in the pool
+    uint8_t peak;
+    uint32_t fails;
+} pool_t;
+
+#define MEM_POOL(name, block_size, blocks)                                              \
+    _Static_assert((blocks) > 0 && (blocks) < 32, #name " needs 1 to 31 blocks");        \
+    _Static_assert((block_size) % 8 == 0, #name " block size must keep blocks aligned"); \
+    static uint8_t pool_mem_##name[(blocks) * (block_size)] __attribute__((aligned(8)));         \
+    extern __typeof__(pool_mem_##name) mem_budget_pool_##name __attribute__((alias("pool_mem_" #name)));
+#define MEM_STATIC(name, bytes)
+#include "mem_budget.def"
+#undef MEM_POOL
+#undef MEM_STATIC
+
+static pool_t pools[MEM_POOL_COUNT] = {
+#define MEM_POOL(id, size, n) \
+    [MEM_POOL_##id] = {.name = #id, .mem = pool_mem_##id, .block_size = size, .blocks = n, .free_mask = (1u << (n)) - 1},
+#define MEM_STATIC(name, bytes)
+#include "mem_budget.def"
+#undef MEM_POOL
+#undef MEM_STATIC
+};
+
+// Written under guard_mux, read by the heap hook without it: a slot is
+// filled before n_guarded counts it. exempt[i] is only changed by task i.
+static portMUX_TYPE guard_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t guarded[MEM_GUARD_TASKS];
+static int exempt[MEM_GUARD_TASKS];
+static int n_guarded;
+static bool steady;
+static mem_heap_stats_t heap;
+
+void *mem_pool_get(mem_pool_t pool)
+{
+    pool_t *p = &pools[pool];
+    uint32_t mask = __atomic_load_n(&p->free_mask, __ATOMIC_RELAXED);
+    int i;
+    do
+    {
+        if (mask == 0)
+        {
+            __atomic_fetch_add(&p->fails, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        i = __builtin_ctz(mask);
+    } while (!__atomic_compare_exchange_n(&p->free_mask, &mask, mask & ~(1u << i), true, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED));
+
+    uint8_t used = (uint8_t)(p->blocks - __builtin_popcount(mask) + 1);
+    uint8_t peak = __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&p->peak, &peak, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return &p->mem[i * p->block_size];
+}
+
+void mem_pool_put(mem_pool_t pool, void *block)
+{
+    if (block == NULL)
+        return;
+    pool_t *p = &pools[pool];
+    size_t i = (size_t)((uint8_t *)block - p->mem) / p->block_size;
+    __atomic_fetch_or(&p->free_mask, 1u << i, __ATOMIC_RELEASE);
+}
+
+void mem_pool_stats(mem_pool_t pool, mem_pool_stats_t *out)
+{
+    const pool_t *p = &pools[pool];
+    uint32_t mask = __atomic_load_n(&p->free_mask, __ATOMIC_RELAXED);
+    out->name = p->name;
+    out->block_size = p->block_size;
+    out->blocks = p->blocks;
+    out->used = (uint8_t)(p->blocks - __builtin_popcount(mask));
+    out->peak = __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    out->fails = __atomic_load_n(&p->fails, __ATOMIC_RELAXED);
+}
+
+// ---- Heap guard ----
+
+void mem_budget_guard(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&guard_mux);
+    bool known = false;
+    for (int i = 0; i < n_guarded; i++)
+        known |= guarded[i] == self;
+    if (!known && n_guarded < MEM_GUARD_TASKS)
+    {
+        guarded[n_guarded] = self;
+        __atomic_store_n(&n_guarded, n_guarded + 1, __ATOMIC_RELEASE);
+    }
+    portEXIT_CRITICAL(&guard_mux);
+}
+
+void mem_budget_steady(void)
+{
+    __atomic_store_n(&steady, true, __ATOMIC_RELEASE);
+}
+
+// Only the calling task: another guarded task allocating meanwhile still
+// counts. A task that is not guarded has nothing to exempt.
+void mem_budget_exempt(bool on)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    int n = __atomic_load_n(&n_guarded, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++)
+    {
+        if (guarded[i] == self)
+        {
+            __atomic_fetch_add(&exempt[i], on ? 1 : -1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+const mem_heap_stats_t *mem_budget_heap(void)
+{
+    return &heap;
+}
+
+// Called by the heap for every allocation (CONFIG_HEAP_USE_HOOKS), from any
+// task or interrupt, so it only counts
+IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!__atomic_load_n(&steady, __ATOMIC_ACQUIRE))
+        return;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    int n = __atomic_load_n(&n_guarded, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++)
+    {
+        if (guarded[i] != self)
+            continue;
+        if (__atomic_load_n(&exempt[i], __ATOMIC_RELAXED))
+            return;
+        __atomic_fetch_add(&heap.allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&heap.bytes, (uint32_t)size, __ATOMIC_RELAXED);
+#if CONFIG_EVOLTE_HEAP_STRICT
+        abort();
+#endif
+        return;
+    }
+}
+
+IRAM_ATTR void esp_heap_trace_free_hook(void *ptr)
+{
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Fixed memory of the firmware, declared in mem_budget.def: block pools for
+// short-lived buffers, and a size limit for each module's large static
+// buffer. Once booted the firmware does no heap allocation at all. Tasks
+// that call mem_budget_guard have their heap allocations counted from
+// mem_budget_steady on, so a regression shows in /metrics, or aborts with
+// CONFIG_EVOLTE_HEAP_STRICT.
+
+typedef enum
+{
+#define MEM_POOL(name, block_size, blocks) MEM_POOL_##name,
+#define MEM_STATIC(name, bytes)
+#include "mem_budget.def"
+#undef MEM_POOL
+#undef MEM_STATIC
+    MEM_POOL_COUNT
+} mem_pool_t;
+
+enum
+{
+#define MEM_POOL(name, block_size, blocks) MEM_POOL_BLOCK_##name = (block_size),
+#define MEM_STATIC(name, bytes) MEM_STATIC_BYTES_##name = (bytes),
+#include "mem_budget.def"
+#undef MEM_POOL
+#undef MEM_STATIC
+};
+
+// After the buffer, at file scope in the module that owns it:
+//   MEM_BUDGET_FITS(DLOG_RING, ring);
+// Besides the check, the buffer gets a second name, mem_budget_static_<name>,
+// so the build's memory report (mem_report.cmake) can read its real size off
+// the image
+#define MEM_BUDGET_FITS(name, obj)                                                                       \
+    _Static_assert(sizeof(obj) <= MEM_STATIC_BYTES_##name, #name " outgrew its entry in mem_budget.def"); \
+    extern __typeof__(obj) mem_budget_static_##name __attribute__((alias(#obj)))
+
+typedef struct
+{
+    const char *name;
+    uint16_t block_size;
+    uint8_t blocks;
+    uint8_t used;
+    uint8_t peak;   // Most blocks out at once since boot
+    uint32_t fails; // Gets with every block out
+} mem_pool_stats_t;
+
+// A block of the pool, NULL if all are out. Lock-free, any task.
+void *mem_pool_get(mem_pool_t pool);
+void mem_pool_put(mem_pool_t pool, void *block);
+void mem_pool_stats(mem_pool_t pool, mem_pool_stats_t *out);
+
+typedef struct
+{
+    uint32_t allocs; // Heap allocations by guarded tasks since steady
+    uint32_t bytes;
+} mem_heap_stats_t;
+
+// Count the calling task's heap allocations once steady
+void mem_budget_guard(void);
+// Boot is over, from now on guarded tasks must not allocate
+void mem_budget_steady(void);
+// Around a library call that allocates by design, like starting an update.
+// Covers the calling task only.
+void mem_budget_exempt(bool on);
+const mem_heap_stats_t *mem_budget_heap(void);
@@ -0,0 +1,48 @@
+# Print the firmware's fixed memory as linked: every entry of mem_budget.def
+# with the size of the buffer behind it, read off the image by the
+# mem_budget_pool_<name> and mem_budget_static_<name> symbols. Run after
+# every link.
+#   cmake -DELF=<image> -DNM=<nm> -DDEF=<mem_budget.def> -P mem_report.cmake
+
+execute_process(COMMAND ${NM} -S --defined-only ${ELF} OUTPUT_VARIABLE syms RESULT_VARIABLE err)
+if(err)
+    message(FATAL_ERROR "mem_report: ${NM} failed on ${ELF}")
+endif()
+string(REGEX MATCHALL "[0-9a-fA-F]+ [0-9a-fA-F]+ [A-Za-z] mem_budget_(pool|static)_[A-Z0-9_]+" syms "${syms}")
+foreach(sym IN LISTS syms)
+    string(REGEX MATCH "^[0-9a-fA-F]+ ([0-9a-fA-F]+) . mem_budget_[a-z]+_([A-Z0-9_]+)$" _ "${sym}")
+    math(EXPR size_${CMAKE_MATCH_2} "0x${CMAKE_MATCH_1}")
+endforeach()
+
+file(READ ${DEF} def)
+string(REGEX MATCHALL "\nMEM_(POOL|STATIC)\\([A-Z0-9_]+" entries "${def}")
+
+function(column out text width)
+    string(LENGTH "${text}" n)
+    if(n LESS width)
+        math(EXPR pad "${width} - ${n}")
+        string(REPEAT " " ${pad} spaces)
+    endif()
+    set(${out} "${text}${spaces}" PARENT_SCOPE)
+endfunction()
+
+set(report "")
+set(pools 0)
+set(statics 0)
+foreach(entry IN LISTS entries)
+    string(REGEX MATCH "MEM_(POOL|STATIC)\\(([A-Z0-9_]+)" _ "${entry}")
+    string(TOLOWER ${CMAKE_MATCH_1} kind)
+    set(name ${CMAKE_MATCH_2})
+    if(DEFINED size_${name})
+        set(bytes ${size_${name}})
+        math(EXPR ${kind}s "${${kind}s} + ${bytes}")
+    else()
+        set(bytes "-") # Not in the image
+    endif()
+    column(c1 ${name} 17)
+    column(c2 ${kind} 7)
+    string(APPEND report "${c1}${c2}${bytes}\n")
+endforeach()
+math(EXPR total "${pools} + ${statics}")
+string(APPEND report "pools            ${pools}\nstatics          ${statics}\ntotal            ${total}")
+message("budget           kind   bytes\n${report}")
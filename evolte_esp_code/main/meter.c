@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include "charger.h"
+#include "dlog.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+#include "meter.h"
+#include "sdkconfig.h"
+
+#define METER_STACK 3072
+#define METER_PRIO 6 // Above the actuator, a late frame is a lost frame
+#define METER_CORE (portNUM_PROCESSORS - 1)
+// 128 pairs is 12.8 ms at 10 kHz; the pool holds four frames, so the task
+// may be held up for about 50 ms before samples are lost
+#define METER_FRAME_PAIRS 128
+#define METER_FRAME_BYTES (METER_FRAME_PAIRS * 2 * SOC_ADC_DIGI_RESULT_BYTES)
+#define METER_POOL_FRAMES 4
+
+#define METER_V_CHANNEL CONFIG_EVOLTE_METER_V_CHANNEL
+#define METER_I_CHANNEL CONFIG_EVOLTE_METER_I_CHANNEL
+
+static const char *TAG = "meter";
+
+static adc_continuous_handle_t adc;
+static TaskHandle_t meter_task_handle;
+static meter_dsp_t dsp;
+
+static portMUX_TYPE meter_lock = portMUX_INITIALIZER_UNLOCKED;
+static meter_dsp_out_t latest;
+static meter_stats_t stats;
+
+static bool IRAM_ATTR on_conv_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata,
+                                   void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(meter_task_handle, &woken);
+    return woken == pdTRUE;
+}
+
+static bool IRAM_ATTR on_pool_ovf(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata,
+                                  void *arg)
+{
+    stats.overruns++;
+    return false;
+}
+
+static struct
+{
+    uint16_t v[METER_FRAME_PAIRS];
+    uint16_t i[METER_FRAME_PAIRS];
+} samples;
+MEM_BUDGET_FITS(METER_SAMPLES, samples);
+
+// Split one DMA frame into voltage/current pairs. The pattern alternates the
+// two channels, but pairing by channel id keeps a dropped conversion from
+// swapping them for the rest of the run.
+static void meter_frame(const uint8_t *frame, uint32_t len)
+{
+    uint16_t *v = samples.v, *i = samples.i;
+    static uint16_t v_pending;
+    static bool have_v;
+    size_t n = 0;
+
+    for (uint32_t k = 0; k + SOC_ADC_DIGI_RESULT_BYTES <= len && n < METER_FRAME_PAIRS;
+         k += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        const adc_digi_output_data_t *d = (const adc_digi_output_data_t *)&frame[k];
+        if (d->type1.channel == METER_V_CHANNEL)
+        {
+            v_pending = d->type1.data;
+            have_v = true;
+        }
+        else if (d->type1.channel == METER_I_CHANNEL && have_v)
+        {
+            v[n] = v_pending;
+            i[n++] = d->type1.data;
+            have_v = false;
+        }
+    }
+
+    meter_dsp_out_t out[2];
+    int w = meter_dsp_feed(&dsp, v, i, n, out, 2);
+    portENTER_CRITICAL(&meter_lock);
+    if (w > 0)
+        latest = out[(w < 2 ? w : 2) - 1];
+    stats.windows += (uint32_t)w;
+    stats.frames++;
+    portEXIT_CRITICAL(&meter_lock);
+}
+
+static uint8_t dma_frame[METER_FRAME_BYTES];
+MEM_BUDGET_FITS(METER_FRAME, dma_frame);
+
+static void meter_task(void *param)
+{
+    uint32_t len;
+
+    mem_budget_guard();
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (adc_continuous_read(adc, dma_frame, sizeof(dma_frame), &len, 0) == ESP_OK)
+            meter_frame(dma_frame, len);
+    }
+}
+
+void meter_init(void)
+{
+    const meter_dsp_cfg_t cfg = {
+        .window = CONFIG_EVOLTE_METER_SAMPLE_HZ / 1000 * CONFIG_EVOLTE_METER_WINDOW_MS,
+        .sample_hz = CONFIG_EVOLTE_METER_SAMPLE_HZ,
+        .v_uv_per_lsb = CONFIG_EVOLTE_METER_V_UV_PER_LSB,
+        .i_ua_per_lsb = CONFIG_EVOLTE_METER_I_UA_PER_LSB,
+    };
+    meter_dsp_init(&dsp, &cfg);
+
+    if (xTaskCreatePinnedToCore(meter_task, "meter", METER_STACK, NULL, METER_PRIO, &meter_task_handle,
+                                METER_CORE) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start the meter task");
+        charger_set_error(CHARGER_ERR_METER);
+        return;
+    }
+
+    const adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = METER_POOL_FRAMES * METER_FRAME_BYTES,
+        .conv_frame_size = METER_FRAME_BYTES,
+    };
+    adc_digi_pattern_config_t pattern[2] = {
+        {.atten = ADC_ATTEN_DB_12, .channel = METER_V_CHANNEL, .unit = ADC_UNIT_1,
+         .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH},
+        {.atten = ADC_ATTEN_DB_12, .channel = METER_I_CHANNEL, .unit = ADC_UNIT_1,
+         .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH},
+    };
+    const adc_continuous_config_t adc_cfg = {
+        .pattern_num = 2,
+        .adc_pattern = pattern,
+        .sample_freq_hz = 2 * CONFIG_EVOLTE_METER_SAMPLE_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    const adc_continuous_evt_cbs_t cbs = {.on_conv_done = on_conv_done, .on_pool_ovf = on_pool_ovf};
+
+    esp_err_t err = adc_continuous_new_handle(&handle_cfg, &adc);
+    if (err == ESP_OK)
+        err = adc_continuous_config(adc, &adc_cfg);
+    if (err == ESP_OK)
+        err = adc_continuous_register_event_callbacks(adc, &cbs, NULL);
+    if (err == ESP_OK)
+        err = adc_continuous_start(adc);
+    if (err != ESP_OK)
+    {
+        DLOG(METER_START_FAILED, err);
+        charger_set_error(CHARGER_ERR_METER);
+    }
+}
+
+void meter_get(meter_dsp_out_t *out)
+{
+    portENTER_CRITICAL(&meter_lock);
+    *out = latest;
+    portEXIT_CRITICAL(&meter_lock);
+}
+
+const meter_stats_t *meter_stats(void)
+{
+    return &stats;
+}
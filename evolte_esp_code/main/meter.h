@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include "meter_dsp.h"
+
+// Voltage and current metering. ADC1 samples both channels in continuous
+// mode into DMA frames; a task on the application core turns them into one
+// aggregate per CONFIG_EVOLTE_METER_WINDOW_MS with the meter_dsp kernels, so
+// none of it runs on the NimBLE host or Wi-Fi core.
+
+typedef struct
+{
+    uint32_t windows;  // Aggregates computed
+    uint32_t frames;   // DMA frames processed
+    uint32_t overruns; // Frames lost because the task fell behind
+} meter_stats_t;
+
+void meter_init(void);
+
+// Latest aggregate, all zero until the first window completes
+void meter_get(meter_dsp_out_t *out);
+const meter_stats_t *meter_stats(void);
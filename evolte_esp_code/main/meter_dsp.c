@@ -0,0 +1,131 @@
+#include <string.h>
+#include "meter_dsp.h"
+
+void meter_dsp_init(meter_dsp_t *m, const meter_dsp_cfg_t *cfg)
+{
+    memset(m, 0, sizeof(*m));
+    m->cfg = *cfg;
+    m->v_scale_q16 = ((uint64_t)cfg->v_uv_per_lsb << 16) / 1000;
+    m->i_scale_q16 = ((uint64_t)cfg->i_ua_per_lsb << 16) / 1000;
+    m->v_dc = m->i_dc = 2048; // Mid scale of a 12-bit ADC until the first window
+    m->v_min = m->i_min = UINT32_MAX;
+}
+
+uint32_t meter_dsp_isqrt64(uint64_t x)
+{
+    uint64_t r = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > x)
+        bit >>= 2;
+    while (bit)
+    {
+        if (x >= r + bit)
+        {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+            r >>= 1;
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+// Count-domain value scaled by a Q16 calibration, rounded
+static uint32_t scale(uint64_t counts_q8, uint64_t scale_q16)
+{
+    return (uint32_t)((counts_q8 * scale_q16 + (1ull << 23)) >> 24);
+}
+
+static uint32_t peak(uint32_t lo, uint32_t hi, int32_t dc)
+{
+    int32_t a = dc - (int32_t)lo, b = (int32_t)hi - dc;
+    int32_t p = a > b ? a : b;
+    return p > 0 ? (uint32_t)p : 0;
+}
+
+static void window_end(meter_dsp_t *m, meter_dsp_out_t *out)
+{
+    int64_t n = m->n;
+    // n^2 * variance and n^2 * mean product, exact in 64 bits for 12-bit
+    // samples and windows up to ~500k pairs. Divided by n once before the
+    // Q16 shift so that cannot overflow either.
+    uint64_t v_var = m->v_sq * n - (uint64_t)(m->v_sum * m->v_sum);
+    uint64_t i_var = m->i_sq * n - (uint64_t)(m->i_sum * m->i_sum);
+    int64_t p = m->vi_sum * n - m->v_sum * m->i_sum;
+
+    // RMS in Q8 counts
+    out->v_rms_mv = scale(meter_dsp_isqrt64(((v_var / n) << 16) / n), m->v_scale_q16);
+    out->i_rms_ma = scale(meter_dsp_isqrt64(((i_var / n) << 16) / n), m->i_scale_q16);
+
+    // Q8 counts^2 -> mV*mA (uW) in Q8, then uW
+    int64_t p_q8 = (p / n) * 256 / n;
+    int64_t uw = p_q8 * (int64_t)m->v_scale_q16 / 65536 * (int64_t)m->i_scale_q16 / 65536 / 256;
+    out->power_w = (int32_t)(uw / 1000000);
+    if (uw > 0)
+        m->energy_uj += (uint64_t)uw * m->n / m->cfg.sample_hz;
+    out->energy_mj = m->energy_uj / 1000;
+
+    out->v_peak_mv = scale((uint64_t)peak(m->v_min, m->v_max, m->v_dc) << 8, m->v_scale_q16);
+    out->i_peak_ma = scale((uint64_t)peak(m->i_min, m->i_max, m->i_dc) << 8, m->i_scale_q16);
+
+    m->v_dc = (int32_t)(m->v_sum / n);
+    m->i_dc = (int32_t)(m->i_sum / n);
+    m->n = 0;
+    m->v_sum = m->i_sum = m->vi_sum = 0;
+    m->v_sq = m->i_sq = 0;
+    m->v_min = m->i_min = UINT32_MAX;
+    m->v_max = m->i_max = 0;
+}
+
+int meter_dsp_feed(meter_dsp_t *m, const uint16_t *v, const uint16_t *i, size_t n, meter_dsp_out_t *out, int cap)
+{
+    int done = 0;
+    while (n > 0)
+    {
+        size_t k = m->cfg.window - m->n;
+        if (k > n)
+            k = n;
+
+        // Hot loop: integer multiply-accumulate only, DC and scaling wait for
+        // the end of the window. Locals so the compiler keeps them in
+        // registers.
+        uint32_t vs = 0, is = 0, vmin = m->v_min, vmax = m->v_max, imin = m->i_min, imax = m->i_max;
+        uint64_t vq = 0, iq = 0;
+        int64_t viq = 0;
+        for (size_t j = 0; j < k; j++)
+        {
+            uint32_t a = v[j], b = i[j];
+            vs += a;
+            is += b;
+            vq += a * a;
+            iq += b * b;
+            viq += (int64_t)(a * b);
+            vmin = a < vmin ? a : vmin;
+            vmax = a > vmax ? a : vmax;
+            imin = b < imin ? b : imin;
+            imax = b > imax ? b : imax;
+        }
+        m->v_sum += vs;
+        m->i_sum += is;
+        m->v_sq += vq;
+        m->i_sq += iq;
+        m->vi_sum += viq;
+        m->v_min = vmin;
+        m->v_max = vmax;
+        m->i_min = imin;
+        m->i_max = imax;
+        m->n += (uint32_t)k;
+        v += k;
+        i += k;
+        n -= k;
+
+        if (m->n == m->cfg.window)
+        {
+            meter_dsp_out_t tmp;
+            window_end(m, done < cap ? &out[done] : &tmp);
+            done++;
+        }
+    }
+    return done;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-point metering kernels, free of ESP-IDF so the host can test and
+// benchmark them on recorded waveforms. Raw ADC counts of one voltage and one
+// current channel go in as sample pairs; every `window` pairs come out as one
+// aggregate. The DC bias of each channel is removed per window, so the
+// analog front end can sit anywhere on the ADC range.
+
+typedef struct
+{
+    uint32_t window;       // Sample pairs per aggregate, whole mains cycles
+    uint32_t sample_hz;    // Pairs per second
+    uint32_t v_uv_per_lsb; // Calibration, microvolts per ADC count
+    uint32_t i_ua_per_lsb; // Calibration, microamps per ADC count
+} meter_dsp_cfg_t;
+
+typedef struct
+{
+    uint32_t v_rms_mv;
+    uint32_t i_rms_ma;
+    int32_t power_w;    // Real power, negative when exporting
+    uint32_t v_peak_mv; // Largest excursion from the window's DC level
+    uint32_t i_peak_ma;
+    uint64_t energy_mj; // Running total of imported energy
+} meter_dsp_out_t;
+
+typedef struct
+{
+    meter_dsp_cfg_t cfg;
+    // Calibration in Q16 millivolts and milliamps per count
+    uint64_t v_scale_q16;
+    uint64_t i_scale_q16;
+    // Window accumulators
+    uint32_t n;
+    int64_t v_sum, i_sum;
+    uint64_t v_sq, i_sq;
+    int64_t vi_sum;
+    // Peaks are measured from the previous window's DC level
+    int32_t v_dc, i_dc;
+    uint32_t v_min, v_max, i_min, i_max;
+    // Energy in microjoules so short windows at low power still add up
+    uint64_t energy_uj;
+} meter_dsp_t;
+
+void meter_dsp_init(meter_dsp_t *m, const meter_dsp_cfg_t *cfg);
+
+// Feeds n sample pairs and returns how many windows they completed, each
+// written to out while there is room (cap)
+int meter_dsp_feed(meter_dsp_t *m, const uint16_t *v, const uint16_t *i, size_t n, meter_dsp_out_t *out, int cap);
+
+uint32_t meter_dsp_isqrt64(uint64_t x);
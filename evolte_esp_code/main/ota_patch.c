@@ -0,0 +1,287 @@
+#include <string.h>
+#include "ota_patch.h"
+
+enum
+{
+    ST_DIFF_LEN,
+    ST_EXTRA_LEN,
+    ST_SEEK,
+    ST_ZEROS,
+    ST_LITS_LEN,
+    ST_LITS,
+    ST_EXTRA,
+    ST_END,
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void fail(ota_patch_t *p, int err)
+{
+    if (p->err == OTA_PATCH_OK)
+        p->err = err;
+}
+
+// ---- Output and the old image ----
+
+static void flush(ota_patch_t *p)
+{
+    if (p->out_len && p->err == OTA_PATCH_OK && p->io.write(p->io.ctx, p->out_buf, p->out_len) != 0)
+        fail(p, OTA_PATCH_ERR_IO);
+    p->out_len = 0;
+}
+
+static void out_byte(ota_patch_t *p, uint8_t b)
+{
+    if (p->out_total >= p->hdr.new_size)
+    {
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return;
+    }
+    p->out_buf[p->out_len++] = b;
+    p->out_total++;
+    if (p->out_len == sizeof(p->out_buf))
+        flush(p);
+}
+
+static int old_byte(ota_patch_t *p, uint8_t *b)
+{
+    if (p->old_pos >= p->hdr.old_size)
+    {
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return -1;
+    }
+    // Also refills when old_pos is before the block, the difference wraps
+    if (p->old_pos - p->old_buf_off >= p->old_buf_len)
+    {
+        uint32_t n = p->hdr.old_size - p->old_pos;
+        if (n > sizeof(p->old_buf))
+            n = sizeof(p->old_buf);
+        if (p->io.read_old(p->io.ctx, p->old_pos, p->old_buf, n) != 0)
+        {
+            fail(p, OTA_PATCH_ERR_IO);
+            return -1;
+        }
+        p->old_buf_off = p->old_pos;
+        p->old_buf_len = n;
+    }
+    *b = p->old_buf[p->old_pos++ - p->old_buf_off];
+    return 0;
+}
+
+// ---- Patch ops ----
+
+static void end_ctrl(ota_patch_t *p)
+{
+    int64_t pos = (int64_t)p->old_pos + p->seek;
+    if (pos < 0 || pos > p->hdr.old_size)
+    {
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return;
+    }
+    p->old_pos = (uint32_t)pos;
+    p->state = p->out_total == p->hdr.new_size ? ST_END : ST_DIFF_LEN;
+}
+
+static void end_diff(ota_patch_t *p)
+{
+    if (p->extra_left)
+        p->state = ST_EXTRA;
+    else
+        end_ctrl(p);
+}
+
+static void varint_done(ota_patch_t *p, uint32_t v)
+{
+    switch (p->state)
+    {
+    case ST_DIFF_LEN:
+        p->diff_left = v;
+        p->state = ST_EXTRA_LEN;
+        break;
+    case ST_EXTRA_LEN:
+        p->extra_left = v;
+        p->state = ST_SEEK;
+        break;
+    case ST_SEEK:
+        p->seek = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        if (p->diff_left > p->hdr.new_size - p->out_total ||
+            p->extra_left > p->hdr.new_size - p->out_total - p->diff_left)
+            fail(p, OTA_PATCH_ERR_FORMAT);
+        else if (p->diff_left)
+            p->state = ST_ZEROS;
+        else
+            end_diff(p);
+        break;
+    case ST_ZEROS:
+        if (v > p->diff_left)
+        {
+            fail(p, OTA_PATCH_ERR_FORMAT);
+            break;
+        }
+        // Unchanged bytes, straight from the old image
+        p->diff_left -= v;
+        for (uint8_t b; v && old_byte(p, &b) == 0; v--)
+            out_byte(p, b);
+        if (p->diff_left == 0)
+            end_diff(p);
+        else
+            p->state = ST_LITS_LEN;
+        break;
+    case ST_LITS_LEN:
+        if (v == 0 || v > p->diff_left)
+        {
+            fail(p, OTA_PATCH_ERR_FORMAT);
+            break;
+        }
+        p->lit_left = v;
+        p->state = ST_LITS;
+        break;
+    }
+}
+
+static void op_byte(ota_patch_t *p, uint8_t b)
+{
+    uint8_t o;
+    switch (p->state)
+    {
+    case ST_LITS:
+        if (old_byte(p, &o) != 0)
+            return;
+        out_byte(p, (uint8_t)(o + b));
+        p->diff_left--;
+        if (--p->lit_left == 0)
+        {
+            if (p->diff_left == 0)
+                end_diff(p);
+            else
+                p->state = ST_ZEROS;
+        }
+        return;
+    case ST_EXTRA:
+        out_byte(p, b);
+        if (--p->extra_left == 0)
+            end_ctrl(p);
+        return;
+    case ST_END:
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return;
+    }
+
+    // LEB128, at most 32 bits
+    if (p->var_shift == 28 && (b & 0xf0))
+    {
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return;
+    }
+    p->var |= (uint32_t)(b & 0x7f) << p->var_shift;
+    if (b & 0x80)
+    {
+        p->var_shift += 7;
+        return;
+    }
+    uint32_t v = p->var;
+    p->var = 0;
+    p->var_shift = 0;
+    varint_done(p, v);
+}
+
+// ---- LZSS ----
+
+static void emit(ota_patch_t *p, uint8_t c)
+{
+    p->win[p->win_pos++ % OTA_PATCH_WINDOW] = c;
+    op_byte(p, c);
+}
+
+static void lz_byte(ota_patch_t *p, uint8_t b)
+{
+    if (p->flag_bits == 0)
+    {
+        p->flags = b;
+        p->flag_bits = 8;
+        return;
+    }
+    if (p->flags & 1)
+    {
+        emit(p, b);
+    }
+    else
+    {
+        p->tok[p->tok_len++] = b;
+        bool ext = (p->tok[1] & 0x0f) == 0x0f;
+        if (p->tok_len < 2 || (ext && p->tok_len < 3))
+            return;
+        uint32_t off = (p->tok[0] | (uint32_t)(p->tok[1] >> 4) << 8) + 1;
+        uint32_t len = ext ? 18u + p->tok[2] : (p->tok[1] & 0x0fu) + OTA_PATCH_MIN_MATCH;
+        p->tok_len = 0;
+        if (off > OTA_PATCH_WINDOW || off > p->win_pos)
+        {
+            fail(p, OTA_PATCH_ERR_FORMAT);
+            return;
+        }
+        for (; len && p->err == OTA_PATCH_OK; len--)
+            emit(p, p->win[(p->win_pos - off) % OTA_PATCH_WINDOW]);
+    }
+    p->flags >>= 1;
+    p->flag_bits--;
+}
+
+// ---- API ----
+
+static void parse_header(ota_patch_t *p)
+{
+    const uint8_t *h = p->hdr_buf;
+    if (memcmp(h, OTA_PATCH_MAGIC, 4) != 0)
+    {
+        fail(p, OTA_PATCH_ERR_FORMAT);
+        return;
+    }
+    p->hdr.old_size = get_le32(&h[4]);
+    p->hdr.new_size = get_le32(&h[8]);
+    memcpy(p->hdr.old_sha256, &h[12], 32);
+    memcpy(p->hdr.new_sha256, &h[44], 32);
+    if (p->io.on_header && p->io.on_header(p->io.ctx, &p->hdr) != 0)
+        fail(p, OTA_PATCH_ERR_BASE);
+    p->state = p->hdr.new_size ? ST_DIFF_LEN : ST_END;
+}
+
+void ota_patch_init(ota_patch_t *p, const ota_patch_io_t *io)
+{
+    memset(p, 0, sizeof(*p));
+    p->io = *io;
+}
+
+int ota_patch_feed(ota_patch_t *p, const void *data, size_t len)
+{
+    const uint8_t *d = data;
+    for (size_t i = 0; i < len && p->err == OTA_PATCH_OK; i++)
+    {
+        if (p->hdr_len < OTA_PATCH_HDR_LEN)
+        {
+            p->hdr_buf[p->hdr_len++] = d[i];
+            if (p->hdr_len == OTA_PATCH_HDR_LEN)
+                parse_header(p);
+        }
+        else
+        {
+            lz_byte(p, d[i]);
+        }
+    }
+    return p->err;
+}
+
+int ota_patch_finish(ota_patch_t *p)
+{
+    flush(p);
+    if (p->err == OTA_PATCH_OK && (p->hdr_len < OTA_PATCH_HDR_LEN || p->state != ST_END || p->tok_len != 0))
+        p->err = OTA_PATCH_ERR_TRUNCATED;
+    return p->err;
+}
+
+const ota_patch_hdr_t *ota_patch_header(const ota_patch_t *p)
+{
+    return p->hdr_len == OTA_PATCH_HDR_LEN ? &p->hdr : NULL;
+}
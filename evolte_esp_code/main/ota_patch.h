@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Delta update patches (host/tools/ota_diff), applied as they stream in.
+// The new image is rebuilt from the one that is running plus the patch,
+// so a small fix to the firmware ships as a few KB instead of the whole
+// image. Free of ESP-IDF: the running image is read and the new one
+// written through callbacks, and nothing is allocated.
+//
+// Patch layout:
+//   "EVD1" old_size:u32 new_size:u32 old_sha256[32] new_sha256[32]
+//   then LZSS compressed (OTA_PATCH_WINDOW bytes of history):
+//     flags:u8 and eight items, bit i set for a literal byte, clear for a
+//     match  off_lo:u8 off_hi:4|len:4 [len_ext:u8], which copies len + 3
+//     bytes (18 + len_ext when len is 15) from off + 1 bytes back
+//   The decompressed stream is bsdiff style, integers LEB128 varints:
+//     diff_len extra_len seek(zigzag)
+//     diff_len bytes of new = old + delta, coded as runs of
+//       zeros:varint [lits:varint lits bytes of delta] until diff_len
+//     extra_len literal bytes of new
+//     then seek moves the read position in old
+//   until new_size bytes are out.
+// A corrupt patch can only produce a wrong image, which the caller's
+// SHA-256 of the output then rejects.
+
+#define OTA_PATCH_MAGIC "EVD1"
+#define OTA_PATCH_HDR_LEN 76
+#define OTA_PATCH_WINDOW 2048
+#define OTA_PATCH_MIN_MATCH 3
+#define OTA_PATCH_MAX_MATCH (18 + 255)
+#define OTA_PATCH_OUT_BUF 256
+#define OTA_PATCH_OLD_BUF 256
+
+enum
+{
+    OTA_PATCH_OK = 0,
+    OTA_PATCH_ERR_FORMAT = -1,    // Not a patch, or a corrupt one
+    OTA_PATCH_ERR_BASE = -2,      // on_header refused it
+    OTA_PATCH_ERR_IO = -3,        // read_old or write failed
+    OTA_PATCH_ERR_TRUNCATED = -4, // Ended before new_size bytes came out
+};
+
+typedef struct
+{
+    uint32_t old_size;
+    uint32_t new_size;
+    uint8_t old_sha256[32];
+    uint8_t new_sha256[32];
+} ota_patch_hdr_t;
+
+typedef struct
+{
+    // Non-zero refuses the patch, e.g. when it was made for another image
+    int (*on_header)(void *ctx, const ota_patch_hdr_t *hdr);
+    int (*read_old)(void *ctx, uint32_t off, void *buf, size_t len);
+    int (*write)(void *ctx, const void *data, size_t len);
+    void *ctx;
+} ota_patch_io_t;
+
+typedef struct
+{
+    ota_patch_io_t io;
+    int err;
+    ota_patch_hdr_t hdr;
+    uint8_t hdr_buf[OTA_PATCH_HDR_LEN];
+    uint32_t hdr_len;
+    // LZSS
+    uint8_t win[OTA_PATCH_WINDOW];
+    uint32_t win_pos; // Bytes ever decompressed
+    uint8_t flags;
+    uint8_t flag_bits; // Items left in the current group
+    uint8_t tok_len;   // Match bytes read so far
+    uint8_t tok[3];
+    // Patch ops
+    uint8_t state;
+    uint8_t var_shift;
+    uint32_t var;
+    uint32_t diff_left;
+    uint32_t extra_left;
+    uint32_t lit_left;
+    int32_t seek;
+    uint32_t old_pos;
+    uint32_t out_total;
+    // Reads of the old image and writes of the new one, in blocks
+    uint8_t old_buf[OTA_PATCH_OLD_BUF];
+    uint32_t old_buf_off;
+    uint32_t old_buf_len;
+    uint8_t out_buf[OTA_PATCH_OUT_BUF];
+    uint32_t out_len;
+} ota_patch_t;
+
+void ota_patch_init(ota_patch_t *p, const ota_patch_io_t *io);
+// Feeds the next len patch bytes, OTA_PATCH_OK or the first error (sticky)
+int ota_patch_feed(ota_patch_t *p, const void *data, size_t len);
+// After the last byte: flushes the output and checks it is complete
+int ota_patch_finish(ota_patch_t *p);
+// Valid once OTA_PATCH_HDR_LEN bytes were fed
+const ota_patch_hdr_t *ota_patch_header(const ota_patch_t *p);
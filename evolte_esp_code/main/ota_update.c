@@ -0,0 +1,601 @@
+#include <string.h>
+#include "dlog.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+#include "mbedtls/sha256.h"
+#include "mem_budget.h"
+#include "nimble/nimble_port.h"
+#include "ota_patch.h"
+#include "ota_update.h"
+#include "sdkconfig.h"
+
+#define OTA_TASK_STACK 4096
+#define OTA_TASK_PRIO 3
+#define OTA_BEGIN_LEN 37
+#define OTA_BEGIN_FMT_LEN 38
+#define OTA_BASE_READ 256
+#define OTA_DATA_HDR_LEN 5
+
+static SemaphoreHandle_t lock; // Transfer state, hash and flash
+
+static struct
+{
+    bool active;
+    ota_src_t src;
+    ota_fmt_t fmt;
+    uint32_t gen;     // Bumped by every begin and end, so stale BLE data is dropped
+    uint32_t in_size; // The stream, image or patch
+    uint32_t received;
+    const esp_partition_t *part;
+    esp_ota_handle_t handle;
+    uint32_t size; // The image, known from a patch's header
+    uint32_t written;
+    uint8_t sha[32];
+    mbedtls_sha256_context ctx;
+    int64_t started_us;
+    ota_patch_t patch;
+    ota_status_t patch_st; // Why a patch callback failed
+} xfer;
+MEM_BUDGET_FITS(OTA_XFER, xfer);
+
+static ota_stats_t stats;
+static esp_timer_handle_t restart_timer;
+static esp_timer_handle_t confirm_timer;
+
+// BLE data waits in the ring for the OTA task, which does the flash writes
+// so the host task never blocks on an erase
+static const uint16_t *ota_handle;
+static TaskHandle_t task;
+static struct ble_npl_event ack_ev;
+static uint16_t ble_conn = BLE_HS_CONN_HANDLE_NONE; // Host task only
+
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t ring[OTA_WINDOW];
+MEM_BUDGET_FITS(OTA_WINDOW, ring);
+static uint32_t r_head, r_tail; // Free running byte counts
+static uint32_t ring_gen;       // The transfer the ring holds data of
+static uint32_t rx_off;         // Stream offset the next DATA must start at
+static bool ring_open;
+static bool finishing;         // FINISH came, verify once the ring is drained
+static uint8_t ack_status;     // What the next ack_ev sends
+static uint32_t ack_off;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ---- Flash writes and patch callbacks, under lock ----
+
+static ota_status_t image_write(const void *data, size_t len)
+{
+    if (xfer.written + len > xfer.size)
+        return OTA_ST_SIZE;
+    esp_err_t rc = esp_ota_write(xfer.handle, data, len);
+    if (rc != ESP_OK)
+        return rc == ESP_ERR_OTA_VALIDATE_FAILED ? OTA_ST_IMAGE : OTA_ST_FLASH;
+    mbedtls_sha256_update(&xfer.ctx, data, len);
+    xfer.written += len;
+    return OTA_ST_OK;
+}
+
+// The patch must have been made against exactly the image that runs
+static bool base_matches(const ota_patch_hdr_t *hdr)
+{
+    const esp_partition_t *base = esp_ota_get_running_partition();
+    uint8_t buf[OTA_BASE_READ], sha[32];
+    mbedtls_sha256_context ctx;
+    if (base == NULL || hdr->old_size > base->size)
+        return false;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    bool ok = true;
+    for (uint32_t off = 0; ok && off < hdr->old_size; off += sizeof(buf))
+    {
+        uint32_t n = hdr->old_size - off < sizeof(buf) ? hdr->old_size - off : sizeof(buf);
+        ok = esp_partition_read(base, off, buf, n) == ESP_OK;
+        mbedtls_sha256_update(&ctx, buf, n);
+    }
+    mbedtls_sha256_finish(&ctx, sha);
+    mbedtls_sha256_free(&ctx);
+    return ok && memcmp(sha, hdr->old_sha256, sizeof(sha)) == 0;
+}
+
+static int patch_header(void *ctx, const ota_patch_hdr_t *hdr)
+{
+    if (memcmp(hdr->new_sha256, xfer.sha, sizeof(xfer.sha)) != 0)
+        xfer.patch_st = OTA_ST_HASH;
+    else if (hdr->new_size == 0 || hdr->new_size > xfer.part->size)
+        xfer.patch_st = OTA_ST_SIZE;
+    else if (!base_matches(hdr))
+        xfer.patch_st = OTA_ST_BASE;
+    else
+        xfer.size = hdr->new_size;
+    DLOG(OTA_PATCH, hdr->old_size, hdr->new_size);
+    return xfer.patch_st == OTA_ST_OK ? 0 : -1;
+}
+
+static int patch_read_old(void *ctx, uint32_t off, void *buf, size_t len)
+{
+    if (esp_partition_read(esp_ota_get_running_partition(), off, buf, len) == ESP_OK)
+        return 0;
+    xfer.patch_st = OTA_ST_FLASH;
+    return -1;
+}
+
+static int patch_write(void *ctx, const void *data, size_t len)
+{
+    xfer.patch_st = image_write(data, len);
+    return xfer.patch_st == OTA_ST_OK ? 0 : -1;
+}
+
+static ota_status_t patch_status(int rc)
+{
+    switch (rc)
+    {
+    case OTA_PATCH_OK:
+        return OTA_ST_OK;
+    case OTA_PATCH_ERR_BASE:
+    case OTA_PATCH_ERR_IO:
+        return xfer.patch_st;
+    default:
+        return OTA_ST_PATCH;
+    }
+}
+
+// ---- Transfer, all under lock ----
+
+static void end_locked(ota_status_t st)
+{
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - xfer.started_us) / 1000);
+    if (st == OTA_ST_DONE)
+    {
+        stats.updates++;
+        stats.patches += xfer.fmt == OTA_FMT_PATCH;
+        stats.last_bytes = xfer.received;
+        stats.last_ms = ms;
+        DLOG(OTA_DONE, xfer.received, ms);
+    }
+    else
+    {
+        stats.failed++;
+        DLOG(OTA_FAILED, st, xfer.received);
+    }
+    mbedtls_sha256_free(&xfer.ctx);
+    xfer.active = false;
+    xfer.gen++;
+
+    portENTER_CRITICAL(&ring_lock);
+    ring_open = false;
+    finishing = false;
+    r_tail = r_head;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+static void abort_locked(ota_status_t st)
+{
+    mem_budget_exempt(true);
+    esp_ota_abort(xfer.handle);
+    mem_budget_exempt(false);
+    end_locked(st);
+}
+
+static ota_status_t begin_locked(ota_src_t src, ota_fmt_t fmt, uint32_t size, const uint8_t *sha)
+{
+    const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+    if (part == NULL || size == 0 || size > part->size)
+        return OTA_ST_SIZE;
+    // Sectors are erased as the image reaches them, not all up front. The
+    // OTA component allocates its handle, the only heap use after boot.
+    mem_budget_exempt(true);
+    esp_err_t err = esp_ota_begin(part, OTA_WITH_SEQUENTIAL_WRITES, &xfer.handle);
+    mem_budget_exempt(false);
+    if (err != ESP_OK)
+        return OTA_ST_FLASH;
+
+    xfer.active = true;
+    xfer.src = src;
+    xfer.fmt = fmt;
+    xfer.gen++;
+    xfer.in_size = size;
+    xfer.received = 0;
+    xfer.part = part;
+    xfer.size = fmt == OTA_FMT_IMAGE ? size : 0;
+    xfer.written = 0;
+    memcpy(xfer.sha, sha, sizeof(xfer.sha));
+    mbedtls_sha256_init(&xfer.ctx);
+    mbedtls_sha256_starts(&xfer.ctx, 0);
+    xfer.started_us = esp_timer_get_time();
+    if (fmt == OTA_FMT_PATCH)
+    {
+        static const ota_patch_io_t io = {
+            .on_header = patch_header, .read_old = patch_read_old, .write = patch_write};
+        ota_patch_init(&xfer.patch, &io);
+        xfer.patch_st = OTA_ST_OK;
+    }
+    DLOG(OTA_BEGIN, src, size);
+    return OTA_ST_OK;
+}
+
+static ota_status_t write_locked(const void *data, size_t len)
+{
+    if (!xfer.active)
+        return OTA_ST_IDLE;
+    if (xfer.received + len > xfer.in_size)
+        return OTA_ST_SIZE;
+    xfer.received += len;
+    if (xfer.fmt == OTA_FMT_IMAGE)
+        return image_write(data, len);
+    return patch_status(ota_patch_feed(&xfer.patch, data, len));
+}
+
+static ota_status_t finish_locked(void)
+{
+    if (!xfer.active)
+        return OTA_ST_IDLE;
+    // A patch still holds the last bytes of the image
+    ota_status_t st = xfer.fmt == OTA_FMT_PATCH ? patch_status(ota_patch_finish(&xfer.patch)) : OTA_ST_OK;
+    uint8_t sha[32];
+    mbedtls_sha256_finish(&xfer.ctx, sha);
+
+    if (st == OTA_ST_OK)
+    {
+        if (xfer.received != xfer.in_size || xfer.written != xfer.size)
+            st = OTA_ST_SIZE;
+        else if (memcmp(sha, xfer.sha, sizeof(sha)) != 0)
+            st = OTA_ST_HASH;
+        else
+            st = OTA_ST_DONE;
+    }
+    mem_budget_exempt(true);
+    if (st != OTA_ST_DONE)
+        esp_ota_abort(xfer.handle);
+    else if (esp_ota_end(xfer.handle) != ESP_OK)
+        st = OTA_ST_IMAGE;
+    else if (esp_ota_set_boot_partition(xfer.part) != ESP_OK)
+        st = OTA_ST_FLASH;
+    mem_budget_exempt(false);
+    end_locked(st);
+
+    // Late enough for the reply to reach the client
+    if (st == OTA_ST_DONE)
+        esp_timer_start_once(restart_timer, OTA_RESTART_MS * 1000ULL);
+    return st;
+}
+
+// A BLE transfer whose client went away may be taken over by anyone
+static bool can_take_over(uint16_t conn_handle)
+{
+    return !xfer.active ||
+           (xfer.src == OTA_SRC_BLE && (ble_conn == BLE_HS_CONN_HANDLE_NONE || ble_conn == conn_handle));
+}
+
+ota_status_t ota_update_begin(ota_src_t src, ota_fmt_t fmt, uint32_t size, const uint8_t sha256[32])
+{
+    ota_status_t st = OTA_ST_BUSY;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (can_take_over(BLE_HS_CONN_HANDLE_NONE))
+    {
+        if (xfer.active)
+            abort_locked(OTA_ST_BUSY);
+        st = begin_locked(src, fmt, size, sha256);
+    }
+    xSemaphoreGive(lock);
+    return st;
+}
+
+ota_status_t ota_update_write(const void *data, size_t len)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    ota_status_t st = write_locked(data, len);
+    if (st != OTA_ST_OK && st != OTA_ST_IDLE)
+        abort_locked(st);
+    xSemaphoreGive(lock);
+    return st;
+}
+
+ota_status_t ota_update_finish(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    ota_status_t st = finish_locked();
+    xSemaphoreGive(lock);
+    return st;
+}
+
+void ota_update_abort(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (xfer.active)
+        abort_locked(OTA_ST_IDLE);
+    xSemaphoreGive(lock);
+}
+
+// ---- Rollback ----
+
+static void restart_cb(void *arg)
+{
+    esp_restart();
+}
+
+static void confirm_timeout_cb(void *arg)
+{
+    DLOG(OTA_ROLLBACK);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void ota_update_init(void)
+{
+    if (lock == NULL)
+    {
+        lock = xSemaphoreCreateMutex();
+        esp_timer_create(&(esp_timer_create_args_t){.callback = restart_cb, .name = "ota_restart"}, &restart_timer);
+        esp_timer_create(&(esp_timer_create_args_t){.callback = confirm_timeout_cb, .name = "ota_confirm"},
+                         &confirm_timer);
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    stats.pending_verify =
+        esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+    if (stats.pending_verify)
+    {
+        DLOG(OTA_PENDING, running->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0, CONFIG_EVOLTE_OTA_CONFIRM_S);
+        esp_timer_start_once(confirm_timer, CONFIG_EVOLTE_OTA_CONFIRM_S * 1000000ULL);
+    }
+}
+
+void ota_update_confirm(void)
+{
+    if (!stats.pending_verify)
+        return;
+    esp_timer_stop(confirm_timer);
+    esp_ota_mark_app_valid_cancel_rollback();
+    stats.pending_verify = false;
+    DLOG(OTA_CONFIRMED);
+}
+
+// ---- BLE ----
+
+static void notify(uint16_t conn_handle, uint8_t st, uint32_t off)
+{
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE)
+        return;
+    uint8_t buf[5] = {st};
+    put_le32(&buf[1], off);
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(buf, sizeof(buf));
+    if (om)
+        ble_gatts_notify_custom(conn_handle, *ota_handle, om);
+}
+
+// Sends what the OTA task last reported, runs on the host task
+static void ack_cb(struct ble_npl_event *ev)
+{
+    portENTER_CRITICAL(&ring_lock);
+    uint8_t st = ack_status;
+    uint32_t off = ack_off;
+    portEXIT_CRITICAL(&ring_lock);
+    notify(ble_conn, st, off);
+}
+
+static void post_ack(ota_status_t st, uint32_t off)
+{
+    portENTER_CRITICAL(&ring_lock);
+    ack_status = (uint8_t)st;
+    ack_off = off;
+    portEXIT_CRITICAL(&ring_lock);
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &ack_ev);
+}
+
+static void drain(void)
+{
+    for (;;)
+    {
+        portENTER_CRITICAL(&ring_lock);
+        uint32_t n = r_head - r_tail;
+        uint32_t tail = r_tail;
+        uint32_t gen = ring_gen;
+        bool fin = finishing && n == 0;
+        finishing = finishing && !fin;
+        portEXIT_CRITICAL(&ring_lock);
+
+        if (fin)
+        {
+            xSemaphoreTake(lock, portMAX_DELAY);
+            ota_status_t st = xfer.active && xfer.gen == gen ? finish_locked() : OTA_ST_IDLE;
+            uint32_t received = xfer.received;
+            xSemaphoreGive(lock);
+            post_ack(st, received);
+            continue;
+        }
+        if (n == 0)
+            break;
+
+        uint32_t off = tail % OTA_WINDOW;
+        if (n > OTA_WINDOW - off)
+            n = OTA_WINDOW - off;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        ota_status_t st = xfer.active && xfer.gen == gen ? write_locked(&ring[off], n) : OTA_ST_IDLE;
+        if (st != OTA_ST_OK && st != OTA_ST_IDLE)
+            abort_locked(st);
+        uint32_t received = xfer.received;
+        xSemaphoreGive(lock);
+
+        portENTER_CRITICAL(&ring_lock);
+        if (ring_gen == gen)
+            r_tail = st == OTA_ST_OK ? r_tail + n : r_head;
+        portEXIT_CRITICAL(&ring_lock);
+        if (st != OTA_ST_OK)
+        {
+            if (st != OTA_ST_IDLE)
+                post_ack(st, received);
+            continue;
+        }
+        if (received / OTA_ACK_BYTES != (received - n) / OTA_ACK_BYTES)
+            post_ack(OTA_ST_OK, received);
+    }
+}
+
+static void ota_task(void *param)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        drain();
+    }
+}
+
+static void ble_begin(uint16_t conn_handle, ota_fmt_t fmt, uint32_t size, const uint8_t *sha)
+{
+    ota_status_t st = OTA_ST_BUSY;
+    uint32_t off = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (can_take_over(conn_handle))
+    {
+        st = OTA_ST_OK;
+        if (xfer.active && xfer.fmt == fmt && xfer.in_size == size && memcmp(xfer.sha, sha, sizeof(xfer.sha)) == 0)
+        {
+            // Same stream: carry on after what already arrived
+            portENTER_CRITICAL(&ring_lock);
+            off = rx_off;
+            portEXIT_CRITICAL(&ring_lock);
+            DLOG(OTA_RESUME, conn_handle, off);
+        }
+        else
+        {
+            if (xfer.active)
+                abort_locked(OTA_ST_BUSY);
+            st = begin_locked(OTA_SRC_BLE, fmt, size, sha);
+            if (st == OTA_ST_OK)
+            {
+                portENTER_CRITICAL(&ring_lock);
+                ring_gen = xfer.gen;
+                r_tail = r_head;
+                rx_off = 0;
+                ring_open = true;
+                finishing = false;
+                portEXIT_CRITICAL(&ring_lock);
+            }
+        }
+    }
+    xSemaphoreGive(lock);
+
+    if (st == OTA_ST_OK)
+        ble_conn = conn_handle;
+    notify(conn_handle, st, off);
+}
+
+static void ble_data(uint16_t conn_handle, uint32_t off, const uint8_t *data, uint32_t n)
+{
+    portENTER_CRITICAL(&ring_lock);
+    bool open = ring_open && conn_handle == ble_conn;
+    uint32_t expect = rx_off;
+    uint32_t head = r_head;
+    bool fits = r_head - r_tail + n <= OTA_WINDOW;
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (!open || off != expect || !fits)
+    {
+        notify(conn_handle, open ? OTA_ST_SEQ : OTA_ST_IDLE, expect);
+        return;
+    }
+    // Only this task moves the head, the OTA task stays behind it
+    uint32_t at = head % OTA_WINDOW;
+    uint32_t first = n < OTA_WINDOW - at ? n : OTA_WINDOW - at;
+    memcpy(&ring[at], data, first);
+    memcpy(ring, data + first, n - first);
+
+    portENTER_CRITICAL(&ring_lock);
+    if (ring_open && r_head == head)
+    {
+        r_head += n;
+        rx_off += n;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+    xTaskNotifyGive(task);
+}
+
+int ota_chr_write(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    if (len == 0)
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+
+    switch (data[0])
+    {
+    case OTA_OP_BEGIN:
+    {
+        if (len != OTA_BEGIN_LEN && len != OTA_BEGIN_FMT_LEN)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        ota_fmt_t fmt = len == OTA_BEGIN_FMT_LEN ? (ota_fmt_t)data[OTA_BEGIN_LEN] : OTA_FMT_IMAGE;
+        if (fmt != OTA_FMT_IMAGE && fmt != OTA_FMT_PATCH)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        ble_begin(conn_handle, fmt, get_le32(&data[1]), &data[5]);
+        break;
+    }
+    case OTA_OP_DATA:
+        if (len < OTA_DATA_HDR_LEN)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        ble_data(conn_handle, get_le32(&data[1]), &data[OTA_DATA_HDR_LEN], len - OTA_DATA_HDR_LEN);
+        break;
+    case OTA_OP_FINISH:
+    {
+        if (len != 1)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        portENTER_CRITICAL(&ring_lock);
+        bool open = ring_open && conn_handle == ble_conn;
+        finishing = finishing || open;
+        portEXIT_CRITICAL(&ring_lock);
+        if (open)
+            xTaskNotifyGive(task);
+        else
+            notify(conn_handle, OTA_ST_IDLE, 0);
+        break;
+    }
+    case OTA_OP_ABORT:
+        if (len != 1)
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        if (conn_handle != ble_conn)
+            break;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (xfer.active && xfer.src == OTA_SRC_BLE)
+            abort_locked(OTA_ST_IDLE);
+        xSemaphoreGive(lock);
+        ble_conn = BLE_HS_CONN_HANDLE_NONE;
+        break;
+    default:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    return 0;
+}
+
+void ota_update_ble_init(const uint16_t *val_handle)
+{
+    ota_handle = val_handle;
+    ble_npl_event_init(&ack_ev, ack_cb, NULL);
+    if (task == NULL)
+        xTaskCreatePinnedToCore(ota_task, "ota", OTA_TASK_STACK, NULL, OTA_TASK_PRIO, &task, tskNO_AFFINITY);
+}
+
+void ota_update_conn_closed(uint16_t conn_handle)
+{
+    if (conn_handle == ble_conn)
+        ble_conn = BLE_HS_CONN_HANDLE_NONE;
+}
+
+const ota_stats_t *ota_update_stats(void)
+{
+    return &stats;
+}
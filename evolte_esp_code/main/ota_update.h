@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Firmware update into the app slot that is not running (partitions.csv),
+// fed as a stream by POST /api/ota or the OTA characteristic. Every byte is
+// hashed as it goes to flash, so the image is checked against the SHA-256
+// the client announced without ever being held in RAM. Only a verified
+// image becomes the boot partition, and the charger restarts into it
+// OTA_RESTART_MS later. The new image boots pending verification: unless
+// every boot stage comes up within CONFIG_EVOLTE_OTA_CONFIRM_S it is marked
+// invalid and the bootloader goes back to the previous one.
+//
+// The stream is either the image itself or a delta patch (ota_patch.h)
+// against the running image, rebuilt into the other slot as it arrives.
+// Sizes and offsets are those of the stream, the SHA-256 always that of the
+// image it ends up as.
+//
+// BLE requests, written without response:
+//   01 size:u32 sha256[32] [format:u8]
+//                            start, or resume the unfinished transfer of
+//                            the same stream from where it stopped; format
+//                            is an ota_fmt_t, the image when left out
+//   02 offset:u32 data       stream bytes, offset must be where the last
+//                            ones ended
+//   03                       finish: verify, switch slots and restart
+//   04                       abort
+//
+// Notifications: status:u8 offset:u32. OTA_ST_OK with the offset the
+// device expects next answers BEGIN, and again each time another
+// OTA_ACK_BYTES reached flash. The client keeps no more than OTA_WINDOW
+// bytes past the last acknowledged offset in flight. OTA_ST_SEQ tells it to
+// go back to offset, OTA_ST_DONE that the image was verified.
+
+#define OTA_WINDOW 8192
+#define OTA_ACK_BYTES 2048
+#define OTA_RESTART_MS 1000
+
+#define OTA_OP_BEGIN 0x01
+#define OTA_OP_DATA 0x02
+#define OTA_OP_FINISH 0x03
+#define OTA_OP_ABORT 0x04
+
+typedef enum
+{
+    OTA_ST_OK = 0,
+    OTA_ST_DONE,  // Verified and made the boot partition
+    OTA_ST_BUSY,  // Another client is updating
+    OTA_ST_SIZE,  // Image larger than the slot, or not all of it was sent
+    OTA_ST_SEQ,   // Data not at the expected offset or past the window
+    OTA_ST_HASH,  // SHA-256 does not match
+    OTA_ST_IMAGE, // Not a valid app image
+    OTA_ST_FLASH, // Flash write failed
+    OTA_ST_IDLE,  // No transfer
+    OTA_ST_BASE,  // Patch made for an image other than the running one
+    OTA_ST_PATCH, // Corrupt patch
+} ota_status_t;
+
+typedef enum
+{
+    OTA_FMT_IMAGE,
+    OTA_FMT_PATCH,
+} ota_fmt_t;
+
+typedef enum
+{
+    OTA_SRC_HTTP,
+    OTA_SRC_BLE,
+} ota_src_t;
+
+typedef struct
+{
+    uint32_t updates;    // Images verified and switched to
+    uint32_t failed;     // Transfers that ended without one
+    uint32_t patches;    // Of the updates, those sent as a patch
+    uint32_t last_bytes; // Bytes sent and duration of the last update
+    uint32_t last_ms;
+    bool pending_verify; // Running a new image that is not confirmed yet
+} ota_stats_t;
+
+// At the start of app_main: arms the rollback timer if the running image
+// is new
+void ota_update_init(void);
+// Every boot stage came up, keep the running image
+void ota_update_confirm(void);
+
+// Streaming API for a transport that writes to flash on its own task
+ota_status_t ota_update_begin(ota_src_t src, ota_fmt_t fmt, uint32_t size, const uint8_t sha256[32]);
+ota_status_t ota_update_write(const void *data, size_t len);
+// Ends the transfer either way, OTA_ST_DONE if the image is now booted next
+ota_status_t ota_update_finish(void);
+void ota_update_abort(void);
+
+// OTA characteristic, the transfer itself runs on the OTA task
+void ota_update_ble_init(const uint16_t *val_handle);
+// Called from BLE_GAP_EVENT_DISCONNECT, the transfer waits to be resumed
+void ota_update_conn_closed(uint16_t conn_handle);
+
+const ota_stats_t *ota_update_stats(void);
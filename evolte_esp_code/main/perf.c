@@ -0,0 +1,431 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "dlog.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_budget.h"
+#include "os/os_mempool.h"
+#include "perf.h"
+
+#define DIAG_HDR_LEN 4
+#define DIAG_LATENCY_LEN 21
+#define DIAG_TASK_LEN 17
+#define DIAG_POOL_LEN 20
+#define DIAG_HEAP_LEN 13
+#define DIAG_NAME_LEN 12
+
+// Metrics text is handed to the writer in pieces of up to this much
+#define PERF_TEXT_CHUNK 512
+#define PERF_LINE_LEN 160
+
+// One core's histogram. The sum is kept in two words since the ESP32 has no
+// 64-bit atomics, the high word takes the carry.
+typedef struct
+{
+    uint32_t count;
+    uint32_t sum_lo;
+    uint32_t sum_hi;
+    uint32_t max_us;
+    uint32_t buckets[PERF_BUCKETS];
+} perf_cell_t;
+
+static perf_cell_t cells[portNUM_PROCESSORS][PERF_SITE_COUNT];
+
+static const char *const site_names[PERF_SITE_COUNT] = {
+    [PERF_GATT_READ] = "gatt_read",
+    [PERF_GATT_WRITE] = "gatt_write",
+    [PERF_HTTP] = "http",
+    [PERF_GPIO] = "gpio",
+};
+
+// uxTaskGetSystemState wants room for every task; too big for the stacks
+// of the callers, so one array shared under a mutex
+static SemaphoreHandle_t status_lock;
+static TaskStatus_t status[PERF_TASKS_MAX];
+MEM_BUDGET_FITS(PERF_TASKS, status);
+static bool cut_logged;
+
+// DIAG pages are only encoded on the NimBLE host task
+static struct
+{
+    perf_task_t tasks[PERF_TASKS_MAX];
+    perf_pool_t pools[PERF_POOLS_MAX];
+} diag;
+MEM_BUDGET_FITS(PERF_DIAG, diag);
+
+// and /metrics only on the httpd task
+static struct
+{
+    perf_task_t tasks[PERF_TASKS_MAX];
+    perf_pool_t pools[PERF_POOLS_MAX];
+    perf_write_fn write;
+    void *ctx;
+    int rc;
+    size_t len;
+    char buf[PERF_TEXT_CHUNK];
+} text;
+MEM_BUDGET_FITS(PERF_TEXT, text);
+
+void perf_init(void)
+{
+    status_lock = xSemaphoreCreateMutex();
+}
+
+const char *perf_site_name(perf_site_t site)
+{
+    return site < PERF_SITE_COUNT ? site_names[site] : "?";
+}
+
+int64_t perf_now(void)
+{
+    return esp_timer_get_time();
+}
+
+static int bucket_of(uint32_t us)
+{
+    if (us <= PERF_BUCKET_US(0))
+        return 0;
+    int i = 32 - __builtin_clz((us - 1) >> 4);
+    return i < PERF_BUCKETS ? i : PERF_BUCKETS - 1;
+}
+
+void perf_record(perf_site_t site, int64_t start_us)
+{
+    int64_t d = esp_timer_get_time() - start_us;
+    uint32_t us = d < 0 ? 0 : d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+    perf_cell_t *c = &cells[xPortGetCoreID()][site];
+
+    __atomic_fetch_add(&c->buckets[bucket_of(us)], 1, __ATOMIC_RELAXED);
+    uint32_t lo = __atomic_fetch_add(&c->sum_lo, us, __ATOMIC_RELAXED);
+    if (lo + us < lo)
+        __atomic_fetch_add(&c->sum_hi, 1, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&c->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_fetch_add(&c->count, 1, __ATOMIC_RELAXED);
+}
+
+void perf_read(perf_site_t site, perf_hist_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        const perf_cell_t *c = &cells[core][site];
+        out->count += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+        out->sum_us += ((uint64_t)__atomic_load_n(&c->sum_hi, __ATOMIC_RELAXED) << 32) |
+                       __atomic_load_n(&c->sum_lo, __ATOMIC_RELAXED);
+        uint32_t max = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+        if (max > out->max_us)
+            out->max_us = max;
+        for (int i = 0; i < PERF_BUCKETS; i++)
+            out->buckets[i] += __atomic_load_n(&c->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t perf_quantile_us(const perf_hist_t *h, uint32_t permille)
+{
+    // From the buckets rather than count, so the two cannot disagree
+    uint64_t total = 0;
+    for (int i = 0; i < PERF_BUCKETS; i++)
+        total += h->buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (total * permille + 999) / 1000;
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < PERF_BUCKETS - 1; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return PERF_BUCKET_US(i) < h->max_us ? PERF_BUCKET_US(i) : h->max_us;
+    }
+    return h->max_us;
+}
+
+int perf_tasks(perf_task_t *out, int max, uint64_t *total_us)
+{
+    xSemaphoreTake(status_lock, portMAX_DELAY);
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    int n = (int)uxTaskGetSystemState(status, PERF_TASKS_MAX, &total);
+    if (n == 0 && !cut_logged)
+    {
+        cut_logged = true;
+        DLOG(PERF_TASKS_CUT, (unsigned)uxTaskGetNumberOfTasks(), PERF_TASKS_MAX);
+    }
+    if (n > max)
+        n = max;
+    for (int i = 0; i < n; i++)
+    {
+        const TaskStatus_t *t = &status[i];
+        BaseType_t core = xTaskGetCoreID(t->xHandle);
+        snprintf(out[i].name, sizeof(out[i].name), "%s", t->pcTaskName);
+        out[i].core = core == tskNO_AFFINITY ? -1 : (int)core;
+        out[i].cpu_us = t->ulRunTimeCounter;
+        out[i].stack_free = t->usStackHighWaterMark;
+    }
+    xSemaphoreGive(status_lock);
+    *total_us = total;
+    return n;
+}
+
+int perf_task_count(void)
+{
+    return (int)uxTaskGetNumberOfTasks();
+}
+
+int perf_pools(perf_pool_t *out, int max)
+{
+    struct os_mempool_info info;
+    struct os_mempool *mp = NULL;
+    int n = 0;
+    while (n < max && (mp = os_mempool_info_get_next(mp, &info)) != NULL)
+    {
+        snprintf(out[n].name, sizeof(out[n].name), "%.*s", PERF_POOL_NAME_LEN - 1, info.omi_name);
+        out[n].block_size = (uint16_t)info.omi_block_size;
+        out[n].blocks = (uint16_t)info.omi_num_blocks;
+        out[n].free = (uint16_t)info.omi_num_free;
+        out[n].min_free = (uint16_t)info.omi_min_free;
+        n++;
+    }
+    for (int p = 0; p < MEM_POOL_COUNT && n < max; p++, n++)
+    {
+        mem_pool_stats_t st;
+        mem_pool_stats((mem_pool_t)p, &st);
+        snprintf(out[n].name, sizeof(out[n].name), "%.*s", PERF_POOL_NAME_LEN - 1, st.name);
+        out[n].block_size = st.block_size;
+        out[n].blocks = st.blocks;
+        out[n].free = (uint16_t)(st.blocks - st.used);
+        out[n].min_free = (uint16_t)(st.blocks - st.peak);
+    }
+    return n;
+}
+
+// ---- DIAG pages ----
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_name(uint8_t *p, const char *name)
+{
+    memset(p, 0, DIAG_NAME_LEN);
+    memcpy(p, name, strnlen(name, DIAG_NAME_LEN));
+}
+
+static void encode_latency(uint8_t *p, perf_site_t site)
+{
+    perf_hist_t h;
+    perf_read(site, &h);
+    p[0] = (uint8_t)site;
+    put_le32(&p[1], h.count);
+    put_le32(&p[5], h.count ? (uint32_t)(h.sum_us / h.count) : 0);
+    put_le32(&p[9], perf_quantile_us(&h, 500));
+    put_le32(&p[13], perf_quantile_us(&h, 990));
+    put_le32(&p[17], h.max_us);
+}
+
+static void encode_task(uint8_t *p, const perf_task_t *t, uint64_t total_us)
+{
+    uint64_t permille = total_us ? t->cpu_us * 1000 / total_us : 0;
+    put_name(p, t->name);
+    p[12] = (uint8_t)(int8_t)t->core;
+    put_le16(&p[13], permille > 1000 ? 1000 : (uint16_t)permille);
+    put_le16(&p[15], t->stack_free > UINT16_MAX ? UINT16_MAX : (uint16_t)t->stack_free);
+}
+
+static void encode_pool(uint8_t *p, const perf_pool_t *pool)
+{
+    put_name(p, pool->name);
+    put_le16(&p[12], pool->block_size);
+    put_le16(&p[14], pool->blocks);
+    put_le16(&p[16], pool->free);
+    put_le16(&p[18], pool->min_free);
+}
+
+static void encode_heap(uint8_t *p)
+{
+    put_le32(&p[0], esp_get_free_heap_size());
+    put_le32(&p[4], esp_get_minimum_free_heap_size());
+    put_le32(&p[8], (uint32_t)(esp_timer_get_time() / 1000));
+    int tasks = perf_task_count();
+    p[12] = tasks > UINT8_MAX ? UINT8_MAX : (uint8_t)tasks;
+}
+
+size_t perf_diag_page(uint8_t page, uint8_t first, uint8_t *buf, size_t cap)
+{
+    int total;
+    size_t size;
+    uint64_t total_us = 0;
+    switch (page)
+    {
+    case PERF_PAGE_LATENCY:
+        total = PERF_SITE_COUNT;
+        size = DIAG_LATENCY_LEN;
+        break;
+    case PERF_PAGE_TASKS:
+        total = perf_tasks(diag.tasks, PERF_TASKS_MAX, &total_us);
+        size = DIAG_TASK_LEN;
+        break;
+    case PERF_PAGE_POOLS:
+        total = perf_pools(diag.pools, PERF_POOLS_MAX);
+        size = DIAG_POOL_LEN;
+        break;
+    case PERF_PAGE_HEAP:
+        total = 1;
+        size = DIAG_HEAP_LEN;
+        break;
+    default:
+        return 0;
+    }
+    if (cap < DIAG_HDR_LEN)
+        return 0;
+
+    size_t len = DIAG_HDR_LEN;
+    int i = first;
+    for (; i < total && len + size <= cap; i++, len += size)
+    {
+        uint8_t *p = &buf[len];
+        if (page == PERF_PAGE_LATENCY)
+            encode_latency(p, (perf_site_t)i);
+        else if (page == PERF_PAGE_TASKS)
+            encode_task(p, &diag.tasks[i], total_us);
+        else if (page == PERF_PAGE_POOLS)
+            encode_pool(p, &diag.pools[i]);
+        else
+            encode_heap(p);
+    }
+    buf[0] = page;
+    buf[1] = (uint8_t)total;
+    buf[2] = first;
+    buf[3] = i > first ? (uint8_t)(i - first) : 0;
+    return len;
+}
+
+// ---- /metrics ----
+
+static void text_flush(void)
+{
+    if (text.rc == 0 && text.len)
+        text.rc = text.write(text.ctx, text.buf, text.len);
+    text.len = 0;
+}
+
+static void text_add(const char *fmt, ...)
+{
+    if (text.rc)
+        return;
+    char line[PERF_LINE_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t)n >= sizeof(line))
+        n = sizeof(line) - 1;
+    if (text.len + (size_t)n > sizeof(text.buf))
+        text_flush();
+    memcpy(&text.buf[text.len], line, (size_t)n);
+    text.len += (size_t)n;
+}
+
+static void metrics_latency(void)
+{
+    text_add("# HELP evolte_latency_us Time spent in a handler\n# TYPE evolte_latency_us histogram\n");
+    for (int s = 0; s < PERF_SITE_COUNT; s++)
+    {
+        perf_hist_t h;
+        perf_read(s, &h);
+        uint64_t cum = 0;
+        for (int i = 0; i < PERF_BUCKETS - 1; i++)
+        {
+            cum += h.buckets[i];
+            text_add("evolte_latency_us_bucket{op=\"%s\",le=\"%u\"} %llu\n", site_names[s],
+                     (unsigned)PERF_BUCKET_US(i), (unsigned long long)cum);
+        }
+        cum += h.buckets[PERF_BUCKETS - 1];
+        text_add("evolte_latency_us_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", site_names[s], (unsigned long long)cum);
+        text_add("evolte_latency_us_sum{op=\"%s\"} %llu\n", site_names[s], (unsigned long long)h.sum_us);
+        text_add("evolte_latency_us_count{op=\"%s\"} %llu\n", site_names[s], (unsigned long long)cum);
+    }
+    text_add("# TYPE evolte_latency_max_us gauge\n");
+    for (int s = 0; s < PERF_SITE_COUNT; s++)
+    {
+        perf_hist_t h;
+        perf_read(s, &h);
+        text_add("evolte_latency_max_us{op=\"%s\"} %lu\n", site_names[s], (unsigned long)h.max_us);
+    }
+}
+
+static void metrics_tasks(void)
+{
+    uint64_t total_us;
+    int n = perf_tasks(text.tasks, PERF_TASKS_MAX, &total_us);
+
+    text_add("# TYPE evolte_task_cpu_us_total counter\n");
+    for (int i = 0; i < n; i++)
+        text_add("evolte_task_cpu_us_total{task=\"%s\",core=\"%d\"} %llu\n", text.tasks[i].name,
+                 text.tasks[i].core, (unsigned long long)text.tasks[i].cpu_us);
+    text_add("# TYPE evolte_task_stack_free_bytes gauge\n");
+    for (int i = 0; i < n; i++)
+        text_add("evolte_task_stack_free_bytes{task=\"%s\"} %lu\n", text.tasks[i].name,
+                 (unsigned long)text.tasks[i].stack_free);
+    text_add("# TYPE evolte_cpu_time_us_total counter\nevolte_cpu_time_us_total %llu\n",
+             (unsigned long long)total_us);
+    // More than PERF_TASKS_MAX leaves them all out
+    int running = perf_task_count();
+    text_add("# TYPE evolte_tasks gauge\nevolte_tasks %d\n", running);
+    text_add("# TYPE evolte_tasks_unlisted gauge\nevolte_tasks_unlisted %d\n", running - n);
+}
+
+static void metrics_pools(void)
+{
+    int n = perf_pools(text.pools, PERF_POOLS_MAX);
+    static const char *const gauges[] = {"block_size_bytes", "blocks", "free_blocks", "min_free_blocks"};
+
+    for (int g = 0; g < 4; g++)
+    {
+        text_add("# TYPE evolte_mempool_%s gauge\n", gauges[g]);
+        for (int i = 0; i < n; i++)
+        {
+            const perf_pool_t *p = &text.pools[i];
+            unsigned v = g == 0 ? p->block_size : g == 1 ? p->blocks : g == 2 ? p->free : p->min_free;
+            text_add("evolte_mempool_%s{pool=\"%s\"} %u\n", gauges[g], p->name, v);
+        }
+    }
+}
+
+int perf_metrics(perf_write_fn write, void *ctx)
+{
+    text.write = write;
+    text.ctx = ctx;
+    text.rc = 0;
+    text.len = 0;
+
+    metrics_latency();
+    metrics_tasks();
+    metrics_pools();
+    text_add("# TYPE evolte_heap_steady_allocs_total counter\nevolte_heap_steady_allocs_total %lu\n",
+             (unsigned long)mem_budget_heap()->allocs);
+    text_add("# TYPE evolte_heap_free_bytes gauge\nevolte_heap_free_bytes %lu\n",
+             (unsigned long)esp_get_free_heap_size());
+    text_add("# TYPE evolte_heap_min_free_bytes gauge\nevolte_heap_min_free_bytes %lu\n",
+             (unsigned long)esp_get_minimum_free_heap_size());
+    text_flush();
+    return text.rc;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runtime counters for sizing the firmware: latency histograms of the hot
+// paths, CPU time and stack headroom of every task, and how full the NimBLE
+// mbuf pools get. Served as Prometheus text on GET /metrics and in pages on
+// the DIAG characteristic.
+//
+// Recording is lock-free: each core has its own histograms, updated with
+// relaxed atomics so tasks preempting each other on a core lose nothing,
+// and a reader adds the cores up. A reader racing a writer may see a sample
+// in its bucket but not yet in count, never a torn counter.
+
+typedef enum
+{
+    PERF_GATT_READ,  // Access callbacks, read
+    PERF_GATT_WRITE, // Access callbacks, write, validation and queueing
+    PERF_HTTP,       // Every HTTP handler
+    PERF_GPIO,       // Relay actuation
+    PERF_SITE_COUNT
+} perf_site_t;
+
+// Bucket i counts samples of at most PERF_BUCKET_US(i) us, the last one
+// everything slower
+#define PERF_BUCKETS 12
+#define PERF_BUCKET_US(i) (16u << (i))
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[PERF_BUCKETS];
+} perf_hist_t;
+
+#define PERF_TASK_NAME_LEN 16
+// uxTaskGetSystemState lists all tasks or none. ESP-IDF with BLE, Wi-Fi and
+// the firmware's own runs about 17 on the ESP32.
+#define PERF_TASKS_MAX 32
+
+typedef struct
+{
+    char name[PERF_TASK_NAME_LEN];
+    int core;            // -1 if the task may run on either
+    uint64_t cpu_us;     // Run time since boot
+    uint32_t stack_free; // Bytes never touched since the task started
+} perf_task_t;
+
+#define PERF_POOL_NAME_LEN 16
+#define PERF_POOLS_MAX 12
+
+typedef struct
+{
+    char name[PERF_POOL_NAME_LEN];
+    uint16_t block_size;
+    uint16_t blocks;
+    uint16_t free;
+    uint16_t min_free; // Low water mark since boot
+} perf_pool_t;
+
+// DIAG characteristic: the client writes a page number and optionally the
+// first entry it wants, reads return that page as
+//   page:u8 total:u8 first:u8 count:u8 entries
+// with as many whole entries as fit the MTU; the client asks for the rest
+// from first + count while that is below total. At the default MTU of 23
+// only the header fits, clients raise the MTU first. Little endian:
+//   PERF_PAGE_LATENCY  site:u8 count:u32 avg_us:u32 p50_us:u32 p99_us:u32 max_us:u32
+//   PERF_PAGE_TASKS    name:char[12] core:i8 cpu_permille:u16 stack_free:u16
+//                      cpu_permille is of one core's time since boot
+//   PERF_PAGE_POOLS    name:char[12] block_size:u16 blocks:u16 free:u16 min_free:u16
+//   PERF_PAGE_HEAP     free:u32 min_free:u32 uptime_ms:u32 tasks:u8, always one
+//                      entry; tasks is how many there are, the tasks page
+//                      lists none if that is over PERF_TASKS_MAX
+#define PERF_PAGE_LATENCY 0
+#define PERF_PAGE_TASKS 1
+#define PERF_PAGE_POOLS 2
+#define PERF_PAGE_HEAP 3
+#define PERF_PAGE_COUNT 4
+
+// Before any task is started
+void perf_init(void);
+
+const char *perf_site_name(perf_site_t site);
+
+// Microsecond clock the samples are timed with
+int64_t perf_now(void);
+
+// Records now - start_us for site
+void perf_record(perf_site_t site, int64_t start_us);
+
+// Sum of every core's histogram for site
+void perf_read(perf_site_t site, perf_hist_t *out);
+
+// Upper bound of the bucket holding the q-th fraction of samples,
+// q in permille. 0 with no samples.
+uint32_t perf_quantile_us(const perf_hist_t *h, uint32_t permille);
+
+// Every task, returns how many. total_us is the run time of one core. With
+// more than PERF_TASKS_MAX tasks there is no list and it returns 0.
+int perf_tasks(perf_task_t *out, int max, uint64_t *total_us);
+
+// Tasks there are, listed or not
+int perf_task_count(void);
+
+// NimBLE memory pools, then the firmware's own (mem_budget.def), returns
+// how many
+int perf_pools(perf_pool_t *out, int max);
+
+// Encodes one DIAG page from entry first on, returns its length, 0 for an
+// unknown page
+size_t perf_diag_page(uint8_t page, uint8_t first, uint8_t *buf, size_t cap);
+
+// Writes the /metrics text in pieces through write, stops at the first
+// write that returns nonzero and returns that
+typedef int (*perf_write_fn)(void *ctx, const char *text, size_t len);
+int perf_metrics(perf_write_fn write, void *ctx);
@@ -1,91 +0,0 @@
-#include <stdio.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/event_groups.h"
-#include "esp_event.h"
-#include "nvs_flash.h"
-#include "esp_log.h"
-#include "esp_nimble_hci.h"
-#include "nimble/nimble_port.h"
-#include "nimble/nimble_port_freertos.h"
-#include "host/ble_hs.h"
-#include "services/gap/ble_svc_gap.h"
-#include "services/gatt/ble_svc_gatt.h"
-#include "sdkconfig.h"
-#include "driver/gpio.h"
-#include "esp_http_server.h"
-#include "esp_wifi.h"
-#include "esp_netif.h"
-#include "esp_event.h"
-#include "esp_log.h"
-#include "lwip/ip4_addr.h"
-
-//// CODE For Local Server Starts
-static void wifi_event_handler(void* arg, esp_event_base_t event_base,
-                              int32_t event_id, void* event_data)
-{
-    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI("WIFI", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        // You can also start your webserver here if you want
-    }
-}
-
-void wifi_init_sta(void)
-{
-    esp_netif_init();
-    esp_event_loop_create_default();
-    esp_netif_create_default_wifi_sta();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
-
-    // Register event handler for IP_EVENT_STA_GOT_IP
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, &instance_any_id);
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = "SUNSHINECDG",
-            .password = "sunshine_cdg2015",
-        },
-    };
-    esp_wifi_set_mode(WIFI_MODE_STA);
-    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-    esp_wifi_start();
-    esp_wifi_connect();
-}
-// Handler to set BLE name via HTTP POST
-esp_err_t set_name_post_handler(httpd_req_t *req)
-{
-    char buf[32];
-    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
-    if (ret <= 0)
-        return ESP_FAIL;
-    buf[ret] = 0; // Null-terminate
-
-    // Set new BLE name
-    ble_svc_gap_device_name_set(buf);
-    ble_app_advertise(); // Restart advertising with new name
-
-    httpd_resp_sendstr(req, "BLE name updated");
-    return ESP_OK;
-}
-
-// Start HTTP server and register URI handler
-void start_webserver(void)
-{
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    httpd_handle_t server = NULL;
-    if (httpd_start(&server, &config) == ESP_OK)
-    {
-        httpd_uri_t set_name_uri = {
-            .uri = "/set_name",
-            .method = HTTP_POST,
-            .handler = set_name_post_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(server, &set_name_uri);
-    }
-}
-
-//// Code for Local Server Ends
\ No newline at end of file
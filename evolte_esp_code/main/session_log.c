@@ -0,0 +1,97 @@
+#include "charger.h"
+#include "esp_timer.h"
+#include "evlog.h"
+#include "freertos/FreeRTOS.h"
+#include "meter.h"
+#include "sdkconfig.h"
+#include "session_log.h"
+
+#define MJ_PER_WH 3600000
+
+typedef struct
+{
+    bool active;
+    uint64_t start_mj; // Meter energy when the session started
+    uint64_t last_mj;  // ... at the last ENERGY record
+} session_t;
+
+// Relay changes come from the actuator task, ENERGY records from the
+// esp_timer task; records are appended after the lock is let go
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static session_t sessions[CHARGER_RELAY_COUNT];
+static esp_timer_handle_t timer;
+
+static uint64_t meter_energy_mj(int32_t *power_w)
+{
+    meter_dsp_out_t m;
+    meter_get(&m);
+    if (power_w)
+        *power_w = m.power_w;
+    return m.energy_mj;
+}
+
+static void timer_cb(void *arg)
+{
+    int32_t power_w;
+    uint64_t now = meter_energy_mj(&power_w);
+    for (uint8_t ch = 0; ch < CHARGER_RELAY_COUNT; ch++)
+    {
+        session_t *s = &sessions[ch];
+        evlog_rec_t rec = {.type = EVLOG_ENERGY, .channel = ch, .power_w = power_w};
+        portENTER_CRITICAL(&lock);
+        bool active = s->active;
+        if (active)
+        {
+            rec.energy_wh = (uint32_t)((now - s->last_mj) / MJ_PER_WH);
+            // Keep the remainder so short intervals still add up
+            s->last_mj += (now - s->last_mj) / MJ_PER_WH * MJ_PER_WH;
+        }
+        portEXIT_CRITICAL(&lock);
+        if (active)
+            evlog_append(&rec);
+    }
+}
+
+void session_log_init(void)
+{
+    if (timer == NULL)
+    {
+        const esp_timer_create_args_t args = {.callback = timer_cb, .name = "session_log"};
+        esp_timer_create(&args, &timer);
+        esp_timer_start_periodic(timer, (uint64_t)CONFIG_EVOLTE_EVLOG_ENERGY_S * 1000000);
+    }
+    // Raised while the log was not up yet
+    uint32_t flags = charger_error_flags();
+    if (flags)
+        evlog_append(&(evlog_rec_t){.type = EVLOG_FAULT, .flags = flags});
+}
+
+void session_log_fault(uint32_t flags)
+{
+    if (timer != NULL)
+        evlog_append(&(evlog_rec_t){.type = EVLOG_FAULT, .flags = flags});
+}
+
+void session_log_relay(uint8_t channel, bool on)
+{
+    if (channel >= CHARGER_RELAY_COUNT)
+        return;
+    session_t *s = &sessions[channel];
+    uint64_t now = meter_energy_mj(NULL);
+    evlog_rec_t rec = {.channel = channel};
+    portENTER_CRITICAL(&lock);
+    if (on)
+    {
+        *s = (session_t){.active = true, .start_mj = now, .last_mj = now};
+        rec.type = EVLOG_SESSION_START;
+    }
+    else if (s->active)
+    {
+        s->active = false;
+        rec.type = EVLOG_SESSION_STOP;
+        rec.energy_wh = (uint32_t)((now - s->start_mj) / MJ_PER_WH);
+    }
+    portEXIT_CRITICAL(&lock);
+    if (rec.type != 0)
+        evlog_append(&rec);
+}
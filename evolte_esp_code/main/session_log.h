@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Charge sessions as evlog records: a session runs while a relay is on,
+// with an ENERGY record every CONFIG_EVOLTE_EVLOG_ENERGY_S and a FAULT
+// record as soon as a new charger error flag is raised.
+
+void session_log_init(void);
+
+// Call after the relay actually changed state
+void session_log_relay(uint8_t channel, bool on);
+// Call with the charger error flags just raised. Flags raised before
+// session_log_init are logged by it.
+void session_log_fault(uint32_t flags);
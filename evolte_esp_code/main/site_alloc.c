@@ -0,0 +1,271 @@
+#include <string.h>
+#include "site_alloc.h"
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(&p[2], (uint16_t)(v >> 16));
+}
+
+// Index of id, or where it would go
+static uint16_t find(const site_alloc_t *s, uint32_t id)
+{
+    uint16_t lo = 0, hi = s->n;
+    while (lo < hi)
+    {
+        uint16_t mid = (uint16_t)((lo + hi) / 2);
+        if (s->nodes[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void site_alloc_init(site_alloc_t *s, uint32_t id, uint16_t group, uint16_t min, uint16_t fallback,
+                     site_node_t *nodes, uint16_t cap)
+{
+    *s = (site_alloc_t){.nodes = nodes, .cap = cap, .n = 1, .id = id, .group = group, .fallback = fallback};
+    nodes[0] = (site_node_t){.id = id, .min = min};
+}
+
+const site_node_t *site_alloc_self(const site_alloc_t *s)
+{
+    return &s->nodes[find(s, s->id)];
+}
+
+void site_alloc_set_local(site_alloc_t *s, uint16_t budget, uint16_t demand)
+{
+    site_node_t *me = &s->nodes[find(s, s->id)];
+    me->budget = budget;
+    me->demand = demand;
+}
+
+bool site_alloc_heard(site_alloc_t *s, const uint8_t *msg, size_t len)
+{
+    if (len != SITE_MSG_LEN || msg[0] != SITE_MSG_MAGIC || msg[1] != SITE_MSG_VERSION ||
+        get_le16(&msg[2]) != s->group)
+    {
+        s->rejected++;
+        return false;
+    }
+    uint32_t id = get_le32(&msg[4]);
+    if (id == s->id)
+    {
+        s->rejected++; // Our own, or another charger with our id
+        return false;
+    }
+
+    uint16_t i = find(s, id);
+    if (i == s->n || s->nodes[i].id != id)
+    {
+        if (s->n == s->cap)
+        {
+            s->rejected++;
+            return false;
+        }
+        memmove(&s->nodes[i + 1], &s->nodes[i], (s->n - i) * sizeof(site_node_t));
+        s->nodes[i] = (site_node_t){.id = id};
+        s->n++;
+    }
+    site_node_t *x = &s->nodes[i];
+    x->budget = get_le16(&msg[8]);
+    x->demand = get_le16(&msg[10]);
+    x->min = get_le16(&msg[12]);
+    x->alloc = get_le16(&msg[14]);
+    x->ticket = get_le32(&msg[16]);
+    x->silent = 0;
+    s->heard++;
+    return true;
+}
+
+size_t site_alloc_report(const site_alloc_t *s, uint8_t *buf, size_t cap)
+{
+    if (cap < SITE_MSG_LEN)
+        return 0;
+    const site_node_t *me = site_alloc_self(s);
+    buf[0] = SITE_MSG_MAGIC;
+    buf[1] = SITE_MSG_VERSION;
+    put_le16(&buf[2], s->group);
+    put_le32(&buf[4], s->id);
+    put_le16(&buf[8], me->budget);
+    put_le16(&buf[10], me->demand);
+    put_le16(&buf[12], me->min);
+    put_le16(&buf[14], me->alloc);
+    put_le32(&buf[16], me->ticket);
+    return SITE_MSG_LEN;
+}
+
+// ---- Fair split ----
+
+// Higher is served first: the lower ticket, then the lower id. Below
+// UINT64_MAX for any charger with a ticket.
+static uint64_t prio(const site_node_t *x)
+{
+    return (uint64_t)~x->ticket << 32 | (uint32_t)~x->id;
+}
+
+static uint16_t need(const site_node_t *x)
+{
+    return x->demand > x->min ? x->demand : x->min;
+}
+
+static uint16_t clamp(uint32_t level, const site_node_t *x)
+{
+    if (level < x->min)
+        return x->min;
+    return level < need(x) ? (uint16_t)level : need(x);
+}
+
+// Minimums of the chargers with demand and at least priority p
+static uint32_t mins_from(const site_node_t *nodes, uint16_t n, uint64_t p)
+{
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < n; i++)
+        if (nodes[i].demand && prio(&nodes[i]) >= p)
+            sum += nodes[i].min;
+    return sum;
+}
+
+// What the chargers served get with every share at level, within their
+// minimum and demand
+static uint32_t fill(const site_node_t *nodes, uint16_t n, uint64_t cut, uint32_t level)
+{
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < n; i++)
+        if (nodes[i].demand && prio(&nodes[i]) >= cut)
+            sum += clamp(level, &nodes[i]);
+    return sum;
+}
+
+// Both searches are over the reports alone, so every charger with the same
+// reports gets the same split
+void site_alloc_share(site_node_t *nodes, uint16_t n, uint16_t budget)
+{
+    // Lowest priority served: the minimums from it up fit the budget
+    uint64_t cut = 0, hi = UINT64_MAX;
+    if (mins_from(nodes, n, 0) > budget)
+    {
+        while (cut < hi)
+        {
+            uint64_t mid = cut + (hi - cut) / 2;
+            if (mins_from(nodes, n, mid) <= budget)
+                hi = mid;
+            else
+                cut = mid + 1;
+        }
+    }
+
+    // Highest common level that fits; what is left over goes 0.1 A at a
+    // time to those held at it, by id
+    uint32_t level = 0, top = UINT16_MAX;
+    while (level < top)
+    {
+        uint32_t mid = (level + top + 1) / 2;
+        if (fill(nodes, n, cut, mid) <= budget)
+            level = mid;
+        else
+            top = mid - 1;
+    }
+    uint32_t left = budget - fill(nodes, n, cut, level);
+    for (uint16_t i = 0; i < n; i++)
+    {
+        site_node_t *x = &nodes[i];
+        if (!x->demand || prio(x) < cut)
+        {
+            x->target = 0;
+            continue;
+        }
+        x->target = clamp(level, x);
+        if (left && x->target == level && x->target < need(x))
+        {
+            x->target++;
+            left--;
+        }
+    }
+}
+
+// ---- Rounds ----
+
+// Cuts at once; raises out of the headroom the reports leave. A charger not
+// heard since last round may already be on its way up, so its share is
+// counted as taken.
+static uint16_t next_alloc(const site_alloc_t *s, const site_node_t *me)
+{
+    if (me->target <= me->alloc)
+        return me->target;
+    uint32_t used = 0, shortfall = 0;
+    for (uint16_t i = 0; i < s->n; i++)
+    {
+        const site_node_t *x = &s->nodes[i];
+        bool up = x->target > x->alloc;
+        used += x->silent && up ? x->target : x->alloc;
+        if (!x->silent && up)
+            shortfall += x->target - x->alloc;
+    }
+    uint32_t room = s->budget > used ? s->budget - used : 0;
+    uint32_t want = me->target - me->alloc;
+    if (shortfall > room)
+        want = (uint32_t)((uint64_t)room * want / shortfall);
+    return (uint16_t)(me->alloc + want);
+}
+
+uint16_t site_alloc_round(site_alloc_t *s)
+{
+    site_node_t *me = &s->nodes[find(s, s->id)];
+    uint16_t budget = me->budget;
+    uint32_t last = 0;
+    for (uint16_t i = 0; i < s->n; i++)
+    {
+        if (s->nodes[i].budget && s->nodes[i].budget < budget)
+            budget = s->nodes[i].budget;
+        if (s->nodes[i].ticket > last)
+            last = s->nodes[i].ticket;
+    }
+    s->budget = budget;
+    if (me->demand == 0)
+        me->ticket = 0;
+    else if (me->ticket == 0)
+        me->ticket = last + 1;
+
+    if (s->n == 1)
+    {
+        me->target = me->demand < s->fallback ? me->demand : s->fallback;
+        me->alloc = me->target;
+    }
+    else
+    {
+        site_alloc_share(s->nodes, s->n, budget);
+        me->alloc = next_alloc(s, me);
+    }
+    uint16_t alloc = me->alloc;
+
+    // Forget chargers gone quiet
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < s->n; i++)
+    {
+        site_node_t *x = &s->nodes[i];
+        if (x->id != s->id && ++x->silent > SITE_TIMEOUT_ROUNDS)
+            continue;
+        s->nodes[kept++] = *x;
+    }
+    s->n = kept;
+    s->rounds++;
+    return alloc;
+}
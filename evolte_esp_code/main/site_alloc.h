@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Site load balancing, free of ESP-IDF: chargers behind one grid connection
+// share its current budget with no controller. Once a round every charger
+// broadcasts a report of its demand and the limit it runs at. From the
+// reports it has, each one works out the same max-min fair split of the
+// budget and moves its own limit towards its share. Cuts apply at once.
+// Raises only come out of the headroom the reports leave, split in
+// proportion to what each charger is still short of its share, so the site
+// stays within budget while limits move. With every report arriving, limits
+// settle two rounds after a change is first reported.
+//
+// Below its minimum a car cannot charge. When the minimums of all cars do
+// not fit the budget, cars are served in the order they started: a charger
+// takes a ticket one above the highest it has heard when its car starts,
+// ties go to the lower id, and the rest wait at 0.
+//
+// A charger that hears no one runs at its fallback current. That keeps a
+// site safe while the link is down only if every charger's fallback fits
+// the budget together.
+//
+// Currents are in 0.1 A.
+
+#define SITE_MSG_LEN 20
+#define SITE_MSG_MAGIC 0xE5
+#define SITE_MSG_VERSION 1
+// A charger not heard for this many rounds is forgotten; until then its
+// share stays reserved
+#define SITE_TIMEOUT_ROUNDS 10
+
+typedef struct
+{
+    uint32_t id;
+    uint16_t budget; // Site budget it was set up with, the lowest one heard applies
+    uint16_t demand; // 0 with no car charging
+    uint16_t min;
+    uint16_t alloc;  // Limit it runs at
+    uint16_t target; // Its share, worked out last round
+    uint32_t ticket; // Place in the queue while it has demand, else 0
+    uint8_t silent;  // Rounds since its last report
+} site_node_t;
+
+typedef struct
+{
+    site_node_t *nodes; // Sorted by id, this charger among them
+    uint16_t cap;
+    uint16_t n;
+    uint32_t id;
+    uint16_t group; // Reports of other groups are ignored
+    uint16_t fallback;
+    uint16_t budget; // Applied last round
+    uint32_t rounds;
+    uint32_t heard;
+    uint32_t rejected; // Malformed, another group, or no room in the table
+} site_alloc_t;
+
+// nodes holds up to cap chargers, this one included
+void site_alloc_init(site_alloc_t *s, uint32_t id, uint16_t group, uint16_t min, uint16_t fallback,
+                     site_node_t *nodes, uint16_t cap);
+
+// This charger's budget and demand for the next round
+void site_alloc_set_local(site_alloc_t *s, uint16_t budget, uint16_t demand);
+
+// A report from another charger; false if it was not taken
+bool site_alloc_heard(site_alloc_t *s, const uint8_t *msg, size_t len);
+
+// Work out the shares from the reports so far and move this charger's
+// limit. Returns the new limit.
+uint16_t site_alloc_round(site_alloc_t *s);
+
+// This charger's report, to broadcast after each round. Returns its length,
+// 0 if cap is too small.
+size_t site_alloc_report(const site_alloc_t *s, uint8_t *buf, size_t cap);
+
+const site_node_t *site_alloc_self(const site_alloc_t *s);
+
+// The fair split of budget over n chargers, into each one's target
+void site_alloc_share(site_node_t *nodes, uint16_t n, uint16_t budget);
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include "actuator.h"
+#include "charger.h"
+#include "config_store.h"
+#include "dlog.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mem_budget.h"
+#include "site_link.h"
+
+static const uint8_t broadcast[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Under lock, taken by the receive callback on the Wi-Fi task, the round
+// timer, the setting and readers
+static SemaphoreHandle_t lock;
+static site_alloc_t site;
+static site_node_t nodes[CONFIG_EVOLTE_SITE_MAX_CHARGERS];
+MEM_BUDGET_FITS(SITE_NODES, nodes);
+static uint16_t budget; // 0.1 A, 0 while off
+static uint16_t limit = CHARGER_LIMIT_NONE;
+
+// Round timer only
+static esp_timer_handle_t round_timer;
+static uint8_t cmd_seq;
+static site_link_stats_t stats;
+
+static void recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    site_alloc_heard(&site, data, (size_t)len);
+    xSemaphoreGive(lock);
+}
+
+// Through the actuator ring of the esp_timer task, like the charge schedule
+static void submit_limit(uint16_t next)
+{
+    cmd_t cmd = {.opcode = CMD_OP_CURRENT_LIMIT,
+                 .seq = cmd_seq++,
+                 .len = 2,
+                 .payload = {(uint8_t)next, (uint8_t)(next >> 8)}};
+    if (!actuator_submit(ACTUATOR_SRC_TIMER, 0, &cmd))
+    {
+        stats.dropped++;
+        return;
+    }
+    stats.limits++;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    limit = next;
+    uint16_t heard = site.n;
+    xSemaphoreGive(lock);
+    DLOG(SITE_LIMIT, next, heard);
+}
+
+static void site_start(uint32_t id)
+{
+    site_alloc_init(&site, id, CONFIG_EVOLTE_SITE_GROUP, CONFIG_EVOLTE_CHARGE_MIN_DA, CONFIG_EVOLTE_SITE_FALLBACK_DA,
+                    nodes, CONFIG_EVOLTE_SITE_MAX_CHARGERS);
+}
+
+static void round_cb(void *arg)
+{
+    uint8_t msg[SITE_MSG_LEN];
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint16_t last = limit;
+    if (budget == 0)
+    {
+        xSemaphoreGive(lock);
+        // Turned off: lift the limit
+        if (last != CHARGER_LIMIT_NONE)
+            submit_limit(CHARGER_LIMIT_NONE);
+        return;
+    }
+    uint16_t demand = charger_relay_want_mask() & 1 ? CONFIG_EVOLTE_CHARGE_MAX_DA : 0;
+    site_alloc_set_local(&site, budget, demand);
+    uint16_t next = site_alloc_round(&site);
+    size_t len = site_alloc_report(&site, msg, sizeof(msg));
+    xSemaphoreGive(lock);
+
+    stats.rounds++;
+    if (esp_now_send(broadcast, msg, len) == ESP_OK)
+        stats.sent++;
+    else
+        stats.send_failed++;
+    if (next != last)
+        submit_limit(next);
+}
+
+void site_link_init(void)
+{
+    lock = xSemaphoreCreateMutex();
+    uint8_t mac[6];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    site_start((uint32_t)mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5]);
+    esp_timer_create(&(esp_timer_create_args_t){.callback = round_cb, .name = "site_round"}, &round_timer);
+
+    // Without the link the charger runs alone, on the fallback current
+    esp_now_peer_info_t peer = {.ifidx = WIFI_IF_STA};
+    memcpy(peer.peer_addr, broadcast, sizeof(broadcast));
+    esp_err_t rc = esp_now_init();
+    if (rc == ESP_OK)
+        rc = esp_now_register_recv_cb(recv_cb);
+    if (rc == ESP_OK)
+        rc = esp_now_add_peer(&peer);
+    if (rc != ESP_OK)
+        DLOG(SITE_NO_LINK, rc);
+    site_link_reconfigure();
+}
+
+void site_link_reconfigure(void)
+{
+    if (round_timer == NULL)
+        return; // Read by site_link_init
+    char val[8];
+    config_get_str(CONFIG_SITE_BUDGET, val, sizeof(val));
+    long amps = strtol(val, NULL, 10);
+    uint16_t next = amps <= 0 ? 0 : amps >= UINT16_MAX / 10 ? UINT16_MAX / 10 * 10 : (uint16_t)(amps * 10);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool changed = next != budget;
+    // Switched on: start alone, the others are heard again within a round
+    if (next && !budget)
+        site_start(site.id);
+    budget = next;
+    xSemaphoreGive(lock);
+    if (!changed)
+        return;
+    DLOG(SITE_BUDGET, next);
+    esp_timer_stop(round_timer);
+    if (next)
+        esp_timer_start_periodic(round_timer, (uint64_t)CONFIG_EVOLTE_SITE_ROUND_MS * 1000);
+    else
+        esp_timer_start_once(round_timer, 0);
+}
+
+void site_link_get(site_link_state_t *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    out->budget = budget;
+    out->group = site.group;
+    out->applied = site.budget;
+    out->limit = limit;
+    out->n = site.n;
+    memcpy(out->nodes, site.nodes, site.n * sizeof(site_node_t));
+    out->self_id = site.id;
+    out->heard = site.heard;
+    out->rejected = site.rejected;
+    xSemaphoreGive(lock);
+}
+
+const site_link_stats_t *site_link_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "site_alloc.h"
+
+// Site load balancing on the charger (site_alloc.h). Reports go out as
+// ESP-NOW broadcasts on the Wi-Fi channel, so every charger of a site must
+// be on the same access point. One esp_timer runs a round every
+// CONFIG_EVOLTE_SITE_ROUND_MS, and this charger's share goes to the
+// actuator as its current limit. While its relay should be on the charger
+// asks for CONFIG_EVOLTE_CHARGE_MAX_DA.
+//
+// The budget is the site_budget setting in amps. At 0 there is no
+// balancing and no limit.
+
+typedef struct
+{
+    uint32_t rounds;
+    uint32_t sent;
+    uint32_t send_failed;
+    uint32_t limits;  // Limit commands submitted
+    uint32_t dropped; // ... that did not fit the ring, retried next round
+} site_link_stats_t;
+
+// Once Wi-Fi is started
+void site_link_init(void);
+// The site_budget setting changed
+void site_link_reconfigure(void);
+
+typedef struct
+{
+    uint16_t budget; // 0.1 A, as set here; 0 when off
+    uint16_t group;
+    uint16_t applied; // Lowest budget heard, applied last round
+    uint16_t limit;   // Last one submitted, CHARGER_LIMIT_NONE if none
+    uint16_t n;
+    site_node_t nodes[CONFIG_EVOLTE_SITE_MAX_CHARGERS]; // By id, this charger among them
+    uint32_t self_id;
+    uint32_t heard;
+    uint32_t rejected;
+} site_link_state_t;
+
+void site_link_get(site_link_state_t *out);
+const site_link_stats_t *site_link_stats(void);
@@ -0,0 +1,154 @@
+#include <string.h>
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "sdkconfig.h"
+#include "ble_session.h"
+#include "status_notify.h"
+
+static const uint16_t *status_handle;
+static status_encode_fn status_encode;
+static struct ble_npl_callout flush_timer;
+
+static bool subscribed(const ble_session_t *s)
+{
+    return s && (s->sub_flags & (BLE_SESSION_SUB_NOTIFY | BLE_SESSION_SUB_INDICATE));
+}
+
+// Send the current value to one connection, skipped if it already has it
+static void conn_send(ble_session_t *s, const uint8_t *val, size_t len, ble_npl_time_t now)
+{
+    status_notify_conn_t *c = &s->notify;
+
+    // A notification carries at most MTU - 3 bytes. Peers on a small MTU get
+    // the head of the value and read the rest when its size says so.
+    if (len > (size_t)s->mtu - 3)
+        len = s->mtu - 3;
+
+    c->pending = false;
+    if (len == c->last_len && memcmp(val, c->last_val, len) == 0)
+        return;
+    if (c->indicate_inflight)
+    {
+        c->pending = true; // Retried from status_notify_tx_done
+        return;
+    }
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(val, len);
+    if (om == NULL)
+    {
+        c->pending = true;
+        return;
+    }
+
+    int rc;
+    if (s->sub_flags & BLE_SESSION_SUB_INDICATE)
+    {
+        rc = ble_gatts_indicate_custom(s->conn_handle, *status_handle, om);
+        c->indicate_inflight = (rc == 0);
+    }
+    else
+    {
+        rc = ble_gatts_notify_custom(s->conn_handle, *status_handle, om);
+    }
+
+    if (rc != 0)
+    {
+        c->pending = true;
+        return;
+    }
+    c->last_tx = now;
+    c->last_len = (uint8_t)len;
+    memcpy(c->last_val, val, len);
+}
+
+static void flush(void)
+{
+    uint8_t val[STATUS_NOTIFY_MAX_LEN];
+    size_t len = 0;
+    bool encoded = false;
+    ble_npl_time_t now = ble_npl_time_get();
+    ble_npl_time_t window = ble_npl_time_ms_to_ticks32(CONFIG_EVOLTE_NOTIFY_COALESCE_MS);
+    ble_npl_time_t next = 0;
+    bool rearm = false;
+
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+    {
+        ble_session_t *s = ble_session_at(i);
+        if (!subscribed(s) || !s->notify.pending)
+            continue;
+
+        ble_npl_time_t due = s->notify.last_tx + window;
+        if (s->notify.last_len != 0 && (ble_npl_stime_t)(now - due) < 0)
+        {
+            if (!rearm || (ble_npl_stime_t)(due - next) < 0)
+                next = due;
+            rearm = true;
+            continue;
+        }
+
+        if (!encoded)
+        {
+            len = status_encode(val, sizeof(val));
+            encoded = true;
+        }
+        conn_send(s, val, len, now);
+    }
+
+    if (rearm)
+        ble_npl_callout_reset(&flush_timer, next - now);
+}
+
+static void flush_timer_cb(struct ble_npl_event *ev)
+{
+    flush();
+}
+
+void status_notify_init(const uint16_t *val_handle, status_encode_fn encode)
+{
+    status_handle = val_handle;
+    status_encode = encode;
+    ble_npl_callout_init(&flush_timer, nimble_port_get_dflt_eventq(), flush_timer_cb, NULL);
+}
+
+void status_notify_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify, bool indicate)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL || attr_handle != *status_handle)
+        return;
+
+    s->sub_flags = (notify ? BLE_SESSION_SUB_NOTIFY : 0) | (indicate ? BLE_SESSION_SUB_INDICATE : 0);
+    memset(&s->notify, 0, sizeof(s->notify));
+    if (subscribed(s))
+    {
+        // Push the current state right away so the peer never needs a read
+        s->notify.pending = true;
+        flush();
+    }
+}
+
+void status_notify_tx_done(uint16_t conn_handle, bool indication)
+{
+    ble_session_t *s = ble_session_find(conn_handle);
+    if (s == NULL || !indication)
+        return;
+
+    s->notify.indicate_inflight = false;
+    if (s->notify.pending)
+        flush();
+}
+
+void status_notify_changed(void)
+{
+    bool any = false;
+    for (int i = 0; i < BLE_SESSION_MAX; i++)
+    {
+        ble_session_t *s = ble_session_at(i);
+        if (subscribed(s))
+        {
+            s->notify.pending = true;
+            any = true;
+        }
+    }
+    if (any)
+        flush();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nimble/nimble_npl.h"
+
+// Pushes the status characteristic value to subscribed connections.
+// Changes that land inside CONFIG_EVOLTE_NOTIFY_COALESCE_MS of the last
+// notification on a connection are merged into one carrying the latest value.
+
+#define STATUS_NOTIFY_MAX_LEN 64
+
+typedef size_t (*status_encode_fn)(uint8_t *buf, size_t cap);
+
+// Notification state kept in each BLE session
+typedef struct
+{
+    bool pending;           // A change is waiting for the window to close
+    bool indicate_inflight; // Waiting for the peer to confirm an indication
+    ble_npl_time_t last_tx;
+    uint8_t last_len;
+    uint8_t last_val[STATUS_NOTIFY_MAX_LEN]; // What this peer saw last
+} status_notify_conn_t;
+
+void status_notify_init(const uint16_t *val_handle, status_encode_fn encode);
+
+// Called from BLE_GAP_EVENT_SUBSCRIBE / BLE_GAP_EVENT_NOTIFY_TX
+void status_notify_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify, bool indicate);
+void status_notify_tx_done(uint16_t conn_handle, bool indication);
+
+// Call after any state that is part of the status value changed
+void status_notify_changed(void);
@@ -0,0 +1,56 @@
+#include <string.h>
+#include "status_snapshot.h"
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+size_t status_snapshot_encode(const status_snapshot_t *snap, uint8_t *buf, size_t cap)
+{
+    if (cap < STATUS_SNAPSHOT_SIZE)
+        return 0;
+
+    buf[0] = STATUS_SNAPSHOT_VERSION;
+    buf[1] = STATUS_SNAPSHOT_SIZE;
+    buf[2] = snap->relay_count;
+    buf[3] = snap->relay_mask;
+    put_le32(&buf[4], snap->uptime_s);
+    put_le32(&buf[8], snap->error_flags);
+    put_le32(&buf[12], snap->fw_version);
+    put_le32(&buf[16], snap->cmds_run);
+    put_le32(&buf[20], snap->cmds_rejected);
+    put_le32(&buf[24], snap->relay_switches);
+    buf[28] = snap->sessions;
+    buf[29] = snap->last_seq;
+    buf[30] = 0;
+    buf[31] = 0;
+    put_le32(&buf[32], snap->v_rms_mv);
+    put_le32(&buf[36], snap->i_rms_ma);
+    put_le32(&buf[40], (uint32_t)snap->power_w);
+    put_le32(&buf[44], snap->energy_wh);
+    put_le32(&buf[48], snap->i_peak_ma);
+    return STATUS_SNAPSHOT_SIZE;
+}
+
+uint32_t status_snapshot_fw_version(const char *version)
+{
+    uint32_t part[3] = {0};
+    int i = 0;
+
+    if (*version == 'v')
+        version++;
+    for (; *version && i < 3; version++)
+    {
+        if (*version >= '0' && *version <= '9')
+            part[i] = part[i] * 10 + (uint32_t)(*version - '0');
+        else if (*version == '.')
+            i++;
+        else
+            break;
+    }
+    return (part[0] & 0xFF) << 16 | (part[1] & 0xFF) << 8 | (part[2] & 0xFF);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Packed status snapshot served by the 0xFEF4 characteristic, all fields
+// little endian. Readers must use `size` to find the end so fields can be
+// appended later without breaking older apps.
+//
+//   off  len  field
+//   0    1    version (STATUS_SNAPSHOT_VERSION)
+//   1    1    size of the snapshot in bytes
+//   2    1    relay_count
+//   3    1    relay_mask, bit n set = relay n closed
+//   4    4    uptime_s
+//   8    4    error_flags (CHARGER_ERR_*)
+//   12   4    fw_version, major << 16 | minor << 8 | patch
+//   16   4    cmds_run
+//   20   4    cmds_rejected
+//   24   4    relay_switches
+//   28   1    sessions, open BLE connections
+//   29   1    last_seq
+//   30   2    reserved
+//   32   4    v_rms_mv, metered voltage
+//   36   4    i_rms_ma, metered current
+//   40   4    power_w, real power, signed
+//   44   4    energy_wh, imported since boot
+//   48   4    i_peak_ma
+
+#define STATUS_SNAPSHOT_VERSION 1
+#define STATUS_SNAPSHOT_SIZE 52
+
+typedef struct
+{
+    uint8_t relay_count;
+    uint8_t relay_mask;
+    uint32_t uptime_s;
+    uint32_t error_flags;
+    uint32_t fw_version;
+    uint32_t cmds_run;
+    uint32_t cmds_rejected;
+    uint32_t relay_switches;
+    uint8_t sessions;
+    uint8_t last_seq;
+    uint32_t v_rms_mv;
+    uint32_t i_rms_ma;
+    int32_t power_w;
+    uint32_t energy_wh;
+    uint32_t i_peak_ma;
+} status_snapshot_t;
+
+// Returns the encoded size, or 0 if cap is too small
+size_t status_snapshot_encode(const status_snapshot_t *snap, uint8_t *buf, size_t cap);
+
+// Parse "1.2.3", "v1.2.3-4-gabc" etc. into the packed fw_version field
+uint32_t status_snapshot_fw_version(const char *version);
@@ -0,0 +1,138 @@
+#include <stddef.h>
+#include "timer_wheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+// Furthest a timer can be filed ahead, farther ones wait in the last level
+#define TW_SPAN ((1u << (TW_LEVELS * TW_BITS)) - 1)
+
+static uint64_t rotr(uint64_t x, unsigned s)
+{
+    return s ? x >> s | x << (64 - s) : x;
+}
+
+static void link_timer(tw_wheel_t *w, tw_timer_t *t, unsigned level, unsigned slot)
+{
+    tw_timer_t *h = &w->slots[level][slot];
+    t->next = h;
+    t->prev = h->prev;
+    h->prev->next = t;
+    h->prev = t;
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)slot;
+    t->pending = true;
+    w->occupied[level] |= 1ull << slot;
+}
+
+static void unlink_timer(tw_wheel_t *w, tw_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    tw_timer_t *h = &w->slots[t->level][t->slot];
+    if (h->next == h)
+        w->occupied[t->level] &= ~(1ull << t->slot);
+    t->pending = false;
+}
+
+// By how far off it is: the slot of its tick, or of the block of ticks that
+// moves down when it comes up. expires is not before now.
+static void file_timer(tw_wheel_t *w, tw_timer_t *t)
+{
+    uint32_t delta = t->expires - w->now;
+    uint32_t at = delta > TW_SPAN ? w->now + TW_SPAN : t->expires;
+    unsigned level = 0;
+    while (level < TW_LEVELS - 1 && (at - w->now) >> ((level + 1) * TW_BITS))
+        level++;
+    link_timer(w, t, level, (at >> (level * TW_BITS)) & TW_MASK);
+}
+
+void tw_init(tw_wheel_t *w, uint32_t now)
+{
+    w->now = now;
+    for (int l = 0; l < TW_LEVELS; l++)
+    {
+        w->occupied[l] = 0;
+        for (unsigned s = 0; s < TW_SLOTS; s++)
+            w->slots[l][s].next = w->slots[l][s].prev = &w->slots[l][s];
+    }
+}
+
+void tw_add(tw_wheel_t *w, tw_timer_t *t, uint32_t expires)
+{
+    if (t->pending)
+        unlink_timer(w, t);
+    t->expires = (int32_t)(expires - w->now) > 0 ? expires : w->now + 1;
+    file_timer(w, t);
+}
+
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t)
+{
+    if (t->pending)
+        unlink_timer(w, t);
+}
+
+uint32_t tw_next(const tw_wheel_t *w)
+{
+    uint32_t next = TW_NEVER;
+    // Level 0 slots are single ticks, now + 1 onwards
+    if (w->occupied[0])
+    {
+        uint32_t first = w->now + 1;
+        next = first + (uint32_t)__builtin_ctzll(rotr(w->occupied[0], first & TW_MASK));
+    }
+    // The others move down at the start of their block
+    for (unsigned l = 1; l < TW_LEVELS; l++)
+    {
+        if (!w->occupied[l])
+            continue;
+        unsigned shift = l * TW_BITS;
+        uint32_t block = (w->now >> shift) + 1;
+        block += (uint32_t)__builtin_ctzll(rotr(w->occupied[l], block & TW_MASK));
+        uint32_t at = block << shift;
+        if (at - w->now < next - w->now)
+            next = at;
+    }
+    return next;
+}
+
+// Move the timers of a slot down, by how far off they are now
+static void cascade(tw_wheel_t *w, unsigned level, unsigned slot)
+{
+    tw_timer_t *h = &w->slots[level][slot];
+    if (h->next == h)
+        return;
+    tw_timer_t *t = h->next;
+    h->prev->next = NULL;
+    h->next = h->prev = h;
+    w->occupied[level] &= ~(1ull << slot);
+    while (t)
+    {
+        tw_timer_t *next = t->next;
+        file_timer(w, t);
+        t = next;
+    }
+}
+
+void tw_advance(tw_wheel_t *w, uint32_t to, tw_fn fn, void *ctx)
+{
+    while ((int32_t)(to - w->now) > 0)
+    {
+        uint32_t n = tw_next(w);
+        if (n == TW_NEVER || n - w->now > to - w->now)
+            break;
+        w->now = n;
+        // Higher levels first, what comes down may be due right now
+        for (unsigned l = TW_LEVELS - 1; l > 0; l--)
+            if ((n & ((1u << (l * TW_BITS)) - 1)) == 0)
+                cascade(w, l, (n >> (l * TW_BITS)) & TW_MASK);
+        // A timer fn adds for now goes to the next tick, so this ends
+        tw_timer_t *h = &w->slots[0][n & TW_MASK];
+        while (h->next != h)
+        {
+            tw_timer_t *t = h->next;
+            unlink_timer(w, t);
+            fn(t, ctx);
+        }
+    }
+    if ((int32_t)(to - w->now) > 0)
+        w->now = to;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel, free of ESP-IDF. Three levels of 64 slots: the
+// first holds timers due in the next 64 ticks, one tick per slot, the next
+// ones 64 and 4096 ticks per slot. A timer is filed by how far off it is and
+// moves down a level when its slot comes up. Adding and cancelling are
+// O(1), and tw_next tells the caller when to come back, so nothing has to
+// tick through the empty stretches between timers.
+//
+// The tick is whatever the caller counts in. Timers more than 64^3 ticks
+// away wait in the last slot and are filed again when it comes up.
+
+#define TW_BITS 6
+#define TW_SLOTS (1u << TW_BITS)
+#define TW_LEVELS 3
+#define TW_NEVER UINT32_MAX
+
+typedef struct tw_timer
+{
+    struct tw_timer *next;
+    struct tw_timer *prev;
+    uint32_t expires;
+    bool pending;
+    uint8_t level; // Where it is filed while pending
+    uint8_t slot;
+} tw_timer_t;
+
+typedef struct
+{
+    uint32_t now; // Last tick advanced to, every timer due by then has run
+    tw_timer_t slots[TW_LEVELS][TW_SLOTS]; // List heads
+    uint64_t occupied[TW_LEVELS];          // Bit n: slot n is not empty
+} tw_wheel_t;
+
+typedef void (*tw_fn)(tw_timer_t *t, void *ctx);
+
+void tw_init(tw_wheel_t *w, uint32_t now);
+
+// Due at expires, or on the next tick if that has passed. A pending timer
+// is moved.
+void tw_add(tw_wheel_t *w, tw_timer_t *t, uint32_t expires);
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t);
+
+// The first tick tw_advance has work at, a timer or one moving down a
+// level; TW_NEVER if the wheel is empty
+uint32_t tw_next(const tw_wheel_t *w);
+
+// Run fn for every timer due by to, in order of expiry. fn may add and
+// cancel timers, also the one it was called for.
+void tw_advance(tw_wheel_t *w, uint32_t to, tw_fn fn, void *ctx);
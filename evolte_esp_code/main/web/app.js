@@ -0,0 +1,86 @@
+'use strict';
+// Status over /api/events, the meter from /api/status, both from the same
+// firmware that serves this page.
+const $ = (id) => document.getElementById(id);
+const state = { relay_count: 0, relay_mask: 0 };
+
+function fmtUptime(s) {
+  const d = Math.floor(s / 86400), h = Math.floor(s / 3600) % 24, m = Math.floor(s / 60) % 60;
+  return (d ? d + 'd ' : '') + h + 'h ' + m + 'm';
+}
+
+function renderRelays() {
+  const box = $('relays');
+  if (box.children.length !== state.relay_count) {
+    box.textContent = '';
+    for (let ch = 0; ch < state.relay_count; ch++) {
+      const row = document.createElement('div');
+      row.className = 'relay';
+      row.innerHTML = '<span>Relay ' + (ch + 1) + '</span><button></button>';
+      row.querySelector('button').onclick = () => setRelay(ch, !(state.relay_mask & (1 << ch)));
+      box.appendChild(row);
+    }
+  }
+  [...box.querySelectorAll('button')].forEach((b, ch) => {
+    const on = (state.relay_mask & (1 << ch)) !== 0;
+    b.textContent = on ? 'On' : 'Off';
+    b.classList.toggle('on', on);
+  });
+}
+
+function render(s) {
+  Object.assign(state, s);
+  if (s.fw_version !== undefined) $('fw_version').textContent = s.fw_version;
+  if (s.uptime_s !== undefined) $('uptime').textContent = fmtUptime(s.uptime_s);
+  if (s.sessions !== undefined) $('sessions').textContent = s.sessions;
+  if (s.error_flags !== undefined) $('error_flags').textContent = s.error_flags ? '0x' + s.error_flags.toString(16) : 'none';
+  if (s.meter) {
+    $('v_rms').textContent = (s.meter.v_rms_mv / 1000).toFixed(1) + ' V';
+    $('i_rms').textContent = (s.meter.i_rms_ma / 1000).toFixed(2) + ' A';
+    $('power').textContent = s.meter.power_w + ' W';
+    $('energy').textContent = (s.meter.energy_mj / 3.6e9).toFixed(3) + ' kWh';
+  }
+  renderRelays();
+}
+
+function post(url, fields) {
+  return fetch(url, { method: 'POST', body: new URLSearchParams(fields) }).then((r) => r.json());
+}
+
+function setRelay(ch, on) {
+  post('/api/relay', { channel: ch, on: on ? 1 : 0 }).catch(() => {});
+}
+
+function poll() {
+  fetch('/api/status').then((r) => r.json()).then(render).catch(() => {});
+}
+
+function connect() {
+  const es = new EventSource('/api/events');
+  es.onopen = () => { $('link').textContent = 'live'; $('link').classList.remove('off'); };
+  es.onerror = () => { $('link').textContent = 'offline'; $('link').classList.add('off'); };
+  es.addEventListener('status', (e) => render(JSON.parse(e.data)));
+}
+
+function loadConfig() {
+  fetch('/api/config').then((r) => r.json()).then((c) => {
+    const f = $('config');
+    f.ble_name.value = c.ble_name || '';
+    f.wifi_ssid.value = c.wifi_ssid || '';
+    if (c.ble_name) $('name').textContent = c.ble_name;
+  }).catch(() => {});
+}
+
+$('config').onsubmit = (e) => {
+  e.preventDefault();
+  const f = e.target, fields = { ble_name: f.ble_name.value, wifi_ssid: f.wifi_ssid.value };
+  if (f.wifi_pass.value) fields.wifi_pass = f.wifi_pass.value;
+  post('/api/config', fields)
+    .then((r) => { $('saved').textContent = r.error ? r.error : 'Saved'; f.wifi_pass.value = ''; })
+    .catch(() => { $('saved').textContent = 'Failed'; });
+};
+
+poll();
+setInterval(poll, 5000);
+connect();
+loadConfig();
@@ -0,0 +1,62 @@
+# Gzip the web UI files listed in web_assets.def into a C header of byte
+# arrays and ETags, web_assets_gen.h, which web_ui.c includes. Used by both
+# the firmware and the host build:
+#   include(web_assets.cmake)
+#   evolte_web_assets(<def> <web dir> <out header>)
+# The output only depends on the files, so it is reproducible.
+
+function(evolte_web_assets_list def out_var)
+    file(STRINGS ${def} lines REGEX "^WEB_ASSET\\(")
+    set(assets)
+    foreach(line IN LISTS lines)
+        string(REGEX MATCH "^WEB_ASSET\\(([A-Z0-9_]+), *\"[^\"]*\", *\"([^\"]+)\"" _ "${line}")
+        list(APPEND assets "${CMAKE_MATCH_1}=${CMAKE_MATCH_2}")
+    endforeach()
+    set(${out_var} ${assets} PARENT_SCOPE)
+endfunction()
+
+function(evolte_web_assets def web_dir out)
+    evolte_web_assets_list(${def} assets)
+    set(files)
+    foreach(a IN LISTS assets)
+        string(REGEX REPLACE "^[^=]*=" "" file "${a}")
+        list(APPEND files ${web_dir}/${file})
+    endforeach()
+    add_custom_command(OUTPUT ${out}
+        COMMAND ${CMAKE_COMMAND} -DDEF=${def} -DWEB_DIR=${web_dir} -DOUT=${out} -P ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+        DEPENDS ${def} ${files} ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+        COMMENT "Packing web UI")
+endfunction()
+
+if(CMAKE_SCRIPT_MODE_FILE)
+    if(CMAKE_VERSION VERSION_LESS 3.19)
+        message(FATAL_ERROR "Packing the web UI needs CMake 3.19 or later")
+    endif()
+    evolte_web_assets_list(${DEF} assets)
+    get_filename_component(tmp_dir ${OUT} DIRECTORY)
+    set(text "// Generated from main/web by main/web_assets.cmake, do not edit.\n#pragma once\n#include <stdint.h>\n")
+    foreach(a IN LISTS assets)
+        string(REGEX MATCH "^([^=]*)=(.*)$" _ "${a}")
+        set(name ${CMAKE_MATCH_1})
+        set(file ${CMAKE_MATCH_2})
+        set(gz ${tmp_dir}/${file}.gz)
+        file(ARCHIVE_CREATE OUTPUT ${gz} PATHS ${WEB_DIR}/${file} FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+        file(READ ${gz} hex HEX)
+        # Clear the timestamp in the gzip header, MTIME 0 means none
+        string(SUBSTRING "${hex}" 0 8 head)
+        string(SUBSTRING "${hex}" 16 -1 tail)
+        set(hex "${head}00000000${tail}")
+        string(SHA256 sum "${hex}")
+        string(SUBSTRING ${sum} 0 16 etag)
+        string(LENGTH "${hex}" n)
+        math(EXPR n "${n} / 2")
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+        string(REPEAT "0x..," 16 line)
+        string(REGEX REPLACE "(${line})" "\\1\n    " bytes "${bytes}")
+        string(REGEX REPLACE "\n    $" "" bytes "${bytes}")
+        string(APPEND text "\n// ${file}, ${n} bytes gzipped\n"
+            "#define WEB_ETAG_${name} \"\\\"${etag}\\\"\"\n"
+            "static const uint8_t web_gz_${name}[${n}] = {\n    ${bytes}\n};\n")
+    endforeach()
+    file(WRITE ${OUT} "${text}")
+endif()
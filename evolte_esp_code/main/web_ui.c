@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <string.h>
+#include "web_assets_gen.h"
+#include "web_ui.h"
+
+// If-None-Match is looked at up to this long, a longer list just misses
+#define WEB_INM_MAX 128
+
+const web_asset_t web_assets[WEB_ASSET_COUNT] = {
+#define WEB_ASSET(name, path, file, mime)                                                                \
+    [WEB_ASSET_##name] = {.uri = path, .type = mime, .data = web_gz_##name, .len = sizeof(web_gz_##name), \
+                          .etag = WEB_ETAG_##name},
+#include "web_assets.def"
+#undef WEB_ASSET
+};
+
+static web_ui_stats_t stats; // httpd task only
+
+// The browser's copy is current: etag is in If-None-Match, weak or not,
+// or that is "*"
+static bool not_modified(httpd_req_t *req, const char *etag)
+{
+    char inm[WEB_INM_MAX];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) != ESP_OK)
+        return false;
+    return strcmp(inm, "*") == 0 || strstr(inm, etag) != NULL;
+}
+
+esp_err_t web_ui_get_handler(httpd_req_t *req)
+{
+    const web_asset_t *a = req->user_ctx;
+    httpd_resp_set_hdr(req, "ETag", a->etag);
+    // Revalidated on every load, which a 304 makes cheap, so a page never
+    // runs with the scripts of the firmware before an update
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (not_modified(req, a->etag))
+    {
+        stats.not_modified++;
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // Only the gzipped copy is stored, every browser takes it
+    stats.sent++;
+    httpd_resp_set_type(req, a->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)a->data, a->len);
+}
+
+const web_ui_stats_t *web_ui_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// The web UI: the files of main/web, gzipped into flash at build time (see
+// web_assets.def). They go out as stored, straight from flash, with
+// Content-Encoding: gzip and an ETag of their content. A browser that has
+// a file already gets 304 and no body, so a page load costs no RAM and
+// next to no CPU.
+
+typedef enum
+{
+#define WEB_ASSET(name, uri, file, type) WEB_ASSET_##name,
+#include "web_assets.def"
+#undef WEB_ASSET
+    WEB_ASSET_COUNT
+} web_asset_id_t;
+
+typedef struct
+{
+    const char *uri;
+    const char *type;
+    const uint8_t *data; // Gzipped
+    uint32_t len;
+    const char *etag; // Quoted, as sent
+} web_asset_t;
+
+typedef struct
+{
+    uint32_t sent;         // Whole files
+    uint32_t not_modified; // 304s
+} web_ui_stats_t;
+
+extern const web_asset_t web_assets[WEB_ASSET_COUNT];
+
+// GET handler of every asset, its user_ctx is the web_assets entry
+esp_err_t web_ui_get_handler(httpd_req_t *req);
+
+const web_ui_stats_t *web_ui_stats(void);